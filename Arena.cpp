@@ -0,0 +1,56 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Arena.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+
+static const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+static size_t page_size() {
+	static const size_t size = ::sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+Arena::Arena(const size_t reserve, const unsigned flags): m_base(nullptr), m_pos(0u), m_limit(0u), m_high_water(0u) {
+	const size_t page = page_size();
+	size_t len = (reserve + page - 1) & ~(page - 1);
+	if (!len) { len = page; }
+	if (flags & HUGE_PAGES) {
+		// transparent huge pages can only back 2 MiB aligned ranges, so over-reserve and align
+		len = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		m_mapping = FileMapping::MapAnonymous(len + HUGE_PAGE_SIZE);
+		const uintptr_t p = reinterpret_cast<uintptr_t>(m_mapping.get());
+		m_base = reinterpret_cast<char*>((p + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+		// only a hint: if THP is disabled we just get normal pages
+		::madvise(m_base, len, MADV_HUGEPAGE);
+#endif
+	} else {
+		m_mapping = FileMapping::MapAnonymous(len);
+		m_base = static_cast<char*>(m_mapping.get());
+	}
+	m_limit = len;
+}
+
+void Arena::trim(const size_t keep) {
+	const size_t page = page_size();
+	size_t begin = m_pos + keep;
+	if (begin < m_pos) { begin = m_limit; } // overflow
+	begin = (begin + page - 1) & ~(page - 1);
+	if (begin >= m_high_water) { return; }
+	const size_t end = (m_high_water + page - 1) & ~(page - 1);
+	if (::madvise(m_base + begin, end - begin, MADV_DONTNEED) == -1) { throw PosixError(errno); }
+	m_high_water = begin;
+}
+
+SlabPool::SlabPool(const size_t object_size, const size_t reserve, const unsigned flags, const size_t align):
+		m_arena(reserve, flags), m_object_size(object_size), m_align(align), m_free(nullptr) {
+	assert(align && !(align & (align - 1)));
+	// blocks must be able to hold the free list link
+	if (m_align < alignof(FreeBlock)) { m_align = alignof(FreeBlock); }
+	if (m_object_size < sizeof(FreeBlock)) { m_object_size = sizeof(FreeBlock); }
+	m_object_size = (m_object_size + m_align - 1) & ~(m_align - 1);
+}
@@ -0,0 +1,168 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+/* Region allocators over a large reserved block of anonymous memory.
+ *
+ * Arena is a bump allocator: allocation is a pointer increment and everything
+ * allocated after a mark can be freed at once by resetting to that mark.
+ * SlabPool hands out fixed-size blocks, with a free list for individual frees
+ * and O(1) reset of the whole pool.
+ *
+ * Both reserve address space up front (FileMapping::MapAnonymous, MAP_NORESERVE);
+ * the kernel commits pages as they are first touched. trim()/release() give pages
+ * back with MADV_DONTNEED. With HUGE_PAGES, the region is 2 MiB aligned and marked
+ * with MADV_HUGEPAGE so transparent huge pages can back it.
+ *
+ * Neither allocator is thread-safe; use one per thread (or per request).
+ * Allocation failure (running out of reserved space) throws std::bad_alloc.
+ * Objects are not destroyed by reset(): these are for trivially destructible data,
+ * or for objects whose destructors the caller runs.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cassert>
+#include <stdint.h>
+
+class Arena {
+	public:
+		enum Flags {
+			HUGE_PAGES = 1
+		};
+
+		static const size_t DEFAULT_RESERVE = size_t(1) << 30;
+
+		/// A position in the arena, as returned by mark().
+		typedef size_t Mark;
+
+		explicit Arena(const size_t reserve = DEFAULT_RESERVE, const unsigned flags = 0);
+
+		Arena(Arena&& other): m_mapping(std::move(other.m_mapping)), m_base(other.m_base),
+				m_pos(other.m_pos), m_limit(other.m_limit), m_high_water(other.m_high_water) {
+			other.m_base = nullptr;
+			other.m_pos = other.m_limit = other.m_high_water = 0u;
+		}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		void *allocate(const size_t size, const size_t align = alignof(std::max_align_t)) {
+			assert(align && !(align & (align - 1)));
+			const size_t begin = (m_pos + align - 1) & ~(align - 1);
+			if (begin > m_limit || size > m_limit - begin) { throw std::bad_alloc(); }
+			m_pos = begin + size;
+			if (m_pos > m_high_water) { m_high_water = m_pos; }
+			return m_base + begin;
+		}
+
+		template <typename T, typename... Args>
+		T *create(Args&&... args) {
+			return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
+
+		template <typename T>
+		T *allocate_array(const size_t count) {
+			if (count > m_limit / sizeof(T)) { throw std::bad_alloc(); }
+			return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		}
+
+		Mark mark() const { return m_pos; }
+
+		/// Free everything allocated since 'm' was taken. The pages stay committed.
+		void reset(const Mark m = 0) { assert(m <= m_pos); m_pos = m; }
+
+		/// Return committed pages beyond the current position (plus 'keep' bytes of slack) to the OS.
+		void trim(const size_t keep = 0);
+
+		/// Free everything and return all pages to the OS.
+		void release() { reset(); trim(); }
+
+		/// @return The number of bytes allocated (including alignment padding).
+		size_t used() const { return m_pos; }
+		size_t reserved() const { return m_limit; }
+
+	private:
+		FileMapping m_mapping;
+		char *m_base;
+		size_t m_pos;
+		size_t m_limit;
+		size_t m_high_water;
+};
+
+class SlabPool {
+	public:
+		SlabPool(const size_t object_size, const size_t reserve = Arena::DEFAULT_RESERVE, const unsigned flags = 0,
+				const size_t align = alignof(std::max_align_t));
+
+		SlabPool(SlabPool&& other): m_arena(std::move(other.m_arena)), m_object_size(other.m_object_size),
+				m_align(other.m_align), m_free(other.m_free) {
+			other.m_free = nullptr;
+		}
+
+		SlabPool(const SlabPool&) = delete;
+		SlabPool& operator=(const SlabPool&) = delete;
+
+		void *allocate() {
+			if (m_free) {
+				FreeBlock * const b = m_free;
+				m_free = b->next;
+				return b;
+			}
+			return m_arena.allocate(m_object_size, m_align);
+		}
+
+		void deallocate(void *p) {
+			if (!p) { return; }
+			FreeBlock * const b = static_cast<FreeBlock*>(p);
+			b->next = m_free;
+			m_free = b;
+		}
+
+		/// Free every block at once. The pages stay committed.
+		void reset() { m_free = nullptr; m_arena.reset(); }
+
+		/// Free every block and return all pages to the OS.
+		void release() { m_free = nullptr; m_arena.release(); }
+
+		size_t object_size() const { return m_object_size; }
+
+	private:
+		struct FreeBlock { FreeBlock *next; };
+
+		Arena m_arena;
+		size_t m_object_size;
+		size_t m_align;
+		FreeBlock *m_free;
+};
+
+/// STL-compatible allocator that allocates from an Arena. deallocate() is a no-op:
+/// memory is reclaimed when the arena is reset.
+template <typename T>
+class ArenaAllocator {
+	public:
+		typedef T value_type;
+
+		explicit ArenaAllocator(Arena &arena): m_arena(&arena) {}
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other): m_arena(other.arena()) {}
+
+		T *allocate(const size_t n) { return m_arena->allocate_array<T>(n); }
+		void deallocate(T *p, const size_t n) { (void)p; (void)n; }
+
+		Arena *arena() const { return m_arena; }
+
+		template <typename U>
+		bool operator==(const ArenaAllocator<U> &other) const { return m_arena == other.arena(); }
+		template <typename U>
+		bool operator!=(const ArenaAllocator<U> &other) const { return m_arena != other.arena(); }
+
+	private:
+		Arena *m_arena;
+};
+
+#endif
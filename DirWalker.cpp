@@ -0,0 +1,332 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "DirWalker.hpp"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <unordered_set>
+
+namespace {
+
+// size of each thread's getdents64 buffer
+const size_t DIRENT_BUFFER_SIZE = 256 * 1024;
+
+// Queued directories normally carry an open descriptor (opened relative to their parent),
+// but a wide tree could have millions of directories queued at once, so beyond this many
+// queued descriptors the directory is queued by name, sharing its parent's descriptor,
+// and opened relative to that when it's processed. The limit is lowered to a quarter of
+// RLIMIT_NOFILE, which is itself often 1024.
+const int MAX_QUEUED_HANDLES = 1024;
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+struct Task {
+	FileDes fd;
+	// if there's no fd yet: the parent's, with the name at path[name_offset]
+	std::shared_ptr<const FileDes> parent;
+	size_t name_offset;
+	bool follow;
+	std::string path;
+	int depth;
+};
+
+struct alignas(64) WorkQueue {
+	std::mutex lock;
+	std::deque<Task> tasks;
+};
+
+unsigned char type_from_mode(const mode_t mode) {
+	switch (mode & S_IFMT) {
+		case S_IFDIR: return DT_DIR;
+		case S_IFREG: return DT_REG;
+		case S_IFLNK: return DT_LNK;
+		case S_IFCHR: return DT_CHR;
+		case S_IFBLK: return DT_BLK;
+		case S_IFIFO: return DT_FIFO;
+		case S_IFSOCK: return DT_SOCK;
+		default: return DT_UNKNOWN;
+	}
+}
+
+struct DevIno {
+	dev_t dev;
+	ino_t ino;
+	bool operator==(const DevIno &other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct DevInoHash {
+	size_t operator()(const DevIno &x) const { return size_t(x.ino) * 31u + size_t(x.dev); }
+};
+
+class Walk {
+	public:
+		Walk(const DirWalker::Options &options, DirWalker::Visitor &visitor, const unsigned nthreads, const dev_t root_dev,
+				const int max_handles):
+			m_options(options), m_visitor(visitor), m_queues(nthreads), m_pending(0), m_queued(0), m_handles(0),
+			m_max_handles(max_handles), m_idle(0), m_done(false), m_root_dev(root_dev), m_failed(false) {}
+
+		void push(const unsigned worker, Task &&task) {
+			m_pending.fetch_add(1, std::memory_order_relaxed);
+			if (task.fd) { m_handles.fetch_add(1, std::memory_order_relaxed); }
+			{
+				std::lock_guard<std::mutex> guard(m_queues[worker].lock);
+				m_queues[worker].tasks.push_back(std::move(task));
+			}
+			m_queued.fetch_add(1, std::memory_order_release);
+			if (m_idle.load(std::memory_order_acquire)) {
+				std::lock_guard<std::mutex> guard(m_idle_lock);
+				m_idle_wake.notify_one();
+			}
+		}
+
+		void remember(const DevIno &id) {
+			std::lock_guard<std::mutex> guard(m_seen_lock);
+			m_seen.insert(id);
+		}
+
+		void run(const unsigned worker);
+
+		std::exception_ptr error;
+
+	private:
+		bool take(const unsigned worker, Task &task);
+		void process(const unsigned worker, Task &task, char *buffer);
+		void finish_one();
+
+		const DirWalker::Options &m_options;
+		DirWalker::Visitor &m_visitor;
+		std::vector<WorkQueue> m_queues;
+		// tasks queued or being processed; the walk is over when this drops to zero
+		std::atomic<size_t> m_pending;
+		std::atomic<size_t> m_queued;
+		std::atomic<int> m_handles;
+		const int m_max_handles;
+		std::atomic<unsigned> m_idle;
+		std::mutex m_idle_lock;
+		std::condition_variable m_idle_wake;
+		bool m_done;
+		dev_t m_root_dev;
+		// directories already visited, if following symlinks
+		std::mutex m_seen_lock;
+		std::unordered_set<DevIno, DevInoHash> m_seen;
+		std::mutex m_error_lock;
+		std::atomic<bool> m_failed;
+};
+
+bool Walk::take(const unsigned worker, Task &task) {
+	const unsigned n = m_queues.size();
+	// own queue first (newest first, for locality), then steal the oldest from the others
+	for (unsigned i = 0; i < n; ++i) {
+		WorkQueue &q = m_queues[(worker + i) % n];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (q.tasks.empty()) { continue; }
+		if (i == 0) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		} else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+		m_queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void Walk::finish_one() {
+	if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::lock_guard<std::mutex> guard(m_idle_lock);
+		m_done = true;
+		m_idle_wake.notify_all();
+	}
+}
+
+void Walk::run(const unsigned worker) {
+	std::unique_ptr<uint64_t[]> buffer(new uint64_t[DIRENT_BUFFER_SIZE / sizeof(uint64_t)]);
+	for (;;) {
+		Task task;
+		if (take(worker, task)) {
+			// after a visitor throws, the remaining tasks are drained without being processed
+			if (!m_failed.load(std::memory_order_relaxed)) {
+				try {
+					process(worker, task, reinterpret_cast<char*>(buffer.get()));
+				} catch (...) {
+					std::lock_guard<std::mutex> guard(m_error_lock);
+					if (!m_failed.exchange(true)) { error = std::current_exception(); }
+				}
+			}
+			finish_one();
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(m_idle_lock);
+		if (m_done) { return; }
+		m_idle.fetch_add(1, std::memory_order_acq_rel);
+		m_idle_wake.wait(guard, [this]() { return m_done || m_queued.load(std::memory_order_acquire) > 0; });
+		m_idle.fetch_sub(1, std::memory_order_relaxed);
+		if (m_done) { return; }
+	}
+}
+
+void Walk::process(const unsigned worker, Task &task, char *buffer) {
+	if (task.fd) {
+		m_handles.fetch_sub(1, std::memory_order_relaxed);
+	} else {
+		const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (task.follow ? 0 : O_NOFOLLOW);
+		task.fd = FileDes(::openat(task.parent->fd(), task.path.c_str() + task.name_offset, flags));
+		task.parent.reset();
+		if (!task.fd) { m_visitor.on_error(task.path, errno); return; }
+	}
+	const int dir_fd = task.fd.fd();
+	// shared with the children queued without a descriptor of their own, once there are any
+	std::shared_ptr<const FileDes> shared_fd;
+	const bool ends_with_slash = (task.path.size() && task.path[task.path.size() - 1] == '/');
+
+	for (;;) {
+		const long nread = ::syscall(SYS_getdents64, dir_fd, buffer, DIRENT_BUFFER_SIZE);
+		if (nread == -1) {
+			if (errno == EINTR) { continue; }
+			m_visitor.on_error(task.path, errno);
+			return;
+		}
+		if (nread == 0) { return; }
+
+		for (long offset = 0; offset < nread; ) {
+			const linux_dirent64 * const d = reinterpret_cast<const linux_dirent64*>(buffer + offset);
+			offset += d->d_reclen;
+			const char * const name = d->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) { continue; }
+
+			DirWalker::Entry e;
+			e.dir_fd = dir_fd;
+			e.dir_path = &task.path;
+			e.name = name;
+			e.type = d->d_type;
+			e.depth = task.depth + 1;
+			e.inode = d->d_ino;
+			e.info = nullptr;
+
+			struct stat info;
+			const bool follow = (m_options.follow_symlinks && e.type == DT_LNK);
+			if (m_options.stat_entries || e.type == DT_UNKNOWN || follow) {
+				if (::fstatat(dir_fd, name, &info, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+					e.type = type_from_mode(info.st_mode);
+					if (m_options.stat_entries) { e.info = &info; }
+				} else if (!follow) {
+					// vanished since it was listed (or unreadable): report it as is
+					m_visitor.on_error(task.path + (ends_with_slash ? "" : "/") + name, errno);
+					continue;
+				}
+			}
+
+			if (e.type != DT_DIR) {
+				m_visitor.on_file(e);
+				continue;
+			}
+			if (!m_visitor.on_directory(e)) { continue; }
+			if (m_options.max_depth >= 0 && e.depth >= m_options.max_depth) { continue; }
+
+			Task child;
+			child.path.reserve(task.path.size() + 1 + std::strlen(name));
+			child.path = task.path;
+			if (!ends_with_slash) { child.path += '/'; }
+			child.name_offset = child.path.size();
+			child.path += name;
+			child.follow = follow;
+			child.depth = e.depth;
+
+			if (m_handles.load(std::memory_order_relaxed) < m_max_handles) {
+				child.fd = FileDes(::openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW)));
+				// out of descriptors anyway (the rest of the process has them): queue it by name
+				if (!child.fd && errno != EMFILE && errno != ENFILE) { m_visitor.on_error(child.path, errno); continue; }
+			}
+			if (!child.fd) {
+				// dir_fd stays open (and the same number) until the last of these is processed
+				if (!shared_fd) { shared_fd = std::make_shared<const FileDes>(std::move(task.fd)); }
+				child.parent = shared_fd;
+			}
+			// with symlinks followed, every directory is recorded so that a link to an
+			// ancestor (or any other cycle) is only descended once
+			if (m_options.same_device || m_options.follow_symlinks) {
+				struct stat dinfo;
+				const int r = child.fd ? ::fstat(child.fd, &dinfo) : ::fstatat(dir_fd, name, &dinfo, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+				if (r == -1) { m_visitor.on_error(child.path, errno); continue; }
+				if (m_options.same_device && dinfo.st_dev != m_root_dev) { continue; }
+				if (m_options.follow_symlinks) {
+					const DevIno id = { dinfo.st_dev, dinfo.st_ino };
+					std::lock_guard<std::mutex> guard(m_seen_lock);
+					if (!m_seen.insert(id).second) { continue; }
+				}
+			}
+			push(worker, std::move(child));
+		}
+	}
+}
+
+} // anonymous namespace
+
+std::string DirWalker::Entry::path() const {
+	std::string p(*dir_path);
+	if (p.empty() || p[p.size() - 1] != '/') { p += '/'; }
+	p += name;
+	return p;
+}
+
+void DirWalker::walk(const char *root, Visitor &visitor) {
+	FileDes fd(::open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	if (!fd) { throw PosixError(errno); }
+	struct stat info;
+	if (::fstat(fd, &info) == -1) { throw PosixError(errno); }
+
+	unsigned nthreads = m_options.threads;
+	if (!nthreads) { nthreads = std::thread::hardware_concurrency(); }
+	if (!nthreads) { nthreads = 1; }
+
+	int max_handles = MAX_QUEUED_HANDLES;
+	struct rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur / 4 < rlim_t(max_handles)) {
+		max_handles = int(limit.rlim_cur / 4);
+	}
+
+	Walk walk(m_options, visitor, nthreads, info.st_dev, max_handles);
+	if (m_options.follow_symlinks) {
+		const DevIno id = { info.st_dev, info.st_ino };
+		walk.remember(id);
+	}
+	Task task;
+	task.fd = std::move(fd);
+	task.name_offset = 0;
+	task.follow = false;
+	task.path = root;
+	task.depth = 0;
+	walk.push(0, std::move(task));
+
+	std::vector<std::thread> threads;
+	threads.reserve(nthreads - 1);
+	for (unsigned i = 1; i < nthreads; ++i) {
+		threads.push_back(std::thread([&walk, i]() { walk.run(i); }));
+	}
+	walk.run(0);
+	for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+	if (walk.error) { std::rethrow_exception(walk.error); }
+}
@@ -0,0 +1,86 @@
+#ifndef DIRWALKER_HPP
+#define DIRWALKER_HPP
+
+/* Parallel recursive directory traversal (Linux only).
+ *
+ * Directories are read with getdents64 into a large per-thread buffer, and subdirectories
+ * are opened relative to their parent's descriptor (openat), so the kernel never has to
+ * resolve a full path. The entry type from the directory listing (d_type) is used to tell
+ * directories from files, so nothing is stat'ed unless the filesystem doesn't supply it
+ * (or the caller asks for stat data). Subdirectories are spread over a pool of threads with
+ * per-thread work queues; idle threads steal from the others.
+ *
+ * The Visitor is called concurrently from all the walker's threads.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <string>
+#include <stdint.h>
+#include <sys/stat.h>
+
+class DirWalker {
+	public:
+		struct Entry {
+			/// Descriptor of the containing directory; 'name' can be used relative to it
+			/// (openat, fstatat, ...). Only valid during the callback.
+			int dir_fd;
+			/// Path of the containing directory (the root as given, plus the relative path).
+			const std::string *dir_path;
+			/// Entry name within its directory.
+			const char *name;
+			/// DT_DIR, DT_REG, DT_LNK, etc.
+			unsigned char type;
+			/// Depth below the root (children of the root have depth 1).
+			int depth;
+			uint64_t inode;
+			/// Only set if Options::stat_entries is on; otherwise null.
+			const struct stat *info;
+
+			/// @return The full path (dir_path + "/" + name). Allocates, so use sparingly.
+			std::string path() const;
+		};
+
+		class Visitor {
+			public:
+				virtual ~Visitor() {}
+
+				/// Called for each directory found (not for the root).
+				/// @return false to skip descending into it.
+				virtual bool on_directory(const Entry &entry) { (void)entry; return true; }
+
+				/// Called for each non-directory entry.
+				virtual void on_file(const Entry &entry) = 0;
+
+				/// Called if a directory can't be opened or read. The walk carries on.
+				virtual void on_error(const std::string &path, int error) { (void)path; (void)error; }
+		};
+
+		struct Options {
+			/// Number of threads; 0 means one per online CPU.
+			unsigned threads;
+			/// fstatat every entry and pass the result to the visitor.
+			bool stat_entries;
+			/// Descend into symlinks that point to directories.
+			bool follow_symlinks;
+			/// Don't descend into directories on other filesystems.
+			bool same_device;
+			/// Maximum depth to descend to (children of the root are depth 1); negative means no limit.
+			int max_depth;
+
+			Options(): threads(0), stat_entries(false), follow_symlinks(false), same_device(false), max_depth(-1) {}
+		};
+
+		explicit DirWalker(const Options &options = Options()): m_options(options) {}
+
+		/// Walk the tree under root, returning when every directory has been read.
+		/// Throws PosixError if root itself can't be opened.
+		void walk(const char *root, Visitor &visitor);
+
+	private:
+		Options m_options;
+};
+
+#endif
@@ -0,0 +1,188 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "EventLoop.hpp"
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cassert>
+
+// epoll_event.data carries the fd in the low half and the registration's generation in the
+// high half, so that events for a registration removed earlier in the same batch (whose fd
+// may even have been reused already) are recognised as stale and dropped.
+static uint64_t pack_event_data(const int fd, const uint32_t generation) {
+	return (uint64_t(generation) << 32) | uint32_t(fd);
+}
+
+EventLoop::EventLoop(const int max_events):
+		m_epoll(::epoll_create1(EPOLL_CLOEXEC)), m_wakeup_handler(nullptr), m_count(0u), m_stop(false) {
+	assert(max_events > 0);
+	if (!m_epoll) { throw PosixError(errno); }
+	m_events.resize(max_events);
+
+	m_wakeup_fd = FileDes(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+	if (!m_wakeup_fd) { throw PosixError(errno); }
+	// the loop keeps ownership of the wakeup descriptor itself, so its entry holds no FileDes
+	insert(m_wakeup_fd.fd(), FileDes(), READABLE, nullptr, KIND_WAKEUP);
+}
+
+EventLoop::~EventLoop() {
+}
+
+int EventLoop::insert(const int raw, FileDes &&owned, const uint32_t events, Handler *handler, const Kind kind) {
+	assert(raw >= 0);
+	if (size_t(raw) >= m_entries.size()) {
+		size_t n = m_entries.size() ? m_entries.size() : 64u;
+		while (n <= size_t(raw)) { n *= 2; }
+		m_entries.resize(n);
+	}
+	Entry &e = m_entries[raw];
+	assert(e.kind == KIND_NONE);
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = pack_event_data(raw, e.generation + 1);
+	if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, raw, &ev) == -1) { throw PosixError(errno); }
+
+	e.fd = std::move(owned);
+	e.handler = handler;
+	e.kind = kind;
+	++e.generation;
+	if (kind != KIND_WAKEUP) { ++m_count; }
+	return raw;
+}
+
+EventLoop::Entry &EventLoop::lookup(const int fd) {
+	if (fd < 0 || size_t(fd) >= m_entries.size() || m_entries[fd].kind == KIND_NONE) {
+		throw PosixError(EBADF, "descriptor is not registered with the event loop");
+	}
+	return m_entries[fd];
+}
+
+int EventLoop::add(FileDes &&fd, const uint32_t events, Handler *handler) {
+	assert(handler && fd);
+	const int raw = fd.fd();
+	return insert(raw, std::move(fd), events, handler, KIND_FD);
+}
+
+void EventLoop::modify(const int fd, const uint32_t events) {
+	Entry &e = lookup(fd);
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = pack_event_data(fd, e.generation);
+	if (::epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) == -1) { throw PosixError(errno); }
+}
+
+void EventLoop::modify(const int fd, const uint32_t events, Handler *handler) {
+	assert(handler);
+	modify(fd, events);
+	m_entries[fd].handler = handler;
+}
+
+FileDes EventLoop::release(const int fd) {
+	Entry &e = lookup(fd);
+	assert(e.kind != KIND_WAKEUP);
+	if (::epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr) == -1) { throw PosixError(errno); }
+	FileDes owned(std::move(e.fd));
+	e.handler = nullptr;
+	e.kind = KIND_NONE;
+	--m_count;
+	return owned;
+}
+
+void EventLoop::remove(const int fd) {
+	// closing the descriptor would drop it from the epoll set anyway, but only if no other
+	// descriptor refers to the same open file description, so deregister explicitly
+	release(fd);
+}
+
+int EventLoop::add_timer(Handler *handler, const uint64_t delay_ns, const uint64_t interval_ns) {
+	assert(handler);
+	FileDes tfd(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+	if (!tfd) { throw PosixError(errno); }
+	const int raw = tfd.fd();
+	const int timer = insert(raw, std::move(tfd), READABLE, handler, KIND_TIMER);
+	try {
+		set_timer(timer, delay_ns, interval_ns);
+	} catch (...) {
+		remove(timer);
+		throw;
+	}
+	return timer;
+}
+
+void EventLoop::set_timer(const int timer, const uint64_t delay_ns, const uint64_t interval_ns) {
+	const Entry &e = lookup(timer);
+	assert(e.kind == KIND_TIMER);
+	(void)e;
+	struct itimerspec spec;
+	spec.it_value.tv_sec = delay_ns / 1000000000u;
+	spec.it_value.tv_nsec = delay_ns % 1000000000u;
+	spec.it_interval.tv_sec = interval_ns / 1000000000u;
+	spec.it_interval.tv_nsec = interval_ns % 1000000000u;
+	if (::timerfd_settime(timer, 0, &spec, nullptr) == -1) { throw PosixError(errno); }
+}
+
+void EventLoop::wakeup() {
+	const uint64_t one = 1;
+	// EAGAIN means the counter is saturated, which still leaves the loop woken up
+	while (::write(m_wakeup_fd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+}
+
+void EventLoop::stop() {
+	m_stop.store(true, std::memory_order_release);
+	wakeup();
+}
+
+int EventLoop::run_once(const int timeout_ms) {
+	int n;
+	do {
+		n = ::epoll_wait(m_epoll, &m_events[0], int(m_events.size()), timeout_ms);
+	} while (n == -1 && errno == EINTR);
+	if (n == -1) { throw PosixError(errno); }
+
+	for (int i = 0; i < n; ++i) {
+		const uint64_t data = m_events[i].data.u64;
+		const int fd = int(uint32_t(data));
+		const uint32_t generation = uint32_t(data >> 32);
+		// don't hold a reference to the entry across a handler call: handlers can add
+		// registrations, which may reallocate the table
+		if (size_t(fd) >= m_entries.size()) { continue; }
+		const Entry &e = m_entries[fd];
+		if (e.kind == KIND_NONE || e.generation != generation) { continue; }
+		Handler * const handler = e.handler;
+
+		switch (e.kind) {
+			case KIND_FD:
+				handler->on_event(*this, fd, m_events[i].events);
+				break;
+			case KIND_TIMER: {
+				uint64_t expirations;
+				const ssize_t r = ::read(fd, &expirations, sizeof(expirations));
+				if (r == sizeof(expirations)) {
+					handler->on_timer(*this, fd, expirations);
+				} else if (r == -1 && errno != EAGAIN && errno != EINTR) {
+					throw PosixError(errno);
+				}
+				break;
+			}
+			case KIND_WAKEUP: {
+				uint64_t count;
+				while (::read(fd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+				if (m_wakeup_handler) { m_wakeup_handler->on_wakeup(*this); }
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+void EventLoop::run() {
+	// the flag is cleared as run() returns, not as it starts, so that a stop() from
+	// another thread just before run() isn't lost
+	while (!m_stop.exchange(false, std::memory_order_acq_rel)) {
+		run_once(-1);
+	}
+}
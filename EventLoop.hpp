@@ -0,0 +1,122 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+/* Single-threaded epoll reactor (Linux only).
+ *
+ * The loop owns the descriptors registered with it (as FileDes), and dispatches
+ * readiness to a Handler object supplied at registration. Handlers are not owned.
+ * Registrations live in a table indexed by fd, so dispatch does no heap allocation.
+ *
+ * In edge-triggered mode a handler is only told when readiness *changes*, so it must
+ * read or write until it gets EAGAIN (and descriptors must be nonblocking).
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+class EventLoop {
+	public:
+		static const uint32_t READABLE = EPOLLIN;
+		static const uint32_t WRITABLE = EPOLLOUT;
+		static const uint32_t HANGUP = EPOLLHUP | EPOLLRDHUP;
+		static const uint32_t ERROR = EPOLLERR;
+		static const uint32_t EDGE_TRIGGERED = EPOLLET;
+		static const uint32_t ONESHOT = EPOLLONESHOT;
+
+		class Handler {
+			public:
+				virtual ~Handler() {}
+
+				/// Called when fd is ready; events is a mask of READABLE, WRITABLE, HANGUP and ERROR.
+				/// The handler may add, modify or remove any registration (including its own).
+				virtual void on_event(EventLoop &loop, int fd, uint32_t events) = 0;
+
+				/// Called when a timer fires. 'expirations' is the number of times it has
+				/// expired since the last call (more than one if the loop fell behind).
+				virtual void on_timer(EventLoop &loop, int timer, uint64_t expirations) {
+					(void)loop; (void)timer; (void)expirations;
+				}
+
+				/// Called on the loop thread after another thread calls wakeup().
+				virtual void on_wakeup(EventLoop &loop) { (void)loop; }
+		};
+
+		/// max_events is the number of events fetched from the kernel per epoll_wait call.
+		explicit EventLoop(const int max_events = 256);
+		~EventLoop();
+
+		EventLoop(const EventLoop&) = delete;
+		EventLoop& operator=(const EventLoop&) = delete;
+
+		/// Register fd (taking ownership of it) for the given events.
+		/// @return The raw descriptor, which identifies the registration.
+		int add(FileDes &&fd, const uint32_t events, Handler *handler);
+
+		/// Change the events or handler for an existing registration.
+		void modify(const int fd, const uint32_t events);
+		void modify(const int fd, const uint32_t events, Handler *handler);
+
+		/// Deregister fd and close it.
+		void remove(const int fd);
+
+		/// Deregister fd and give ownership of it back to the caller.
+		FileDes release(const int fd);
+
+		/// Create a timer (a timerfd) that first fires after delay_ns, then every interval_ns
+		/// (or just once if interval_ns is zero). Remove it with remove().
+		/// @return The timer's identifier (its descriptor).
+		int add_timer(Handler *handler, const uint64_t delay_ns, const uint64_t interval_ns = 0);
+
+		/// Re-arm an existing timer. A delay of zero disarms it.
+		void set_timer(const int timer, const uint64_t delay_ns, const uint64_t interval_ns = 0);
+
+		/// Set the handler that receives on_wakeup() calls.
+		void set_wakeup_handler(Handler *handler) { m_wakeup_handler = handler; }
+
+		/// Wake the loop from another thread. Safe to call from any thread.
+		void wakeup();
+
+		/// Make run() return after the current dispatch round. Safe to call from any thread.
+		void stop();
+
+		/// Wait for events (up to timeout_ms; -1 waits indefinitely) and dispatch them.
+		/// @return The number of events dispatched.
+		int run_once(const int timeout_ms = -1);
+
+		/// Dispatch events until stop() is called. A stop() that comes before run() (from
+		/// another thread, say, that got there first) makes it return straight away.
+		void run();
+
+		/// @return The number of registrations (including timers), not counting the internal wakeup descriptor.
+		size_t size() const { return m_count; }
+
+	private:
+		enum Kind { KIND_NONE, KIND_FD, KIND_TIMER, KIND_WAKEUP };
+
+		struct Entry {
+			FileDes fd;
+			Handler *handler;
+			uint32_t generation;
+			uint8_t kind;
+			Entry(): handler(nullptr), generation(0u), kind(KIND_NONE) {}
+		};
+
+		int insert(const int raw, FileDes &&owned, const uint32_t events, Handler *handler, const Kind kind);
+		Entry &lookup(const int fd);
+
+		FileDes m_epoll;
+		FileDes m_wakeup_fd;
+		Handler *m_wakeup_handler;
+		std::vector<Entry> m_entries;
+		std::vector<struct epoll_event> m_events;
+		size_t m_count;
+		std::atomic<bool> m_stop;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef MAPPEDRECORDS_HPP
+#define MAPPEDRECORDS_HPP
+
+/* Zero-copy views of flat binary record files, typically over a FileMapping.
+ *
+ * FixedRecords<T> views an array of fixed-stride records as T objects in place.
+ * Bounds are checked once, when the view is made; indexing and iteration are unchecked.
+ *
+ * PrefixedRecords<Prefix> views a sequence of length-prefixed records (U32Prefix for a
+ * little-endian uint32_t length, VarintPrefix for a LEB128 length). Each record is checked
+ * once against the end of the view as it's reached (the length prefix itself is decoded
+ * without per-byte checks whenever a whole prefix fits), and a truncated or oversized record,
+ * or an overlong varint prefix, throws RecordFormatError. valid_bytes() and split() judge
+ * prefixes the same way.
+ *
+ * Both kinds of view can be split into balanced subranges for parallel consumers.
+ *
+ * Views can be made from a whole-file mapping (FileMapping::MapWholeFile) or from a partial
+ * mapping (FileMapping(fd, len, offset)); since mmap offsets must be page aligned, the 'begin'
+ * argument gives the position of the first record within the mapping.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <vector>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <cassert>
+#include <cstring>
+#include <stdint.h>
+
+class RecordFormatError : public std::runtime_error {
+	public:
+		RecordFormatError(size_t offset, const char *message): std::runtime_error(message), m_offset(offset) {}
+
+		/// @return The byte offset (from the start of the view) of the bad record.
+		size_t offset() const { return m_offset; }
+	private:
+		size_t m_offset;
+};
+
+template <typename T>
+class FixedRecords {
+	static_assert(std::is_trivially_copyable<T>::value, "records must be trivially copyable to be viewed in place");
+
+	public:
+		class iterator {
+			public:
+				typedef std::random_access_iterator_tag iterator_category;
+				typedef T value_type;
+				typedef ptrdiff_t difference_type;
+				typedef const T *pointer;
+				typedef const T &reference;
+
+				iterator(): m_pos(nullptr), m_stride(0) {}
+				iterator(const char *pos, size_t stride): m_pos(pos), m_stride(stride) {}
+
+				reference operator*() const { return *reinterpret_cast<const T*>(m_pos); }
+				pointer operator->() const { return reinterpret_cast<const T*>(m_pos); }
+				reference operator[](difference_type n) const { return *(*this + n); }
+
+				iterator &operator++() { m_pos += m_stride; return *this; }
+				iterator operator++(int) { iterator tmp(*this); m_pos += m_stride; return tmp; }
+				iterator &operator--() { m_pos -= m_stride; return *this; }
+				iterator operator--(int) { iterator tmp(*this); m_pos -= m_stride; return tmp; }
+				iterator &operator+=(difference_type n) { m_pos += n * difference_type(m_stride); return *this; }
+				iterator &operator-=(difference_type n) { m_pos -= n * difference_type(m_stride); return *this; }
+				iterator operator+(difference_type n) const { iterator tmp(*this); return tmp += n; }
+				iterator operator-(difference_type n) const { iterator tmp(*this); return tmp -= n; }
+				difference_type operator-(const iterator &other) const { return (m_pos - other.m_pos) / difference_type(m_stride); }
+
+				bool operator==(const iterator &other) const { return m_pos == other.m_pos; }
+				bool operator!=(const iterator &other) const { return m_pos != other.m_pos; }
+				bool operator<(const iterator &other) const { return m_pos < other.m_pos; }
+				bool operator>(const iterator &other) const { return m_pos > other.m_pos; }
+				bool operator<=(const iterator &other) const { return m_pos <= other.m_pos; }
+				bool operator>=(const iterator &other) const { return m_pos >= other.m_pos; }
+
+			private:
+				const char *m_pos;
+				size_t m_stride;
+		};
+
+		FixedRecords(): m_base(nullptr), m_count(0u), m_stride(sizeof(T)), m_trailing(0u) {}
+
+		/// View size bytes at data as records of 'stride' bytes (at least sizeof(T)).
+		/// Any incomplete record at the end is excluded (see trailing_bytes()).
+		FixedRecords(const void *data, const size_t size, const size_t stride = sizeof(T)):
+				m_base(static_cast<const char*>(data)), m_count(0u), m_stride(stride), m_trailing(0u) {
+			if (stride < sizeof(T)) { throw RecordFormatError(0, "record stride is smaller than the record type"); }
+			if ((reinterpret_cast<uintptr_t>(data) % alignof(T)) || (stride % alignof(T))) {
+				throw RecordFormatError(0, "records are not suitably aligned for the record type");
+			}
+			m_count = size / stride;
+			m_trailing = size % stride;
+		}
+
+		/// View the records in a mapping, starting 'begin' bytes in.
+		explicit FixedRecords(const FileMapping &mapping, const size_t begin = 0, const size_t stride = sizeof(T)):
+			FixedRecords(static_cast<const char*>(mapping.get()) + begin, checked_size(mapping, begin), stride) {}
+
+		size_t size() const { return m_count; }
+		bool empty() const { return !m_count; }
+		size_t stride() const { return m_stride; }
+
+		/// @return The number of bytes at the end that don't make up a complete record.
+		size_t trailing_bytes() const { return m_trailing; }
+
+		const T &operator[](const size_t i) const {
+			assert(i < m_count);
+			return *reinterpret_cast<const T*>(m_base + i * m_stride);
+		}
+
+		iterator begin() const { return iterator(m_base, m_stride); }
+		iterator end() const { return iterator(m_base + m_count * m_stride, m_stride); }
+
+		/// @return A view of 'count' records starting at record 'first'.
+		FixedRecords subrange(const size_t first, const size_t count) const {
+			assert(first <= m_count && count <= m_count - first);
+			return FixedRecords(m_base + first * m_stride, count * m_stride, m_stride);
+		}
+
+		/// Split into (at most) 'parts' non-empty views with record counts that differ by at most one.
+		std::vector<FixedRecords> split(size_t parts) const {
+			std::vector<FixedRecords> ranges;
+			if (parts > m_count) { parts = m_count; }
+			if (!parts) { return ranges; }
+			ranges.reserve(parts);
+			const size_t each = m_count / parts, extra = m_count % parts;
+			size_t first = 0;
+			for (size_t i = 0; i < parts; ++i) {
+				const size_t n = each + (i < extra ? 1 : 0);
+				ranges.push_back(subrange(first, n));
+				first += n;
+			}
+			return ranges;
+		}
+
+	private:
+		static size_t checked_size(const FileMapping &mapping, const size_t begin) {
+			if (begin > mapping.size()) { throw RecordFormatError(begin, "record data starts past the end of the mapping"); }
+			return mapping.size() - begin;
+		}
+
+		const char *m_base;
+		size_t m_count;
+		size_t m_stride;
+		size_t m_trailing;
+};
+
+/// Length prefix: little-endian uint32_t.
+struct U32Prefix {
+	static const size_t MAX_BYTES = 4;
+
+	/// Fast path: the caller guarantees at least MAX_BYTES are readable at p.
+	/// @return false if the prefix is malformed (never, for this one).
+	static bool decode_unchecked(const unsigned char *&p, uint64_t &len) {
+		len = uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) | (uint64_t(p[3]) << 24);
+		p += 4;
+		return true;
+	}
+
+	/// @return false if the prefix doesn't fit before 'end'.
+	static bool decode(const unsigned char *&p, const unsigned char *end, uint64_t &len) {
+		if (end - p < 4) { return false; }
+		return decode_unchecked(p, len);
+	}
+};
+
+/// Length prefix: unsigned LEB128 varint (7 bits per byte, least significant group first).
+/// Overlong prefixes (more than MAX_BYTES, or more than 64 bits) are malformed.
+struct VarintPrefix {
+	static const size_t MAX_BYTES = 10;
+
+	static bool decode_unchecked(const unsigned char *&p, uint64_t &len) {
+		len = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			const unsigned char b = *p++;
+			len |= uint64_t(b & 0x7fu) << shift;
+			// the tenth byte only has room for the top bit
+			if (!(b & 0x80u)) { return shift < 63 || b <= 1u; }
+		}
+		return false;
+	}
+
+	/// @return false if the prefix doesn't fit before 'end', or is overlong.
+	static bool decode(const unsigned char *&p, const unsigned char *end, uint64_t &len) {
+		// same answers as decode_unchecked, so that iteration and split() agree
+		if (size_t(end - p) >= MAX_BYTES) { return decode_unchecked(p, len); }
+		len = 0;
+		for (unsigned shift = 0; p != end; shift += 7) {
+			const unsigned char b = *p++;
+			len |= uint64_t(b & 0x7fu) << shift;
+			if (!(b & 0x80u)) { return true; }
+		}
+		return false;
+	}
+};
+
+template <typename Prefix>
+class PrefixedRecords {
+	public:
+		struct Record {
+			const char *data;
+			size_t size;
+		};
+
+		class iterator {
+			public:
+				typedef std::forward_iterator_tag iterator_category;
+				typedef Record value_type;
+				typedef ptrdiff_t difference_type;
+				typedef const Record *pointer;
+				typedef const Record &reference;
+
+				iterator(): m_base(nullptr), m_pos(nullptr), m_end(nullptr), m_next(nullptr) {}
+				iterator(const unsigned char *base, const unsigned char *pos, const unsigned char *end):
+						m_base(base), m_pos(pos), m_end(end), m_next(pos) {
+					load();
+				}
+
+				reference operator*() const { return m_record; }
+				pointer operator->() const { return &m_record; }
+
+				iterator &operator++() { m_pos = m_next; load(); return *this; }
+				iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+
+				bool operator==(const iterator &other) const { return m_pos == other.m_pos; }
+				bool operator!=(const iterator &other) const { return m_pos != other.m_pos; }
+
+				/// @return The byte offset of the current record's prefix, relative to the view.
+				size_t offset() const { return m_pos - m_base; }
+
+			private:
+				void load() {
+					if (m_pos == m_end) { return; }
+					const unsigned char *p = m_pos;
+					uint64_t len;
+					if (!(size_t(m_end - p) >= Prefix::MAX_BYTES ? Prefix::decode_unchecked(p, len) : Prefix::decode(p, m_end, len))) {
+						throw RecordFormatError(m_pos - m_base, "truncated or malformed record length");
+					}
+					if (len > uint64_t(m_end - p)) {
+						throw RecordFormatError(m_pos - m_base, "record extends past the end of the data");
+					}
+					m_record.data = reinterpret_cast<const char*>(p);
+					m_record.size = size_t(len);
+					m_next = p + len;
+				}
+
+				const unsigned char *m_base;
+				const unsigned char *m_pos;
+				const unsigned char *m_end;
+				const unsigned char *m_next;
+				Record m_record;
+		};
+
+		PrefixedRecords(): m_base(nullptr), m_size(0u) {}
+		PrefixedRecords(const void *data, const size_t size): m_base(static_cast<const unsigned char*>(data)), m_size(size) {}
+
+		/// View the records in a mapping, starting 'begin' bytes in.
+		explicit PrefixedRecords(const FileMapping &mapping, const size_t begin = 0):
+				m_base(static_cast<const unsigned char*>(mapping.get()) + begin), m_size(0u) {
+			if (begin > mapping.size()) { throw RecordFormatError(begin, "record data starts past the end of the mapping"); }
+			m_size = mapping.size() - begin;
+		}
+
+		const void *data() const { return m_base; }
+		size_t size_bytes() const { return m_size; }
+
+		iterator begin() const { return iterator(m_base, m_base, m_base + m_size); }
+		iterator end() const { return iterator(m_base, m_base + m_size, m_base + m_size); }
+
+		/// Scan the record boundaries (without touching record contents).
+		/// @return The length of the longest prefix of the view that consists of complete records.
+		/// If this is less than size_bytes(), the data is truncated or corrupt at that offset.
+		size_t valid_bytes(size_t *count = nullptr) const {
+			const unsigned char *p = m_base, * const end = m_base + m_size;
+			size_t n = 0;
+			while (p != end) {
+				const unsigned char *q = p;
+				uint64_t len;
+				if (!Prefix::decode(q, end, len) || len > uint64_t(end - q)) { break; }
+				p = q + len;
+				++n;
+			}
+			if (count) { *count = n; }
+			return p - m_base;
+		}
+
+		/// @return A view that stops before any truncated record at the end.
+		PrefixedRecords complete() const { return PrefixedRecords(m_base, valid_bytes()); }
+
+		/// Split into (at most) 'parts' non-empty views of roughly equal byte size, each
+		/// starting on a record boundary. Finding the boundaries needs one pass over the
+		/// length prefixes (skipping the record contents). Throws RecordFormatError if a
+		/// record boundary can't be found because the data is malformed.
+		std::vector<PrefixedRecords> split(const size_t parts) const {
+			std::vector<PrefixedRecords> ranges;
+			if (!parts || !m_size) { return ranges; }
+			ranges.reserve(parts);
+			const unsigned char *p = m_base, *start = m_base, * const end = m_base + m_size;
+			for (size_t i = 1; i < parts && p != end; ++i) {
+				const unsigned char * const target = m_base + (m_size / parts) * i;
+				while (p < target && p != end) {
+					const unsigned char *q = p;
+					uint64_t len;
+					if (!Prefix::decode(q, end, len) || len > uint64_t(end - q)) {
+						throw RecordFormatError(p - m_base, "malformed record while splitting");
+					}
+					p = q + len;
+				}
+				if (p != start) {
+					ranges.push_back(PrefixedRecords(start, p - start));
+					start = p;
+				}
+			}
+			if (start != end) { ranges.push_back(PrefixedRecords(start, end - start)); }
+			return ranges;
+		}
+
+	private:
+		const unsigned char *m_base;
+		size_t m_size;
+};
+
+#endif
@@ -3,80 +3,337 @@
  */
 
 #include "OptionParser.hpp"
-#include <iostream>
-#include <sstream>
+#include "Posix.hpp"
+#include <ostream>
+#include <string>
 #include <cassert>
 #include <cstring>
+#include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
-
-#ifndef NDEBUG
-#include <tr1/unordered_set>
-#endif
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
 
 namespace {
 
-#ifndef NDEBUG
-static bool has_ambiguous_flags(const OptionParser::FlagSpec *specs, int numspecs) {
-	char shortflags[256];
-	std::tr1::unordered_set<std::string> longflags;
+bool is_space(const char c) { return c == ' ' || (c >= '\t' && c <= '\r') || c == '\0'; }
+bool is_hspace(const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v' || c == '\0'; }
 
-	std::memset(shortflags, 0, 256);
+// orders spec indexes by long flag, and repeated long flags by index (so the first comes first)
+struct LongFlagLess {
+	const OptionParser::FlagSpec *specs;
+	bool operator()(int a, int b) const {
+		const int cmp = std::strcmp(specs[a].long_flag, specs[b].long_flag);
+		return cmp < 0 || (cmp == 0 && a < b);
+	}
+	bool operator()(int a, const char *flag) const { return std::strcmp(specs[a].long_flag, flag) < 0; }
+};
 
-	for (int i = 0; i < numspecs; ++i) {
-		const OptionParser::FlagSpec &spec = specs[i];
-		if (spec.short_flags) {
-			for (const char *c = spec.short_flags; *c; ++c) {
-				int cid = *c;
-				if (shortflags[cid]) { return true; }
-				++shortflags[cid];
+// Accumulates usage text in a buffer. With a flush function, the buffer is passed on
+// each time it fills; without one, output past the end of the buffer is counted but dropped.
+class UsageWriter {
+	public:
+		typedef void (*Flush)(void *target, const char *data, size_t len);
+
+		UsageWriter(char *buf, size_t size, Flush flush = 0, void *target = 0):
+			buf(buf), size(size), used(0), total(0), flush(flush), target(target) {}
+
+		void put(const char *s, size_t len) {
+			total += len;
+			while (len) {
+				if (used == size) {
+					if (!flush) { return; }
+					flush(target, buf, used);
+					used = 0;
+				}
+				const size_t n = std::min(len, size - used);
+				std::memcpy(buf + used, s, n);
+				used += n;
+				s += n;
+				len -= n;
 			}
 		}
-		if (spec.long_flag) {
-			std::string s(spec.long_flag);
-			if (longflags.count(s)) { return true; }
-			longflags.insert(std::move(s));
+		void put(const char *s) { put(s, std::strlen(s)); }
+		void put(const char c) { put(&c, 1); }
+
+		/// Flush what's left, or NUL-terminate the buffer.
+		/// @return The total length written.
+		size_t finish() {
+			if (flush) {
+				if (used) { flush(target, buf, used); }
+			} else if (size) {
+				buf[std::min(used, size - 1)] = '\0';
+			}
+			used = 0;
+			return total;
 		}
-	}
 
-	return false;
+	private:
+		char *buf;
+		size_t size, used, total;
+		Flush flush;
+		void *target;
+};
+
+void write_fd(void *target, const char *data, size_t len) {
+	const int fd = *static_cast<const int*>(target);
+	while (len) {
+		const ssize_t n = ::write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) { continue; }
+			throw PosixError(errno);
+		}
+		data += n;
+		len -= size_t(n);
+	}
 }
-#endif
 
-} // annoymous namespace
+void write_stream(void *target, const char *data, size_t len) {
+	static_cast<std::ostream*>(target)->write(data, std::streamsize(len));
+}
 
-void OptionParser::print_usage(const OptionParser::FlagSpec *specs, std::ostream &ss, const char *progname, const char *description) {
+void write_usage(const OptionParser::FlagSpec *specs, UsageWriter &out, const char *progname, const char *description) {
 	assert(specs && progname);
-	ss << "usage: " << progname << " [options] inputs\n";
+	out.put("usage: ");
+	out.put(progname);
+	out.put(" [options] inputs\n");
 	if (description) {
-		ss << "\n" << description;
+		out.put('\n');
+		out.put(description);
 	}
 	if (specs->short_flags || specs->long_flag) {
-		ss << "\nOptions:\n";
+		out.put("\nOptions:\n");
 		for (const OptionParser::FlagSpec *s = specs; s->short_flags || s->long_flag; ++s) {
 			if (! s->help)
 				continue;
 
-			ss << "    ";
+			const char *meta = s->metaname ? s->metaname : "";
+			out.put("    ");
 			if (s->short_flags && *s->short_flags) {
-				ss << "-" << *s->short_flags << (s->metaname ? s->metaname : "");
-				for (const char *c = s->short_flags + 1; *c; ++c) {
-					ss << ", -" << *c << (s->metaname ? s->metaname : "");
+				for (const char *c = s->short_flags; *c; ++c) {
+					if (c != s->short_flags)
+						out.put(", ");
+					out.put('-');
+					out.put(*c);
+					out.put(meta);
 				}
 				if (s->long_flag && *s->long_flag)
-					ss << ", ";
+					out.put(", ");
 			}
 			if (s->long_flag && *s->long_flag) {
-				ss << "--" << s->long_flag;
-				if (s->metaname)
-					ss << "=" << s->metaname;
+				out.put("--");
+				out.put(s->long_flag);
+				if (s->metaname) {
+					out.put('=');
+					out.put(s->metaname);
+				}
+			}
+			out.put("\n          ");
+			out.put(s->help);
+			out.put("\n\n");
+		}
+	}
+}
+
+void write_command_usage(const OptionParser::Command * const *commands, size_t count, UsageWriter &out,
+		const char *progname, const char *description) {
+	assert(progname);
+	out.put("usage: ");
+	out.put(progname);
+	out.put(" [options] <command> [command options] inputs\n");
+	if (description) {
+		out.put('\n');
+		out.put(description);
+	}
+	if (count) {
+		out.put("\nCommands:\n");
+		for (size_t i = 0; i < count; ++i) {
+			out.put("    ");
+			out.put(commands[i]->name);
+			out.put('\n');
+			if (commands[i]->help) {
+				out.put("          ");
+				out.put(commands[i]->help);
+				out.put('\n');
 			}
-			ss << "\n";
-			ss << "          " << s->help << "\n\n";
+			out.put('\n');
 		}
 	}
 }
 
+// FNV-1a
+uint32_t hash_name(const char *name) {
+	uint32_t h = 2166136261u;
+	for (; *name; ++name) {
+		h = (h ^ static_cast<unsigned char>(*name)) * 16777619u;
+	}
+	return h;
+}
+
+// size of the stack buffer that print_usage() writes through
+const size_t USAGE_CHUNK = 4096;
+
+} // annoymous namespace
+
+OptionParser::BadFlag::BadFlag(const char *flag, const char *s): flag(flag) {
+	const size_t len = std::min(std::strlen(s), MAX_MESSAGE - 1);
+	std::memcpy(msg, s, len);
+	msg[len] = '\0';
+}
+
+// A response or config file, mapped copy-on-write and split into words in place:
+// each word is unquoted where it lies and NUL-terminated, and the bytes between
+// words are cleared, so afterwards the mapping is a series of C strings separated
+// by NULs, and pointers into it stay valid for the life of the parser.
+struct OptionParser::TokenFile {
+	std::string path;
+	FileMapping mapping;
+	char *begin, *pos, *end;
+	// a final word that runs to the end of the file has nowhere to put its NUL, so it's copied here
+	std::vector<char> tail;
+
+	explicit TokenFile(const char *path);
+
+	/// @return The next word (response file syntax), or null at the end.
+	char *next_token();
+	/// Read the next "name [=] value" line (config file syntax); value is null if there isn't one.
+	bool next_entry(char *&key, char *&value);
+
+	template <typename Stop>
+	char *unquote(Stop stop);
+	char *terminate(char *start, char *out);
+};
+
+OptionParser::TokenFile::TokenFile(const char *path): path(path) {
+	try {
+		mapping = FileMapping::MapWholeFile(path, PROT_READ | PROT_WRITE, MAP_PRIVATE);
+	} catch (const PosixError &err) {
+		char msg[BadFlag::MAX_MESSAGE];
+		std::snprintf(msg, sizeof(msg), "can't read '%s': %s", path, err.what());
+		throw BadFlag(path, msg);
+	}
+	begin = pos = static_cast<char*>(mapping.get());
+	end = begin + mapping.size();
+}
+
+// Unquote the word at pos in place, stopping (outside quotes) where stop(c) is true.
+// Leaves pos at the stopping character; returns the end of the unquoted word.
+template <typename Stop>
+char *OptionParser::TokenFile::unquote(Stop stop) {
+	char *out = pos;
+	while (pos < end && !stop(*pos)) {
+		const char c = *pos++;
+		if (c == '\'') {
+			while (pos < end && *pos != '\'') { *out++ = *pos++; }
+			if (pos < end) { ++pos; }
+		} else if (c == '"') {
+			while (pos < end && *pos != '"') {
+				if (*pos == '\\' && pos + 1 < end && (pos[1] == '"' || pos[1] == '\\')) { ++pos; }
+				*out++ = *pos++;
+			}
+			if (pos < end) { ++pos; }
+		} else if (c == '\\' && pos < end) {
+			*out++ = *pos++;
+		} else {
+			*out++ = c;
+		}
+	}
+	return out;
+}
+
+// NUL-terminate the word [start, out), which was read up to pos: in the space freed by
+// unquoting, or over the separator at pos, or failing that (at the end of the file) in a copy.
+char *OptionParser::TokenFile::terminate(char *start, char *out) {
+	if (out < pos) {
+		std::memset(out, 0, pos - out);
+		return start;
+	}
+	if (pos < end) {
+		*pos++ = '\0';
+		return start;
+	}
+	tail.assign(start, out);
+	tail.push_back('\0');
+	return &tail[0];
+}
+
+char *OptionParser::TokenFile::next_token() {
+	for (;;) {
+		while (pos < end && is_space(*pos)) { *pos++ = '\0'; }
+		if (pos == end) { return nullptr; }
+		char * const start = pos;
+		char * const out = unquote(is_space);
+		if (out == start) {
+			// an empty word ('' or "") isn't an argument
+			std::memset(start, 0, pos - start);
+			continue;
+		}
+		return terminate(start, out);
+	}
+}
+
+bool OptionParser::TokenFile::next_entry(char *&key, char *&value) {
+	for (;;) {
+		while (pos < end && is_space(*pos)) { ++pos; }
+		if (pos == end) { return false; }
+		if (*pos == '#') {
+			while (pos < end && *pos != '\n') { ++pos; }
+			continue;
+		}
+
+		char * const key_start = pos;
+		char *out = unquote([](const char c) { return is_space(c) || c == '='; });
+		const bool key_equals = (pos < end && *pos == '=');
+		const bool key_newline = (pos < end && *pos == '\n');
+		key = terminate(key_start, out);
+		// the separator may have been overwritten by the terminator (and skipped)
+		bool equals = key_equals;
+		if (key_equals && pos < end && *pos == '=') { ++pos; }
+		value = nullptr;
+		if (key_newline) { return true; }
+
+		while (pos < end && is_hspace(*pos)) { ++pos; }
+		if (!equals && pos < end && *pos == '=') {
+			++pos;
+			equals = true;
+			while (pos < end && is_hspace(*pos)) { ++pos; }
+		}
+		if (pos < end && *pos != '\n') {
+			char * const value_start = pos;
+			out = unquote([](const char c) { return c == '\n'; });
+			while (out > value_start && is_hspace(out[-1])) { --out; }
+			value = terminate(value_start, out);
+		} else if (equals) {
+			// "name =" gives an empty value; point at the terminator after the key
+			value = key + std::strlen(key);
+		}
+		return true;
+	}
+}
+
+void OptionParser::print_usage(const OptionParser::FlagSpec *specs, std::ostream &ss, const char *progname, const char *description) {
+	char buf[USAGE_CHUNK];
+	UsageWriter out(buf, sizeof(buf), write_stream, &ss);
+	write_usage(specs, out, progname, description);
+	out.finish();
+}
+
+void OptionParser::print_usage(const OptionParser::FlagSpec *specs, int fd, const char *progname, const char *description) {
+	char buf[USAGE_CHUNK];
+	UsageWriter out(buf, sizeof(buf), write_fd, &fd);
+	write_usage(specs, out, progname, description);
+	out.finish();
+}
+
+size_t OptionParser::format_usage(const OptionParser::FlagSpec *specs, char *buf, size_t bufsize, const char *progname, const char *description) {
+	UsageWriter out(buf, bufsize);
+	write_usage(specs, out, progname, description);
+	return out.finish();
+}
+
 OptionParser::OptionParser(const OptionParser::FlagSpec *specs, int argc, char **argv):
 	specs(specs), argc(argc), argv(argv) {
 	assert(specs && argc >= 0 && argv);
@@ -85,14 +342,22 @@ OptionParser::OptionParser(const OptionParser::FlagSpec *specs, int argc, char *
 	while (specs[numspecs].short_flags || specs[numspecs].long_flag)
 		++numspecs;
 
-#ifndef NDEBUG
-	assert(! has_ambiguous_flags(specs, numspecs));
-#endif
+	const bool ambiguous = build_index();
+	assert(! ambiguous);
+	(void)ambiguous;
 
 	x = y = 0;
 	remain = 0;
 	flag_idx = -1;
 	arg_value = 0;
+
+	response_files = false;
+	stop_at_positional = false;
+	flags_done = false;
+	finished = false;
+	file_depth = 0;
+	next_config = 0;
+	positional_count = 0;
 }
 
 OptionParser::~OptionParser() {
@@ -102,8 +367,45 @@ void OptionParser::print_usage(std::ostream &ss, const char *description) {
 	OptionParser::print_usage(specs, ss, argv[0], description);
 }
 
+void OptionParser::print_usage(int fd, const char *description) {
+	OptionParser::print_usage(specs, fd, argv[0], description);
+}
+
+size_t OptionParser::format_usage(char *buf, size_t bufsize, const char *description) {
+	return OptionParser::format_usage(specs, buf, bufsize, argv[0], description);
+}
+
 int OptionParser::next() {
-	while (remain || (x < argc)) {
+	// config files come before the command line
+	while (next_config < configs.size()) {
+		TokenFile &f = *files[configs[next_config]];
+		char *key, *value;
+		if (!f.next_entry(key, value)) {
+			++next_config;
+			continue;
+		}
+		const int flagidx = match_long_flag(key);
+		if (flagidx < 0) {
+			char msg[BadFlag::MAX_MESSAGE];
+			std::snprintf(msg, sizeof(msg), "unknown flag '%s' in '%s'", key, f.path.c_str());
+			throw UnknownFlag(key, msg);
+		}
+		if (specs[flagidx].metaname && !value) {
+			char msg[BadFlag::MAX_MESSAGE];
+			std::snprintf(msg, sizeof(msg), "expected argument for flag '%s' in '%s'", key, f.path.c_str());
+			throw ExpectedArg(key, msg);
+		}
+		if (!specs[flagidx].metaname && value) {
+			char msg[BadFlag::MAX_MESSAGE];
+			std::snprintf(msg, sizeof(msg), "flag '%s' in '%s' takes no argument", key, f.path.c_str());
+			throw BadFlag(key, msg);
+		}
+		arg_value = value;
+		flag_idx = flagidx;
+		return specs[flagidx].id;
+	}
+
+	while (!finished) {
 		char *flagtext;
 		char *value = 0;
 		int flagidx = -1;
@@ -116,10 +418,12 @@ int OptionParser::next() {
 			flagidx = match_short_flag(flagtext[1]);
 			if (!*++remain) { remain = 0; }
 		} else {
-			flagtext = argv[x++];
-			if (flagtext[0] == '-' && flagtext[1] != '\0') {
+			bool from_file;
+			flagtext = next_arg(from_file, true);
+			if (!flagtext) { break; }
+			if (!flags_done && flagtext[0] == '-' && flagtext[1] != '\0') {
 				if (flagtext[1] == '-') {
-					if (flagtext[2] == '\0') { break; } // end of flags
+					if (flagtext[2] == '\0') { flags_done = true; continue; } // end of flags
 					// long flag
 					value = std::strchr(flagtext+2, '=');
 					if (value) { *value++ = '\0'; }
@@ -131,23 +435,27 @@ int OptionParser::next() {
 				}
 			} else {
 				// positional argument
-				if (flagtext[0] != '\0') argv[y++] = flagtext;
+				keep_positional(flagtext, from_file);
+				// (argv[0], the program name, doesn't count)
+				if (stop_at_positional && (from_file || x > 1)) { flags_done = true; }
 				continue;
 			}
 		}
 
 		if (flagidx < 0) {
-			std::ostringstream ss;
-			ss << "unknown flag '" << flagtext << "'";
-			throw UnknownFlag(flagtext, ss.str());
+			char msg[BadFlag::MAX_MESSAGE];
+			std::snprintf(msg, sizeof(msg), "unknown flag '%s'", flagtext);
+			throw UnknownFlag(flagtext, msg);
 		}
 		if (specs[flagidx].metaname) {
-			if (!value)
-				value = (x < argc ? argv[x++] : 0);
 			if (!value) {
-				std::ostringstream ss;
-				ss << "expected argument for flag '" << flagtext << "'";
-				throw ExpectedArg(flagtext, ss.str());
+				bool from_file;
+				value = next_arg(from_file, false);
+			}
+			if (!value) {
+				char msg[BadFlag::MAX_MESSAGE];
+				std::snprintf(msg, sizeof(msg), "expected argument for flag '%s'", flagtext);
+				throw ExpectedArg(flagtext, msg);
 			}
 			remain = 0;
 		} else
@@ -158,10 +466,115 @@ int OptionParser::next() {
 		return specs[flagidx].id;
 	}
 
-	while (x < argc) argv[y++] = argv[x++];
+	finish();
+	return -1;
+}
+
+char *OptionParser::next_arg(bool &from_file, const bool expand) {
+	const bool expanding = expand && response_files && !flags_done;
+	for (;;) {
+		char *text;
+		if (file_depth) {
+			text = files[file_stack[file_depth - 1]]->next_token();
+			if (!text) {
+				--file_depth;
+				continue;
+			}
+			from_file = true;
+		} else {
+			if (x >= argc) { return 0; }
+			text = argv[x++];
+			from_file = false;
+		}
+		if (expanding && text[0] == '@' && text[1] != '\0') {
+			push_file(text + 1);
+			continue;
+		}
+		return text;
+	}
+}
+
+void OptionParser::push_file(const char *path) {
+	if (file_depth == MAX_RESPONSE_FILE_DEPTH) {
+		char msg[BadFlag::MAX_MESSAGE];
+		std::snprintf(msg, sizeof(msg), "response files nested too deeply at '%s'", path);
+		throw BadFlag(path, msg);
+	}
+	std::unique_ptr<TokenFile> file(new TokenFile(path));
+	files.push_back(std::move(file));
+	file_stack[file_depth++] = int(files.size() - 1);
+}
+
+void OptionParser::keep_positional(char *text, const bool from_file) {
+	// empty arguments are dropped, except after "--" (or the first positional, with
+	// set_stop_at_positional), where everything is passed through
+	if (text[0] == '\0' && !flags_done) { return; }
+	if (from_file) {
+		// the words are recorded as they're handed out, since the file they point into
+		// has been split up in place and can't be scanned for them again
+		if (file_runs.empty() || file_runs.back().before != size_t(y)) {
+			const FileRun run = { size_t(y), file_words.size(), file_words.size() };
+			file_runs.push_back(run);
+		}
+		file_words.push_back(text);
+		++file_runs.back().end;
+	} else {
+		argv[y++] = text;
+	}
+	++positional_count;
+}
+
+void OptionParser::finish() {
+	assert(!file_depth);
+	finished = true;
 	x = y;
 	while (x < argc) argv[x++] = 0;
-	return -1;
+}
+
+void OptionParser::load_config(const char *path) {
+	assert(!finished && x == 0);
+	files.push_back(std::unique_ptr<TokenFile>(new TokenFile(path)));
+	configs.push_back(int(files.size() - 1));
+}
+
+OptionParser::Positionals::iterator OptionParser::Positionals::begin() const {
+	iterator it(parser, 0, 0, parser->file_runs.empty() ? 0 : parser->file_runs[0].begin);
+	it.settle();
+	return it;
+}
+
+OptionParser::Positionals::iterator OptionParser::Positionals::end() const {
+	return iterator(parser, size_t(parser->y), parser->file_runs.size(), 0);
+}
+
+// is the iterator among the file words that come before argv[argv_pos]?
+bool OptionParser::Positionals::iterator::in_run() const {
+	const std::vector<FileRun> &runs = parser->file_runs;
+	return run < runs.size() && runs[run].before == argv_pos && word < runs[run].end;
+}
+
+// move forward (if necessary) past the end of a run of file words
+void OptionParser::Positionals::iterator::settle() {
+	const std::vector<FileRun> &runs = parser->file_runs;
+	while (run < runs.size() && runs[run].before == argv_pos && word == runs[run].end) {
+		word = (++run < runs.size()) ? runs[run].begin : 0;
+	}
+	if (in_run()) {
+		current = parser->file_words[word];
+	} else if (argv_pos < size_t(parser->y)) {
+		current = parser->argv[argv_pos];
+	} else {
+		current = nullptr;
+	}
+}
+
+void OptionParser::Positionals::iterator::advance() {
+	if (in_run()) {
+		++word;
+	} else {
+		++argv_pos;
+	}
+	settle();
 }
 
 const char *OptionParser::arg() const {
@@ -172,18 +585,144 @@ int OptionParser::arg_count() const {
 	return y;
 }
 
-int OptionParser::match_long_flag(const char *flag) {
+bool OptionParser::build_index() {
+	bool ambiguous = false;
+
+	// where a flag is repeated, the first spec that has it wins (as with a linear search)
+	std::fill(short_index, short_index + 256, -1);
+	num_long = 0;
+	for (int i = 0; i < numspecs; ++i) {
+		if (specs[i].long_flag) { ++num_long; }
+	}
+	long_index = long_inline;
+	if (num_long > INLINE_LONG_FLAGS) {
+		long_heap.reset(new int[num_long]);
+		long_index = long_heap.get();
+	}
+
+	size_t n = 0;
 	for (int i = 0; i < numspecs; ++i) {
 		const FlagSpec &s = specs[i];
-		if (s.long_flag && !std::strcmp(s.long_flag, flag)) { return i; }
+		if (s.short_flags) {
+			for (const char *c = s.short_flags; *c; ++c) {
+				int &slot = short_index[static_cast<unsigned char>(*c)];
+				if (slot >= 0) { ambiguous = true; } else { slot = i; }
+			}
+		}
+		if (s.long_flag) { long_index[n++] = i; }
 	}
+
+	// (std::sort, unlike std::stable_sort, doesn't need a temporary buffer)
+	LongFlagLess less = { specs };
+	std::sort(long_index, long_index + num_long, less);
+	for (size_t i = 1; i < num_long; ++i) {
+		if (!std::strcmp(specs[long_index[i-1]].long_flag, specs[long_index[i]].long_flag)) { ambiguous = true; }
+	}
+	return ambiguous;
+}
+
+int OptionParser::match_long_flag(const char *flag) const {
+	LongFlagLess less = { specs };
+	const int * const begin = long_index;
+	const int * const end = begin + num_long;
+	const int * const it = std::lower_bound(begin, end, flag, less);
+	if (it != end && !std::strcmp(specs[*it].long_flag, flag)) { return *it; }
 	return -1;
 }
 
-int OptionParser::match_short_flag(char f) {
-	for (int i = 0; i < numspecs; ++i ) {
-		const FlagSpec &s = specs[i];
-		if (s.short_flags && std::strchr(s.short_flags, f)) { return i; }
+int OptionParser::match_short_flag(char f) const {
+	return short_index[static_cast<unsigned char>(f)];
+}
+
+bool OptionParser::convert(const char *text, long &value) {
+	char *end;
+	errno = 0;
+	value = std::strtol(text, &end, 0);
+	return (end != text && !*end && errno != ERANGE);
+}
+
+bool OptionParser::convert(const char *text, unsigned long &value) {
+	char *end;
+	// strtoul accepts (and negates) a leading minus sign
+	const char *p = text;
+	while (*p == ' ' || (*p >= '\t' && *p <= '\r')) { ++p; }
+	if (*p == '-') { return false; }
+	errno = 0;
+	value = std::strtoul(text, &end, 0);
+	return (end != text && !*end && errno != ERANGE);
+}
+
+bool OptionParser::convert(const char *text, double &value) {
+	char *end;
+	errno = 0;
+	value = std::strtod(text, &end);
+	return (end != text && !*end && errno != ERANGE);
+}
+
+void OptionParser::throw_bad_value(const char *short_flags, const char *long_flag, const char *value) {
+	char msg[BadFlag::MAX_MESSAGE];
+	if (long_flag && *long_flag) {
+		std::snprintf(msg, sizeof(msg), "invalid value '%s' for flag '--%s'", value, long_flag);
+	} else {
+		std::snprintf(msg, sizeof(msg), "invalid value '%s' for flag '-%.1s'", value, short_flags ? short_flags : "");
 	}
-	return -1;
+	throw BadValue(long_flag ? long_flag : short_flags, msg);
+}
+
+const size_t OptionParser::INLINE_LONG_FLAGS;
+const size_t OptionParser::MAX_RESPONSE_FILE_DEPTH;
+const size_t OptionParser::Commands::MAX_COMMANDS;
+const size_t OptionParser::Commands::NUM_SLOTS;
+
+OptionParser::Commands::Commands(): count(0) {
+	std::fill(slots, slots + NUM_SLOTS, uint16_t(0));
+}
+
+void OptionParser::Commands::add(const Command &command) {
+	assert(command.name && command.specs && command.handler);
+	if (count == MAX_COMMANDS) {
+		throw std::length_error("too many commands");
+	}
+	size_t i = hash_name(command.name) & (NUM_SLOTS - 1);
+	while (slots[i]) {
+		assert(std::strcmp(commands[slots[i] - 1]->name, command.name) != 0);
+		i = (i + 1) & (NUM_SLOTS - 1);
+	}
+	commands[count++] = &command;
+	slots[i] = uint16_t(count);
+}
+
+const OptionParser::Command *OptionParser::Commands::find(const char *name) const {
+	for (size_t i = hash_name(name) & (NUM_SLOTS - 1); slots[i]; i = (i + 1) & (NUM_SLOTS - 1)) {
+		const Command *c = commands[slots[i] - 1];
+		if (!std::strcmp(c->name, name)) { return c; }
+	}
+	return nullptr;
+}
+
+int OptionParser::Commands::run(int argc, char **argv, void *context) const {
+	if (argc < 1 || !argv[0]) {
+		throw UnknownCommand("", "expected a command");
+	}
+	const Command *command = find(argv[0]);
+	if (!command) {
+		char msg[BadFlag::MAX_MESSAGE];
+		std::snprintf(msg, sizeof(msg), "unknown command '%s'", argv[0]);
+		throw UnknownCommand(argv[0], msg);
+	}
+	OptionParser opts(command->specs(), argc, argv);
+	return command->handler(opts, context);
+}
+
+void OptionParser::Commands::print_usage(int fd, const char *progname, const char *description) const {
+	char buf[USAGE_CHUNK];
+	UsageWriter out(buf, sizeof(buf), write_fd, &fd);
+	write_command_usage(commands, count, out, progname, description);
+	out.finish();
+}
+
+size_t OptionParser::Commands::format_usage(char *buf, size_t bufsize, const char *progname, const char *description) const {
+	UsageWriter out(buf, bufsize);
+	write_command_usage(commands, count, out, progname, description);
+	return out.finish();
 }
@@ -9,9 +9,14 @@
  * WITHOUT WARRANTY OF ANY KIND.
  */
 
-#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
 #include <iosfwd>
 #include <exception>
+#include <cstddef>
+#include <cassert>
+#include <stdint.h>
 
 class OptionParser {
 	public:
@@ -38,28 +43,132 @@ class OptionParser {
 			const char *help;
 		};
 
+		/// The message is copied into the exception (truncated to MAX_MESSAGE - 1 bytes),
+		/// so reporting a bad flag never allocates.
 		struct BadFlag : public std::exception {
 			public:
-				BadFlag(const char *flag, const std::string &s): flag(flag), msg(s) {}
+				static const size_t MAX_MESSAGE = 256;
+
+				BadFlag(const char *flag, const char *s);
 				virtual ~BadFlag() noexcept {}
-				virtual const char *what() const throw() { return msg.c_str(); }
+				virtual const char *what() const throw() { return msg; }
 			private:
 				const char *flag;
-				std::string msg;
+				char msg[MAX_MESSAGE];
 		};
 
 		struct ExpectedArg : public BadFlag {
-			ExpectedArg(const char *flag, const std::string &s): BadFlag(flag, s) {}
+			ExpectedArg(const char *flag, const char *s): BadFlag(flag, s) {}
 		};
 
 		struct UnknownFlag : public BadFlag {
-			UnknownFlag(const char *flag, const std::string &s): BadFlag(flag, s) {}
+			UnknownFlag(const char *flag, const char *s): BadFlag(flag, s) {}
+		};
+
+		/// Thrown by parse() when a typed flag's argument isn't a valid value for its type.
+		struct BadValue : public BadFlag {
+			BadValue(const char *flag, const char *s): BadFlag(flag, s) {}
+		};
+
+		/// A flag that stores straight into a field of a struct S (the typed front end).
+		/// The field's type decides how the argument is converted:
+		///   bool: set to true, takes no argument (metaname must be null);
+		///   int, long, unsigned long: decimal, or hex/octal with a 0x/0 prefix, range checked;
+		///   double: as strtod;
+		///   const char *: points into argv, no copy.
+		/// Declare the table constexpr and check it with valid_flags() at compile time, e.g.
+		/// (parse() asserts valid_flags() too, so an unchecked table fails in debug builds):
+		///   struct Settings { bool verbose; int jobs; const char *output; };
+		///   static constexpr OptionParser::Flag<Settings> FLAGS[] = {
+		///      { "v", "verbose", &Settings::verbose, nullptr, "Print more." },
+		///      { "j", "jobs", &Settings::jobs, "N", "Run N jobs at once." },
+		///      { "o", "output", &Settings::output, "FILE", "Write to FILE." },
+		///   };
+		///   static_assert(OptionParser::valid_flags(FLAGS), "bad flag table");
+		///   Settings settings = { false, 1, "out.txt" };
+		///   int nargs = OptionParser::parse(FLAGS, settings, argc, argv);
+		template <typename S>
+		struct Flag {
+			enum Type { BOOL, INT, LONG, ULONG, DOUBLE, STRING };
+
+			union Member {
+				bool S::*b;
+				int S::*i;
+				long S::*l;
+				unsigned long S::*u;
+				double S::*d;
+				const char *S::*s;
+
+				constexpr Member(bool S::*m): b(m) {}
+				constexpr Member(int S::*m): i(m) {}
+				constexpr Member(long S::*m): l(m) {}
+				constexpr Member(unsigned long S::*m): u(m) {}
+				constexpr Member(double S::*m): d(m) {}
+				constexpr Member(const char *S::*m): s(m) {}
+			};
+
+			const char *short_flags;
+			const char *long_flag;
+			const char *metaname;
+			const char *help;
+			Type type;
+			Member member;
+
+			constexpr Flag(const char *short_flags, const char *long_flag, bool S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(BOOL), member(m) {}
+			constexpr Flag(const char *short_flags, const char *long_flag, int S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(INT), member(m) {}
+			constexpr Flag(const char *short_flags, const char *long_flag, long S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(LONG), member(m) {}
+			constexpr Flag(const char *short_flags, const char *long_flag, unsigned long S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(ULONG), member(m) {}
+			constexpr Flag(const char *short_flags, const char *long_flag, double S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(DOUBLE), member(m) {}
+			constexpr Flag(const char *short_flags, const char *long_flag, const char *S::*m, const char *metaname, const char *help):
+				short_flags(short_flags), long_flag(long_flag), metaname(metaname), help(help), type(STRING), member(m) {}
+
+			/// Convert and store the argument. Throws BadValue.
+			void store(S &values, const char *value) const;
 		};
 
+		/// Check of a typed flag table: constexpr, for a static_assert on a constexpr table.
+		/// parse() asserts it at run time as well.
+		/// @return false if a short or long flag is used twice, a flag has neither form,
+		/// or a bool flag has a metaname (or a non-bool flag lacks one).
+		/// The check compares every pair of flags, so tables of more than a couple of hundred
+		/// flags may need a higher compiler limit (-fconstexpr-ops-limit, -fconstexpr-steps).
+		template <typename S, size_t N>
+		static constexpr bool valid_flags(const Flag<S> (&flags)[N]) {
+			return !any_invalid(flags, 0, N, N);
+		}
+
+		/// Parse all the flags in argv into 'values' (fields whose flags don't appear are left alone).
+		/// The table must pass valid_flags() (asserted).
+		/// As with next(), argv is rearranged so that it starts with the positional arguments.
+		/// Throws UnknownFlag, ExpectedArg or BadValue.
+		/// @return The number of positional arguments (counting argv[0], as arg_count() does).
+		template <typename S, size_t N>
+		static int parse(const Flag<S> (&flags)[N], S &values, int argc, char **argv);
+
+		/// Print a usage summary listing the flags from a typed flag table.
+		template <typename S, size_t N>
+		static void print_usage(const Flag<S> (&flags)[N], std::ostream &ss, const char *progname, const char *description = 0);
+		template <typename S, size_t N>
+		static void print_usage(const Flag<S> (&flags)[N], int fd, const char *progname, const char *description = 0);
+		template <typename S, size_t N>
+		static size_t format_usage(const Flag<S> (&flags)[N], char *buf, size_t bufsize, const char *progname, const char *description = 0);
+
+		/// Tables with up to this many long flags are indexed inside the parser; bigger
+		/// ones get their index allocated once, when the parser is constructed.
+		static const size_t INLINE_LONG_FLAGS = 256;
+
 		/// Construct the parser. Note that argv is non-const: the array is rearranged during parsing,
 		/// so that when all flags have been processed (as indicated by next() returning -1),
 		/// the array will contain only positional arguments (followed by some nulls).
 		/// When parsing is completed, use arg_count() to find the number of positional arguments.
+		/// Empty arguments are dropped, except after "--", where they're kept as positional.
+		/// With up to INLINE_LONG_FLAGS long flags, neither constructing the parser nor parsing
+		/// argv allocates; only reading response files and config files does.
 		OptionParser(const FlagSpec *specs, int argc, char **argv);
 		~OptionParser();
 
@@ -69,6 +178,18 @@ class OptionParser {
 		/// Print a usage summary of the program, listing the available flags.
 		void print_usage(std::ostream &ss, const char *description = 0);
 
+		/// Write a usage summary straight to a file descriptor (a FileDes converts), through
+		/// a small stack buffer: no allocation, and no need for iostreams.
+		/// Throws PosixError if the write fails.
+		static void print_usage(const FlagSpec *spec, int fd, const char *progname, const char *description = 0);
+		void print_usage(int fd, const char *description = 0);
+
+		/// Format a usage summary into buf, as snprintf does: the result is truncated to
+		/// fit (and always NUL-terminated if bufsize > 0).
+		/// @return The length of the whole summary, not counting the NUL.
+		static size_t format_usage(const FlagSpec *spec, char *buf, size_t bufsize, const char *progname, const char *description = 0);
+		size_t format_usage(char *buf, size_t bufsize, const char *description = 0);
+
 		/// @return The 'id' value of the next flag, or -1 if there are no more flags.
 		int next();
 
@@ -78,12 +199,222 @@ class OptionParser {
 		/// @return The number of free arguments. Only valid once next() returns -1.
 		int arg_count() const;
 
+		/// Expand "@path" arguments: the file is read in place of the argument, split into
+		/// arguments at whitespace ('...' and "..." quote, backslash escapes). Files can
+		/// name other files. Positional arguments read from files are not moved into argv;
+		/// use positionals() to see them. Throws BadFlag if a file can't be read.
+		/// Off by default; call before the first next().
+		void set_response_files(const bool enable) { response_files = enable; }
+
+		/// Treat every argument after the first positional one as positional too, as if a
+		/// "--" preceded it, so that parsing stops at a subcommand name and leaves the
+		/// subcommand's flags alone (see Commands). Call before the first next().
+		void set_stop_at_positional(const bool enable) { stop_at_positional = enable; }
+
+		/// Read flags from a config file before the command line (so the command line can
+		/// override them). One flag per line, by its long name without the "--":
+		///    # comment
+		///    verbose
+		///    output = /tmp/out.txt
+		/// The value is the rest of the line (quotes and escapes as for response files).
+		/// Config files are read in the order they're loaded. Call before the first next().
+		/// Throws BadFlag if the file can't be read; unknown names are reported by next().
+		void load_config(const char *path);
+
+		/// The positional arguments in order, wherever they came from (argv or response files).
+		/// Iterating walks argv and the words kept from the files (which point into the
+		/// tokenized files); nothing is copied.
+		/// Only valid once next() returns -1, and while the parser exists.
+		class Positionals {
+			public:
+				class iterator {
+					public:
+						typedef std::forward_iterator_tag iterator_category;
+						typedef const char *value_type;
+						typedef std::ptrdiff_t difference_type;
+						typedef const char * const *pointer;
+						typedef const char * const &reference;
+
+						iterator(): parser(nullptr), argv_pos(0), run(0), word(0), current(nullptr) {}
+
+						reference operator*() const { return current; }
+						iterator &operator++() { advance(); return *this; }
+						iterator operator++(int) { iterator tmp(*this); advance(); return tmp; }
+						bool operator==(const iterator &other) const {
+							return argv_pos == other.argv_pos && run == other.run && word == other.word;
+						}
+						bool operator!=(const iterator &other) const { return !(*this == other); }
+
+					private:
+						friend class Positionals;
+						iterator(const OptionParser *parser, size_t argv_pos, size_t run, size_t word):
+							parser(parser), argv_pos(argv_pos), run(run), word(word), current(nullptr) {}
+						bool in_run() const;
+						void settle();
+						void advance();
+
+						const OptionParser *parser;
+						// next argv index, file run, and file word (if in that run)
+						size_t argv_pos;
+						size_t run;
+						size_t word;
+						const char *current;
+				};
+
+				iterator begin() const;
+				iterator end() const;
+				size_t size() const { return parser->positional_count; }
+				bool empty() const { return !size(); }
+
+			private:
+				friend class OptionParser;
+				explicit Positionals(const OptionParser *parser): parser(parser) {}
+				const OptionParser *parser;
+		};
+
+		Positionals positionals() const { return Positionals(this); }
+
+		/// A subcommand, as in "tool <command> [flags]".
+		struct Command {
+			/// Name on the command line, e.g. "commit".
+			const char *name;
+
+			/// One-line summary, printed by Commands::print_usage.
+			const char *help;
+
+			/// Returns the command's flag table. Called only once the command has been
+			/// selected, so building the table costs nothing when another command runs.
+			const FlagSpec *(*specs)();
+
+			/// Runs the command, with a parser over its arguments (argv[0] is the command
+			/// name). The context is the one passed to Commands::run; the return value is
+			/// returned from it.
+			int (*handler)(OptionParser &opts, void *context);
+		};
+
+		/// Dispatch table for subcommands. Registering a command just records a pointer
+		/// to it: the command's flag table and handler aren't touched until it's selected,
+		/// and selecting one is a hash lookup, so neither costs more with more commands.
+		/// Typical use, with global flags before the command:
+		///   OptionParser opts(GLOBAL_FLAGS, argc, argv);
+		///   opts.set_stop_at_positional(true);
+		///   while ((flag = opts.next()) != -1) { ... }
+		///   return commands.run(opts.arg_count() - 1, argv + 1, &settings);
+		class Commands {
+			public:
+				static const size_t MAX_COMMANDS = 256;
+
+				Commands();
+
+				/// Register a command. It isn't copied, so it must outlive this table
+				/// (a static const Command is typical). Each name may be registered once.
+				/// Throws std::length_error if there are already MAX_COMMANDS commands.
+				void add(const Command &command);
+
+				/// @return The command with this name, or null.
+				const Command *find(const char *name) const;
+
+				/// Run the command named by argv[0] with the rest of argv as its arguments.
+				/// Throws UnknownCommand if there is no such command (or no argv[0]), and
+				/// anything the command's parser or handler throws.
+				/// @return The handler's return value.
+				int run(int argc, char **argv, void *context = 0) const;
+
+				/// Print or format (as format_usage does for flags) a usage summary listing
+				/// the commands in the order they were added.
+				void print_usage(int fd, const char *progname, const char *description = 0) const;
+				size_t format_usage(char *buf, size_t bufsize, const char *progname, const char *description = 0) const;
+
+				size_t size() const { return count; }
+
+			private:
+				static const size_t NUM_SLOTS = 2 * MAX_COMMANDS;
+
+				// commands in the order they were added
+				const Command *commands[MAX_COMMANDS];
+				size_t count;
+				// open addressing (linear probing) on the name hash: index into commands + 1, or 0
+				uint16_t slots[NUM_SLOTS];
+		};
+
+		struct UnknownCommand : public BadFlag {
+			UnknownCommand(const char *command, const char *s): BadFlag(command, s) {}
+		};
+
 	private:
-		int match_long_flag(const char *flag);
-		int match_short_flag(char f);
+		struct TokenFile;
+
+		// positional arguments file_words[begin, end), from response files, that come
+		// after the first 'before' positional arguments in argv
+		struct FileRun {
+			size_t before;
+			size_t begin, end;
+		};
+
+		template <typename S, size_t N>
+		static void make_specs(const Flag<S> (&flags)[N], FlagSpec (&specs)[N + 1]);
+
+		static bool convert(const char *text, long &value);
+		static bool convert(const char *text, unsigned long &value);
+		static bool convert(const char *text, double &value);
+		static void throw_bad_value(const char *short_flags, const char *long_flag, const char *value);
+
+		// constexpr helpers for valid_flags; the tables are checked by halves so that the
+		// recursion depth is logarithmic in the number of flags
+		static constexpr bool str_equal(const char *a, const char *b) {
+			return *a == *b && (!*a || str_equal(a + 1, b + 1));
+		}
+		static constexpr bool contains(const char *s, const char c) {
+			return s && *s && (*s == c || contains(s + 1, c));
+		}
+		static constexpr bool shares_char(const char *a, const char *b) {
+			return a && *a && (contains(b, *a) || shares_char(a + 1, b));
+		}
+		static constexpr bool repeats_char(const char *s) {
+			return s && *s && (contains(s + 1, *s) || repeats_char(s + 1));
+		}
+		template <typename S>
+		static constexpr bool clash(const Flag<S> &a, const Flag<S> &b) {
+			return shares_char(a.short_flags, b.short_flags) || (a.long_flag && b.long_flag && str_equal(a.long_flag, b.long_flag));
+		}
+		template <typename S>
+		static constexpr bool malformed(const Flag<S> &f) {
+			return (!f.short_flags && !f.long_flag) || repeats_char(f.short_flags)
+				|| ((f.type == Flag<S>::BOOL) != (f.metaname == nullptr));
+		}
+		// does flags[i] clash with any of flags[lo, hi)?
+		template <typename S>
+		static constexpr bool clashes(const Flag<S> *flags, size_t i, size_t lo, size_t hi) {
+			return (hi - lo == 0) ? false
+				: (hi - lo == 1) ? clash(flags[i], flags[lo])
+				: (clashes(flags, i, lo, lo + (hi - lo) / 2) || clashes(flags, i, lo + (hi - lo) / 2, hi));
+		}
+		template <typename S>
+		static constexpr bool any_invalid(const Flag<S> *flags, size_t lo, size_t hi, size_t n) {
+			return (hi - lo == 0) ? false
+				: (hi - lo == 1) ? (malformed(flags[lo]) || clashes(flags, lo, lo + 1, n))
+				: (any_invalid(flags, lo, lo + (hi - lo) / 2, n) || any_invalid(flags, lo + (hi - lo) / 2, hi, n));
+		}
+
+		// limit on @file nesting (which also catches a file that names itself)
+		static const size_t MAX_RESPONSE_FILE_DEPTH = 32;
+
+		/// Builds short_index and long_index.
+		/// @return true if any short or long flag is used by more than one spec.
+		bool build_index();
+		int match_long_flag(const char *flag) const;
+		int match_short_flag(char f) const;
 
 		const FlagSpec *specs;
 		int numspecs;
+		// spec index for each short flag character, or -1
+		int short_index[256];
+		// indexes of the specs with long flags, sorted by long flag: in long_inline,
+		// or in long_heap if there are too many
+		int *long_index;
+		size_t num_long;
+		int long_inline[INLINE_LONG_FLAGS];
+		std::unique_ptr<int[]> long_heap;
 		int argc;
 		char **argv;
 
@@ -91,6 +422,104 @@ class OptionParser {
 		char *remain;
 		int flag_idx;
 		char *arg_value;
+
+		char *next_arg(bool &from_file, bool expand);
+		void push_file(const char *path);
+		void keep_positional(char *text, const bool from_file);
+		void finish();
+
+		bool response_files;
+		bool stop_at_positional;
+		bool flags_done;
+		bool finished;
+		// every file read (kept open, since arguments point into them)
+		std::vector<std::unique_ptr<TokenFile>> files;
+		// indexes into files of the response files being read, innermost last
+		int file_stack[MAX_RESPONSE_FILE_DEPTH];
+		size_t file_depth;
+		std::vector<int> configs;
+		size_t next_config;
+		// positional arguments from response files (pointing into them), in order
+		std::vector<const char *> file_words;
+		std::vector<FileRun> file_runs;
+		size_t positional_count;
 };
 
+template <typename S>
+void OptionParser::Flag<S>::store(S &values, const char *value) const {
+	switch (type) {
+		case BOOL: values.*member.b = true; return;
+		case STRING: values.*member.s = value; return;
+		case INT: {
+			long v;
+			if (!convert(value, v) || v < int(-0x7fffffff - 1) || v > 0x7fffffff) { break; }
+			values.*member.i = int(v);
+			return;
+		}
+		case LONG: {
+			long v;
+			if (!convert(value, v)) { break; }
+			values.*member.l = v;
+			return;
+		}
+		case ULONG: {
+			unsigned long v;
+			if (!convert(value, v)) { break; }
+			values.*member.u = v;
+			return;
+		}
+		case DOUBLE: {
+			double v;
+			if (!convert(value, v)) { break; }
+			values.*member.d = v;
+			return;
+		}
+	}
+	throw_bad_value(short_flags, long_flag, value);
+}
+
+template <typename S, size_t N>
+void OptionParser::make_specs(const Flag<S> (&flags)[N], FlagSpec (&specs)[N + 1]) {
+	for (size_t i = 0; i < N; ++i) {
+		const FlagSpec spec = { int(i), flags[i].short_flags, flags[i].long_flag, flags[i].metaname, flags[i].help };
+		specs[i] = spec;
+	}
+	const FlagSpec end = { -1, 0, 0, 0, 0 };
+	specs[N] = end;
+}
+
+template <typename S, size_t N>
+int OptionParser::parse(const Flag<S> (&flags)[N], S &values, int argc, char **argv) {
+	// a static_assert can't be made here (flags is a reference parameter), and callers may not have made one
+	assert(valid_flags(flags));
+	FlagSpec specs[N + 1];
+	make_specs(flags, specs);
+	OptionParser parser(specs, argc, argv);
+	for (int id; (id = parser.next()) != -1; ) {
+		flags[id].store(values, parser.arg());
+	}
+	return parser.arg_count();
+}
+
+template <typename S, size_t N>
+void OptionParser::print_usage(const Flag<S> (&flags)[N], std::ostream &ss, const char *progname, const char *description) {
+	FlagSpec specs[N + 1];
+	make_specs(flags, specs);
+	print_usage(specs, ss, progname, description);
+}
+
+template <typename S, size_t N>
+void OptionParser::print_usage(const Flag<S> (&flags)[N], int fd, const char *progname, const char *description) {
+	FlagSpec specs[N + 1];
+	make_specs(flags, specs);
+	print_usage(specs, fd, progname, description);
+}
+
+template <typename S, size_t N>
+size_t OptionParser::format_usage(const Flag<S> (&flags)[N], char *buf, size_t bufsize, const char *progname, const char *description) {
+	FlagSpec specs[N + 1];
+	make_specs(flags, specs);
+	return format_usage(specs, buf, bufsize, progname, description);
+}
+
 #endif
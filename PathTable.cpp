@@ -0,0 +1,180 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "PathTable.hpp"
+#include "lookup3.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const size_t NAME_BLOCK_SIZE = size_t(1) << 20;
+const size_t MAX_NAME_BLOCKS = size_t(1) << (32 - 20);
+const size_t INITIAL_SLOTS = 64;
+
+} // anonymous namespace
+
+const PathTable::PathId PathTable::INVALID;
+const PathTable::PathId PathTable::RELATIVE_ROOT;
+const PathTable::PathId PathTable::ABSOLUTE_ROOT;
+const uint32_t PathTable::EMPTY_SLOT;
+
+PathTable::PathTable(): m_names_used(0), m_slots(INITIAL_SLOTS, EMPTY_SLOT) {
+	static_assert(NAME_BLOCK_SIZE == (size_t(1) << NAME_BLOCK_BITS), "name block size mismatch");
+	m_names.emplace_back(new char[NAME_BLOCK_SIZE]);
+	// the roots have empty names and aren't in the hash table
+	const Node relative_root = { INVALID, 0u, 0u };
+	const Node absolute_root = { INVALID, 0u, 0u };
+	m_nodes.push_back(relative_root);
+	m_nodes.push_back(absolute_root);
+}
+
+uint32_t PathTable::hash(const PathId parent, const struct path_view name) const {
+	return hashlittle(name.ptr, name.len, parent);
+}
+
+uint32_t PathTable::store_name(const struct path_view name) {
+	if (m_names_used + name.len > NAME_BLOCK_SIZE) {
+		if (m_names.size() == MAX_NAME_BLOCKS) { throw std::length_error("PathTable: name storage full"); }
+		m_names.emplace_back(new char[NAME_BLOCK_SIZE]);
+		m_names_used = 0;
+	}
+	const uint32_t offset = uint32_t((m_names.size() - 1) << NAME_BLOCK_BITS) | m_names_used;
+	std::memcpy(m_names.back().get() + m_names_used, name.ptr, name.len);
+	m_names_used += name.len;
+	return offset;
+}
+
+void PathTable::grow_slots() {
+	std::vector<uint32_t> slots(m_slots.size() * 2, EMPTY_SLOT);
+	const size_t mask = slots.size() - 1;
+	for (size_t i = 0; i < m_slots.size(); ++i) {
+		const uint32_t id = m_slots[i];
+		if (id == EMPTY_SLOT) { continue; }
+		const Node &n = m_nodes[id];
+		size_t pos = hash(n.parent, path_view_make(name_ptr(n.name_offset), n.name_len)) & mask;
+		while (slots[pos] != EMPTY_SLOT) { pos = (pos + 1) & mask; }
+		slots[pos] = id;
+	}
+	m_slots.swap(slots);
+}
+
+PathTable::PathId PathTable::find_child(const PathId parent, const struct path_view name) const {
+	const size_t mask = m_slots.size() - 1;
+	for (size_t pos = hash(parent, name) & mask; ; pos = (pos + 1) & mask) {
+		const uint32_t id = m_slots[pos];
+		if (id == EMPTY_SLOT) { return INVALID; }
+		const Node &n = m_nodes[id];
+		if (n.parent == parent && n.name_len == name.len && std::memcmp(name_ptr(n.name_offset), name.ptr, name.len) == 0) {
+			return id;
+		}
+	}
+}
+
+PathTable::PathId PathTable::intern_child(const PathId parent, const struct path_view name) {
+	if (name.len > 0xffffu) { throw std::length_error("PathTable: path component too long"); }
+	size_t mask = m_slots.size() - 1;
+	const uint32_t h = hash(parent, name);
+	size_t pos = h & mask;
+	for (;;) {
+		const uint32_t id = m_slots[pos];
+		if (id == EMPTY_SLOT) { break; }
+		const Node &n = m_nodes[id];
+		if (n.parent == parent && n.name_len == name.len && std::memcmp(name_ptr(n.name_offset), name.ptr, name.len) == 0) {
+			return id;
+		}
+		pos = (pos + 1) & mask;
+	}
+
+	// ids must stay below EMPTY_SLOT (== INVALID)
+	if (m_nodes.size() >= size_t(EMPTY_SLOT) - 1) { throw std::length_error("PathTable: too many paths"); }
+	// keep the load factor at or below 3/4
+	if ((m_nodes.size() + 1) * 4 > m_slots.size() * 3) {
+		grow_slots();
+		mask = m_slots.size() - 1;
+		pos = h & mask;
+		while (m_slots[pos] != EMPTY_SLOT) { pos = (pos + 1) & mask; }
+	}
+
+	const PathId id = PathId(m_nodes.size());
+	const Node n = { parent, store_name(name), uint16_t(name.len) };
+	m_nodes.push_back(n);
+	m_slots[pos] = id;
+	return id;
+}
+
+PathTable::PathId PathTable::intern(const struct path_view path) {
+	PathId id = path_view_is_absolute(path) ? ABSOLUTE_ROOT : RELATIVE_ROOT;
+	struct path_iter it;
+	struct path_view component;
+	path_iter_init(&it, path);
+	while (path_iter_next(&it, &component)) {
+		id = intern_child(id, component);
+	}
+	return id;
+}
+
+PathTable::PathId PathTable::find(const struct path_view path) const {
+	PathId id = path_view_is_absolute(path) ? ABSOLUTE_ROOT : RELATIVE_ROOT;
+	struct path_iter it;
+	struct path_view component;
+	path_iter_init(&it, path);
+	while (path_iter_next(&it, &component)) {
+		id = find_child(id, component);
+		if (id == INVALID) { break; }
+	}
+	return id;
+}
+
+unsigned PathTable::depth(const PathId id) const {
+	unsigned d = 0;
+	for (PathId p = id; m_nodes[p].parent != INVALID; p = m_nodes[p].parent) { ++d; }
+	return d;
+}
+
+size_t PathTable::path(const PathId id, char *buf, const size_t bufsize) const {
+	// measure first, then fill in from the end, walking up the parents again
+	size_t len = 0;
+	PathId p = id;
+	for (; m_nodes[p].parent != INVALID; p = m_nodes[p].parent) {
+		len += m_nodes[p].name_len + 1u;
+	}
+	const bool absolute = (p == ABSOLUTE_ROOT);
+	// one separator per component, but the first one is only there for absolute paths
+	if (len && !absolute) { --len; }
+	if (!len && absolute) { len = 1; }
+
+	// bytes at or beyond 'limit' don't fit (truncate, leaving room for the NUL)
+	const size_t limit = bufsize ? bufsize - 1 : 0;
+	size_t end = len;
+	for (p = id; m_nodes[p].parent != INVALID; p = m_nodes[p].parent) {
+		const Node &n = m_nodes[p];
+		const size_t begin = end - n.name_len;
+		if (begin < limit) {
+			std::memcpy(buf + begin, name_ptr(n.name_offset), (end < limit ? end : limit) - begin);
+		}
+		if (begin == 0) { break; }
+		end = begin - 1;
+		if (end < limit) { buf[end] = '/'; }
+	}
+	if (absolute && limit) { buf[0] = '/'; }
+	if (bufsize) { buf[len < limit ? len : limit] = '\0'; }
+	return len;
+}
+
+std::string PathTable::path(const PathId id) const {
+	char small[256];
+	const size_t len = path(id, small, sizeof(small));
+	if (len < sizeof(small)) { return std::string(small, len); }
+	std::string result(len + 1, '\0');
+	path(id, &result[0], result.size());
+	result.resize(len);
+	return result;
+}
+
+size_t PathTable::memory_usage() const {
+	return m_nodes.capacity() * sizeof(Node)
+		+ m_names.capacity() * sizeof(m_names[0]) + m_names.size() * NAME_BLOCK_SIZE
+		+ m_slots.capacity() * sizeof(m_slots[0]);
+}
@@ -0,0 +1,108 @@
+#ifndef PATHTABLE_HPP
+#define PATHTABLE_HPP
+
+/* Interned path table.
+ *
+ * Paths are split into components (the same splitting as normalise_path: repeated
+ * and trailing slashes are ignored) and stored as a tree, so each directory is
+ * stored once no matter how many paths pass through it. Every node (file or
+ * directory) gets a 32-bit PathId; equal paths intern to the same id, so path
+ * equality is an integer compare. Full paths are only rebuilt on request.
+ *
+ * Children are found through a single open-addressing hash table keyed on
+ * (parent id, component name), hashed with hashlittle from lookup3.c.
+ * A node costs 12 bytes plus its name, plus about 5 bytes of hash table.
+ *
+ * "." and ".." components are stored as they are; normalise paths with
+ * normalise_path_lexical first if they should be resolved.
+ * The table is not thread-safe.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "path-operations.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+class PathTable {
+	public:
+		typedef uint32_t PathId;
+
+		static const PathId INVALID = 0xffffffffu;
+		/// The id of the empty relative path.
+		static const PathId RELATIVE_ROOT = 0u;
+		/// The id of "/".
+		static const PathId ABSOLUTE_ROOT = 1u;
+
+		PathTable();
+
+		PathTable(const PathTable&) = delete;
+		PathTable& operator=(const PathTable&) = delete;
+
+		/// Add a path (and all its ancestors) if it's not already present.
+		/// Throws std::length_error if a component is longer than 65535 bytes
+		/// or the table is full.
+		PathId intern(const char *path) { return intern(path_view_of(path)); }
+		PathId intern(const struct path_view path);
+
+		/// @return The id of the path, or INVALID if it has not been interned.
+		PathId find(const char *path) const { return find(path_view_of(path)); }
+		PathId find(const struct path_view path) const;
+
+		/// Add (or find) a single child component of an existing node.
+		PathId intern_child(const PathId parent, const struct path_view name);
+		PathId find_child(const PathId parent, const struct path_view name) const;
+
+		/// @return The parent of a node (INVALID for the two roots).
+		PathId parent(const PathId id) const { return m_nodes[id].parent; }
+
+		/// @return The last component of a node's path (empty for the roots).
+		struct path_view name(const PathId id) const {
+			const Node &n = m_nodes[id];
+			return path_view_make(name_ptr(n.name_offset), n.name_len);
+		}
+
+		/// @return The number of components in the path (0 for the roots).
+		unsigned depth(const PathId id) const;
+
+		/// Write the full path into buf (NUL-terminated, if bufsize > 0).
+		/// @return The length of the full path; if it's >= bufsize the output was truncated.
+		size_t path(const PathId id, char *buf, const size_t bufsize) const;
+		std::string path(const PathId id) const;
+
+		/// @return The number of nodes (including the two roots).
+		size_t size() const { return m_nodes.size(); }
+
+		/// @return Approximate heap memory used, in bytes.
+		size_t memory_usage() const;
+
+	private:
+		struct Node {
+			PathId parent;
+			uint32_t name_offset;
+			uint16_t name_len;
+		};
+
+		static const unsigned NAME_BLOCK_BITS = 20;
+		static const uint32_t EMPTY_SLOT = 0xffffffffu;
+
+		const char *name_ptr(const uint32_t offset) const {
+			return m_names[offset >> NAME_BLOCK_BITS].get() + (offset & ((1u << NAME_BLOCK_BITS) - 1));
+		}
+
+		uint32_t hash(const PathId parent, const struct path_view name) const;
+		uint32_t store_name(const struct path_view name);
+		void grow_slots();
+
+		std::vector<Node> m_nodes;
+		// names are packed into fixed-size blocks so that growing never moves them
+		std::vector<std::unique_ptr<char[]>> m_names;
+		uint32_t m_names_used;
+		// open-addressing hash table of node ids
+		std::vector<uint32_t> m_slots;
+};
+
+#endif
@@ -0,0 +1,228 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "PerfCounters.hpp"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+const unsigned PerfCounters::HARDWARE;
+const unsigned PerfCounters::SOFTWARE;
+const unsigned PerfCounters::ALL;
+
+namespace {
+
+struct EventType {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+const uint64_t CACHE_READ_MISS = (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+
+// indexed by PerfCounters::Event
+const EventType EVENT_TYPES[PerfCounters::NUM_EVENTS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "L1D-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | CACHE_READ_MISS },
+	{ "LLC-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | CACHE_READ_MISS },
+	{ "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+int perf_event_open(struct perf_event_attr *attr, const pid_t pid, const int cpu, const int group_fd, const unsigned long flags) {
+	return int(::syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags));
+}
+
+void write_all(const int fd, const char *data, size_t len) {
+	while (len) {
+		const ssize_t n = ::write(fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR) { continue; }
+			throw PosixError(errno);
+		}
+		data += n;
+		len -= size_t(n);
+	}
+}
+
+struct ThreadCounters {
+	PerfCounters counters;
+
+	ThreadCounters() {
+		// a scope has no way to report a failure, so counters that won't start just read as empty
+		try { counters.start(); } catch (PosixError &) {}
+	}
+};
+
+} // anonymous namespace
+
+const char *PerfCounters::event_name(const Event event) {
+	return (event >= 0 && event < NUM_EVENTS) ? EVENT_TYPES[event].name : "unknown";
+}
+
+PerfCounters::Sample::Sample(): events(0u), time_enabled(0u), time_running(0u) {
+	std::memset(value, 0, sizeof(value));
+}
+
+PerfCounters::Sample &PerfCounters::Sample::operator+=(const Sample &other) {
+	for (int e = 0; e < NUM_EVENTS; ++e) { value[e] += other.value[e]; }
+	events |= other.events;
+	time_enabled += other.time_enabled;
+	time_running += other.time_running;
+	return *this;
+}
+
+PerfCounters::PerfCounters(const unsigned events): m_count(0u), m_available(0u), m_error(0) {
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		if (!(events & (1u << e))) { continue; }
+		struct perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = EVENT_TYPES[e].type;
+		attr.config = EVENT_TYPES[e].config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		// the leader starts stopped; the others follow it
+		attr.disabled = (m_count == 0);
+		// user space only, which is all that perf_event_paranoid=2 (the usual default) allows
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		const int leader = m_count ? m_fds[0].fd() : -1;
+		const int fd = perf_event_open(&attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+		if (fd == -1) {
+			if (!m_error) { m_error = errno; }
+			continue;
+		}
+		m_fds[m_count] = FileDes(fd);
+		m_order[m_count] = Event(e);
+		++m_count;
+		m_available |= 1u << e;
+	}
+}
+
+void PerfCounters::start(const bool reset) {
+	if (!m_count) { return; }
+	if (reset && ::ioctl(m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) == -1) { throw PosixError(errno); }
+	if (::ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) { throw PosixError(errno); }
+}
+
+void PerfCounters::stop() {
+	if (!m_count) { return; }
+	if (::ioctl(m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) { throw PosixError(errno); }
+}
+
+bool PerfCounters::read(Sample &sample) const {
+	sample = Sample();
+	if (!m_count) { return false; }
+	// nr, time_enabled, time_running, then a value per event in the order they were opened
+	uint64_t buf[3 + NUM_EVENTS];
+	ssize_t n;
+	do {
+		n = ::read(m_fds[0], buf, sizeof(buf));
+	} while (n == -1 && errno == EINTR);
+	if (n < ssize_t((3 + m_count) * sizeof(uint64_t)) || buf[0] != m_count) { return false; }
+	sample.time_enabled = buf[1];
+	sample.time_running = buf[2];
+	for (unsigned i = 0; i < m_count; ++i) {
+		sample.value[m_order[i]] = buf[3 + i];
+	}
+	sample.events = m_available;
+	return true;
+}
+
+PerfCounters::Sample PerfCounters::difference(const Sample &before, const Sample &after) {
+	Sample d;
+	const unsigned events = before.events & after.events;
+	if (!events || after.time_running <= before.time_running) { return d; }
+	d.events = events;
+	d.time_enabled = after.time_enabled - before.time_enabled;
+	d.time_running = after.time_running - before.time_running;
+	const double scale = (d.time_running < d.time_enabled) ? double(d.time_enabled) / d.time_running : 1.0;
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		if (!((events >> e) & 1u)) { continue; }
+		const uint64_t raw = after.value[e] - before.value[e];
+		d.value[e] = (scale == 1.0) ? raw : uint64_t(raw * scale + 0.5);
+	}
+	return d;
+}
+
+PerfCounters &PerfCounters::this_thread() {
+	static thread_local ThreadCounters counters;
+	return counters.counters;
+}
+
+std::atomic<PerfCounters::Site *> PerfCounters::Site::s_first(nullptr);
+
+PerfCounters::Site::Site(const char *name): m_name(name), m_calls(0u), m_seen(0u), m_next(nullptr) {
+	for (int e = 0; e < NUM_EVENTS; ++e) { m_value[e].store(0u, std::memory_order_relaxed); }
+	Site *head = s_first.load(std::memory_order_relaxed);
+	do {
+		m_next = head;
+	} while (!s_first.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void PerfCounters::Site::add(const Sample &sample) {
+	m_calls.fetch_add(1u, std::memory_order_relaxed);
+	if (!sample.events) { return; }
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		if (sample.has(Event(e))) { m_value[e].fetch_add(sample.value[e], std::memory_order_relaxed); }
+	}
+	if ((m_seen.load(std::memory_order_relaxed) & sample.events) != sample.events) {
+		m_seen.fetch_or(sample.events, std::memory_order_relaxed);
+	}
+}
+
+PerfCounters::Sample PerfCounters::Site::total() const {
+	Sample s;
+	for (int e = 0; e < NUM_EVENTS; ++e) { s.value[e] = m_value[e].load(std::memory_order_relaxed); }
+	s.events = m_seen.load(std::memory_order_relaxed);
+	return s;
+}
+
+void PerfCounters::Site::report(const int fd) {
+	char line[512];
+	int len = std::snprintf(line, sizeof(line), "%-24s %12s", "site", "calls");
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		char heading[32];
+		std::snprintf(heading, sizeof(heading), "%s/call", EVENT_TYPES[e].name);
+		len += std::snprintf(line + len, sizeof(line) - len, " %18s", heading);
+	}
+	len += std::snprintf(line + len, sizeof(line) - len, " %8s\n", "IPC");
+	write_all(fd, line, size_t(len));
+
+	for (const Site *site = first(); site; site = site->next()) {
+		const uint64_t calls = site->calls();
+		const Sample total = site->total();
+		len = std::snprintf(line, sizeof(line), "%-24.24s %12llu", site->name(), (unsigned long long)calls);
+		for (int e = 0; e < NUM_EVENTS; ++e) {
+			if (calls && total.has(Event(e))) {
+				len += std::snprintf(line + len, sizeof(line) - len, " %18.1f", double(total.value[e]) / calls);
+			} else {
+				len += std::snprintf(line + len, sizeof(line) - len, " %18s", "-");
+			}
+		}
+		if (total.has(CYCLES) && total.has(INSTRUCTIONS) && total.value[CYCLES]) {
+			len += std::snprintf(line + len, sizeof(line) - len, " %8.2f\n", double(total.value[INSTRUCTIONS]) / total.value[CYCLES]);
+		} else {
+			len += std::snprintf(line + len, sizeof(line) - len, " %8s\n", "-");
+		}
+		write_all(fd, line, size_t(len));
+	}
+}
+
+PerfCounters::Scope::~Scope() {
+	Sample end;
+	m_counters.read(end);
+	const Sample d = difference(m_start, end);
+	if (m_site) {
+		m_site->add(d);
+	} else {
+		*m_total += d;
+	}
+}
@@ -0,0 +1,195 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+/* Hardware performance counters (perf_event_open, Linux only), for telling why a
+ * piece of code got slower: cycles, instructions, branch misses, L1D and LLC read
+ * misses, plus task-clock and page faults from the kernel's software counters.
+ *
+ * A PerfCounters object opens the counters as one group on the thread that creates
+ * it, so they are read together with a single read() and always cover the same
+ * instructions. Counters the machine doesn't have (in a VM, say, or with
+ * perf_event_paranoid set too high) are left out rather than treated as errors;
+ * if none can be opened, reads return empty samples and everything else still works.
+ * If the group needs more hardware counters than the CPU has, the kernel can't
+ * schedule it at all and its samples come back empty too: ask for fewer events.
+ *
+ * Scopes measure a region of code by reading the counters at both ends, which
+ * costs two system calls, so they suit whole operations (decoding a buffer,
+ * hashing a batch of keys) rather than single calls of a small function.
+ *
+ * In production code use the macros, which compile to nothing unless PERF_COUNTERS
+ * is defined:
+ *
+ *    void decode_all(...) {
+ *       PERF_SCOPE("decode_all");
+ *       ...
+ *    }
+ *    ...
+ *    PERF_REPORT(STDERR_FILENO);
+ *
+ * Each PERF_SCOPE site adds up the counts of every pass through it, from any
+ * thread (each thread gets its own counters the first time it enters a scope).
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <atomic>
+#include <stdint.h>
+
+class PerfCounters {
+	public:
+		enum Event {
+			CYCLES,
+			INSTRUCTIONS,
+			BRANCH_MISSES,
+			L1D_MISSES,
+			LLC_MISSES,
+			TASK_CLOCK,
+			PAGE_FAULTS,
+			NUM_EVENTS
+		};
+
+		static const unsigned HARDWARE = (1u << CYCLES) | (1u << INSTRUCTIONS) | (1u << BRANCH_MISSES)
+			| (1u << L1D_MISSES) | (1u << LLC_MISSES);
+		static const unsigned SOFTWARE = (1u << TASK_CLOCK) | (1u << PAGE_FAULTS);
+		static const unsigned ALL = HARDWARE | SOFTWARE;
+
+		/// Short name of an event, e.g. "branch-misses".
+		static const char *event_name(const Event event);
+
+		struct Sample {
+			/// Values of the events in the 'events' mask (the others are zero).
+			uint64_t value[NUM_EVENTS];
+			unsigned events;
+			/// Nanoseconds the group was enabled, and actually counting; they differ when
+			/// the kernel multiplexes the counters with other users of them.
+			uint64_t time_enabled;
+			uint64_t time_running;
+
+			Sample();
+
+			bool has(const Event event) const { return (events >> event) & 1u; }
+
+			/// Add up the counts and times (events from either).
+			Sample &operator+=(const Sample &other);
+		};
+
+		/// Open the events in the 'events' mask (a mask of 1 << Event) for the calling
+		/// thread, stopped. Never throws: see available() and error().
+		explicit PerfCounters(const unsigned events = ALL);
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		/// @return The mask of events that could be opened.
+		unsigned available() const { return m_available; }
+
+		/// @return The errno from the first event that couldn't be opened, or 0.
+		int error() const { return m_error; }
+
+		explicit operator bool() const { return m_available != 0; }
+
+		/// Start or stop counting (the counts are kept). start() can reset them to zero first.
+		/// Throws PosixError.
+		void start(const bool reset = true);
+		void stop();
+
+		/// Read the counts so far. No allocation and no exceptions; a failed read gives
+		/// an empty sample.
+		/// @return false if the read failed (or there are no counters).
+		bool read(Sample &sample) const;
+
+		/// The counts between two reads, scaled up by the fraction of that time the
+		/// counters were running when they were multiplexed. Events that weren't counted
+		/// at all in between are left out.
+		static Sample difference(const Sample &before, const Sample &after);
+
+		/// Counters for the calling thread, opened (with ALL events) and started the first
+		/// time it's called on each thread. Used by the scopes.
+		static PerfCounters &this_thread();
+
+		/// Totals for one PERF_SCOPE (or any other place that adds samples to it).
+		/// Sites are meant to be static: each registers itself in a global list, for
+		/// report(), and stays there.
+		class Site {
+			public:
+				explicit Site(const char *name);
+
+				Site(const Site&) = delete;
+				Site& operator=(const Site&) = delete;
+
+				/// Add one pass's counts. Lock-free; safe from any thread.
+				void add(const Sample &sample);
+
+				const char *name() const { return m_name; }
+				uint64_t calls() const { return m_calls.load(std::memory_order_relaxed); }
+				/// The totals so far (not a consistent snapshot while other threads add to them).
+				Sample total() const;
+
+				/// Iterate over all the sites (most recently registered first).
+				static const Site *first() { return s_first.load(std::memory_order_acquire); }
+				const Site *next() const { return m_next; }
+
+				/// Write a table of all the sites, with per-call averages, to fd.
+				/// Throws PosixError if the write fails.
+				static void report(const int fd);
+
+			private:
+				const char *m_name;
+				std::atomic<uint64_t> m_calls;
+				std::atomic<uint64_t> m_value[NUM_EVENTS];
+				// events that some pass had
+				std::atomic<unsigned> m_seen;
+				Site *m_next;
+				static std::atomic<Site *> s_first;
+		};
+
+		/// Measures from construction to destruction, adding the counts to a Site or a
+		/// Sample. The counters must belong to the thread the scope is on.
+		class Scope {
+			public:
+				explicit Scope(Site &site): m_counters(this_thread()), m_site(&site), m_total(nullptr) {
+					m_counters.read(m_start);
+				}
+				Scope(PerfCounters &counters, Sample &total): m_counters(counters), m_site(nullptr), m_total(&total) {
+					m_counters.read(m_start);
+				}
+				~Scope();
+
+				Scope(const Scope&) = delete;
+				Scope& operator=(const Scope&) = delete;
+
+			private:
+				const PerfCounters &m_counters;
+				Site *m_site;
+				Sample *m_total;
+				Sample m_start;
+		};
+
+	private:
+		FileDes m_fds[NUM_EVENTS];
+		// the event counted by each open descriptor, in the order the group reads them
+		Event m_order[NUM_EVENTS];
+		unsigned m_count;
+		unsigned m_available;
+		int m_error;
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+
+#ifdef PERF_COUNTERS
+/// Count the rest of the enclosing block under 'name' (a string literal).
+#define PERF_SCOPE(name) \
+	static PerfCounters::Site PERF_CONCAT(perf_site_, __LINE__)(name); \
+	PerfCounters::Scope PERF_CONCAT(perf_scope_, __LINE__)(PERF_CONCAT(perf_site_, __LINE__))
+/// Write the totals of every PERF_SCOPE to a file descriptor.
+#define PERF_REPORT(fd) PerfCounters::Site::report(fd)
+#else
+#define PERF_SCOPE(name) do {} while (0)
+#define PERF_REPORT(fd) do {} while (0)
+#endif
+
+#endif
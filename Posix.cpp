@@ -4,44 +4,135 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <cerrno>
 #include <cstdio>
 #include <cstdarg>
+#include <cassert>
+#include <ctime>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/syscall.h>
+
+// Warnings are rate limited (so an error storm can't turn into a stderr storm), and are
+// formatted on the stack and written with a single write() call, so emitting one never takes
+// a lock or allocates. Warnings over the limit are counted and reported in the next window.
+static const unsigned WARNING_LIMIT_PER_SECOND = 10;
+static std::atomic<long> s_warning_window(0);
+static std::atomic<unsigned> s_warning_count(0);
+static std::atomic<unsigned> s_warnings_suppressed(0);
+
+static void write_warning(const char *text, size_t len) {
+	while (len) {
+		const ssize_t n = ::write(STDERR_FILENO, text, len);
+		if (n == -1) {
+			if (errno == EINTR) { continue; }
+			return;
+		}
+		text += n;
+		len -= n;
+	}
+}
 
 static void __attribute__((format(printf, 1, 2))) emit_warning(const char *fmt, ...) {
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	long window = s_warning_window.load(std::memory_order_relaxed);
+	if (ts.tv_sec != window && s_warning_window.compare_exchange_strong(window, ts.tv_sec)) {
+		s_warning_count.store(0, std::memory_order_relaxed);
+		const unsigned suppressed = s_warnings_suppressed.exchange(0);
+		if (suppressed) {
+			char buf[64];
+			const int len = snprintf(buf, sizeof(buf), "warning: %u warnings suppressed\n", suppressed);
+			write_warning(buf, len);
+		}
+	}
+	if (s_warning_count.fetch_add(1, std::memory_order_relaxed) >= WARNING_LIMIT_PER_SECOND) {
+		s_warnings_suppressed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	char buf[256];
+	const size_t prefix = sizeof("warning: ") - 1;
+	std::memcpy(buf, "warning: ", prefix);
 	va_list args;
 	va_start(args, fmt);
-	fprintf(stderr, "warning: ");
-	vfprintf(stderr, fmt, args);
-	fprintf(stderr, "\n");
+	int len = vsnprintf(buf + prefix, sizeof(buf) - prefix - 1, fmt, args);
 	va_end(args);
+	if (len < 0) { return; }
+	size_t total = prefix + len;
+	if (total > sizeof(buf) - 2) { total = sizeof(buf) - 2; }
+	buf[total++] = '\n';
+	write_warning(buf, total);
+}
+
+static void close_fd(const int fd) {
+	if (::close(fd) == -1) {
+		// on most platforms, if close fails there's really nothing sensible we can do to recover,
+		// so we just emit a warning.
+		// In particular, we shouldn't retry if we get EINTR, because on several platforms the
+		// file descriptor is *already closed* in that situation, and re-trying may close some other
+		// fd that was just opened by another thread
+		int e = errno;
+		switch (e) {
+			case EBADF: emit_warning("fd %d was invalid on close", fd); break;
+			default:
+				emit_warning("fd %d caused an I/O error on close (errno = %d)", fd, e);
+				break;
+		}
+	}
 }
 
 FileDes::~FileDes() {
 	if (m_fd != -1) {
-		if (::close(m_fd) == -1) {
-			// on most platforms, if close fails there's really nothing sensible we can do to recover,
-			// so we just emit a warning.
-			// In particular, we shouldn't retry if we get EINTR, because on several platforms the
-			// file descriptor is *already closed* in that situation, and re-trying may close some other
-			// fd that was just opened by another thread
-			int e = errno;
-			switch (e) {
-				case EBADF: emit_warning("fd %d was invalid on close", m_fd); break;
-				default:
-					emit_warning("fd %d caused an I/O error on close (errno = %d)", m_fd, e);
-					break;
+		CloseQueue * const queue = CloseQueue::current();
+		if (!queue || !queue->try_push(m_fd)) {
+			close_fd(m_fd);
+		}
+	}
+}
+
+void close_descriptors(int *fds, const size_t count) {
+	std::sort(fds, fds + count);
+	size_t i = 0;
+	while (i < count) {
+		size_t j = i + 1;
+#ifdef SYS_close_range
+		while (j < count && fds[j] == fds[j-1] + 1) { ++j; }
+		if (j - i > 1) {
+			// close_range closes every descriptor in [first, last], so it's only used for
+			// runs where every descriptor in the range is in the batch
+			if (::syscall(SYS_close_range, unsigned(fds[i]), unsigned(fds[j-1]), 0u) == 0) {
+				i = j;
+				continue;
 			}
+			// ENOSYS (older kernels) or some other failure: fall back to closing one at a time,
+			// which also gets us per-descriptor warnings
 		}
+#endif
+		for (; i < j; ++i) { close_fd(fds[i]); }
 	}
 }
 
-FileMapping FileMapping::MapWholeFile(const char * const path) {
+FileMapping FileMapping::MapWholeFile(const char * const path, const int prot, const int flags) {
 	const FileDes fd(::open(path, O_RDONLY));
 	if (!fd) { throw PosixError(errno); }
 	struct stat info;
 	if (::fstat(fd, &info) == -1) { throw PosixError(errno); }
-	return FileMapping(fd, info.st_size, 0, PROT_READ, MAP_SHARED);
+	// mmap refuses zero-length mappings
+	if (info.st_size == 0) { return FileMapping(); }
+	return FileMapping(fd, info.st_size, 0, prot, flags);
+}
+
+FileMapping FileMapping::MapAnonymous(const size_t len, const int extra_flags) {
+	return FileMapping(-1, len, 0, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags);
 }
 
 FileMapping::FileMapping(const int fd, const size_t len, const off_t offset, const int prot):
@@ -66,3 +157,526 @@ FileMapping::~FileMapping() {
 		}
 	}
 }
+
+static size_t page_size() {
+	static const size_t size = ::sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+static size_t round_up_to_page(const size_t n) {
+	const size_t page = page_size();
+	return (n + page - 1) & ~(page - 1);
+}
+
+AppendMapping AppendMapping::OpenFile(const char * const path, const size_t grow_step, const mode_t mode) {
+	FileDes fd(::open(path, O_RDWR | O_CREAT | O_CLOEXEC, mode));
+	if (!fd) { throw PosixError(errno); }
+	return AppendMapping(std::move(fd), grow_step);
+}
+
+AppendMapping::AppendMapping(FileDes &&fd, const size_t grow_step):
+		m_fd(std::move(fd)), m_base(nullptr), m_size(0u), m_capacity(0u), m_synced(0u),
+		m_grow_step(grow_step ? round_up_to_page(grow_step) : page_size()), m_flush_interval(0u) {
+	struct stat info;
+	if (::fstat(m_fd, &info) == -1) { throw PosixError(errno); }
+	m_size = m_synced = info.st_size;
+	if (m_size) { grow(m_size); }
+}
+
+AppendMapping::~AppendMapping() {
+	if (m_base) {
+		// dirty pages stay in the page cache after munmap, so there's no need to msync here
+		if (::munmap(m_base, m_capacity) == -1) {
+			int e = errno;
+			emit_warning("unmap failure: %s (%zu bytes at %p)", strerror(e), m_capacity, m_base);
+		}
+	}
+	if (m_fd && m_capacity != m_size) {
+		if (::ftruncate(m_fd, m_size) == -1) {
+			int e = errno;
+			emit_warning("fd %d could not be truncated to %zu bytes: %s", m_fd.fd(), m_size, strerror(e));
+		}
+	}
+}
+
+void AppendMapping::swap(AppendMapping &other) {
+	using std::swap;
+	swap(m_fd, other.m_fd);
+	swap(m_base, other.m_base);
+	swap(m_size, other.m_size);
+	swap(m_capacity, other.m_capacity);
+	swap(m_synced, other.m_synced);
+	swap(m_grow_step, other.m_grow_step);
+	swap(m_flush_interval, other.m_flush_interval);
+}
+
+void AppendMapping::grow(const size_t min_capacity) {
+	assert(m_fd);
+	size_t capacity = m_capacity + m_grow_step;
+	if (capacity < min_capacity) { capacity = min_capacity; }
+	capacity = round_up_to_page(capacity);
+
+	if (::ftruncate(m_fd, capacity) == -1) { throw PosixError(errno); }
+
+	void *p;
+	if (m_base) {
+#ifdef __linux__
+		p = ::mremap(m_base, m_capacity, capacity, MREMAP_MAYMOVE);
+#else
+		// without mremap we have to drop the old mapping and make a new one;
+		// the mapping is shared, so the contents are preserved in the file
+		if (::munmap(m_base, m_capacity) == -1) { throw PosixError(errno); }
+		m_base = nullptr;
+		p = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+#endif
+	} else {
+		p = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	}
+	if (p == MAP_FAILED) { throw PosixError(errno); }
+	m_base = p;
+	m_capacity = capacity;
+}
+
+void AppendMapping::reserve(const size_t capacity) {
+	if (capacity > m_capacity) { grow(capacity); }
+}
+
+void *AppendMapping::append(const size_t len) {
+	// the flush check is done *before* handing out new space, so that
+	// it only covers records the caller has already finished writing
+	if (m_flush_interval && (m_size - m_synced) >= m_flush_interval) { flush(false); }
+	if (len > m_capacity - m_size) { grow(m_size + len); }
+	char * const p = static_cast<char*>(m_base) + m_size;
+	m_size += len;
+	return p;
+}
+
+void AppendMapping::flush(const bool wait) {
+	if (!m_base || m_synced == m_size) { return; }
+	// msync requires a page aligned start address
+	const size_t begin = m_synced & ~(page_size() - 1);
+	if (::msync(static_cast<char*>(m_base) + begin, m_size - begin, wait ? MS_SYNC : MS_ASYNC) == -1) {
+		throw PosixError(errno);
+	}
+	m_synced = m_size;
+}
+
+void AppendMapping::close() {
+	if (m_base) {
+		flush(true);
+		void * const base = m_base;
+		m_base = nullptr;
+		if (::munmap(base, m_capacity) == -1) { throw PosixError(errno); }
+	}
+	if (m_fd && m_capacity != m_size) {
+		m_capacity = m_size;
+		if (::ftruncate(m_fd, m_size) == -1) { throw PosixError(errno); }
+	}
+	m_fd = FileDes();
+	m_size = m_capacity = m_synced = 0u;
+}
+
+// largest request passed to a single transfer syscall (Linux caps these at 0x7ffff000 anyway)
+static const size_t MAX_TRANSFER_CHUNK = 1u << 30;
+
+static bool is_would_block(const int e) {
+	return (e == EAGAIN || e == EWOULDBLOCK);
+}
+
+// errors that mean "this kernel path isn't available for these descriptors"
+static bool is_unsupported(const int e) {
+	return (e == EINVAL || e == ENOSYS || e == EXDEV || e == EOPNOTSUPP || e == ENOTSUP || e == EBADF);
+}
+
+static void wait_for_output(const int fd) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	while (::poll(&pfd, 1, -1) == -1) {
+		if (errno != EINTR) { throw PosixError(errno); }
+	}
+}
+
+// true if a write to fd wouldn't block (or would report an error) right now
+static bool output_ready(const int fd) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	int n;
+	while ((n = ::poll(&pfd, 1, 0)) == -1) {
+		if (errno != EINTR) { throw PosixError(errno); }
+	}
+	return n > 0;
+}
+
+// Only regular files and block devices can really be seeked back over: lseek "succeeds"
+// on many other descriptors (an eventfd, most character devices) without doing anything.
+static bool is_seekable(const int fd) {
+	struct stat st;
+	return ::fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+}
+
+static bool is_nonblocking(const int fd) {
+	const int flags = ::fcntl(fd, F_GETFL);
+	return flags != -1 && (flags & O_NONBLOCK);
+}
+
+// Somewhere to keep bytes that were read from an unseekable input but couldn't be
+// written (SplicePipe's pipe, which is empty whenever copy_with_buffer is used).
+struct Stash {
+	int fd;
+	size_t capacity;
+	size_t *buffered;
+};
+
+static void write_all(const int fd, const char *data, size_t len) {
+	while (len) {
+		const ssize_t n = ::write(fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR) { continue; }
+			throw PosixError(errno);
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static TransferResult copy_with_buffer(const int in_fd, off_t *in_offset, const int out_fd, off_t *out_offset, const size_t len,
+		TransferResult r, const Stash *stash = nullptr) {
+	char buf[64*1024];
+	// Bytes read from an unseekable input can't be put back if the output turns out to
+	// be full. Unless there's a stash for them, only read when the output is writable,
+	// and no more than PIPE_BUF bytes, which a writable pipe takes in one go (and a
+	// writable socket almost always does).
+	const bool seekable = in_offset || is_seekable(in_fd);
+	const bool careful = !seekable && !stash && is_nonblocking(out_fd);
+	while (r.bytes < len) {
+		size_t want = len - r.bytes;
+		if (want > sizeof(buf)) { want = sizeof(buf); }
+		if (stash && want > stash->capacity) { want = stash->capacity; }
+		if (careful) {
+			if (!output_ready(out_fd)) { r.would_block = true; return r; }
+			if (want > PIPE_BUF) { want = PIPE_BUF; }
+		}
+		ssize_t n = in_offset ? ::pread(in_fd, buf, want, *in_offset) : ::read(in_fd, buf, want);
+		if (n == -1) {
+			const int e = errno;
+			if (e == EINTR) { continue; }
+			if (is_would_block(e)) { r.would_block = true; return r; }
+			throw PosixError(e);
+		}
+		if (n == 0) { r.eof = true; return r; }
+
+		size_t done = 0;
+		while (done < size_t(n)) {
+			const ssize_t w = out_offset
+				? ::pwrite(out_fd, buf + done, n - done, *out_offset)
+				: ::write(out_fd, buf + done, n - done);
+			if (w == -1) {
+				const int e = errno;
+				if (e == EINTR) { continue; }
+				if (!is_would_block(e)) { throw PosixError(e); }
+				// the output is full, but we've already consumed input that we can't deliver;
+				// with an explicit offset we just don't advance past it, otherwise seek back
+				// or stash it
+				const size_t unwritten = size_t(n) - done;
+				if (in_offset) {
+					*in_offset += done;
+					r.bytes += done;
+					r.would_block = true;
+					return r;
+				}
+				if (seekable && ::lseek(in_fd, -off_t(unwritten), SEEK_CUR) != -1) {
+					r.bytes += done;
+					r.would_block = true;
+					return r;
+				}
+				if (stash) {
+					write_all(stash->fd, buf + done, unwritten);
+					*stash->buffered += unwritten;
+					r.bytes += done;
+					r.would_block = true;
+					return r;
+				}
+				// the rare socket that was writable but not for PIPE_BUF bytes: wait for
+				// room for the rest of this (small) chunk
+				wait_for_output(out_fd);
+				continue;
+			}
+			done += w;
+			if (out_offset) { *out_offset += w; }
+		}
+		if (in_offset) { *in_offset += n; }
+		r.bytes += n;
+	}
+	return r;
+}
+
+TransferResult send_file_data(const int out_fd, const int in_fd, off_t *in_offset, const size_t len) {
+	TransferResult r = { 0u, false, false };
+#ifdef __linux__
+	while (r.bytes < len) {
+		size_t want = len - r.bytes;
+		if (want > MAX_TRANSFER_CHUNK) { want = MAX_TRANSFER_CHUNK; }
+		const ssize_t n = ::sendfile(out_fd, in_fd, in_offset, want);
+		if (n == -1) {
+			const int e = errno;
+			if (e == EINTR) { continue; }
+			if (is_would_block(e)) { r.would_block = true; return r; }
+			// sendfile needs an mmap-able input; anything else goes through the buffer
+			if (r.bytes == 0 && is_unsupported(e)) { break; }
+			throw PosixError(e);
+		}
+		if (n == 0) { r.eof = true; return r; }
+		r.bytes += n;
+	}
+	if (r.bytes == len) { return r; }
+#endif
+	return copy_with_buffer(in_fd, in_offset, out_fd, nullptr, len, r);
+}
+
+TransferResult copy_file_data(const int in_fd, off_t *in_offset, const int out_fd, off_t *out_offset, const size_t len) {
+	TransferResult r = { 0u, false, false };
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+	while (r.bytes < len) {
+		size_t want = len - r.bytes;
+		if (want > MAX_TRANSFER_CHUNK) { want = MAX_TRANSFER_CHUNK; }
+		loff_t in_off, out_off;
+		if (in_offset) { in_off = *in_offset; }
+		if (out_offset) { out_off = *out_offset; }
+		const ssize_t n = ::copy_file_range(in_fd, in_offset ? &in_off : nullptr,
+				out_fd, out_offset ? &out_off : nullptr, want, 0);
+		if (n == -1) {
+			const int e = errno;
+			if (e == EINTR) { continue; }
+			if (is_would_block(e)) { r.would_block = true; return r; }
+			if (r.bytes == 0 && is_unsupported(e)) { break; }
+			throw PosixError(e);
+		}
+		if (n == 0) {
+			// some pseudo-filesystems report a size of zero and make copy_file_range
+			// return 0 immediately, so only trust EOF once something has been copied
+			if (r.bytes) { r.eof = true; return r; }
+			break;
+		}
+		if (in_offset) { *in_offset = in_off; }
+		if (out_offset) { *out_offset = out_off; }
+		r.bytes += n;
+	}
+	if (r.bytes == len) { return r; }
+#endif
+#ifdef __linux__
+	// sendfile can't write at an explicit output offset
+	if (!out_offset) {
+		const TransferResult s = send_file_data(out_fd, in_fd, in_offset, len - r.bytes);
+		r.bytes += s.bytes;
+		r.would_block = s.would_block;
+		r.eof = s.eof;
+		return r;
+	}
+#endif
+	return copy_with_buffer(in_fd, in_offset, out_fd, out_offset, len, r);
+}
+
+SplicePipe::SplicePipe(): m_capacity(0u), m_buffered(0u) {
+	int fds[2];
+#ifdef __linux__
+	if (::pipe2(fds, O_CLOEXEC) == -1) { throw PosixError(errno); }
+#else
+	if (::pipe(fds) == -1) { throw PosixError(errno); }
+#endif
+	m_read = FileDes(fds[0]);
+	m_write = FileDes(fds[1]);
+#ifdef __linux__
+	// ask for a bigger pipe to cut the number of splice calls; this can fail
+	// (e.g., if it exceeds /proc/sys/fs/pipe-max-size), in which case we keep the default
+	::fcntl(m_write, F_SETPIPE_SZ, 1 << 20);
+	const int sz = ::fcntl(m_write, F_GETPIPE_SZ);
+	m_capacity = (sz > 0) ? size_t(sz) : 65536u;
+#else
+	m_capacity = 65536u;
+#endif
+}
+
+TransferResult SplicePipe::transfer(const int in_fd, const int out_fd, const size_t len) {
+	TransferResult r = { 0u, false, false };
+#ifdef __linux__
+	// whether splicing from in_fd has worked in this call (r.bytes can't say, since it
+	// also counts bytes left in the pipe by an earlier call, which may have been the
+	// fallback's, for this same input that can't splice)
+	bool input_spliced = false;
+	while (r.bytes < len) {
+		// deliver whatever is already in the pipe first (but no more than len)
+		while (m_buffered && r.bytes < len) {
+			const size_t want = std::min(m_buffered, len - r.bytes);
+			const ssize_t n = ::splice(m_read, nullptr, out_fd, nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (n == -1) {
+				const int e = errno;
+				if (e == EINTR) { continue; }
+				if (is_would_block(e)) { r.would_block = true; return r; }
+				if (!is_unsupported(e)) { throw PosixError(e); }
+				// the output can't take a splice (the bytes were stashed by the fallback below)
+				TransferResult d = { 0u, false, false };
+				d = copy_with_buffer(m_read, nullptr, out_fd, nullptr, want, d);
+				m_buffered -= d.bytes;
+				r.bytes += d.bytes;
+				if (d.would_block) { r.would_block = true; return r; }
+				continue;
+			}
+			m_buffered -= n;
+			r.bytes += n;
+		}
+		if (r.bytes >= len) { break; }
+
+		// the pipe is empty, so filling it up to its capacity can't block on the pipe side
+		size_t want = len - r.bytes;
+		if (want > m_capacity) { want = m_capacity; }
+		const ssize_t n = ::splice(in_fd, nullptr, m_write, nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n == -1) {
+			const int e = errno;
+			if (e == EINTR) { continue; }
+			if (is_would_block(e)) { r.would_block = true; return r; }
+			if (!input_spliced && is_unsupported(e)) { break; }
+			throw PosixError(e);
+		}
+		if (n == 0) { r.eof = true; return r; }
+		input_spliced = true;
+		m_buffered += n;
+	}
+	if (r.bytes >= len) { return r; }
+#endif
+	assert(m_buffered == 0);
+#ifdef __linux__
+	// bytes that can't be written are kept in the (empty) pipe, for the drain above
+	const Stash stash = { m_write.fd(), m_capacity, &m_buffered };
+	return copy_with_buffer(in_fd, nullptr, out_fd, nullptr, len, r, &stash);
+#else
+	return copy_with_buffer(in_fd, nullptr, out_fd, nullptr, len, r);
+#endif
+}
+
+struct CloseQueue::Cell {
+	std::atomic<size_t> sequence;
+	int fd;
+};
+
+struct CloseQueue::Worker {
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stop;
+	Worker(): stop(false) {}
+};
+
+static thread_local CloseQueue *s_current_close_queue = nullptr;
+
+CloseQueue::Scope::Scope(CloseQueue &queue): m_previous(s_current_close_queue) {
+	s_current_close_queue = &queue;
+}
+
+CloseQueue::Scope::~Scope() {
+	s_current_close_queue = m_previous;
+}
+
+CloseQueue *CloseQueue::current() {
+	return s_current_close_queue;
+}
+
+// This is a bounded MPMC queue (from Dmitry Vyukov's design): each cell has a sequence number
+// that tells producers and consumers whether it's their turn to use that cell.
+CloseQueue::CloseQueue(const size_t capacity): m_cells(nullptr), m_mask(0u), m_worker(nullptr),
+		m_enqueue_pos(0u), m_dequeue_pos(0u), m_draining(false) {
+	size_t n = 2;
+	while (n < capacity) { n *= 2; }
+	m_cells = new Cell[n];
+	m_mask = n - 1;
+	for (size_t i = 0; i < n; ++i) {
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		m_cells[i].fd = -1;
+	}
+}
+
+CloseQueue::~CloseQueue() {
+	if (m_worker) {
+		{
+			std::lock_guard<std::mutex> guard(m_worker->lock);
+			m_worker->stop = true;
+		}
+		m_worker->wake.notify_one();
+		m_worker->thread.join();
+		delete m_worker;
+	}
+	while (drain()) {}
+	delete[] m_cells;
+}
+
+bool CloseQueue::try_push(const int fd) {
+	size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell &cell = m_cells[pos & m_mask];
+		const size_t seq = cell.sequence.load(std::memory_order_acquire);
+		const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+		if (diff == 0) {
+			if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell.fd = fd;
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				// nudge the worker once when the queue gets half full
+				if (m_worker && pos - m_dequeue_pos.load(std::memory_order_relaxed) == (m_mask + 1) / 2) {
+					m_worker->wake.notify_one();
+				}
+				return true;
+			}
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void CloseQueue::push(FileDes &&fd) {
+	FileDes owned(std::move(fd));
+	// if the queue is full, owned's destructor closes the descriptor
+	if (owned && try_push(owned.fd())) { owned.release(); }
+}
+
+bool CloseQueue::try_pop(int &fd) {
+	// only called with m_draining held, so there is a single consumer
+	const size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+	Cell &cell = m_cells[pos & m_mask];
+	const size_t seq = cell.sequence.load(std::memory_order_acquire);
+	if (intptr_t(seq) - intptr_t(pos + 1) < 0) { return false; }
+	fd = cell.fd;
+	m_dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+	cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+	return true;
+}
+
+size_t CloseQueue::drain() {
+	if (m_draining.exchange(true, std::memory_order_acquire)) { return 0; }
+	size_t total = 0;
+	int batch[256];
+	for (;;) {
+		size_t n = 0;
+		while (n < sizeof(batch)/sizeof(batch[0]) && try_pop(batch[n])) { ++n; }
+		if (!n) { break; }
+		close_descriptors(batch, n);
+		total += n;
+	}
+	m_draining.store(false, std::memory_order_release);
+	return total;
+}
+
+void CloseQueue::start_worker(const unsigned interval_ms) {
+	assert(!m_worker);
+	m_worker = new Worker;
+	m_worker->thread = std::thread([this, interval_ms]() {
+		std::unique_lock<std::mutex> guard(m_worker->lock);
+		while (!m_worker->stop) {
+			m_worker->wake.wait_for(guard, std::chrono::milliseconds(interval_ms));
+			guard.unlock();
+			drain();
+			guard.lock();
+		}
+	});
+}
@@ -2,8 +2,10 @@
 #define POSIX_HPP
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <stdexcept>
 #include <cstring>
+#include <atomic>
 
 class PosixError : public std::runtime_error {
 	public:
@@ -36,15 +38,94 @@ class FileDes {
 		int fd() const { return m_fd; }
 		operator int() const { return m_fd; }
 
+		/// Give up ownership of the descriptor without closing it.
+		int release() { const int fd = m_fd; m_fd = -1; return fd; }
+
 		explicit operator bool() const { return (m_fd != -1); }
 
 	private:
 		int m_fd;
 };
 
+/// Close a batch of descriptors, using close_range() for runs of consecutive descriptors
+/// where it's available. The array is sorted in place. Failures are reported as warnings.
+void close_descriptors(int *fds, const size_t count);
+
+// A lock-free queue of descriptors waiting to be closed.
+// While a CloseQueue::Scope is active on a thread, FileDes objects destroyed on that thread
+// don't call close() themselves; they push their descriptor onto the queue (or close it
+// directly if the queue is full). The queue is emptied in batches by drain(), which can be
+// called from a housekeeping thread or timer, or by a worker started with start_worker().
+// A descriptor number is not reused until it has actually been closed, so deferring the close
+// can't make a later open() hand out a number that's still queued, but the process will hold up
+// to 'capacity' extra descriptors. Everything else that happens on close waits for the drain too:
+// the peer of a socket or the reader of a pipe doesn't see EOF, and locks held through the
+// descriptor (fcntl record locks, flock) aren't released. When something is waiting on one of
+// those, let it go outside any Scope, or close(fd.release()) it.
+class CloseQueue {
+	public:
+		class Scope {
+			public:
+				explicit Scope(CloseQueue &queue);
+				~Scope();
+				Scope(const Scope&) = delete;
+				Scope& operator=(const Scope&) = delete;
+			private:
+				CloseQueue *m_previous;
+		};
+
+		/// capacity is rounded up to a power of two.
+		explicit CloseQueue(const size_t capacity = 4096);
+		/// Stops the worker (if any) and closes everything still queued.
+		~CloseQueue();
+
+		CloseQueue(const CloseQueue&) = delete;
+		CloseQueue& operator=(const CloseQueue&) = delete;
+
+		/// @return The queue installed on the calling thread, or null.
+		static CloseQueue *current();
+
+		/// Queue fd to be closed. Safe to call from any number of threads.
+		/// @return false if the queue is full (in which case the caller still owns fd).
+		bool try_push(const int fd);
+
+		/// Queue fd to be closed, closing it immediately if the queue is full.
+		void push(FileDes &&fd);
+
+		/// Close everything queued so far. Safe to call from any thread; if another thread
+		/// is already draining the queue this returns 0 immediately.
+		/// @return The number of descriptors closed.
+		size_t drain();
+
+		/// Start a thread that drains the queue every interval_ms milliseconds
+		/// (and sooner if it fills past half its capacity).
+		void start_worker(const unsigned interval_ms = 10);
+
+	private:
+		struct Cell;
+		struct Worker;
+
+		bool try_pop(int &fd);
+
+		Cell *m_cells;
+		size_t m_mask;
+		Worker *m_worker;
+		alignas(64) std::atomic<size_t> m_enqueue_pos;
+		alignas(64) std::atomic<size_t> m_dequeue_pos;
+		std::atomic<bool> m_draining;
+};
+
 class FileMapping {
 	public:
-		static FileMapping MapWholeFile(const char * const path);
+		/// Map a whole file (read-only and shared by default). MAP_PRIVATE with PROT_WRITE gives a
+		/// copy-on-write view that can be modified without touching the file. An empty file gives
+		/// an empty (null) mapping.
+		static FileMapping MapWholeFile(const char * const path, const int prot = PROT_READ, const int flags = MAP_SHARED);
+
+		/// Map len bytes of private anonymous memory, read-write, with the given extra mmap
+		/// flags (MAP_NORESERVE by default, so the address space is reserved without
+		/// committing memory; pages are committed by the kernel when first touched).
+		static FileMapping MapAnonymous(const size_t len, const int extra_flags = MAP_NORESERVE);
 
 		FileMapping(): m_base(nullptr), m_size(0u) {}
 		~FileMapping();
@@ -59,12 +140,10 @@ class FileMapping {
 		}
 
 		FileMapping& operator=(FileMapping&& other) {
-			if (this != &other) {
-				this->m_base = other.m_base;
-				this->m_size = other.m_size;
-				other.m_base = nullptr;
-				other.m_size = 0u;
-			}
+			FileMapping tmp(std::move(other));
+			using std::swap;
+			swap(this->m_base, tmp.m_base);
+			swap(this->m_size, tmp.m_size);
 			return *this;
 		}
 
@@ -81,4 +160,148 @@ class FileMapping {
 		size_t m_size;
 };
 
+// A read-write shared mapping of a whole file, which can be grown in place.
+// Intended for append-only logs: append() hands out space at the end of the file,
+// growing the file (ftruncate) and the mapping (mremap) by at least grow_step bytes at a time.
+// Growing may move the mapping, so pointers obtained from get() or append() are
+// only valid until the next call that can grow the file.
+// On destruction (or close()) the file is truncated back to size() bytes.
+class AppendMapping {
+	public:
+		static const size_t DEFAULT_GROW_STEP = 64u << 20;
+
+		/// Open (creating if necessary) a file for appending. Existing contents are kept.
+		static AppendMapping OpenFile(const char * const path, const size_t grow_step = DEFAULT_GROW_STEP, const mode_t mode = 0644);
+
+		AppendMapping(): m_base(nullptr), m_size(0u), m_capacity(0u), m_synced(0u),
+			m_grow_step(DEFAULT_GROW_STEP), m_flush_interval(0u) {}
+		~AppendMapping();
+
+		/// Take ownership of fd, which must be open for reading and writing.
+		explicit AppendMapping(FileDes &&fd, const size_t grow_step = DEFAULT_GROW_STEP);
+
+		AppendMapping(AppendMapping&& other): m_fd(std::move(other.m_fd)), m_base(other.m_base),
+				m_size(other.m_size), m_capacity(other.m_capacity), m_synced(other.m_synced),
+				m_grow_step(other.m_grow_step), m_flush_interval(other.m_flush_interval) {
+			other.m_base = nullptr;
+			other.m_size = other.m_capacity = other.m_synced = 0u;
+		}
+
+		AppendMapping& operator=(AppendMapping&& other) {
+			AppendMapping tmp(std::move(other));
+			swap(tmp);
+			return *this;
+		}
+
+		AppendMapping(const AppendMapping&) = delete;
+		AppendMapping& operator=(const AppendMapping&) = delete;
+
+		void swap(AppendMapping &other);
+
+		void *get() const { return m_base; }
+		/// @return The number of bytes of the file that are in use (the logical file size).
+		size_t size() const { return m_size; }
+		/// @return The number of bytes currently mapped (and allocated in the file).
+		size_t capacity() const { return m_capacity; }
+		/// @return The number of bytes appended since the last flush.
+		size_t unflushed() const { return m_size - m_synced; }
+		int fd() const { return m_fd.fd(); }
+
+		explicit operator bool() const { return static_cast<bool>(m_fd); }
+
+		/// Make sure at least 'capacity' bytes are mapped, growing the file if necessary.
+		void reserve(const size_t capacity);
+
+		/// Extend the file by len bytes and return a pointer to the new space.
+		void *append(const size_t len);
+		void append(const void *data, const size_t len) { std::memcpy(append(len), data, len); }
+
+		/// Automatically start writeback (msync MS_ASYNC) whenever at least 'bytes' bytes
+		/// have been appended since the last flush. Zero (the default) disables this.
+		void set_flush_interval(const size_t bytes) { m_flush_interval = bytes; }
+
+		/// Write back everything appended since the last flush.
+		/// If 'wait' is true this uses MS_SYNC, otherwise MS_ASYNC.
+		void flush(const bool wait = false);
+
+		/// Flush (synchronously), truncate the file to size(), unmap it and close it.
+		void close();
+
+	private:
+		void grow(const size_t min_capacity);
+
+		FileDes m_fd;
+		void *m_base;
+		size_t m_size;
+		size_t m_capacity;
+		size_t m_synced;
+		size_t m_grow_step;
+		size_t m_flush_interval;
+};
+
+/// Result of a bulk transfer between file descriptors.
+/// Hard errors are reported by throwing PosixError; a transfer that stops early
+/// for one of the reasons below is not an error.
+struct TransferResult {
+	/// Number of bytes written to the output.
+	size_t bytes;
+	/// The transfer stopped early because a nonblocking descriptor returned EAGAIN.
+	bool would_block;
+	/// The transfer stopped early because the input reached end-of-file.
+	bool eof;
+};
+
+// Bulk transfer helpers. These use the cheapest kernel path available and fall back
+// to a read/write loop through a userspace buffer when the kernel refuses that path.
+// EINTR is retried. If an offset pointer is non-null, that offset is used and updated
+// (and the file position is left alone), otherwise the file position is used and updated.
+// With a nonblocking output they return would_block rather than wait, without losing
+// input: the buffered fallback seeks back over bytes it couldn't write (in a regular
+// file or block device), and from any other input (a pipe, say) it reads only when the
+// output polls writable, at most PIPE_BUF bytes at a time. Only if a socket then takes
+// less than that does it wait for room for the rest of those few bytes.
+
+/// Copy up to len bytes from one file to another (copy_file_range, then sendfile, then read/write).
+TransferResult copy_file_data(const int in_fd, off_t *in_offset, const int out_fd, off_t *out_offset, const size_t len);
+
+/// Send up to len bytes from a file to a socket or other descriptor (sendfile, then read/write).
+TransferResult send_file_data(const int out_fd, const int in_fd, off_t *in_offset, const size_t len);
+
+// Moves data between arbitrary descriptors (e.g., socket to socket) using splice() through
+// a private pipe. If the output would block, data already pulled from the input stays
+// buffered in the pipe and is delivered first by the next call to transfer(); that holds
+// for the read/write fallback too, so transfer() never waits for a nonblocking output.
+class SplicePipe {
+	public:
+		SplicePipe();
+
+		SplicePipe(SplicePipe&& from): m_read(std::move(from.m_read)), m_write(std::move(from.m_write)),
+			m_capacity(from.m_capacity), m_buffered(from.m_buffered) { from.m_buffered = 0u; }
+		SplicePipe& operator=(SplicePipe&& from) {
+			SplicePipe tmp(std::move(from));
+			using std::swap;
+			swap(m_read, tmp.m_read);
+			swap(m_write, tmp.m_write);
+			swap(m_capacity, tmp.m_capacity);
+			swap(m_buffered, tmp.m_buffered);
+			return *this;
+		}
+
+		SplicePipe(const SplicePipe&) = delete;
+		SplicePipe& operator=(const SplicePipe&) = delete;
+
+		/// Move up to len bytes from in_fd to out_fd. len counts bytes delivered to out_fd,
+		/// including any left buffered by a previous call.
+		TransferResult transfer(const int in_fd, const int out_fd, const size_t len);
+
+		/// @return The number of bytes read from an input but not yet delivered.
+		size_t buffered() const { return m_buffered; }
+
+	private:
+		FileDes m_read;
+		FileDes m_write;
+		size_t m_capacity;
+		size_t m_buffered;
+};
+
 #endif
@@ -0,0 +1,250 @@
+/* This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "ShmRing.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+		"shared memory rings need address-free (lock-free) atomics");
+
+static const uint32_t RING_MAGIC = 0x474e5253u; // "SRNG"
+static const uint32_t RING_VERSION = 1u;
+static const size_t CACHE_LINE = 64u;
+static const int SPIN_BEFORE_SLEEP = 256;
+
+struct ShmRing::Header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t mode;
+	uint32_t reserved;
+	uint64_t slot_count;
+	uint64_t stride;
+	uint64_t max_message;
+
+	// written by producers
+	alignas(CACHE_LINE) std::atomic<uint64_t> producer_pos;
+
+	// written by the consumer
+	alignas(CACHE_LINE) std::atomic<uint64_t> consumer_pos;
+	std::atomic<uint32_t> consumer_sleeping;
+	// futex word; bumped by a producer when it wakes the consumer
+	std::atomic<uint32_t> wake_count;
+};
+
+static size_t round_up(const size_t n, const size_t align) {
+	return (n + align - 1) & ~(align - 1);
+}
+
+size_t ShmRing::slots_offset() {
+	return round_up(sizeof(Header), CACHE_LINE);
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static int futex(std::atomic<uint32_t> *word, const int op, const uint32_t value, const struct timespec *timeout) {
+	// not FUTEX_PRIVATE_FLAG: the word is in memory shared between processes
+	return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+}
+
+ShmRing ShmRing::Create(const size_t slot_count, const size_t max_message, const Mode mode, const char *name) {
+	size_t count = 2;
+	while (count < slot_count) { count *= 2; }
+	if (max_message > UINT32_MAX) { throw PosixError(EMSGSIZE); }
+	const size_t stride = round_up(sizeof(Slot) + max_message, CACHE_LINE);
+	const size_t total = slots_offset() + count * stride;
+
+	FileDes fd(::memfd_create(name, MFD_CLOEXEC));
+	if (!fd) { throw PosixError(errno); }
+	if (::ftruncate(fd, total) == -1) { throw PosixError(errno); }
+	FileMapping mapping(fd, total, 0, PROT_READ | PROT_WRITE, MAP_SHARED);
+
+	Header * const h = new (mapping.get()) Header;
+	h->magic = RING_MAGIC;
+	h->version = RING_VERSION;
+	h->mode = mode;
+	h->reserved = 0u;
+	h->slot_count = count;
+	h->stride = stride;
+	h->max_message = max_message;
+	h->producer_pos.store(0u, std::memory_order_relaxed);
+	h->consumer_pos.store(0u, std::memory_order_relaxed);
+	h->consumer_sleeping.store(0u, std::memory_order_relaxed);
+	h->wake_count.store(0u, std::memory_order_relaxed);
+
+	char * const slots = static_cast<char*>(mapping.get()) + slots_offset();
+	for (size_t i = 0; i < count; ++i) {
+		Slot * const s = new (slots + i * stride) Slot;
+		s->sequence.store(i, std::memory_order_relaxed);
+		s->size = 0u;
+		s->reserved = 0u;
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	return ShmRing(std::move(fd), std::move(mapping));
+}
+
+ShmRing ShmRing::Attach(FileDes &&fd) {
+	struct stat info;
+	if (::fstat(fd, &info) == -1) { throw PosixError(errno); }
+	if (size_t(info.st_size) < slots_offset()) { throw PosixError(EINVAL, "descriptor does not hold a ring buffer"); }
+	FileMapping mapping(fd, info.st_size, 0, PROT_READ | PROT_WRITE, MAP_SHARED);
+	const Header * const h = static_cast<const Header*>(mapping.get());
+	if (h->magic != RING_MAGIC || h->version != RING_VERSION ||
+			(h->mode != SINGLE_PRODUCER && h->mode != MULTI_PRODUCER) ||
+			!h->slot_count || (h->slot_count & (h->slot_count - 1)) ||
+			h->stride < sizeof(Slot) + h->max_message ||
+			slots_offset() + h->slot_count * h->stride > size_t(info.st_size)) {
+		throw PosixError(EINVAL, "descriptor does not hold a ring buffer");
+	}
+	return ShmRing(std::move(fd), std::move(mapping));
+}
+
+ShmRing::ShmRing(FileDes &&fd, FileMapping &&mapping):
+		m_fd(std::move(fd)), m_mapping(std::move(mapping)) {
+	m_header = static_cast<Header*>(m_mapping.get());
+	m_slots = static_cast<char*>(m_mapping.get()) + slots_offset();
+	m_mask = m_header->slot_count - 1;
+	m_stride = m_header->stride;
+	m_max_message = m_header->max_message;
+	m_mode = Mode(m_header->mode);
+}
+
+uint64_t ShmRing::claim(const size_t count, size_t &claimed) {
+	uint64_t pos = m_header->producer_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		// a slot is free for position p when its sequence number is p
+		size_t n = 0;
+		while (n < count && n <= m_mask && slot(pos + n)->sequence.load(std::memory_order_acquire) == pos + n) { ++n; }
+		if (!n) {
+			const uint64_t seq = slot(pos)->sequence.load(std::memory_order_acquire);
+			if (int64_t(seq - pos) < 0) { claimed = 0; return pos; } // full
+			// another producer got there first
+			pos = m_header->producer_pos.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (m_mode == SINGLE_PRODUCER) {
+			m_header->producer_pos.store(pos + n, std::memory_order_relaxed);
+			claimed = n;
+			return pos;
+		}
+		if (m_header->producer_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+			claimed = n;
+			return pos;
+		}
+	}
+}
+
+void ShmRing::publish(const uint64_t pos, const Message *messages, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		Slot * const s = slot(pos + i);
+		std::memcpy(s->data(), messages[i].data, messages[i].size);
+		s->size = uint32_t(messages[i].size);
+		s->sequence.store(pos + i + 1, std::memory_order_release);
+	}
+	wake_consumer();
+}
+
+void ShmRing::wake_consumer() {
+	// pairs with the fence in wait(): either we see that the consumer is sleeping,
+	// or the consumer sees our message before it goes to sleep
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_header->consumer_sleeping.load(std::memory_order_relaxed) &&
+			m_header->consumer_sleeping.exchange(0u, std::memory_order_acq_rel)) {
+		m_header->wake_count.fetch_add(1u, std::memory_order_release);
+		futex(&m_header->wake_count, FUTEX_WAKE, 1, nullptr);
+	}
+}
+
+bool ShmRing::try_push(const void *data, const size_t size) {
+	const Message m = { data, size };
+	return try_push_batch(&m, 1) == 1;
+}
+
+size_t ShmRing::try_push_batch(const Message *messages, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		if (messages[i].size > m_max_message) { throw PosixError(EMSGSIZE); }
+	}
+	size_t done = 0;
+	while (done < count) {
+		size_t n;
+		const uint64_t pos = claim(count - done, n);
+		if (!n) { break; }
+		publish(pos, messages + done, n);
+		done += n;
+	}
+	return done;
+}
+
+uint64_t ShmRing::consumer_pos() const {
+	return m_header->consumer_pos.load(std::memory_order_relaxed);
+}
+
+void ShmRing::release(const uint64_t pos) {
+	m_header->consumer_pos.store(pos, std::memory_order_relaxed);
+}
+
+bool ShmRing::ready() const {
+	const uint64_t pos = consumer_pos();
+	return slot(pos)->sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+bool ShmRing::wait(const int timeout_ms) {
+	for (int i = 0; i < SPIN_BEFORE_SLEEP; ++i) {
+		if (ready()) { return true; }
+		cpu_relax();
+	}
+
+	struct timespec deadline;
+	if (timeout_ms >= 0) {
+		::clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) { ++deadline.tv_sec; deadline.tv_nsec -= 1000000000L; }
+	}
+
+	for (;;) {
+		const uint32_t w = m_header->wake_count.load(std::memory_order_acquire);
+		m_header->consumer_sleeping.store(1u, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ready()) {
+			m_header->consumer_sleeping.store(0u, std::memory_order_relaxed);
+			return true;
+		}
+
+		struct timespec remaining, *timeout = nullptr;
+		if (timeout_ms >= 0) {
+			struct timespec now;
+			::clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+			remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) { --remaining.tv_sec; remaining.tv_nsec += 1000000000L; }
+			if (remaining.tv_sec < 0) {
+				m_header->consumer_sleeping.store(0u, std::memory_order_relaxed);
+				return ready();
+			}
+			timeout = &remaining;
+		}
+
+		if (futex(&m_header->wake_count, FUTEX_WAIT, w, timeout) == -1 &&
+				errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+			const int e = errno;
+			m_header->consumer_sleeping.store(0u, std::memory_order_relaxed);
+			throw PosixError(e);
+		}
+		m_header->consumer_sleeping.store(0u, std::memory_order_relaxed);
+		if (ready()) { return true; }
+	}
+}
@@ -0,0 +1,163 @@
+#ifndef SHMRING_HPP
+#define SHMRING_HPP
+
+/* Lock-free message ring buffer in shared memory (Linux only).
+ *
+ * The ring lives in a memfd-backed shared FileMapping, so it can be shared with another
+ * process by passing its descriptor (fd(); inherit it across fork, or send it over a unix
+ * socket with SCM_RIGHTS) and calling ShmRing::Attach() on the other side.
+ *
+ * The ring is an array of fixed-size slots, each holding one message of up to max_message()
+ * bytes. Each slot carries a sequence number that tells producers and the consumer whose turn
+ * it is to use it, so in SINGLE_PRODUCER mode neither side needs any atomic read-modify-write
+ * operations. MULTI_PRODUCER mode lets any number of producers (in any processes) push
+ * concurrently; there is always a single consumer.
+ *
+ * The producer and consumer positions are on separate cache lines, and slots are whole
+ * cache lines, so the two sides don't false-share. Batch operations claim and publish several
+ * slots at once. The consumer can block in wait(); producers only make a syscall (a futex
+ * wake) when the consumer is actually sleeping.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+class ShmRing {
+	public:
+		enum Mode {
+			SINGLE_PRODUCER = 1,
+			MULTI_PRODUCER = 2
+		};
+
+		struct Message {
+			const void *data;
+			size_t size;
+		};
+
+		/// Create a new ring with (at least) slot_count slots (rounded up to a power of two)
+		/// of max_message bytes each. 'name' is only used to label the memfd (e.g., in /proc).
+		static ShmRing Create(const size_t slot_count, const size_t max_message, const Mode mode, const char *name = "shmring");
+
+		/// Map an existing ring from its descriptor. Throws PosixError(EINVAL) if the
+		/// descriptor doesn't hold a ring.
+		static ShmRing Attach(FileDes &&fd);
+
+		ShmRing(): m_header(nullptr), m_slots(nullptr), m_mask(0u), m_stride(0u), m_max_message(0u), m_mode(SINGLE_PRODUCER) {}
+
+		ShmRing(ShmRing&& other): m_fd(std::move(other.m_fd)), m_mapping(std::move(other.m_mapping)),
+				m_header(other.m_header), m_slots(other.m_slots), m_mask(other.m_mask), m_stride(other.m_stride),
+				m_max_message(other.m_max_message), m_mode(other.m_mode) {
+			other.m_header = nullptr;
+			other.m_slots = nullptr;
+		}
+
+		ShmRing& operator=(ShmRing&& other) {
+			ShmRing tmp(std::move(other));
+			using std::swap;
+			swap(m_fd, tmp.m_fd);
+			swap(m_mapping, tmp.m_mapping);
+			swap(m_header, tmp.m_header);
+			swap(m_slots, tmp.m_slots);
+			swap(m_mask, tmp.m_mask);
+			swap(m_stride, tmp.m_stride);
+			swap(m_max_message, tmp.m_max_message);
+			swap(m_mode, tmp.m_mode);
+			return *this;
+		}
+
+		ShmRing(const ShmRing&) = delete;
+		ShmRing& operator=(const ShmRing&) = delete;
+
+		/// @return The descriptor to pass to another process.
+		int fd() const { return m_fd.fd(); }
+		size_t capacity() const { return m_mask + 1; }
+		size_t max_message() const { return m_max_message; }
+		Mode mode() const { return m_mode; }
+
+		explicit operator bool() const { return m_header; }
+
+		// Producer side.
+
+		/// @return false if the ring is full. Throws PosixError(EMSGSIZE) if the message is too big.
+		bool try_push(const void *data, const size_t size);
+
+		/// Push as many of the messages as fit (in order), claiming and publishing them as a batch.
+		/// @return The number of messages pushed.
+		size_t try_push_batch(const Message *messages, const size_t count);
+
+		// Consumer side.
+
+		/// Call f(const void *data, size_t size) for up to 'max' waiting messages, in order.
+		/// The data is only valid during the call.
+		/// @return The number of messages consumed.
+		template <typename F>
+		size_t consume(F &&f, const size_t max = size_t(-1));
+
+		/// Block until a message is available, or until timeout_ms has passed (-1 waits forever).
+		/// @return true if a message is available.
+		bool wait(const int timeout_ms = -1);
+
+		/// @return true if at least one message is waiting.
+		bool ready() const;
+
+	private:
+		struct Header;
+		struct Slot;
+
+		ShmRing(FileDes &&fd, FileMapping &&mapping);
+
+		static size_t slots_offset();
+
+		Slot *slot(const uint64_t pos) const;
+		uint64_t claim(const size_t count, size_t &claimed);
+		void publish(const uint64_t pos, const Message *messages, const size_t count);
+		void wake_consumer();
+		uint64_t consumer_pos() const;
+		void release(const uint64_t pos);
+
+		FileDes m_fd;
+		FileMapping m_mapping;
+		Header *m_header;
+		char *m_slots;
+		size_t m_mask;
+		size_t m_stride;
+		size_t m_max_message;
+		Mode m_mode;
+};
+
+// a slot is a header followed by the message bytes; slots are cache line multiples
+struct ShmRing::Slot {
+	std::atomic<uint64_t> sequence;
+	uint32_t size;
+	uint32_t reserved;
+
+	const void *data() const { return this + 1; }
+	void *data() { return this + 1; }
+};
+
+inline ShmRing::Slot *ShmRing::slot(const uint64_t pos) const {
+	return reinterpret_cast<Slot*>(m_slots + (pos & m_mask) * m_stride);
+}
+
+template <typename F>
+size_t ShmRing::consume(F &&f, const size_t max) {
+	const uint64_t first = consumer_pos();
+	uint64_t pos = first;
+	while (size_t(pos - first) < max) {
+		Slot * const s = slot(pos);
+		if (s->sequence.load(std::memory_order_acquire) != pos + 1) { break; }
+		f(static_cast<const void*>(s->data()), size_t(s->size));
+		// hand the slot back to the producers for the next lap
+		s->sequence.store(pos + m_mask + 1, std::memory_order_release);
+		++pos;
+	}
+	if (pos != first) { release(pos); }
+	return size_t(pos - first);
+}
+
+#endif
@@ -0,0 +1,219 @@
+/* Tests for Arena and SlabPool: alignment of allocations, blocks and created objects;
+ * reset to a mark, and the slab's free list; trim() and release() giving pages back
+ * (checked with mincore) and leaving them zeroed; allocations larger than a page, or
+ * than the whole reservation, which throw rather than wrap around; and HUGE_PAGES,
+ * both where transparent huge pages are available and where they aren't (turned off
+ * for the process with PR_SET_THP_DISABLE), where the arena just gets normal pages.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Arena.hpp"
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+const size_t MB = size_t(1) << 20;
+const size_t PAGE = ::sysconf(_SC_PAGESIZE);
+
+bool aligned(const void *p, const size_t align) {
+	return (reinterpret_cast<uintptr_t>(p) & (align - 1)) == 0;
+}
+
+/// The number of pages of [p, p + len) that are resident; p must be page aligned.
+size_t resident_pages(const void *p, const size_t len) {
+	std::vector<unsigned char> pages((len + PAGE - 1) / PAGE);
+	if (::mincore(const_cast<void*>(p), len, &pages[0]) == -1) { throw PosixError(errno); }
+	size_t n = 0;
+	for (size_t i = 0; i < pages.size(); ++i) { n += (pages[i] & 1); }
+	return n;
+}
+
+bool all_zero(const char *p, const size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		if (p[i]) { return false; }
+	}
+	return true;
+}
+
+struct alignas(64) CacheLine {
+	int value;
+	explicit CacheLine(const int value): value(value) {}
+};
+
+void test_alignment() {
+	Arena arena(MB);
+	bool ok = true;
+	for (size_t align = 1; align <= 4096; align *= 2) {
+		arena.allocate(1, 1); // leave the position odd
+		ok = ok && aligned(arena.allocate(3, align), align);
+	}
+	check(ok, "Arena: allocations aligned as requested");
+	check(aligned(arena.allocate(1), alignof(std::max_align_t)), "Arena: default alignment");
+	arena.allocate(1, 1);
+	CacheLine * const line = arena.create<CacheLine>(42);
+	check(aligned(line, 64) && line->value == 42, "Arena: create() aligns for the type");
+
+	SlabPool pool(40, MB, 0, 64);
+	char * const first = static_cast<char*>(pool.allocate());
+	char * const second = static_cast<char*>(pool.allocate());
+	check(pool.object_size() == 64 && aligned(first, 64) && second - first == 64, "SlabPool: blocks rounded up to the alignment");
+	SlabPool tiny(1, MB, 0, 1);
+	check(tiny.object_size() >= sizeof(void*) && aligned(tiny.allocate(), alignof(void*)), "SlabPool: blocks hold a free-list link");
+}
+
+void test_reset() {
+	Arena arena(MB);
+	arena.allocate(100);
+	const Arena::Mark m = arena.mark();
+	void * const after = arena.allocate(1000);
+	arena.allocate(5000);
+	arena.reset(m);
+	check(arena.used() == m && arena.allocate(1000) == after, "Arena: reset to a mark reuses what came after it");
+	arena.reset();
+	check(arena.used() == 0u, "Arena: reset to the start");
+
+	SlabPool pool(100, MB);
+	void * const a = pool.allocate();
+	void * const b = pool.allocate();
+	void * const c = pool.allocate();
+	pool.deallocate(b);
+	pool.deallocate(a);
+	pool.deallocate(nullptr);
+	check(pool.allocate() == a && pool.allocate() == b && pool.allocate() != c, "SlabPool: freed blocks are reused, last freed first");
+	pool.reset();
+	check(pool.allocate() == a, "SlabPool: reset starts over");
+}
+
+void test_trim() {
+	Arena arena(64 * MB);
+	char * const base = static_cast<char*>(arena.allocate(8 * MB, PAGE));
+	std::memset(base, 0xab, 8 * MB);
+	check(resident_pages(base, 8 * MB) == 8 * MB / PAGE, "trim: touched pages are resident");
+
+	// reset keeps the pages; trim past a little slack gives back the rest
+	arena.reset();
+	check(resident_pages(base, 8 * MB) == 8 * MB / PAGE, "trim: reset keeps pages");
+	arena.trim(MB);
+	check(resident_pages(base, MB) == MB / PAGE && resident_pages(base + MB, 7 * MB) == 0, "trim: pages past the slack returned");
+
+	arena.allocate(2 * MB);
+	arena.release();
+	check(resident_pages(base, 8 * MB) == 0 && arena.used() == 0u, "release: every page returned");
+	// (reading them maps the shared zero page, which mincore counts, so this comes last)
+	check(all_zero(base, 8 * MB), "returned pages read back as zeros");
+
+	SlabPool pool(4096, 64 * MB);
+	char * const first = static_cast<char*>(pool.allocate());
+	for (int i = 0; i < 1000; ++i) { std::memset(pool.allocate(), 1, 4096); }
+	pool.release();
+	check(resident_pages(first, 1001 * 4096) == 0 && pool.allocate() == first, "SlabPool: release returns pages");
+}
+
+void test_large() {
+	// larger than a page, and all of the reservation
+	Arena arena(16 * MB);
+	char * const big = arena.allocate_array<char>(10 * MB);
+	big[0] = 1;
+	big[10 * MB - 1] = 2;
+	arena.allocate(6 * MB);
+	check(arena.used() == 16 * MB && arena.reserved() == 16 * MB, "Arena: large allocations fill the reservation exactly");
+
+	int thrown = 0;
+	try { arena.allocate(1); } catch (std::bad_alloc &) { ++thrown; }
+	arena.reset();
+	try { arena.allocate(16 * MB + 1); } catch (std::bad_alloc &) { ++thrown; }
+	// sizes that would wrap the position or the byte count around
+	try { arena.allocate(size_t(-1)); } catch (std::bad_alloc &) { ++thrown; }
+	arena.allocate(1);
+	try { arena.allocate(size_t(-1) - 8, 16); } catch (std::bad_alloc &) { ++thrown; }
+	try { arena.allocate_array<uint64_t>(size_t(-1) / 4); } catch (std::bad_alloc &) { ++thrown; }
+	check(thrown == 5 && arena.used() == 1u, "Arena: too large throws bad_alloc and allocates nothing");
+
+	// slab blocks bigger than a page
+	SlabPool pool(3 * MB, 16 * MB);
+	std::vector<char*> blocks;
+	for (int i = 0; i < 5; ++i) { blocks.push_back(static_cast<char*>(pool.allocate())); }
+	bool full = false;
+	try { pool.allocate(); } catch (std::bad_alloc &) { full = true; }
+	pool.deallocate(blocks[2]);
+	check(full && blocks[4] - blocks[0] == ptrdiff_t(12 * MB) && pool.allocate() == blocks[2], "SlabPool: multi-megabyte blocks");
+}
+
+/// AnonHugePages (in kB) of the mapping that contains p.
+long huge_kb(const void *p) {
+	FILE * const f = std::fopen("/proc/self/smaps", "r");
+	if (!f) { return -1; }
+	const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+	char line[256];
+	bool inside = false;
+	long kb = -1;
+	while (std::fgets(line, sizeof(line), f)) {
+		unsigned long begin, end;
+		if (std::sscanf(line, "%lx-%lx ", &begin, &end) == 2) {
+			inside = (addr >= begin && addr < end);
+		} else if (inside && std::sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+			break;
+		}
+	}
+	std::fclose(f);
+	return kb;
+}
+
+void test_huge_pages(const char *what) {
+	Arena arena(8 * MB, Arena::HUGE_PAGES);
+	char * const p = static_cast<char*>(arena.allocate(8 * MB, PAGE));
+	std::memset(p, 0x5a, 8 * MB);
+	bool ok = aligned(p, 2 * MB) && arena.reserved() == 8 * MB;
+	arena.release();
+	ok = ok && all_zero(p, 8 * MB);
+	check(ok, what);
+}
+
+} // anonymous namespace
+
+int main() {
+	try {
+		test_alignment();
+		test_reset();
+		test_trim();
+		test_large();
+
+		// transparent huge pages if the system has them (enabled, or "madvise")
+		test_huge_pages("HUGE_PAGES: aligned, usable and released");
+		// and with them turned off for this process, it's just normal pages
+		if (::prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) == 0) {
+			Arena arena(8 * MB, Arena::HUGE_PAGES);
+			char * const p = static_cast<char*>(arena.allocate(8 * MB));
+			std::memset(p, 1, 8 * MB);
+			check(huge_kb(p) <= 0 && resident_pages(p, 8 * MB) == 8 * MB / PAGE, "HUGE_PAGES without huge pages: normal pages");
+			test_huge_pages("HUGE_PAGES without huge pages: aligned, usable and released");
+		}
+	} catch (PosixError &e) {
+		check(false, e.what());
+	}
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+/* Tests for DirWalker, over a tree generated in a temporary directory and compared
+ * with a serial walk (nftw) of the same tree: a directory with more subdirectories
+ * than the walker keeps open at once, so the rest are opened relative to their shared
+ * parent later (as they are when the process runs out of descriptors); a nested tree;
+ * max_depth; symlink loops with follow_symlinks (each directory is read once, and the
+ * walk ends); same_device, with a link to another filesystem; and a visitor that throws.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "DirWalker.hpp"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+// more than the walker's MAX_QUEUED_HANDLES (1024)
+const int WIDE_DIRS = 1500;
+const int NESTED_DEPTH = 5;
+
+void make_dir(const std::string &path) {
+	if (::mkdir(path.c_str(), 0700) == -1) { throw PosixError(errno); }
+}
+
+void make_file(const std::string &path) {
+	FileDes fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+	if (!fd) { throw PosixError(errno); }
+}
+
+void make_link(const char *target, const std::string &path) {
+	if (::symlink(target, path.c_str()) == -1) { throw PosixError(errno); }
+}
+
+void make_nested(const std::string &path, const int levels) {
+	make_file(path + "/a.txt");
+	make_file(path + "/b.txt");
+	if (!levels) { return; }
+	for (int i = 0; i < 3; ++i) {
+		const std::string sub = path + "/sub" + char('0' + i);
+		make_dir(sub);
+		make_nested(sub, levels - 1);
+	}
+}
+
+/// "<relative path> <d|l|f>" for each entry, sorted.
+typedef std::vector<std::string> Listing;
+
+std::string describe(const std::string &relative, const unsigned char type) {
+	return relative + ((type == DT_DIR) ? " d" : (type == DT_LNK) ? " l" : " f");
+}
+
+// state for the nftw callbacks, which take no context
+size_t serial_prefix;
+int serial_max_depth;
+Listing *serial_out;
+
+int serial_entry(const char *path, const struct stat *info, int flag, struct FTW *ftw) {
+	(void)info;
+	if (ftw->level == 0 || (serial_max_depth >= 0 && ftw->level > serial_max_depth)) { return 0; }
+	const unsigned char type = (flag == FTW_D || flag == FTW_DNR) ? DT_DIR : (flag == FTW_SL) ? DT_LNK : DT_REG;
+	serial_out->push_back(describe(path + serial_prefix, type));
+	return 0;
+}
+
+Listing serial_walk(const std::string &root, const int max_depth) {
+	Listing out;
+	serial_prefix = root.size() + 1;
+	serial_max_depth = max_depth;
+	serial_out = &out;
+	if (::nftw(root.c_str(), serial_entry, 64, FTW_PHYS) == -1) { throw PosixError(errno); }
+	std::sort(out.begin(), out.end());
+	return out;
+}
+
+int remove_entry(const char *path, const struct stat *info, int flag, struct FTW *ftw) {
+	(void)info; (void)flag; (void)ftw;
+	return ::remove(path);
+}
+
+void remove_tree(const std::string &root) {
+	::nftw(root.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+class Collector : public DirWalker::Visitor {
+	public:
+		Collector(const std::string &root): errors(0), max_depth(0), m_prefix(root.size() + 1) {}
+
+		bool on_directory(const DirWalker::Entry &entry) override {
+			add(entry);
+			return true;
+		}
+		void on_file(const DirWalker::Entry &entry) override { add(entry); }
+		void on_error(const std::string &path, int error) override {
+			std::printf("    %s: %s\n", path.c_str(), std::strerror(error));
+			std::lock_guard<std::mutex> guard(m_lock);
+			++errors;
+		}
+
+		Listing sorted() {
+			std::sort(listing.begin(), listing.end());
+			return listing;
+		}
+
+		Listing listing;
+		int errors;
+		int max_depth;
+
+	private:
+		void add(const DirWalker::Entry &entry) {
+			const std::string line = describe(entry.path().substr(m_prefix), entry.type);
+			std::lock_guard<std::mutex> guard(m_lock);
+			listing.push_back(line);
+			max_depth = std::max(max_depth, entry.depth);
+		}
+
+		size_t m_prefix;
+		std::mutex m_lock;
+};
+
+class Thrower : public DirWalker::Visitor {
+	public:
+		void on_file(const DirWalker::Entry &entry) override {
+			if (std::strcmp(entry.name, "b.txt") == 0) { throw std::runtime_error("visitor failed"); }
+		}
+};
+
+Listing walk(const std::string &root, const DirWalker::Options &options, Collector &collector) {
+	DirWalker(options).walk(root.c_str(), collector);
+	return collector.sorted();
+}
+
+/// Entries from listing that aren't under 'prefix'.
+Listing without(const Listing &listing, const std::string &prefix) {
+	Listing out;
+	for (size_t i = 0; i < listing.size(); ++i) {
+		if (listing[i].compare(0, prefix.size(), prefix) != 0) { out.push_back(listing[i]); }
+	}
+	return out;
+}
+
+/// Only the files (not directories or links) from listing.
+Listing files_of(const Listing &listing) {
+	Listing out;
+	for (size_t i = 0; i < listing.size(); ++i) {
+		if (listing[i].compare(listing[i].size() - 2, 2, " f") == 0) { out.push_back(listing[i]); }
+	}
+	return out;
+}
+
+void test_walks(const std::string &root) {
+	make_dir(root + "/wide");
+	for (int i = 0; i < WIDE_DIRS; ++i) {
+		char name[32];
+		std::snprintf(name, sizeof(name), "/wide/d%04d", i);
+		make_dir(root + name);
+		make_file(root + name + "/f");
+	}
+	make_dir(root + "/nested");
+	make_nested(root + "/nested", NESTED_DEPTH);
+	make_dir(root + "/loop");
+	make_dir(root + "/loop/inner");
+	make_file(root + "/loop/inner/file");
+	make_link(".", root + "/loop/self");
+	make_link("..", root + "/loop/up");
+	make_link("../..", root + "/loop/inner/back");
+
+	const Listing expected = serial_walk(root, -1);
+	check(expected.size() > size_t(2 * WIDE_DIRS), "tree generated");
+
+	// one thread queues every wide/dNNNN at once, so past the limit they are
+	// queued by name and opened relative to wide/ when their turn comes
+	DirWalker::Options options;
+	options.threads = 1;
+	Collector one(root);
+	check(walk(root, options, one) == expected && one.errors == 0, "one thread: same entries as a serial walk");
+
+	options.threads = 8;
+	Collector eight(root);
+	check(walk(root, options, eight) == expected && eight.errors == 0, "eight threads: same entries as a serial walk");
+
+	// with fewer descriptors than it would like to queue, the rest are queued by name
+	struct rlimit limit, low;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == -1) { throw PosixError(errno); }
+	low = limit;
+	low.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 256);
+	if (::setrlimit(RLIMIT_NOFILE, &low) == -1) { throw PosixError(errno); }
+	Collector limited(root);
+	const Listing limited_listing = walk(root, options, limited);
+	::setrlimit(RLIMIT_NOFILE, &limit);
+	check(limited_listing == expected && limited.errors == 0, "out of descriptors: same entries as a serial walk");
+
+	options.max_depth = 2;
+	Collector shallow(root);
+	check(walk(root, options, shallow) == serial_walk(root, 2) && shallow.max_depth == 2, "max_depth 2");
+	options.max_depth = 0;
+	Collector top(root);
+	check(walk(root, options, top) == serial_walk(root, 1), "max_depth 0: only the root's entries");
+	options.max_depth = -1;
+
+	// following links, loop/self, loop/up and loop/inner/back lead back to directories
+	// already read: they're reported, but not descended into
+	options.follow_symlinks = true;
+	Collector follow(root);
+	const Listing followed = walk(root, options, follow);
+	check(files_of(followed) == files_of(expected) && follow.errors == 0, "symlink loops: every file once");
+	check(std::count(followed.begin(), followed.end(), std::string("loop/up d")) == 1
+			&& std::count(followed.begin(), followed.end(), std::string("loop/self d")) == 1,
+			"symlink loops: links reported as directories");
+
+	Thrower thrower;
+	bool threw = false;
+	try {
+		DirWalker(options).walk(root.c_str(), thrower);
+	} catch (std::runtime_error &e) {
+		threw = (std::strcmp(e.what(), "visitor failed") == 0);
+	}
+	check(threw, "a visitor's exception comes out of walk()");
+	options.follow_symlinks = false;
+}
+
+void test_same_device(const std::string &root) {
+	// somewhere on another filesystem to link to; skipped if there isn't one
+	char other[] = "/dev/shm/dirwalker-test.XXXXXX";
+	struct stat root_info, other_info;
+	if (::stat(root.c_str(), &root_info) == -1 || !::mkdtemp(other)) { return; }
+	if (::stat(other, &other_info) == -1 || other_info.st_dev == root_info.st_dev) {
+		::rmdir(other);
+		return;
+	}
+	make_file(std::string(other) + "/elsewhere");
+	make_link(other, root + "/other");
+
+	DirWalker::Options options;
+	options.threads = 4;
+	options.follow_symlinks = true;
+	Collector across(root);
+	const Listing all = walk(root, options, across);
+	check(std::count(all.begin(), all.end(), std::string("other/elsewhere f")) == 1, "follows a link to another filesystem");
+
+	options.same_device = true;
+	Collector same(root);
+	const Listing local = walk(root, options, same);
+	check(local == without(all, "other/") && local.size() + 1 == all.size(), "same_device stops at another filesystem");
+
+	remove_tree(other);
+	::unlink((root + "/other").c_str());
+}
+
+} // anonymous namespace
+
+int main() {
+	char root[] = "/tmp/dirwalker-test.XXXXXX";
+	if (!::mkdtemp(root)) {
+		std::perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	try {
+		test_walks(root);
+		test_same_device(root);
+	} catch (PosixError &e) {
+		check(false, e.what());
+	}
+	remove_tree(root);
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
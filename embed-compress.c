@@ -0,0 +1,82 @@
+/*
+ * Compresses a file into the format read by embed-lz.c; embed-data.sh -z runs
+ * this on each input.
+ *
+ * usage: embed-compress [-c chunk-size] input output
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "embed-lz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static void* read_file(const char* path, size_t* size)
+{
+   FILE* f = fopen(path, "rb");
+   if (!f) { return NULL; }
+   size_t capacity = 1 << 16, used = 0;
+   char* data = malloc(capacity);
+   while (data) {
+      used += fread(data + used, 1, capacity - used, f);
+      if (used < capacity) { break; }
+      char* bigger = realloc(data, capacity * 2);
+      if (!bigger) { free(data); data = NULL; errno = ENOMEM; break; }
+      data = bigger;
+      capacity *= 2;
+   }
+   if (data && ferror(f)) { free(data); data = NULL; }
+   fclose(f);
+   *size = used;
+   return data;
+}
+
+int main(int argc, char** argv)
+{
+   uint32_t chunk_size = EMBED_LZ_DEFAULT_CHUNK_SIZE;
+   int arg = 1;
+   if (argc > arg && !strncmp(argv[arg], "-c", 2)) {
+      const char* value = argv[arg][2] ? argv[arg] + 2 : (++arg < argc ? argv[arg] : "");
+      char* end;
+      const unsigned long v = strtoul(value, &end, 0);
+      if (end == value || *end || v == 0 || v > EMBED_LZ_MAX_CHUNK_SIZE) {
+         fprintf(stderr, "embed-compress: bad chunk size '%s'\n", value);
+         return EXIT_FAILURE;
+      }
+      chunk_size = (uint32_t)v;
+      ++arg;
+   }
+   if (argc - arg != 2) {
+      fprintf(stderr, "usage: embed-compress [-c chunk-size] input output\n");
+      return EXIT_FAILURE;
+   }
+   const char* inpath = argv[arg];
+   const char* outpath = argv[arg + 1];
+
+   size_t size;
+   void* in = read_file(inpath, &size);
+   if (!in) {
+      fprintf(stderr, "embed-compress: can't read '%s': %s\n", inpath, strerror(errno));
+      return EXIT_FAILURE;
+   }
+   void* out = malloc(embed_lz_bound(size, chunk_size));
+   if (!out) {
+      fprintf(stderr, "embed-compress: out of memory\n");
+      return EXIT_FAILURE;
+   }
+   const size_t out_size = embed_lz_compress(in, size, out, chunk_size);
+
+   FILE* f = fopen(outpath, "wb");
+   if (!f || fwrite(out, 1, out_size, f) != out_size || fclose(f) != 0) {
+      fprintf(stderr, "embed-compress: can't write '%s': %s\n", outpath, strerror(errno));
+      return EXIT_FAILURE;
+   }
+   free(out);
+   free(in);
+   return EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
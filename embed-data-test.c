@@ -0,0 +1,150 @@
+/*
+ * Test for embed-data.sh with embed-index.c, embed-region.c and
+ * embed-verify.c. Link with an object made by
+ *    embed-data.sh -i -s -c -o embedded.o README:page rand.c rand.h
+ * and run from the directory holding those files: every file must be found
+ * by name, with the same contents, and other names must not be. README must
+ * be page-aligned, with the right 64-bit size, and take access hints. The
+ * digests must match, checked serially and in the background, and a corrupted
+ * buffer must fail.
+ */
+
+#include "embed-index.h"
+#include "embed-region.h"
+#include "embed-verify.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+extern const char DATA_README[], DATA_README_END[];
+extern const uint64_t DATA_README_SIZE, DATA_README_HASH;
+extern const char DATA_RAND_C[], DATA_RAND_C_END[];
+extern const uint64_t DATA_RAND_C_HASH;
+extern const char DATA_RAND_H[], DATA_RAND_H_END[];
+extern const uint64_t DATA_RAND_H_HASH;
+
+static const struct embed_check CHECKS[] = {
+   EMBED_CHECK(DATA_README), EMBED_CHECK(DATA_RAND_C), EMBED_CHECK(DATA_RAND_H)
+};
+#define NCHECKS (sizeof(CHECKS) / sizeof(CHECKS[0]))
+
+static const char* const EMBEDDED_FILES[] = { "README", "rand.c", "rand.h" };
+static const char* const MISSING_NAMES[] = { "", "readme", "rand", "rand.c ", "./rand.c", "rand.hh" };
+
+static int check(int* count, int* good_count, int ok, const char* what)
+{
+   ++*count;
+   if (ok) {
+      ++*good_count;
+   } else {
+      printf(" BAD %s\n", what);
+   }
+   return ok;
+}
+
+static void run_tests_verify(int* count, int* good_count)
+{
+   check(count, good_count, embed_verify(CHECKS, NCHECKS) == 0, "embed_verify");
+
+   struct embed_verifier* v = embed_verify_start(CHECKS, NCHECKS, 2, EMBED_VERIFY_DROP_PAGES);
+   check(count, good_count, v != NULL, "embed_verify_start");
+   if (!v) { return; }
+   check(count, good_count, embed_verify_wait_one(v, 1) == EMBED_VERIFY_OK, "embed_verify_wait_one");
+   check(count, good_count, embed_verify_finish(v) == 0, "embed_verify_finish");
+
+   /* several chunks, some empty data, and one corrupted copy */
+   const size_t size = 5 * EMBED_DIGEST_CHUNK + 12345;
+   char* data = malloc(size);
+   char* bad = malloc(size);
+   if (!data || !bad) { abort(); }
+   for (size_t i = 0; i < size; ++i) { data[i] = (char)(i * 2654435761u >> 13); }
+   memcpy(bad, data, size);
+   bad[3 * EMBED_DIGEST_CHUNK + 7] ^= 1;
+   const uint64_t digest = embed_digest(data, size);
+   const uint64_t empty_digest = embed_digest(data, 0);
+   const struct embed_check heap_checks[] = {
+      { data, data + size, &digest, "data" },
+      { bad, bad + size, &digest, "bad" },
+      { data, data, &empty_digest, "empty" },
+      { data, data + size - 1, &digest, "short" },
+   };
+   v = embed_verify_start(heap_checks, 4, 3, 0);
+   check(count, good_count, v != NULL, "embed_verify_start (heap)");
+   if (v) {
+      check(count, good_count, embed_verify_wait_one(v, 0) == EMBED_VERIFY_OK, "parallel digest");
+      check(count, good_count, embed_verify_wait_one(v, 1) == EMBED_VERIFY_FAILED, "corrupted data");
+      check(count, good_count, embed_verify_status(v, 2) == EMBED_VERIFY_OK, "empty data");
+      check(count, good_count, embed_verify_wait_one(v, 3) == EMBED_VERIFY_FAILED, "truncated data");
+      check(count, good_count, embed_verify_finish(v) == 2, "embed_verify_finish (heap)");
+   }
+   free(bad);
+   free(data);
+}
+
+static int check_file(const char* name)
+{
+   const struct embed_entry* e = find_embedded(name);
+   if (!e) {
+      printf(" BAD '%s' not found\n", name);
+      return 0;
+   }
+   FILE* f = fopen(name, "rb");
+   char* want = malloc(e->size + 1);
+   const size_t n = (f && want) ? fread(want, 1, e->size + 1, f) : 0;
+   const int ok = (n == e->size && !memcmp(want, embed_entry_data(e), n) && !strcmp(embed_entry_name(e), name));
+   if (!ok) { printf(" BAD '%s' has the wrong contents\n", name); }
+   free(want);
+   if (f) { fclose(f); }
+   return ok;
+}
+
+int main(void)
+{
+   int count = 0, good_count = 0;
+   for (size_t i = 0; i < sizeof(EMBEDDED_FILES) / sizeof(EMBEDDED_FILES[0]); ++i) {
+      ++count;
+      good_count += check_file(EMBEDDED_FILES[i]);
+   }
+   for (size_t i = 0; i < sizeof(MISSING_NAMES) / sizeof(MISSING_NAMES[0]); ++i) {
+      ++count;
+      if (find_embedded(MISSING_NAMES[i])) {
+         printf(" BAD '%s' found\n", MISSING_NAMES[i]);
+      } else {
+         ++good_count;
+      }
+   }
+   ++count;
+   if ((uintptr_t)DATA_README % (uintptr_t)sysconf(_SC_PAGESIZE) == 0
+         && DATA_README_SIZE == (uint64_t)(DATA_README_END - DATA_README)
+         && find_embedded("README") && DATA_README_SIZE == find_embedded("README")->size) {
+      ++good_count;
+   } else {
+      printf(" BAD README is misaligned or has the wrong size\n");
+   }
+   static const enum embed_hint HINTS[] = {
+      EMBED_HINT_WILLNEED, EMBED_HINT_POPULATE, EMBED_HINT_DONTNEED, EMBED_HINT_SEQUENTIAL, EMBED_HINT_NORMAL
+   };
+   for (size_t i = 0; i < sizeof(HINTS) / sizeof(HINTS[0]); ++i) {
+      ++count;
+      if (EMBED_REGION_HINT(DATA_README, HINTS[i]) == 0) {
+         ++good_count;
+      } else {
+         printf(" BAD hint %d failed\n", (int)HINTS[i]);
+      }
+   }
+   run_tests_verify(&count, &good_count);
+
+   ++count;
+   if (DATA_index.count == sizeof(EMBEDDED_FILES) / sizeof(EMBEDDED_FILES[0])) {
+      ++good_count;
+   } else {
+      printf(" BAD index has %u entries\n", (unsigned)DATA_index.count);
+   }
+
+   printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+   return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -19,7 +19,8 @@
 # This possibly allows inlining[??] but can break if things are relocated)
 #
 # In this script, given an input path "foo/fallback_font.ttf", three symbols
-# are defined, which can be declared in C++ as:
+# are defined (anything but letters, digits and '_' becomes '_' in the name),
+# which can be declared in C++ as:
 #
 #   extern "C" const char DATA_FOO_FALLBACK_FONT_TTF[];
 #   extern "C" const char DATA_FOO_FALLBACK_FONT_TTF_END[];
@@ -27,12 +28,52 @@
 #
 # the X and X_END symbols refer to the beginning and end of the data.
 # (ie, X_SIZE == X_END - X)
+#
+# With -z, each file is compressed first (by embed-compress, built from
+# embed-compress.c and embed-lz.c; set EMBED_COMPRESS to say where it is), and
+# the symbols refer to the compressed data. Read it through embed-lz.h, which
+# decompresses on first use:
+#
+#   static struct embed_lz_blob font = EMBED_LZ_BLOB_INIT(DATA_FOO_FALLBACK_FONT_TTF);
+#   const void *ttf = embed_lz_get(&font, &size);
+#
+# With -i, a table of all the files is emitted too (by embed-mkindex, built from
+# embed-mkindex.c and lookup3.c; set EMBED_MKINDEX to say where it is), so they
+# can be found by name without declaring each one. See embed-index.h:
+#
+#   const struct embed_entry *e = find_embedded("foo/fallback_font.ttf");
+#
+# With -c, a digest of each file's data (as stored, so compressed with -z) is
+# embedded too, computed by embed-hash (built from embed-hash.c, embed-verify.c,
+# embed-region.c and lookup3.c; set EMBED_HASH to say where it is), so that the
+# data can be checked at run time with embed-verify.h:
+#
+#   extern "C" const uint64_t DATA_FOO_FALLBACK_FONT_TTF_HASH;
+#
+# Alignment: -a sets the default (16), and a file can have its own by adding
+# ":N" to its path (a number; or "page" for the build machine's page size, or
+# "hugepage" for 2 MB), e.g. "tables/big.bin:page". A path that really ends in
+# ":" and digits needs a different spelling (e.g. "./x:1" -> "x:1:16").
+#
+# With -s, each file goes in its own section (.rodata.embed.X), padded at the
+# end to its alignment, so a page-aligned file shares no pages with anything
+# else and whole-page hints (madvise, mlock) affect only it; see embed-region.h.
+# The linker can also drop unused files then, with --gc-sections.
 
 ALIGN=16
+PAGE_SIZE="$(getconf PAGESIZE 2>/dev/null || echo 4096)"
+HUGE_PAGE_SIZE=2097152
 PREFIX=DATA_
 BASENAME_ONLY=no
+COMPRESS=no
+INDEX=no
+SECTIONS=no
+CHECKSUM=no
+EMBED_COMPRESS="${EMBED_COMPRESS:-embed-compress}"
+EMBED_MKINDEX="${EMBED_MKINDEX:-embed-mkindex}"
+EMBED_HASH="${EMBED_HASH:-embed-hash}"
 
-while getopts bo:a:p: flag; do
+while getopts bzisco:a:p: flag; do
 	case "$flag" in
 		o)
 			OUTPATH_ARG="-o$OPTARG";
@@ -46,6 +87,18 @@ while getopts bo:a:p: flag; do
 		b)
 			BASENAME_ONLY=yes;
 			;;
+		z)
+			COMPRESS=yes;
+			;;
+		i)
+			INDEX=yes;
+			;;
+		s)
+			SECTIONS=yes;
+			;;
+		c)
+			CHECKSUM=yes;
+			;;
 		?)
 			printf 'Unknown argument';
 			exit 1;
@@ -55,31 +108,92 @@ done
 
 shift $((OPTIND - 1));
 
+if test "$COMPRESS" = "yes"; then
+	TMPDIR_Z="$(mktemp -d)" || exit 1
+	trap 'rm -rf "$TMPDIR_Z"' EXIT
+	trap 'exit 1' HUP INT TERM
+fi
+
+N=0
+INDEX_LIST=
 {
 	printf '.section .rodata\n\n'
 
 	while test "$#" -gt 0; do
 		INPATH="$1"
-		SYM="$INPATH"
+		FILE_ALIGN="$ALIGN"
+		SUFFIX="${INPATH##*:}"
+		if test "$SUFFIX" != "$INPATH"; then
+			case "$SUFFIX" in
+				page) FILE_ALIGN="$PAGE_SIZE"; INPATH="${INPATH%:*}";;
+				hugepage) FILE_ALIGN="$HUGE_PAGE_SIZE"; INPATH="${INPATH%:*}";;
+				''|*[!0-9]*) ;;
+				*) FILE_ALIGN="$SUFFIX"; INPATH="${INPATH%:*}";;
+			esac
+		fi
+		NAME="$INPATH"
 		if test "$BASENAME_ONLY" = "yes"; then
-			SYM="$(basename "$SYM")"
+			NAME="$(basename "$NAME")"
 		fi
-		SYM="$(printf '%s%s' "$PREFIX" "$SYM" | tr '/.[:lower:]' '__[:upper:]')"
+		SYM="$(printf '%s%s' "$PREFIX" "$NAME" | tr -c '[:alnum:]_' '_' | tr '[:lower:]' '[:upper:]')"
+		INDEX_LIST="$INDEX_LIST$SYM $NAME
+"
 		shift 1;
+		if test "$COMPRESS" = "yes"; then
+			N=$((N + 1))
+			# (this runs in a subshell feeding as, so fail the assembly)
+			if ! "$EMBED_COMPRESS" "$INPATH" "$TMPDIR_Z/$N.lz"; then
+				printf '\t.error "could not compress %s"\n' "$INPATH"
+				exit 1
+			fi
+			INPATH="$TMPDIR_Z/$N.lz"
+		fi
+
+		if test "$SECTIONS" = "yes"; then
+			printf '\t.section .rodata.embed.%s,"a",@progbits\n' "$SYM"
+		fi
 
 cat <<END_SECTION
 	.global $SYM
 	.global ${SYM}_END
 	.global ${SYM}_SIZE
-	.balign $ALIGN
+	.balign $FILE_ALIGN
 $SYM:
 	.incbin "$INPATH"
 	.balign 1
 ${SYM}_END:
 	.int 0
-	.balign $ALIGN
+END_SECTION
+
+		if test "$SECTIONS" = "yes"; then
+			printf '\t.balign %s\n\t.section .rodata\n' "$FILE_ALIGN"
+		fi
+
+cat <<END_SECTION
+	.balign 8
 ${SYM}_SIZE:
-	.int ${SYM}_END - ${SYM}
+	.quad ${SYM}_END - ${SYM}
+
 END_SECTION
+
+		if test "$CHECKSUM" = "yes"; then
+			if ! HASH="$("$EMBED_HASH" "$INPATH")"; then
+				printf '\t.error "could not hash %s"\n' "$INPATH"
+				exit 1
+			fi
+			printf '\t.global %s_HASH\n%s_HASH:\n\t.quad %s\n\n' "$SYM" "$SYM" "$HASH"
+		fi
 	done
-} | as $OUTPATH_ARG
+
+	if test "$INDEX" = "yes"; then
+		ZFLAG=
+		if test "$COMPRESS" = "yes"; then ZFLAG=-z; fi
+		if ! printf '%s' "$INDEX_LIST" | "$EMBED_MKINDEX" $ZFLAG "$PREFIX"; then
+			printf '\t.error "could not make the index"\n'
+			exit 1
+		fi
+	fi
+
+	# no executable stack needed
+	printf '\t.section .note.GNU-stack,"",@progbits\n'
+} | as $OUTPATH_ARG || exit 1
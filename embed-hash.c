@@ -0,0 +1,44 @@
+/*
+ * Prints the embed_digest of a file (as used by embed-verify.h), for
+ * embed-data.sh -c to store as X_HASH.
+ *
+ * usage: embed-hash file
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "embed-verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+int main(int argc, char** argv)
+{
+   if (argc != 2) {
+      fprintf(stderr, "usage: embed-hash file\n");
+      return EXIT_FAILURE;
+   }
+   FILE* f = fopen(argv[1], "rb");
+   size_t capacity = 1 << 16, used = 0;
+   char* data = f ? malloc(capacity) : NULL;
+   while (data) {
+      used += fread(data + used, 1, capacity - used, f);
+      if (used < capacity) { break; }
+      char* bigger = realloc(data, capacity * 2);
+      if (!bigger) { free(data); data = NULL; errno = ENOMEM; break; }
+      data = bigger;
+      capacity *= 2;
+   }
+   if (!data || ferror(f)) {
+      fprintf(stderr, "embed-hash: can't read '%s': %s\n", argv[1], strerror(errno));
+      return EXIT_FAILURE;
+   }
+   fclose(f);
+   printf("0x%016llx\n", (unsigned long long)embed_digest(data, used));
+   free(data);
+   return EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
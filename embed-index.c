@@ -0,0 +1,21 @@
+#include "embed-index.h"
+#include "lookup3.h"
+#include <string.h>
+
+const struct embed_entry* find_embedded_in(const struct embed_index* index, const char* name)
+{
+   const size_t len = strlen(name);
+   const uint32_t hash = hashlittle(name, len, 0);
+   const struct embed_entry* entries = embed_index_entries(index);
+   const uint32_t* start = (const uint32_t*)(entries + index->count);
+   const uint32_t b = hash & index->bucket_mask;
+   for (uint32_t i = start[b]; i < start[b + 1]; ++i) {
+      const struct embed_entry* e = &entries[i];
+      if (e->hash == hash && e->name_len == len && !memcmp(embed_entry_name(e), name, len)) {
+         return e;
+      }
+   }
+   return NULL;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,86 @@
+#ifndef EMBED_INDEX_H
+#define EMBED_INDEX_H
+
+/*
+ * Lookup by name of the files embedded by embed-data.sh -i.
+ *
+ * With -i, embed-data.sh also emits a hash table of everything in the
+ * object, as a symbol named PREFIX "index" (DATA_index by default; lower
+ * case, so it can't clash with a file's symbols). The table is built at
+ * build time (by embed-mkindex), and it only holds offsets relative to
+ * itself, so it needs no relocations and nothing runs at startup:
+ *
+ *    const struct embed_entry* e = find_embedded("fonts/fallback.ttf");
+ *    if (e) { use(embed_entry_data(e), e->size); }
+ *
+ * Names are the paths as given to embed-data.sh (or just the file names,
+ * with -b). Lookup hashes the name with lookup3's hashlittle and checks
+ * one bucket, so it takes the same time however many files there are.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the data is in the embed-lz.h format (embed-data.sh -z) */
+#define EMBED_ENTRY_COMPRESSED 1u
+
+struct embed_entry {
+   /* offsets from the field itself to the name (NUL-terminated) and to the data */
+   int64_t name_offset;
+   int64_t data_offset;
+   /* size of the data as stored (compressed, if it is) */
+   uint64_t size;
+   /* hashlittle(name, name_len, 0) */
+   uint32_t hash;
+   uint16_t name_len;
+   uint16_t flags;
+};
+
+/* followed by count entries (grouped by bucket), then bucket_mask + 2 bucket
+ * start indexes (uint32_t): bucket b holds entries [start[b], start[b+1]) */
+struct embed_index {
+   uint32_t count;
+   uint32_t bucket_mask;
+};
+
+static inline const char* embed_entry_name(const struct embed_entry* e)
+{
+   return (const char*)&e->name_offset + e->name_offset;
+}
+
+static inline const void* embed_entry_data(const struct embed_entry* e)
+{
+   return (const char*)&e->data_offset + e->data_offset;
+}
+
+/* all the entries, for iteration; there are index->count of them */
+static inline const struct embed_entry* embed_index_entries(const struct embed_index* index)
+{
+   return (const struct embed_entry*)(index + 1);
+}
+
+/* returns the entry with the given name, or NULL */
+const struct embed_entry* find_embedded_in(const struct embed_index* index, const char* name);
+
+/* the index emitted with the default prefix */
+extern const struct embed_index DATA_index;
+
+static inline const struct embed_entry* find_embedded(const char* name)
+{
+   return find_embedded_in(&DATA_index, name);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,215 @@
+/*
+ * Tests for embed-lz.c: round trips over several kinds of data and chunk
+ * sizes, chunk-at-a-time reads, corrupted input, and embed_lz_get from
+ * several threads at once.
+ *
+ * usage: embed-lz-test [seed]
+ */
+
+#include "embed-lz.h"
+#include "rand.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+enum data_kind { DATA_ZERO, DATA_RANDOM, DATA_TEXT, DATA_RUNS, DATA_KIND_COUNT };
+static const char* const DATA_KIND_NAMES[DATA_KIND_COUNT] = { "zero", "random", "text", "runs" };
+
+static void generate(unsigned char* buf, size_t size, enum data_kind kind, struct xorshift_rng* rng)
+{
+   static const char* const WORDS[] = { "the ", "path ", "of ", "data ", "embedded ", "font ", "\n" };
+   size_t i = 0;
+   switch (kind) {
+      case DATA_ZERO: memset(buf, 0, size); break;
+      case DATA_RANDOM:
+         for (; i < size; ++i) { buf[i] = (unsigned char)xorshift_next_i32(rng); }
+         break;
+      case DATA_TEXT:
+         while (i < size) {
+            const char* w = WORDS[xorshift_next_i32(rng) % (sizeof(WORDS) / sizeof(WORDS[0]))];
+            for (; *w && i < size; ++w) { buf[i++] = (unsigned char)*w; }
+         }
+         break;
+      case DATA_RUNS:
+         while (i < size) {
+            const unsigned char c = (unsigned char)xorshift_next_i32(rng);
+            for (size_t n = 1 + xorshift_next_i32(rng) % 300; n && i < size; --n) { buf[i++] = c; }
+         }
+         break;
+      default: assert(0); break;
+   }
+}
+
+static int check(int* count, int* good_count, int ok, const char* what, const char* kind, size_t size, uint32_t chunk_size)
+{
+   ++*count;
+   if (ok) {
+      ++*good_count;
+   } else {
+      printf(" BAD %s (%s, %zu bytes, chunk size %u)\n", what, kind, size, (unsigned)chunk_size);
+   }
+   return ok;
+}
+
+static void run_tests_round_trip(int* count, int* good_count, struct xorshift_rng* rng)
+{
+   static const size_t SIZES[] = { 0, 1, 12, 13, 100, 4096, 65536, 65537, 300000 };
+   static const uint32_t CHUNK_SIZES[] = { 1, 16, 4096, EMBED_LZ_DEFAULT_CHUNK_SIZE, 1u << 20 };
+   for (int kind = 0; kind < DATA_KIND_COUNT; ++kind) {
+      for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+         for (size_t c = 0; c < sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]); ++c) {
+            const size_t size = SIZES[s];
+            const uint32_t chunk_size = CHUNK_SIZES[c];
+            const char* name = DATA_KIND_NAMES[kind];
+            if (chunk_size == 1 && size > 4096) { continue; }
+            unsigned char* in = malloc(size + 1);
+            unsigned char* z = malloc(embed_lz_bound(size, chunk_size));
+            unsigned char* out = malloc(size + 1);
+            unsigned char* piece = malloc(chunk_size);
+            assert(in && z && out && piece);
+            generate(in, size, (enum data_kind)kind, rng);
+
+            const size_t zsize = embed_lz_compress(in, size, z, chunk_size);
+            check(count, good_count, zsize <= embed_lz_bound(size, chunk_size), "bound", name, size, chunk_size);
+            struct embed_lz_info info;
+            check(count, good_count, embed_lz_info(z, zsize, &info) == 0 && info.size == size
+                  && info.chunk_size == chunk_size, "info", name, size, chunk_size);
+            check(count, good_count, embed_lz_decompress(z, zsize, out) == 0 && !memcmp(in, out, size),
+                  "decompress", name, size, chunk_size);
+
+            /* chunks, last first */
+            int chunks_ok = 1;
+            for (size_t i = info.chunk_count; i-- > 0; ) {
+               const size_t len = embed_lz_read_chunk(z, zsize, i, piece);
+               const size_t expected = (i + 1 < info.chunk_count) ? chunk_size : size - i * chunk_size;
+               chunks_ok = chunks_ok && len == expected && !memcmp(piece, in + i * chunk_size, len);
+            }
+            check(count, good_count, chunks_ok, "read_chunk", name, size, chunk_size);
+            check(count, good_count, embed_lz_read_chunk(z, zsize, info.chunk_count, piece) == 0,
+                  "read_chunk past the end", name, size, chunk_size);
+            if (kind == DATA_ZERO && size >= 4096 && chunk_size >= 4096) {
+               check(count, good_count, zsize * 50 < size, "compression ratio", name, size, chunk_size);
+            }
+            if (kind == DATA_RANDOM && size > 0) {
+               check(count, good_count, zsize <= size + 16 + 4 * info.chunk_count, "stored", name, size, chunk_size);
+            }
+
+            free(piece);
+            free(out);
+            free(z);
+            free(in);
+         }
+      }
+   }
+}
+
+/* corrupt and truncated blobs must be rejected (or at least not overrun anything) */
+static void run_tests_corrupt(int* count, int* good_count, struct xorshift_rng* rng)
+{
+   const size_t size = 20000;
+   unsigned char* in = malloc(size);
+   unsigned char* z = malloc(embed_lz_bound(size, 4096));
+   unsigned char* bad = malloc(embed_lz_bound(size, 4096));
+   unsigned char* out = malloc(size);
+   assert(in && z && bad && out);
+   generate(in, size, DATA_TEXT, rng);
+   const size_t zsize = embed_lz_compress(in, size, z, 4096);
+
+   int truncated_ok = 1;
+   for (size_t n = 0; n < zsize; n += 1 + n / 8) {
+      truncated_ok = truncated_ok && embed_lz_decompress(z, n, out) != 0;
+   }
+   check(count, good_count, truncated_ok, "truncated", "text", size, 4096);
+
+   for (int i = 0; i < 2000; ++i) {
+      memcpy(bad, z, zsize);
+      for (int k = 1 + (int)(xorshift_next_i32(rng) % 4); k; --k) {
+         bad[16 + xorshift_next_i32(rng) % (zsize - 16)] ^= (unsigned char)(1 + xorshift_next_i32(rng) % 255);
+      }
+      /* the result doesn't matter, only that the decoder stays in bounds */
+      (void)embed_lz_decompress(bad, zsize, out);
+   }
+   check(count, good_count, 1, "random corruption", "text", size, 4096);
+
+   memcpy(bad, z, zsize);
+   memcpy(bad, "ELZ2", 4);
+   check(count, good_count, embed_lz_decompress(bad, zsize, out) != 0, "bad magic", "text", size, 4096);
+
+   free(out);
+   free(bad);
+   free(z);
+   free(in);
+}
+
+#define BLOB_THREADS 4
+
+struct blob_test {
+   struct embed_lz_blob* blob;
+   const void* result;
+   size_t size;
+};
+
+static void* blob_thread(void* arg)
+{
+   struct blob_test* t = arg;
+   t->result = embed_lz_get(t->blob, &t->size);
+   return NULL;
+}
+
+static void run_tests_blob(int* count, int* good_count, struct xorshift_rng* rng)
+{
+   const size_t size = 1000000;
+   unsigned char* in = malloc(size);
+   char* z = malloc(embed_lz_bound(size, EMBED_LZ_DEFAULT_CHUNK_SIZE));
+   assert(in && z);
+   generate(in, size, DATA_RUNS, rng);
+   const size_t zsize = embed_lz_compress(in, size, z, EMBED_LZ_DEFAULT_CHUNK_SIZE);
+
+   /* stands in for the symbols from embed-data.sh */
+   const char* BLOB = z;
+   const char* BLOB_END = z + zsize;
+   struct embed_lz_blob blob = EMBED_LZ_BLOB_INIT(BLOB);
+
+   struct blob_test tests[BLOB_THREADS];
+   pthread_t threads[BLOB_THREADS];
+   for (int i = 0; i < BLOB_THREADS; ++i) {
+      tests[i].blob = &blob;
+      int rc = pthread_create(&threads[i], NULL, &blob_thread, &tests[i]);
+      assert(rc == 0);
+      (void)rc;
+   }
+   int same = 1;
+   for (int i = 0; i < BLOB_THREADS; ++i) {
+      pthread_join(threads[i], NULL);
+      same = same && tests[i].result == tests[0].result && tests[i].size == size;
+   }
+   check(count, good_count, same && tests[0].result && !memcmp(tests[0].result, in, size), "embed_lz_get", "runs", size, EMBED_LZ_DEFAULT_CHUNK_SIZE);
+   size_t again_size = 0;
+   check(count, good_count, embed_lz_get(&blob, &again_size) == tests[0].result && again_size == size,
+         "embed_lz_get (cached)", "runs", size, EMBED_LZ_DEFAULT_CHUNK_SIZE);
+   embed_lz_release(&blob);
+
+   z[0] = 'X';
+   check(count, good_count, embed_lz_get(&blob, NULL) == NULL, "embed_lz_get (corrupt)", "runs", size, EMBED_LZ_DEFAULT_CHUNK_SIZE);
+
+   free(z);
+   free(in);
+}
+
+int main(int argc, char** argv)
+{
+   int count = 0, good_count = 0;
+   struct xorshift_rng rng;
+   xorshift_init(&rng, (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 12345u);
+
+   run_tests_round_trip(&count, &good_count, &rng);
+   run_tests_corrupt(&count, &good_count, &rng);
+   run_tests_blob(&count, &good_count, &rng);
+
+   printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+   return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,293 @@
+#include "embed-lz.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define EMBED_LZ_HEADER_SIZE 16
+#define EMBED_LZ_STORED 0x80000000u
+
+/* LZ4 block format limits: matches are at least MIN_MATCH long and at most
+ * MAX_OFFSET back; the last LAST_LITERALS bytes are always literals, and no
+ * match starts in the last MATCH_LIMIT bytes */
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+#define HASH_BITS 12
+
+static uint32_t read32(const unsigned char* p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write32(unsigned char* p, uint32_t v)
+{
+   p[0] = (unsigned char)v;
+   p[1] = (unsigned char)(v >> 8);
+   p[2] = (unsigned char)(v >> 16);
+   p[3] = (unsigned char)(v >> 24);
+}
+
+static size_t chunk_count(uint64_t size, uint32_t chunk_size)
+{
+   return (size_t)((size + chunk_size - 1) / chunk_size);
+}
+
+#ifndef NDEBUG
+static size_t chunk_bound(size_t size)
+{
+   return size + size / 255 + 16;
+}
+#endif
+
+size_t embed_lz_bound(size_t size, uint32_t chunk_size)
+{
+   assert(chunk_size > 0 && chunk_size <= EMBED_LZ_MAX_CHUNK_SIZE);
+   const size_t n = chunk_count(size, chunk_size);
+   return EMBED_LZ_HEADER_SIZE + 4 * n + size + size / 255 + 16 * n;
+}
+
+static unsigned char* put_length(unsigned char* op, size_t len)
+{
+   for (; len >= 255; len -= 255) { *op++ = 255; }
+   *op++ = (unsigned char)len;
+   return op;
+}
+
+static unsigned char* put_sequence(unsigned char* op, const unsigned char* literals, size_t nlit,
+      size_t offset, size_t match_len)
+{
+   unsigned char* token = op++;
+   *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+   if (nlit >= 15) { op = put_length(op, nlit - 15); }
+   memcpy(op, literals, nlit);
+   op += nlit;
+   if (match_len) {
+      *op++ = (unsigned char)offset;
+      *op++ = (unsigned char)(offset >> 8);
+      match_len -= MIN_MATCH;
+      *token |= (unsigned char)(match_len < 15 ? match_len : 15);
+      if (match_len >= 15) { op = put_length(op, match_len - 15); }
+   }
+   return op;
+}
+
+/* greedy: take the most recent earlier position with the same 4-byte hash, if it matches */
+static size_t compress_chunk(const unsigned char* in, size_t n, unsigned char* out)
+{
+   uint32_t table[1u << HASH_BITS];
+   const unsigned char* anchor = in;
+   unsigned char* op = out;
+
+   if (n > MATCH_LIMIT) {
+      const unsigned char* ip = in;
+      const unsigned char* const limit = in + n - MATCH_LIMIT;
+      const unsigned char* const match_end = in + n - LAST_LITERALS;
+      /* positions are stored + 1, so 0 is empty */
+      memset(table, 0, sizeof(table));
+      while (ip < limit) {
+         const uint32_t seq = read32(ip);
+         const uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+         const uint32_t cand = table[h];
+         table[h] = (uint32_t)(ip - in) + 1;
+         if (!cand || (size_t)(ip - in) - (cand - 1) > MAX_OFFSET || read32(in + cand - 1) != seq) {
+            ++ip;
+            continue;
+         }
+         const unsigned char* m = in + cand - 1;
+         size_t len = MIN_MATCH;
+         while (ip + len < match_end && ip[len] == m[len]) { ++len; }
+         op = put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - m), len);
+         ip += len;
+         anchor = ip;
+      }
+   }
+   op = put_sequence(op, anchor, (size_t)(in + n - anchor), 0, 0);
+   return (size_t)(op - out);
+}
+
+size_t embed_lz_compress(const void* in, size_t size, void* out, uint32_t chunk_size)
+{
+   assert(chunk_size > 0 && chunk_size <= EMBED_LZ_MAX_CHUNK_SIZE);
+   const unsigned char* src = (const unsigned char*)in;
+   unsigned char* dst = (unsigned char*)out;
+   const size_t n = chunk_count(size, chunk_size);
+
+   memcpy(dst, "ELZ1", 4);
+   write32(dst + 4, chunk_size);
+   write32(dst + 8, (uint32_t)size);
+   write32(dst + 12, (uint32_t)((uint64_t)size >> 32));
+
+   unsigned char* op = dst + EMBED_LZ_HEADER_SIZE + 4 * n;
+   for (size_t i = 0; i < n; ++i) {
+      const size_t len = (i + 1 < n) ? chunk_size : size - i * (size_t)chunk_size;
+      const unsigned char* chunk = src + i * (size_t)chunk_size;
+      size_t clen = compress_chunk(chunk, len, op);
+      assert(clen <= chunk_bound(len));
+      uint32_t entry = (uint32_t)clen;
+      if (clen >= len) {
+         /* incompressible: store it */
+         memcpy(op, chunk, len);
+         clen = len;
+         entry = (uint32_t)len | EMBED_LZ_STORED;
+      }
+      write32(dst + EMBED_LZ_HEADER_SIZE + 4 * i, entry);
+      op += clen;
+   }
+   return (size_t)(op - dst);
+}
+
+int embed_lz_info(const void* data, size_t data_size, struct embed_lz_info* info)
+{
+   const unsigned char* p = (const unsigned char*)data;
+   if (data_size < EMBED_LZ_HEADER_SIZE || memcmp(p, "ELZ1", 4) != 0) { return -1; }
+   const uint32_t chunk_size = read32(p + 4);
+   const uint64_t size = (uint64_t)read32(p + 8) | ((uint64_t)read32(p + 12) << 32);
+   if (chunk_size == 0 || chunk_size > EMBED_LZ_MAX_CHUNK_SIZE || size != (uint64_t)(size_t)size) { return -1; }
+   const uint64_t n = (size + chunk_size - 1) / chunk_size;
+   if (n > (data_size - EMBED_LZ_HEADER_SIZE) / 4) { return -1; }
+   info->size = size;
+   info->chunk_size = chunk_size;
+   info->chunk_count = (size_t)n;
+   return 0;
+}
+
+static size_t get_length(const unsigned char** pp, const unsigned char* end, size_t len)
+{
+   const unsigned char* p = *pp;
+   unsigned char b;
+   do {
+      if (p == end) { return (size_t)-1; }
+      b = *p++;
+      len += b;
+   } while (b == 255);
+   *pp = p;
+   return len;
+}
+
+/* returns 0 if [in, in_end) decodes to exactly n bytes at out, otherwise -1 */
+static int decompress_chunk(const unsigned char* in, const unsigned char* in_end, unsigned char* out, size_t n)
+{
+   unsigned char* op = out;
+   unsigned char* const op_end = out + n;
+   while (in < in_end) {
+      const unsigned token = *in++;
+      size_t nlit = token >> 4;
+      if (nlit == 15 && (nlit = get_length(&in, in_end, nlit)) == (size_t)-1) { return -1; }
+      if (nlit > (size_t)(in_end - in) || nlit > (size_t)(op_end - op)) { return -1; }
+      memcpy(op, in, nlit);
+      in += nlit;
+      op += nlit;
+      if (in == in_end) { break; }
+
+      if (in_end - in < 2) { return -1; }
+      const size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+      in += 2;
+      if (offset == 0 || offset > (size_t)(op - out)) { return -1; }
+      size_t len = token & 15;
+      if (len == 15 && (len = get_length(&in, in_end, len)) == (size_t)-1) { return -1; }
+      len += MIN_MATCH;
+      if (len > (size_t)(op_end - op)) { return -1; }
+      const unsigned char* m = op - offset;
+      if (offset >= len) {
+         memcpy(op, m, len);
+         op += len;
+      } else {
+         /* overlapping: repeats the last 'offset' bytes */
+         while (len--) { *op++ = *m++; }
+      }
+   }
+   return (op == op_end) ? 0 : -1;
+}
+
+size_t embed_lz_read_chunk(const void* data, size_t data_size, size_t index, void* out)
+{
+   struct embed_lz_info info;
+   if (embed_lz_info(data, data_size, &info) != 0 || index >= info.chunk_count) { return 0; }
+   const unsigned char* p = (const unsigned char*)data;
+   const unsigned char* const end = p + data_size;
+   const unsigned char* chunk = p + EMBED_LZ_HEADER_SIZE + 4 * info.chunk_count;
+   for (size_t i = 0; i < index; ++i) {
+      const uint32_t clen = read32(p + EMBED_LZ_HEADER_SIZE + 4 * i) & ~EMBED_LZ_STORED;
+      if (clen > (size_t)(end - chunk)) { return 0; }
+      chunk += clen;
+   }
+
+   const uint32_t entry = read32(p + EMBED_LZ_HEADER_SIZE + 4 * index);
+   const size_t clen = entry & ~EMBED_LZ_STORED;
+   const size_t len = (index + 1 < info.chunk_count) ? info.chunk_size
+      : (size_t)(info.size - (uint64_t)index * info.chunk_size);
+   if (clen > (size_t)(end - chunk)) { return 0; }
+   if (entry & EMBED_LZ_STORED) {
+      if (clen != len) { return 0; }
+      memcpy(out, chunk, len);
+   } else if (decompress_chunk(chunk, chunk + clen, (unsigned char*)out, len) != 0) {
+      return 0;
+   }
+   return len;
+}
+
+int embed_lz_decompress(const void* data, size_t data_size, void* out)
+{
+   struct embed_lz_info info;
+   if (embed_lz_info(data, data_size, &info) != 0) { return -1; }
+   const unsigned char* p = (const unsigned char*)data;
+   const unsigned char* const end = p + data_size;
+   const unsigned char* chunk = p + EMBED_LZ_HEADER_SIZE + 4 * info.chunk_count;
+   unsigned char* op = (unsigned char*)out;
+   for (size_t i = 0; i < info.chunk_count; ++i) {
+      const uint32_t entry = read32(p + EMBED_LZ_HEADER_SIZE + 4 * i);
+      const size_t clen = entry & ~EMBED_LZ_STORED;
+      const size_t len = (i + 1 < info.chunk_count) ? info.chunk_size
+         : (size_t)(info.size - (uint64_t)i * info.chunk_size);
+      if (clen > (size_t)(end - chunk)) { return -1; }
+      if (entry & EMBED_LZ_STORED) {
+         if (clen != len) { return -1; }
+         memcpy(op, chunk, len);
+      } else if (decompress_chunk(chunk, chunk + clen, op, len) != 0) {
+         return -1;
+      }
+      chunk += clen;
+      op += len;
+   }
+   return 0;
+}
+
+const void* embed_lz_get(struct embed_lz_blob* blob, size_t* size)
+{
+   /* fast path: already decompressed (the release store below publishes size too) */
+   void* data = __atomic_load_n(&blob->data, __ATOMIC_ACQUIRE);
+   if (!data) {
+      pthread_mutex_lock(&blob->lock);
+      data = blob->data;
+      if (!data) {
+         struct embed_lz_info info;
+         const size_t data_size = (size_t)(blob->end - blob->begin);
+         if (embed_lz_info(blob->begin, data_size, &info) == 0) {
+            /* at least one byte, so that an empty blob still gets a non-null pointer */
+            data = malloc(info.size ? (size_t)info.size : 1);
+            if (data && embed_lz_decompress(blob->begin, data_size, data) != 0) {
+               free(data);
+               data = NULL;
+            }
+         }
+         if (data) {
+            blob->size = (size_t)info.size;
+            __atomic_store_n(&blob->data, data, __ATOMIC_RELEASE);
+         }
+      }
+      pthread_mutex_unlock(&blob->lock);
+      if (!data) { return NULL; }
+   }
+   if (size) { *size = blob->size; }
+   return data;
+}
+
+void embed_lz_release(struct embed_lz_blob* blob)
+{
+   free(blob->data);
+   blob->data = NULL;
+   blob->size = 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
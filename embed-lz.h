@@ -0,0 +1,104 @@
+#ifndef EMBED_LZ_H
+#define EMBED_LZ_H
+
+/*
+ * Compressed data for embed-data.sh -z, and lazy access to it at run time.
+ *
+ * The format is a small header followed by independently compressed chunks,
+ * so a blob can be decompressed all at once or a chunk at a time:
+ *
+ *    offset 0:  "ELZ1"
+ *           4:  chunk size (uint32, little-endian)
+ *           8:  uncompressed size (uint64, little-endian)
+ *          16:  one uint32 per chunk: its compressed size; if bit 31 is set,
+ *               the chunk is stored uncompressed (and the size is the low bits)
+ *         ...:  the chunks
+ *
+ * Chunks use the LZ4 block format (a token byte of literal and match lengths,
+ * the literals, a 16-bit offset, extra length bytes), so the decoder is short
+ * and fast. Every chunk but the last holds exactly 'chunk size' bytes
+ * uncompressed.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMBED_LZ_DEFAULT_CHUNK_SIZE (64u * 1024u)
+#define EMBED_LZ_MAX_CHUNK_SIZE (1u << 30)
+
+/* compression (used by embed-compress at build time) */
+
+/* the most bytes embed_lz_compress can write for 'size' bytes of input */
+size_t embed_lz_bound(size_t size, uint32_t chunk_size);
+/* returns the compressed size; out must hold embed_lz_bound(size, chunk_size) bytes */
+size_t embed_lz_compress(const void* in, size_t size, void* out, uint32_t chunk_size);
+
+/* decompression */
+
+struct embed_lz_info {
+   uint64_t size;
+   uint32_t chunk_size;
+   size_t chunk_count;
+};
+
+/* reads the header; returns 0, or -1 if the data isn't a valid blob */
+int embed_lz_info(const void* data, size_t data_size, struct embed_lz_info* info);
+
+/*
+ * Decompresses chunk 'index' into out, which must hold info.chunk_size bytes.
+ * Chunks don't depend on each other, so they can be read in any order (or by
+ * several threads at once). Finding a chunk walks the size table.
+ * Returns the chunk's uncompressed size, or 0 if the data is corrupt.
+ */
+size_t embed_lz_read_chunk(const void* data, size_t data_size, size_t index, void* out);
+
+/* decompresses everything into out (info.size bytes); returns 0, or -1 if the data is corrupt */
+int embed_lz_decompress(const void* data, size_t data_size, void* out);
+
+/*
+ * Lazily decompressed blob. Declare one per embedded file and initialise it
+ * with the symbols from embed-data.sh:
+ *
+ *    extern const char DATA_FONT_TTF[], DATA_FONT_TTF_END[];
+ *    static struct embed_lz_blob font = EMBED_LZ_BLOB_INIT(DATA_FONT_TTF);
+ *    ...
+ *    size_t size;
+ *    const unsigned char* ttf = embed_lz_get(&font, &size);
+ *
+ * Nothing is decompressed (or paged in) until the first embed_lz_get, which
+ * decompresses the whole blob into a buffer that's kept for later calls.
+ * embed_lz_get is thread-safe. For streaming, use embed_lz_read_chunk on
+ * blob.begin directly instead.
+ */
+struct embed_lz_blob {
+   const char* begin;
+   const char* end;
+   pthread_mutex_t lock;
+   void* data;
+   size_t size;
+};
+
+#define EMBED_LZ_BLOB_INIT(sym) { sym, sym##_END, PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+
+/* returns the decompressed data (and its size, if size isn't NULL), or NULL
+ * if the blob is corrupt or there isn't enough memory */
+const void* embed_lz_get(struct embed_lz_blob* blob, size_t* size);
+
+/* frees the cached data; no other thread may be using the blob */
+void embed_lz_release(struct embed_lz_blob* blob);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
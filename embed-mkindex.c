@@ -0,0 +1,166 @@
+/*
+ * Writes (as assembly) the table read by embed-index.h; embed-data.sh -i
+ * runs this with a line per embedded file on stdin: its symbol, a space, and
+ * the name to look it up by.
+ *
+ * usage: embed-mkindex [-z] prefix < list
+ *
+ * -z marks every entry as compressed (embed-data.sh -z).
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "embed-index.h"
+#include "lookup3.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct item {
+   const char* sym;
+   const char* name;
+   size_t name_len;
+   uint32_t hash;
+};
+
+static uint32_t s_bucket_mask;
+
+static int compare_items(const void* a, const void* b)
+{
+   const struct item* x = a;
+   const struct item* y = b;
+   const uint32_t bx = x->hash & s_bucket_mask, by = y->hash & s_bucket_mask;
+   if (bx != by) { return (bx < by) ? -1 : 1; }
+   return strcmp(x->name, y->name);
+}
+
+static char* read_all(FILE* f, size_t* size)
+{
+   size_t capacity = 4096, used = 0;
+   char* data = malloc(capacity + 1);
+   while (data) {
+      used += fread(data + used, 1, capacity - used, f);
+      if (used < capacity) { break; }
+      char* bigger = realloc(data, capacity * 2 + 1);
+      if (!bigger) { free(data); return NULL; }
+      data = bigger;
+      capacity *= 2;
+   }
+   if (data) { data[used] = '\0'; }
+   *size = used;
+   return data;
+}
+
+static void put_string(const char* s)
+{
+   putchar('"');
+   for (; *s; ++s) {
+      const unsigned char c = (unsigned char)*s;
+      if (c == '"' || c == '\\') {
+         printf("\\%c", c);
+      } else if (c < 0x20 || c >= 0x7f) {
+         printf("\\%03o", c);
+      } else {
+         putchar(c);
+      }
+   }
+   putchar('"');
+}
+
+int main(int argc, char** argv)
+{
+   int arg = 1;
+   unsigned flags = 0;
+   if (argc > arg && !strcmp(argv[arg], "-z")) {
+      flags |= EMBED_ENTRY_COMPRESSED;
+      ++arg;
+   }
+   if (argc - arg != 1) {
+      fprintf(stderr, "usage: embed-mkindex [-z] prefix < list\n");
+      return EXIT_FAILURE;
+   }
+   const char* prefix = argv[arg];
+
+   size_t size;
+   char* list = read_all(stdin, &size);
+   if (!list) {
+      fprintf(stderr, "embed-mkindex: out of memory\n");
+      return EXIT_FAILURE;
+   }
+   size_t count = 0;
+   for (size_t i = 0; i < size; ++i) { count += (list[i] == '\n'); }
+   struct item* items = malloc((count + 1) * sizeof(struct item));
+   if (!items) {
+      fprintf(stderr, "embed-mkindex: out of memory\n");
+      return EXIT_FAILURE;
+   }
+
+   count = 0;
+   for (char* line = list; *line; ) {
+      char* end = strchr(line, '\n');
+      if (end) { *end = '\0'; }
+      char* space = strchr(line, ' ');
+      if (*line) {
+         if (!space || space == line || !space[1]) {
+            fprintf(stderr, "embed-mkindex: bad line '%s'\n", line);
+            return EXIT_FAILURE;
+         }
+         *space = '\0';
+         struct item* it = &items[count++];
+         it->sym = line;
+         it->name = space + 1;
+         it->name_len = strlen(it->name);
+         if (it->name_len > 0xffff) {
+            fprintf(stderr, "embed-mkindex: name too long '%s'\n", it->name);
+            return EXIT_FAILURE;
+         }
+         it->hash = hashlittle(it->name, it->name_len, 0);
+      }
+      if (!end) { break; }
+      line = end + 1;
+   }
+
+   /* at least as many buckets as entries, so buckets hold about one entry each */
+   uint32_t nbuckets = 1;
+   while (nbuckets < count) { nbuckets *= 2; }
+   s_bucket_mask = nbuckets - 1;
+   qsort(items, count, sizeof(struct item), &compare_items);
+   for (size_t i = 1; i < count; ++i) {
+      if (!strcmp(items[i-1].name, items[i].name)) {
+         fprintf(stderr, "embed-mkindex: '%s' is embedded twice\n", items[i].name);
+         return EXIT_FAILURE;
+      }
+   }
+
+   printf("\n\t.section .rodata\n");
+   printf("\t.global %sindex\n", prefix);
+   printf("\t.balign 8\n");
+   printf("%sindex:\n", prefix);
+   printf("\t.int %zu\n", count);
+   printf("\t.int %lu\n", (unsigned long)s_bucket_mask);
+   for (size_t i = 0; i < count; ++i) {
+      printf("\t.quad .Lembed_name_%zu - .\n", i);
+      printf("\t.quad %s - .\n", items[i].sym);
+      printf("\t.quad %s_END - %s\n", items[i].sym, items[i].sym);
+      printf("\t.int %lu\n", (unsigned long)items[i].hash);
+      printf("\t.short %zu\n", items[i].name_len);
+      printf("\t.short %u\n", flags);
+   }
+   size_t next = 0;
+   for (uint32_t b = 0; b <= nbuckets; ++b) {
+      while (next < count && (items[next].hash & s_bucket_mask) < b) { ++next; }
+      printf("\t.int %zu\n", next);
+   }
+   for (size_t i = 0; i < count; ++i) {
+      printf(".Lembed_name_%zu:\n\t.asciz ", i);
+      put_string(items[i].name);
+      putchar('\n');
+   }
+
+   free(items);
+   free(list);
+   return (fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set sts=3 sw=3 et: */
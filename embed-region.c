@@ -0,0 +1,59 @@
+/* madvise and the MADV_ constants aren't in X/Open */
+#define _DEFAULT_SOURCE
+#include "embed-region.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+int embed_region_hint(const void* begin, const void* end, enum embed_hint hint)
+{
+   const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+   uintptr_t lo = (uintptr_t)begin;
+   uintptr_t hi = (uintptr_t)end;
+   if (hi < lo) {
+      errno = EINVAL;
+      return -1;
+   }
+   if (hint == EMBED_HINT_DONTNEED) {
+      lo = (lo + page - 1) & ~(page - 1);
+      hi &= ~(page - 1);
+      if (hi <= lo) { return 0; }
+   } else {
+      lo &= ~(page - 1);
+      hi = (hi + page - 1) & ~(page - 1);
+   }
+   void* const p = (void*)lo;
+   const size_t len = (size_t)(hi - lo);
+   if (!len) { return 0; }
+
+   switch (hint) {
+      case EMBED_HINT_NORMAL: return madvise(p, len, MADV_NORMAL);
+      case EMBED_HINT_SEQUENTIAL: return madvise(p, len, MADV_SEQUENTIAL);
+      case EMBED_HINT_RANDOM: return madvise(p, len, MADV_RANDOM);
+      case EMBED_HINT_WILLNEED: return madvise(p, len, MADV_WILLNEED);
+      case EMBED_HINT_DONTNEED: return madvise(p, len, MADV_DONTNEED);
+      case EMBED_HINT_POPULATE: {
+#ifdef MADV_POPULATE_READ
+         if (madvise(p, len, MADV_POPULATE_READ) == 0) { return 0; }
+         if (errno != EINVAL) { return -1; }
+#endif
+         /* older kernels: touch a byte of each page */
+         const volatile char* c = (const volatile char*)lo;
+         for (uintptr_t off = 0; off < len; off += page) { (void)c[off]; }
+         return 0;
+      }
+      case EMBED_HINT_LOCK: return mlock(p, len);
+      case EMBED_HINT_UNLOCK: return munlock(p, len);
+      case EMBED_HINT_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+         return madvise(p, len, MADV_HUGEPAGE);
+#else
+         break;
+#endif
+   }
+   errno = EINVAL;
+   return -1;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,62 @@
+#ifndef EMBED_REGION_H
+#define EMBED_REGION_H
+
+/*
+ * Access hints for embedded data (or any other read-only region of the
+ * executable). Embedded files are mapped from the executable like code, so the
+ * kernel pages them in on first touch and may drop them again under memory
+ * pressure; these let a program say how a file will be used:
+ *
+ *    extern const char DATA_TABLES_BIG_BIN[], DATA_TABLES_BIG_BIN_END[];
+ *    EMBED_REGION_HINT(DATA_TABLES_BIG_BIN, EMBED_HINT_LOCK);
+ *
+ * Hints work on whole pages. Except for EMBED_HINT_DONTNEED, a region is
+ * widened to the pages it touches, so unless the file was embedded page-aligned
+ * in its own section (embed-data.sh -s, "file:page") a hint may also cover
+ * whatever shares its first and last page. EMBED_HINT_DONTNEED is narrowed to
+ * the pages entirely inside the region instead.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum embed_hint {
+   /* undo SEQUENTIAL or RANDOM */
+   EMBED_HINT_NORMAL,
+   /* read ahead aggressively, and drop pages soon after they're read */
+   EMBED_HINT_SEQUENTIAL,
+   /* no read-ahead */
+   EMBED_HINT_RANDOM,
+   /* start reading it in now (returns without waiting) */
+   EMBED_HINT_WILLNEED,
+   /* read it in now, and wait until it's all resident */
+   EMBED_HINT_POPULATE,
+   /* not needed for now: the pages can be dropped (they're read again if touched) */
+   EMBED_HINT_DONTNEED,
+   /* keep it resident (mlock; limited by RLIMIT_MEMLOCK) */
+   EMBED_HINT_LOCK,
+   /* undo LOCK */
+   EMBED_HINT_UNLOCK,
+   /* use transparent huge pages if possible (needs huge-page alignment, and
+    * a kernel that supports them for file mappings) */
+   EMBED_HINT_HUGEPAGE
+};
+
+/* returns 0, or -1 with errno set (EINVAL if the system doesn't support the hint) */
+int embed_region_hint(const void* begin, const void* end, enum embed_hint hint);
+
+#define EMBED_REGION_HINT(sym, hint) embed_region_hint(sym, sym##_END, hint)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
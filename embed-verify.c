@@ -0,0 +1,223 @@
+#include "embed-verify.h"
+#include "embed-region.h"
+#include "lookup3.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define EMBED_VERIFY_MAX_THREADS 64
+
+static void chunk_hash(const char* p, size_t len, uint32_t* hash)
+{
+   uint32_t c = 0, b = 0;
+   hashlittle2(p, len, &c, &b);
+   hash[0] = c;
+   hash[1] = b;
+}
+
+/* folds a chunk hash into the digest; bytes in a fixed order, so the result doesn't depend on endianness */
+static void fold(uint32_t* pc, uint32_t* pb, const uint32_t* hash)
+{
+   unsigned char bytes[8];
+   for (int i = 0; i < 4; ++i) {
+      bytes[i] = (unsigned char)(hash[0] >> (8 * i));
+      bytes[4 + i] = (unsigned char)(hash[1] >> (8 * i));
+   }
+   hashlittle2(bytes, sizeof(bytes), pc, pb);
+}
+
+static size_t chunk_count(size_t size)
+{
+   return (size + EMBED_DIGEST_CHUNK - 1) / EMBED_DIGEST_CHUNK;
+}
+
+uint64_t embed_digest(const void* data, size_t size)
+{
+   const char* p = (const char*)data;
+   uint32_t pc = (uint32_t)size, pb = (uint32_t)((uint64_t)size >> 32);
+   for (size_t off = 0; off < size; off += EMBED_DIGEST_CHUNK) {
+      uint32_t hash[2];
+      chunk_hash(p + off, (size - off < EMBED_DIGEST_CHUNK) ? size - off : EMBED_DIGEST_CHUNK, hash);
+      fold(&pc, &pb, hash);
+   }
+   return (uint64_t)pc | ((uint64_t)pb << 32);
+}
+
+size_t embed_verify(const struct embed_check* checks, size_t count)
+{
+   size_t failed = 0;
+   for (size_t i = 0; i < count; ++i) {
+      failed += (embed_digest(checks[i].begin, (size_t)(checks[i].end - checks[i].begin)) != *checks[i].expected);
+   }
+   return failed;
+}
+
+/*
+ * The chunks of all the files are numbered consecutively (file i has chunks
+ * first_chunk[i] up to first_chunk[i+1]), and threads take the next chunk
+ * number until there are none left. Whichever thread hashes the last chunk of
+ * a file folds the file's chunk hashes and publishes the result.
+ */
+struct embed_verifier {
+   const struct embed_check* checks;
+   size_t count;
+   unsigned flags;
+   size_t* first_chunk;
+   uint32_t* chunk_hashes;
+   size_t* remaining;
+   unsigned char* status;
+   size_t total_chunks;
+   size_t next_chunk;
+   pthread_mutex_t lock;
+   pthread_cond_t changed;
+   pthread_t threads[EMBED_VERIFY_MAX_THREADS];
+   unsigned nthreads;
+};
+
+static void set_status(struct embed_verifier* v, size_t i, enum embed_verify_status status)
+{
+   pthread_mutex_lock(&v->lock);
+   v->status[i] = (unsigned char)status;
+   pthread_cond_broadcast(&v->changed);
+   pthread_mutex_unlock(&v->lock);
+}
+
+static void finish_check(struct embed_verifier* v, size_t i)
+{
+   const size_t size = (size_t)(v->checks[i].end - v->checks[i].begin);
+   uint32_t pc = (uint32_t)size, pb = (uint32_t)((uint64_t)size >> 32);
+   for (size_t k = v->first_chunk[i]; k < v->first_chunk[i + 1]; ++k) {
+      fold(&pc, &pb, &v->chunk_hashes[2 * k]);
+   }
+   const uint64_t digest = (uint64_t)pc | ((uint64_t)pb << 32);
+   set_status(v, i, (digest == *v->checks[i].expected) ? EMBED_VERIFY_OK : EMBED_VERIFY_FAILED);
+}
+
+static void* verify_thread(void* arg)
+{
+   struct embed_verifier* v = arg;
+   size_t i = 0;
+   for (;;) {
+      const size_t k = __atomic_fetch_add(&v->next_chunk, 1, __ATOMIC_RELAXED);
+      if (k >= v->total_chunks) { break; }
+      /* chunk numbers only increase, so the file index only moves forward */
+      while (v->first_chunk[i + 1] <= k) { ++i; }
+      const char* begin = v->checks[i].begin + (k - v->first_chunk[i]) * (size_t)EMBED_DIGEST_CHUNK;
+      const size_t left = (size_t)(v->checks[i].end - begin);
+      const size_t len = (left < EMBED_DIGEST_CHUNK) ? left : EMBED_DIGEST_CHUNK;
+      chunk_hash(begin, len, &v->chunk_hashes[2 * k]);
+      if (v->flags & EMBED_VERIFY_DROP_PAGES) {
+         (void)embed_region_hint(begin, begin + len, EMBED_HINT_DONTNEED);
+      }
+      /* the release publishes this chunk's hash to whichever thread finishes the file */
+      if (__atomic_sub_fetch(&v->remaining[i], 1, __ATOMIC_ACQ_REL) == 0) {
+         finish_check(v, i);
+      }
+   }
+   return NULL;
+}
+
+static void free_verifier(struct embed_verifier* v)
+{
+   pthread_cond_destroy(&v->changed);
+   pthread_mutex_destroy(&v->lock);
+   free(v->status);
+   free(v->remaining);
+   free(v->chunk_hashes);
+   free(v->first_chunk);
+   free(v);
+}
+
+struct embed_verifier* embed_verify_start(const struct embed_check* checks, size_t count,
+      unsigned max_threads, unsigned flags)
+{
+   struct embed_verifier* v = calloc(1, sizeof(struct embed_verifier));
+   if (!v) { return NULL; }
+   v->checks = checks;
+   v->count = count;
+   v->flags = flags;
+   pthread_mutex_init(&v->lock, NULL);
+   pthread_cond_init(&v->changed, NULL);
+
+   v->first_chunk = malloc((count + 1) * sizeof(size_t));
+   v->remaining = malloc((count + 1) * sizeof(size_t));
+   v->status = malloc(count + 1);
+   if (!v->first_chunk || !v->remaining || !v->status) {
+      free_verifier(v);
+      errno = ENOMEM;
+      return NULL;
+   }
+   size_t total = 0;
+   for (size_t i = 0; i < count; ++i) {
+      v->first_chunk[i] = total;
+      v->remaining[i] = chunk_count((size_t)(checks[i].end - checks[i].begin));
+      v->status[i] = EMBED_VERIFY_PENDING;
+      total += v->remaining[i];
+   }
+   v->first_chunk[count] = total;
+   v->total_chunks = total;
+   v->chunk_hashes = malloc((total ? total : 1) * 2 * sizeof(uint32_t));
+   if (!v->chunk_hashes) {
+      free_verifier(v);
+      errno = ENOMEM;
+      return NULL;
+   }
+   /* empty files have no chunks for a thread to finish */
+   for (size_t i = 0; i < count; ++i) {
+      if (!v->remaining[i]) { finish_check(v, i); }
+   }
+
+   if (max_threads == 0) {
+      const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      max_threads = (ncpu > 0) ? (unsigned)ncpu : 1u;
+   }
+   if (max_threads > EMBED_VERIFY_MAX_THREADS) { max_threads = EMBED_VERIFY_MAX_THREADS; }
+   if (max_threads > total) { max_threads = (unsigned)total; }
+   int err = 0;
+   for (unsigned t = 0; t < max_threads; ++t) {
+      err = pthread_create(&v->threads[v->nthreads], NULL, &verify_thread, v);
+      if (err) { break; }
+      ++v->nthreads;
+   }
+   if (total && !v->nthreads) {
+      free_verifier(v);
+      errno = err;
+      return NULL;
+   }
+   return v;
+}
+
+enum embed_verify_status embed_verify_status(struct embed_verifier* v, size_t index)
+{
+   pthread_mutex_lock(&v->lock);
+   const enum embed_verify_status status = (enum embed_verify_status)v->status[index];
+   pthread_mutex_unlock(&v->lock);
+   return status;
+}
+
+enum embed_verify_status embed_verify_wait_one(struct embed_verifier* v, size_t index)
+{
+   pthread_mutex_lock(&v->lock);
+   while (v->status[index] == EMBED_VERIFY_PENDING) {
+      pthread_cond_wait(&v->changed, &v->lock);
+   }
+   const enum embed_verify_status status = (enum embed_verify_status)v->status[index];
+   pthread_mutex_unlock(&v->lock);
+   return status;
+}
+
+size_t embed_verify_finish(struct embed_verifier* v)
+{
+   for (unsigned t = 0; t < v->nthreads; ++t) {
+      pthread_join(v->threads[t], NULL);
+   }
+   size_t failed = 0;
+   for (size_t i = 0; i < v->count; ++i) {
+      failed += (v->status[i] == EMBED_VERIFY_FAILED);
+   }
+   free_verifier(v);
+   return failed;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,89 @@
+#ifndef EMBED_VERIFY_H
+#define EMBED_VERIFY_H
+
+/*
+ * Integrity checks for embedded files. embed-data.sh -c stores a digest of
+ * each file as X_HASH (computed at build time by embed-hash), and these check
+ * the data against it, in the background so that startup doesn't wait:
+ *
+ *    extern const char DATA_MODEL_BIN[], DATA_MODEL_BIN_END[];
+ *    extern const uint64_t DATA_MODEL_BIN_HASH;
+ *    static const struct embed_check CHECKS[] = { EMBED_CHECK(DATA_MODEL_BIN) };
+ *
+ *    struct embed_verifier* v = embed_verify_start(CHECKS, 1, 0, EMBED_VERIFY_DROP_PAGES);
+ *    ...
+ *    if (embed_verify_wait_one(v, 0) != EMBED_VERIFY_OK) { ...corrupt... }
+ *    ...
+ *    embed_verify_finish(v);
+ *
+ * The digest is defined so that it can be computed in parallel: the data is
+ * split into EMBED_DIGEST_CHUNK byte chunks, each chunk is hashed with lookup3's
+ * hashlittle2, and the chunk hashes are folded together in order (see
+ * embed_digest). It's for catching corruption and mismatched builds, not
+ * tampering: lookup3 isn't a cryptographic hash.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMBED_DIGEST_CHUNK (1024u * 1024u)
+
+uint64_t embed_digest(const void* data, size_t size);
+
+struct embed_check {
+   const char* begin;
+   const char* end;
+   const uint64_t* expected;
+   const char* name;
+};
+
+#define EMBED_CHECK(sym) { sym, sym##_END, &sym##_HASH, #sym }
+
+enum embed_verify_status {
+   EMBED_VERIFY_PENDING,
+   EMBED_VERIFY_OK,
+   EMBED_VERIFY_FAILED
+};
+
+/* drop each chunk's pages (embed_region_hint DONTNEED) as soon as that chunk has
+ * been hashed, before the file's result is folded together and published, so
+ * checking doesn't leave everything resident */
+#define EMBED_VERIFY_DROP_PAGES 1u
+
+struct embed_verifier;
+
+/*
+ * Starts checking 'count' files on up to max_threads background threads (0
+ * means one per online CPU), in order, with the chunks of each file shared
+ * between the threads. The checks array must stay valid until
+ * embed_verify_finish. Returns NULL if no thread could be started (errno set).
+ */
+struct embed_verifier* embed_verify_start(const struct embed_check* checks, size_t count,
+      unsigned max_threads, unsigned flags);
+
+/* the status of checks[index], without waiting */
+enum embed_verify_status embed_verify_status(struct embed_verifier* v, size_t index);
+
+/* waits until checks[index] has been checked; returns EMBED_VERIFY_OK or EMBED_VERIFY_FAILED */
+enum embed_verify_status embed_verify_wait_one(struct embed_verifier* v, size_t index);
+
+/* waits for all the checks, frees the verifier, and returns the number that failed */
+size_t embed_verify_finish(struct embed_verifier* v);
+
+/* checks synchronously on the calling thread; returns the number that failed */
+size_t embed_verify(const struct embed_check* checks, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,147 @@
+/* Loopback benchmark for EventLoop.
+ *
+ * Creates a number of connected socket pairs, registers both ends with a single
+ * EventLoop, and bounces a small message back and forth on every pair.
+ * Reports how many readiness events per second the loop dispatches.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "EventLoop.hpp"
+#include "OptionParser.hpp"
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+const OptionParser::FlagSpec FLAGS[] = {
+	{ 'h', "h?", "help", 0, "Show this help." },
+	{ 'n', "n", "pairs", "N", "Number of socket pairs (default 1000)." },
+	{ 'a', "a", "active", "N", "Number of pairs with a message in flight (default: all)." },
+	{ 't', "t", "seconds", "S", "Run time in seconds (default 5)." },
+	{ 'l', "l", "level-triggered", 0, "Use level-triggered rather than edge-triggered readiness." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+class PingPong : public EventLoop::Handler {
+	public:
+		PingPong(): events(0u), messages(0u) {}
+
+		uint64_t events;
+		uint64_t messages;
+
+		virtual void on_event(EventLoop &loop, int fd, uint32_t ev) {
+			(void)loop;
+			++events;
+			if (!(ev & EventLoop::READABLE)) { return; }
+			char buf[64];
+			// drain to EAGAIN (required in edge-triggered mode), sending each message
+			// back to the other end of the pair
+			for (;;) {
+				const ssize_t n = ::read(fd, buf, sizeof(buf));
+				if (n == -1) {
+					if (errno == EINTR) { continue; }
+					if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+					throw PosixError(errno);
+				}
+				if (n == 0) { break; }
+				++messages;
+				if (::write(fd, buf, n) != n) { throw PosixError(errno); }
+			}
+		}
+};
+
+class StopTimer : public EventLoop::Handler {
+	public:
+		virtual void on_event(EventLoop &loop, int fd, uint32_t events) { (void)loop; (void)fd; (void)events; }
+		virtual void on_timer(EventLoop &loop, int timer, uint64_t expirations) {
+			(void)timer; (void)expirations;
+			loop.stop();
+		}
+};
+
+void raise_fd_limit(const size_t needed) {
+	struct rlimit lim;
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < needed) {
+		lim.rlim_cur = (needed < lim.rlim_max) ? needed : lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	long pairs = 1000, active = -1;
+	double seconds = 5.0;
+	uint32_t mode = EventLoop::EDGE_TRIGGERED;
+
+	try {
+		OptionParser opts(FLAGS, argc, argv);
+		int flag;
+		while ((flag = opts.next()) != -1) {
+			switch (flag) {
+				case 'h': opts.print_usage(STDOUT_FILENO, "Measure EventLoop dispatch rate over loopback socket pairs.\n"); return EXIT_SUCCESS;
+				case 'n': pairs = std::atol(opts.arg()); break;
+				case 'a': active = std::atol(opts.arg()); break;
+				case 't': seconds = std::atof(opts.arg()); break;
+				case 'l': mode = 0; break;
+			}
+		}
+	} catch (OptionParser::BadFlag &err) {
+		std::fprintf(stderr, "%s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	if (pairs < 1) { pairs = 1; }
+	if (active < 0 || active > pairs) { active = pairs; }
+
+	raise_fd_limit(size_t(pairs) * 2 + 64);
+
+	try {
+		EventLoop loop(1024);
+		PingPong pingpong;
+		std::vector<int> first_ends;
+		first_ends.reserve(pairs);
+		for (long i = 0; i < pairs; ++i) {
+			int sv[2];
+			if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1) { throw PosixError(errno); }
+			first_ends.push_back(sv[0]);
+			loop.add(FileDes(sv[0]), EventLoop::READABLE | mode, &pingpong);
+			loop.add(FileDes(sv[1]), EventLoop::READABLE | mode, &pingpong);
+		}
+
+		for (long i = 0; i < active; ++i) {
+			if (::write(first_ends[i], "ping", 4) != 4) { throw PosixError(errno); }
+		}
+
+		StopTimer stopper;
+		loop.add_timer(&stopper, uint64_t(seconds * 1e9));
+
+		const double start = now_seconds();
+		loop.run();
+		const double elapsed = now_seconds() - start;
+
+		std::printf("pairs %ld, active %ld, %s-triggered\n", pairs, active, mode ? "edge" : "level");
+		std::printf("%.3f s, %llu events (%.0f events/s), %llu messages (%.0f messages/s)\n",
+				elapsed,
+				(unsigned long long)pingpong.events, pingpong.events / elapsed,
+				(unsigned long long)pingpong.messages, pingpong.messages / elapsed);
+	} catch (PosixError &err) {
+		std::fprintf(stderr, "error: %s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
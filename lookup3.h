@@ -0,0 +1,26 @@
+#ifndef LOOKUP3_H
+#define LOOKUP3_H
+
+/*
+ * Declarations for lookup3.c (Bob Jenkins, May 2006, Public Domain).
+ * See lookup3.c for the details of each function.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t hashword(const uint32_t *k, size_t length, uint32_t initval);
+void hashword2(const uint32_t *k, size_t length, uint32_t *pc, uint32_t *pb);
+uint32_t hashlittle(const void *key, size_t length, uint32_t initval);
+void hashlittle2(const void *key, size_t length, uint32_t *pc, uint32_t *pb);
+uint32_t hashbig(const void *key, size_t length, uint32_t initval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
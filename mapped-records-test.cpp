@@ -0,0 +1,279 @@
+/* Tests for MappedRecords.hpp: FixedRecords bounds, strides and splitting, and
+ * PrefixedRecords over well-formed, truncated and overlong length prefixes, where
+ * iteration, valid_bytes() and split() must all agree about where the data goes bad.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "MappedRecords.hpp"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+struct Pair {
+	uint32_t key;
+	uint32_t value;
+};
+
+void test_fixed() {
+	alignas(8) unsigned char buf[5 * 16 + 3] = {};
+	for (uint32_t i = 0; i < 5; ++i) {
+		std::memcpy(buf + i * 16, &i, 4);
+		const uint32_t v = i * 10;
+		std::memcpy(buf + i * 16 + 4, &v, 4);
+	}
+
+	FixedRecords<Pair> packed(buf, 40);
+	check(packed.size() == 5 && packed.trailing_bytes() == 0, "fixed: packed size");
+
+	FixedRecords<Pair> strided(buf, sizeof(buf), 16);
+	check(strided.size() == 5 && strided.trailing_bytes() == 3, "fixed: trailing bytes excluded");
+	bool in_place = true;
+	uint32_t i = 0;
+	for (FixedRecords<Pair>::iterator it = strided.begin(); it != strided.end(); ++it, ++i) {
+		in_place = in_place && it->key == i && it->value == i * 10;
+	}
+	check(in_place && i == 5, "fixed: strided iteration");
+	check(strided.end() - strided.begin() == 5 && strided.begin()[3].key == 3, "fixed: iterator arithmetic");
+
+	FixedRecords<Pair> short_view(buf, 15, 16);
+	check(short_view.empty() && short_view.trailing_bytes() == 15, "fixed: truncated first record");
+
+	const std::vector<FixedRecords<Pair> > parts = strided.split(3);
+	check(parts.size() == 3 && parts[0].size() == 2 && parts[1].size() == 2 && parts[2].size() == 1
+			&& parts[1][0].key == 2 && parts[2][0].key == 4, "fixed: split");
+	check(strided.split(9).size() == 5 && strided.split(0).empty(), "fixed: split into more parts than records");
+
+	bool threw = false;
+	try { FixedRecords<Pair>(buf, sizeof(buf), 4); } catch (RecordFormatError &) { threw = true; }
+	check(threw, "fixed: stride smaller than the type");
+	threw = false;
+	try { FixedRecords<Pair>(buf + 1, 16); } catch (RecordFormatError &) { threw = true; }
+	check(threw, "fixed: misaligned data");
+	threw = false;
+	try { FixedRecords<Pair>(buf, sizeof(buf), 10); } catch (RecordFormatError &) { threw = true; }
+	check(threw, "fixed: misaligned stride");
+}
+
+void test_mapping() {
+	char path[] = "/tmp/mapped-records-test.XXXXXX";
+	FileDes fd(::mkstemp(path));
+	if (!check(fd.fd() != -1, "mapping: mkstemp")) { return; }
+	::unlink(path);
+	// a 6-byte header, then records starting 'begin' bytes into the mapping
+	const unsigned char data[] = { 'H', 'E', 'A', 'D', 'E', 'R', 3, 'a', 'b', 'c', 0, 2, 'd', 'e' };
+	check(::write(fd.fd(), data, sizeof(data)) == ssize_t(sizeof(data)), "mapping: write");
+	const FileMapping mapping(fd.fd(), sizeof(data));
+
+	PrefixedRecords<VarintPrefix> records(mapping, 6);
+	std::string joined;
+	size_t n = 0;
+	for (PrefixedRecords<VarintPrefix>::iterator it = records.begin(); it != records.end(); ++it, ++n) {
+		joined.append(it->data, it->size).append("|");
+	}
+	check(n == 3 && joined == "abc||de|", "mapping: records after a header");
+
+	bool threw = false;
+	try { PrefixedRecords<VarintPrefix>(mapping, sizeof(data) + 1); } catch (RecordFormatError &e) { threw = e.offset() == sizeof(data) + 1; }
+	check(threw, "mapping: begin past the end");
+	check(FixedRecords<unsigned char>(mapping, sizeof(data)).empty(), "mapping: begin at the end");
+}
+
+void append_u32(std::string &out, const uint32_t len) {
+	for (int i = 0; i < 4; ++i) { out += char((len >> (8 * i)) & 0xffu); }
+}
+
+void append_varint(std::string &out, uint64_t len) {
+	do {
+		out += char((len & 0x7fu) | (len > 0x7fu ? 0x80u : 0u));
+		len >>= 7;
+	} while (len);
+}
+
+/// Where iteration over a view of the data throws.
+/// @return The offset (from 'base') of the bad record, or the end of the view.
+template <typename Prefix>
+size_t first_bad(const PrefixedRecords<Prefix> &view, const char *base, size_t &records) {
+	const size_t start = static_cast<const char*>(view.data()) - base;
+	try {
+		for (typename PrefixedRecords<Prefix>::iterator it = view.begin(); it != view.end(); ++it) { ++records; }
+	} catch (RecordFormatError &e) {
+		return start + e.offset();
+	}
+	return start + view.size_bytes();
+}
+
+/// Scan the data every way there is: iteration (which decodes without bounds checks
+/// where a whole prefix fits), valid_bytes(), and split() followed by iteration over
+/// each part (the parts after a bad record are never reached).
+/// @return The offset where iteration threw, or the size if it got through.
+template <typename Prefix>
+size_t scan(const std::string &data, size_t &records, size_t &valid, size_t &split_bad) {
+	const PrefixedRecords<Prefix> view(data.data(), data.size());
+	records = 0;
+	const size_t bad = first_bad(view, data.data(), records);
+	valid = view.valid_bytes();
+	split_bad = data.size();
+	try {
+		const std::vector<PrefixedRecords<Prefix> > ranges = view.split(data.size() ? data.size() : 1);
+		size_t split_records = 0;
+		for (size_t r = 0; r < ranges.size(); ++r) {
+			const size_t end = static_cast<const char*>(ranges[r].data()) - data.data() + ranges[r].size_bytes();
+			const size_t at = first_bad(ranges[r], data.data(), split_records);
+			if (at != end) {
+				split_bad = at;
+				break;
+			}
+		}
+	} catch (RecordFormatError &e) {
+		split_bad = e.offset();
+	}
+	return bad;
+}
+
+template <typename Prefix>
+void check_good(const std::string &data, const size_t expected_records, const char *what) {
+	size_t records, valid, split_bad, n;
+	const size_t bad = scan<Prefix>(data, records, valid, split_bad);
+	const PrefixedRecords<Prefix> view(data.data(), data.size());
+	view.valid_bytes(&n);
+	check(bad == data.size() && records == expected_records && valid == data.size() && n == expected_records
+			&& split_bad == data.size(), what);
+}
+
+/// The data is good up to 'offset', where there's a bad record (or prefix).
+template <typename Prefix>
+void check_bad(const std::string &data, const size_t offset, const char *what) {
+	size_t records, valid, split_bad;
+	const size_t bad = scan<Prefix>(data, records, valid, split_bad);
+	check(bad == offset && valid == offset && split_bad == offset, what);
+	const PrefixedRecords<Prefix> complete = PrefixedRecords<Prefix>(data.data(), data.size()).complete();
+	check(complete.size_bytes() == offset, what);
+}
+
+void test_u32() {
+	std::string data;
+	for (uint32_t i = 0; i < 100; ++i) {
+		append_u32(data, i % 7);
+		data.append(i % 7, char('a' + i % 26));
+	}
+	check_good<U32Prefix>(data, 100, "u32: well formed");
+
+	// every split covers the data exactly, on record boundaries
+	const PrefixedRecords<U32Prefix> view(data.data(), data.size());
+	bool covers = true;
+	for (size_t parts = 1; parts <= 12; ++parts) {
+		const std::vector<PrefixedRecords<U32Prefix> > ranges = view.split(parts);
+		size_t records = 0;
+		const char *next = data.data();
+		for (size_t r = 0; r < ranges.size(); ++r) {
+			covers = covers && ranges[r].data() == next && ranges[r].size_bytes() > 0;
+			size_t n = 0;
+			covers = covers && ranges[r].valid_bytes(&n) == ranges[r].size_bytes();
+			records += n;
+			next += ranges[r].size_bytes();
+		}
+		covers = covers && next == data.data() + data.size() && records == 100 && ranges.size() <= parts;
+	}
+	check(covers, "u32: split covers the data");
+
+	const size_t good = data.size();
+	std::string truncated_prefix = data;
+	truncated_prefix.append("\x05\x00", 2);
+	check_bad<U32Prefix>(truncated_prefix, good, "u32: truncated prefix");
+
+	std::string truncated_record = data;
+	append_u32(truncated_record, 10);
+	truncated_record.append("abc");
+	check_bad<U32Prefix>(truncated_record, good, "u32: truncated record");
+
+	std::string huge = data;
+	append_u32(huge, 0xffffffffu);
+	huge.append(16, 'x');
+	check_bad<U32Prefix>(huge, good, "u32: record longer than the data");
+}
+
+void test_varint() {
+	std::string data;
+	const uint64_t LENGTHS[] = { 0, 1, 127, 128, 300, 16383, 16384, 5 };
+	for (size_t i = 0; i < sizeof(LENGTHS) / sizeof(LENGTHS[0]); ++i) {
+		append_varint(data, LENGTHS[i]);
+		data.append(size_t(LENGTHS[i]), 'v');
+	}
+	check_good<VarintPrefix>(data, 8, "varint: well formed");
+
+	const size_t good = data.size();
+
+	// a prefix cut short, both at the very end and with a continuation byte last
+	std::string truncated = data;
+	truncated += '\x80';
+	check_bad<VarintPrefix>(truncated, good, "varint: truncated prefix");
+	truncated = data;
+	append_varint(truncated, 300);
+	truncated.resize(truncated.size() - 1);
+	check_bad<VarintPrefix>(truncated, good, "varint: truncated two-byte prefix");
+
+	std::string truncated_record = data;
+	append_varint(truncated_record, 200);
+	truncated_record.append(199, 'x');
+	check_bad<VarintPrefix>(truncated_record, good, "varint: truncated record");
+
+	// the longest valid prefix: UINT64_MAX in ten bytes (it's well formed, just too long for the data)
+	std::string longest = data;
+	append_varint(longest, ~uint64_t(0));
+	check(longest.size() - good == VarintPrefix::MAX_BYTES, "varint: UINT64_MAX takes ten bytes");
+	longest.append(32, 'x');
+	check_bad<VarintPrefix>(longest, good, "varint: ten-byte prefix longer than the data");
+
+	// overlong prefixes, with enough data after them that iteration takes the unchecked path...
+	std::string overlong = data;
+	overlong.append(10, '\x80');
+	overlong += '\x00';
+	overlong.append(32, 'x');
+	check_bad<VarintPrefix>(overlong, good, "varint: eleven-byte prefix");
+
+	std::string overflow = data;
+	overflow.append(9, '\x80');
+	overflow += '\x02';
+	overflow.append(32, 'x');
+	check_bad<VarintPrefix>(overflow, good, "varint: ten-byte prefix over 64 bits");
+
+	// ...and at the very end, where it takes the checked one
+	overlong = data;
+	overlong.append(10, '\x80');
+	check_bad<VarintPrefix>(overlong, good, "varint: overlong prefix at the end");
+
+	// a small value padded with continuation bytes is merely redundant, not overlong
+	std::string padded = data;
+	padded.append("\x83\x80\x80\x00", 4);
+	padded.append(3, 'p');
+	check_good<VarintPrefix>(padded, 9, "varint: padded prefix");
+}
+
+} // anonymous namespace
+
+int main() {
+	test_fixed();
+	test_mapping();
+	test_u32();
+	test_varint();
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
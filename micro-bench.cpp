@@ -0,0 +1,895 @@
+/* Micro-benchmarks for the small modules: lookup3 hashing, UTF-8 decoding and
+ * encoding, the random number generators, path operations, OptionParser and
+ * reading files through mmap.
+ *
+ * Each benchmark runs a batch of operations over generated input. A few warmup
+ * batches are run first (and used to work out how many batches make up one
+ * repetition of at least --min-time seconds), then each repetition is timed with
+ * the monotonic clock, and with the time-stamp counter where there is one.
+ * Reports the min, median, mean, standard deviation and max time per operation
+ * over the repetitions, and with --perf the hardware counters (PerfCounters) per
+ * operation, as a table, CSV or JSON; the CSV and JSON output carry a
+ * --label and a description of the machine, so that runs from different commits
+ * or machines can be collected and compared.
+ *
+ * usage: micro-bench [flags] [pattern...]
+ * where each pattern selects benchmarks by name, as a shell glob (e.g. 'utf8/dec*').
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "OptionParser.hpp"
+#include "PerfCounters.hpp"
+#include "Posix.hpp"
+#include "lookup3.h"
+#include "path-operations.h"
+#include "rand.h"
+#include "utf8.h"
+#include <sys/utsname.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICRO_BENCH_TSC 1
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const OptionParser::FlagSpec FLAGS[] = {
+	{ 'h', "h?", "help", 0, "Show this help." },
+	{ 'l', "l", "list", 0, "List the benchmarks and exit." },
+	{ 'w', "w", "warmup", "N", "Warmup batches before measuring (default 3, at least 1)." },
+	{ 'r', "r", "repetitions", "N", "Timed repetitions (default 10)." },
+	{ 't', "t", "min-time", "S", "Minimum time of one repetition in seconds (default 0.05)." },
+	{ 'c', "c", "cpu", "N", "Pin the process to CPU N." },
+	{ 'f', "f", "format", "FMT", "Output format: text (default), csv or json." },
+	{ 'L', "L", "label", "TEXT", "Label for this run (e.g. a commit id), included in csv and json output." },
+	{ 'd', "d", "tmpdir", "DIR", "Directory for the mmap benchmarks' file (default $TMPDIR or /tmp)." },
+	{ 'p', "p", "perf", 0, "Count cycles, instructions, cache and branch misses with perf_event_open." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The time-stamp counter ticks at a constant rate (not the core clock) on anything
+// recent, so ticks per operation are comparable between runs on the same machine,
+// with less overhead and finer resolution than the clock. The fences keep the
+// measured work from being reordered around the reads.
+uint64_t read_ticks() {
+#ifdef MICRO_BENCH_TSC
+	_mm_lfence();
+	const uint64_t t = __rdtsc();
+	_mm_lfence();
+	return t;
+#else
+	return 0u;
+#endif
+}
+
+// results are folded into this, so that the work can't be optimised away
+volatile uint64_t g_sink;
+
+const char *g_tmpdir = "/tmp";
+
+class Benchmark {
+	public:
+		Benchmark(): items(0u), bytes(0u) {}
+		virtual ~Benchmark() {}
+
+		/// Run one batch: 'items' operations over 'bytes' bytes of input (0 if the
+		/// operations don't have any).
+		/// @return A value depending on the results, for the sink.
+		virtual uint64_t run() = 0;
+
+		size_t items;
+		size_t bytes;
+};
+
+std::vector<unsigned char> random_bytes(const size_t size, const uint32_t seed) {
+	std::vector<unsigned char> data(size);
+	struct xorshift_rng rng;
+	xorshift_init(&rng, seed);
+	for (size_t i = 0; i < size; ++i) { data[i] = (unsigned char)xorshift_next_i32(&rng); }
+	return data;
+}
+
+// ---- lookup3 ----
+
+template <size_t KEY_SIZE>
+class HashLittle : public Benchmark {
+	public:
+		// hashlittle may read whole words past the end of a key, hence the padding
+		HashLittle(): data(random_bytes(BATCH_BYTES + 8, 1u)) {
+			items = BATCH_BYTES / KEY_SIZE;
+			bytes = items * KEY_SIZE;
+		}
+		virtual uint64_t run() {
+			uint32_t h = 0;
+			for (size_t i = 0; i < items; ++i) { h += hashlittle(&data[i * KEY_SIZE], KEY_SIZE, h); }
+			return h;
+		}
+	private:
+		static const size_t BATCH_BYTES = 1024 * 1024;
+		std::vector<unsigned char> data;
+};
+
+class HashWord : public Benchmark {
+	public:
+		HashWord(): data(BATCH_WORDS) {
+			struct xorshift_rng rng;
+			xorshift_init(&rng, 2u);
+			for (size_t i = 0; i < BATCH_WORDS; ++i) { data[i] = xorshift_next_i32(&rng); }
+			items = BATCH_WORDS / KEY_WORDS;
+			bytes = items * KEY_WORDS * 4;
+		}
+		virtual uint64_t run() {
+			uint32_t h = 0;
+			for (size_t i = 0; i < items; ++i) { h += hashword(&data[i * KEY_WORDS], KEY_WORDS, h); }
+			return h;
+		}
+	private:
+		static const size_t BATCH_WORDS = 256 * 1024;
+		static const size_t KEY_WORDS = 1024;
+		std::vector<uint32_t> data;
+};
+
+// ---- UTF-8 ----
+
+// Code points with a length distribution selected by 'mix': 0 is all ASCII,
+// 1 is mostly ASCII with some 2 and 3 byte characters (European text), and 2 is
+// every length equally often.
+std::vector<uint32_t> random_code_points(const size_t count, const int mix, const uint32_t seed) {
+	std::vector<uint32_t> cps(count);
+	struct xorshift_rng rng;
+	xorshift_init(&rng, seed);
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t r = xorshift_next_i32(&rng);
+		unsigned len = 1;
+		if (mix == 1) {
+			len = (r % 100 < 85) ? 1 : (r % 100 < 97) ? 2 : 3;
+		} else if (mix == 2) {
+			len = 1 + r % 4;
+		}
+		const uint32_t v = r >> 8;
+		uint32_t cp;
+		switch (len) {
+			case 1: cp = 0x20 + v % 0x5f; break;
+			case 2: cp = 0x80 + v % 0x780; break;
+			case 3: cp = 0x800 + v % (0x10000 - 0x800 - 0x800); if (cp >= 0xd800) { cp += 0x800; } break;
+			default: cp = 0x10000 + v % 0x100000; break;
+		}
+		cps[i] = cp;
+	}
+	return cps;
+}
+
+template <int MIX>
+class Utf8Decode : public Benchmark {
+	public:
+		Utf8Decode() {
+			const std::vector<uint32_t> cps = random_code_points(BATCH_CODE_POINTS, MIX, 3u);
+			text.resize(cps.size() * 4);
+			size_t len = 0;
+			for (size_t i = 0; i < cps.size(); ++i) { len += utf8_encode(&text[len], cps[i]); }
+			text.resize(len);
+			items = cps.size();
+			bytes = len;
+		}
+		virtual uint64_t run() {
+			uint32_t state = UTF8_ACCEPT, cp = 0, sum = 0;
+			for (size_t i = 0; i < text.size(); ++i) {
+				if (utf8_decode(&state, &cp, text[i]) == UTF8_ACCEPT) { sum += cp; }
+			}
+			return sum + state;
+		}
+	private:
+		static const size_t BATCH_CODE_POINTS = 256 * 1024;
+		std::vector<uint8_t> text;
+};
+
+template <int MIX>
+class Utf8Encode : public Benchmark {
+	public:
+		Utf8Encode(): cps(random_code_points(BATCH_CODE_POINTS, MIX, 4u)), out(BATCH_CODE_POINTS * 4) {
+			items = cps.size();
+			bytes = 0;
+			uint8_t buf[4];
+			for (size_t i = 0; i < cps.size(); ++i) { bytes += utf8_encode(buf, cps[i]); }
+		}
+		virtual uint64_t run() {
+			size_t len = 0;
+			for (size_t i = 0; i < cps.size(); ++i) { len += utf8_encode(&out[len], cps[i]); }
+			return len + out[len / 2];
+		}
+	private:
+		static const size_t BATCH_CODE_POINTS = 256 * 1024;
+		std::vector<uint32_t> cps;
+		std::vector<uint8_t> out;
+};
+
+// ---- random number generators ----
+
+const size_t RNG_BATCH = 1024 * 1024;
+
+class Cmwc32 : public Benchmark {
+	public:
+		Cmwc32() { cmwc_init(&rng, 5u); items = RNG_BATCH; }
+		virtual uint64_t run() {
+			uint32_t sum = 0;
+			for (size_t i = 0; i < RNG_BATCH; ++i) { sum += cmwc_next_i32(&rng); }
+			return sum;
+		}
+	private:
+		struct cmwc_rng rng;
+};
+
+class Xorshift32 : public Benchmark {
+	public:
+		Xorshift32() { xorshift_init(&rng, 6u); items = RNG_BATCH; }
+		virtual uint64_t run() {
+			uint32_t sum = 0;
+			for (size_t i = 0; i < RNG_BATCH; ++i) { sum += xorshift_next_i32(&rng); }
+			return sum;
+		}
+	private:
+		struct xorshift_rng rng;
+};
+
+class Xorshift64 : public Benchmark {
+	public:
+		Xorshift64() { xorshift_init(&rng, 7u); items = RNG_BATCH; }
+		virtual uint64_t run() {
+			uint64_t sum = 0;
+			for (size_t i = 0; i < RNG_BATCH; ++i) { sum += xorshift_next_i64(&rng); }
+			return sum;
+		}
+	private:
+		struct xorshift_rng rng;
+};
+
+// ---- path operations ----
+
+enum PathOp { PATH_NORMALISE, PATH_DIRNAME, PATH_BASENAME, PATH_JOIN };
+
+// Relative and absolute paths of 1-12 components, with the odd doubled slash,
+// "." and "..", packed together (NUL-terminated) into about 1 MB.
+// path-operations-bench has more thorough distributions of its own.
+template <PathOp OP>
+class PathBench : public Benchmark {
+	public:
+		PathBench() {
+			static const char NAME_CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789._-";
+			struct xorshift_rng rng;
+			xorshift_init(&rng, 8u);
+			while (data.size() < BATCH_BYTES) {
+				offsets.push_back(data.size());
+				if (xorshift_next_i32(&rng) % 2) { data.push_back('/'); }
+				const unsigned n = 1 + xorshift_next_i32(&rng) % 12;
+				for (unsigned c = 0; c < n; ++c) {
+					if (c) {
+						data.push_back('/');
+						if (xorshift_next_i32(&rng) % 8 == 0) { data.push_back('/'); }
+					}
+					const uint32_t r = xorshift_next_i32(&rng) % 16;
+					if (r == 0) {
+						data.push_back('.');
+					} else if (r == 1) {
+						data.push_back('.');
+						data.push_back('.');
+					} else {
+						for (unsigned k = 1 + r % 12; k; --k) {
+							data.push_back(NAME_CHARS[xorshift_next_i32(&rng) % (sizeof(NAME_CHARS) - 1)]);
+						}
+					}
+				}
+				data.push_back('\0');
+			}
+			offsets.push_back(data.size());
+			items = offsets.size() - 1;
+			bytes = data.size();
+		}
+		virtual uint64_t run() {
+			char buf[MAX_PATH];
+			uint64_t sum = 0;
+			for (size_t i = 0; i < items; ++i) {
+				const char *path = &data[offsets[i]];
+				switch (OP) {
+					case PATH_NORMALISE:
+						// normalise_path works in place, so this pays for a copy too
+						std::memcpy(buf, path, offsets[i + 1] - offsets[i]);
+						normalise_path(buf);
+						break;
+					case PATH_DIRNAME: dirname(buf, sizeof(buf), path); break;
+					case PATH_BASENAME: basename(buf, sizeof(buf), path); break;
+					case PATH_JOIN: path_join(buf, sizeof(buf), "/usr/local/lib", path); break;
+				}
+				sum += (unsigned char)buf[0];
+			}
+			return sum;
+		}
+	private:
+		static const size_t BATCH_BYTES = 1024 * 1024;
+		static const size_t MAX_PATH = 512;
+		std::vector<char> data;
+		std::vector<size_t> offsets;
+};
+
+// ---- OptionParser ----
+
+const OptionParser::FlagSpec PARSE_FLAGS[] = {
+	{ 'h', "h?", "help", 0, "Show this help." },
+	{ 'v', "v", "verbose", 0, "Print more." },
+	{ 'q', "q", "quiet", 0, "Print less." },
+	{ 'j', "j", "jobs", "N", "Run N jobs at once." },
+	{ 'o', "o", "output", "FILE", "Write to FILE." },
+	{ 'I', "I", "include-dir", "DIR", "Add DIR to the search path." },
+	{ 'D', "D", "define", "NAME=VALUE", "Define a macro." },
+	{ 'x', "x", "exclude", "PATTERN", "Skip files matching PATTERN." },
+	{ 'k', "k", "keep-going", 0, "Carry on after errors." },
+	{ 'n', "n", "dry-run", 0, "Don't do anything." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+// A typical command line, parsed from scratch each time (with a fresh copy of the
+// arguments, since the parser rearranges argv and splits --flag=value in place).
+template <bool LONG_FLAGS>
+class ParseFlags : public Benchmark {
+	public:
+		ParseFlags() {
+			static const char * const SHORT_ARGS[] = {
+				"prog", "-vk", "-j", "8", "-o", "out.txt", "-I", "include", "-Dx=1", "src/a.c", "-x", "*.o", "src/b.c", 0
+			};
+			static const char * const LONG_ARGS[] = {
+				"prog", "--verbose", "--keep-going", "--jobs=8", "--output", "out.txt", "--include-dir=include",
+				"--define", "x=1", "src/a.c", "--exclude=*.o", "src/b.c", 0
+			};
+			for (const char * const *arg = LONG_FLAGS ? LONG_ARGS : SHORT_ARGS; *arg; ++arg) {
+				offsets.push_back(text.size());
+				text.insert(text.end(), *arg, *arg + std::strlen(*arg) + 1);
+			}
+			items = BATCH_PARSES;
+		}
+		virtual uint64_t run() {
+			uint64_t sum = 0;
+			std::vector<char> copy(text.size());
+			std::vector<char *> argv(offsets.size() + 1);
+			for (size_t i = 0; i < BATCH_PARSES; ++i) {
+				std::memcpy(&copy[0], &text[0], text.size());
+				for (size_t a = 0; a < offsets.size(); ++a) { argv[a] = &copy[offsets[a]]; }
+				argv[offsets.size()] = 0;
+				OptionParser opts(PARSE_FLAGS, int(offsets.size()), &argv[0]);
+				int flag;
+				while ((flag = opts.next()) != -1) {
+					sum += flag;
+					if (opts.arg()) { sum += (unsigned char)opts.arg()[0]; }
+				}
+				sum += opts.arg_count();
+			}
+			return sum;
+		}
+	private:
+		static const size_t BATCH_PARSES = 1000;
+		std::vector<char> text;
+		std::vector<size_t> offsets;
+};
+
+// ---- mmap I/O ----
+
+// A 16 MB file of random bytes, unlinked as soon as it's created. It was just
+// written, so it's in the page cache: these measure the cost of getting at data
+// that's already in memory, not the disk.
+class FileBench : public Benchmark {
+	public:
+		FileBench(): page(size_t(sysconf(_SC_PAGESIZE))) {
+			std::vector<char> path(g_tmpdir, g_tmpdir + std::strlen(g_tmpdir));
+			const char NAME[] = "/micro-bench.XXXXXX";
+			path.insert(path.end(), NAME, NAME + sizeof(NAME));
+			file = FileDes(::mkstemp(&path[0]));
+			if (!file) {
+				const int e = errno;
+				char msg[512];
+				std::snprintf(msg, sizeof(msg), "can't create a file in %s: %s", g_tmpdir, std::strerror(e));
+				throw PosixError(e, msg);
+			}
+			::unlink(&path[0]);
+			const std::vector<unsigned char> data = random_bytes(FILE_SIZE, 9u);
+			for (size_t done = 0; done < FILE_SIZE; ) {
+				const ssize_t n = ::write(file, &data[done], FILE_SIZE - done);
+				if (n == -1) {
+					if (errno == EINTR) { continue; }
+					throw PosixError(errno);
+				}
+				done += size_t(n);
+			}
+			items = FILE_SIZE / page;
+			bytes = FILE_SIZE;
+		}
+	protected:
+		static const size_t FILE_SIZE = 16 * 1024 * 1024;
+		static uint64_t sum_words(const void *p, const size_t len) {
+			const uint64_t *w = static_cast<const uint64_t *>(p);
+			uint64_t sum = 0;
+			for (size_t i = 0; i < len / 8; ++i) { sum += w[i]; }
+			return sum;
+		}
+		const size_t page;
+		FileDes file;
+};
+
+// map the file, read a byte from each page (a page fault each), unmap
+class MapTouch : public FileBench {
+	public:
+		virtual uint64_t run() {
+			FileMapping map(file, FILE_SIZE);
+			const volatile unsigned char *p = static_cast<const unsigned char *>(map.get());
+			uint64_t sum = 0;
+			for (size_t off = 0; off < FILE_SIZE; off += page) { sum += p[off]; }
+			return sum;
+		}
+};
+
+// read all of an existing mapping
+class MapScan : public FileBench {
+	public:
+		MapScan(): map(file, FILE_SIZE) {}
+		virtual uint64_t run() { return sum_words(map.get(), FILE_SIZE); }
+	private:
+		FileMapping map;
+};
+
+// read all of the file with pread into a buffer, for comparison
+class PreadScan : public FileBench {
+	public:
+		PreadScan(): buf(BUFFER_SIZE / 8) {}
+		virtual uint64_t run() {
+			uint64_t sum = 0;
+			for (size_t off = 0; off < FILE_SIZE; off += BUFFER_SIZE) {
+				const ssize_t n = ::pread(file, &buf[0], BUFFER_SIZE, off_t(off));
+				if (n == -1) { throw PosixError(errno); }
+				sum += sum_words(&buf[0], size_t(n));
+			}
+			return sum;
+		}
+	private:
+		static const size_t BUFFER_SIZE = 64 * 1024;
+		std::vector<uint64_t> buf;
+};
+
+// ---- registry ----
+
+struct Entry {
+	const char *name;
+	/// What one operation is, for the text output (e.g. "key" for ns/key).
+	const char *unit;
+	Benchmark *(*make)();
+};
+
+template <typename B>
+Benchmark *make() { return new B; }
+
+const Entry BENCHMARKS[] = {
+	{ "hash/hashlittle-16B", "key", &make<HashLittle<16> > },
+	{ "hash/hashlittle-256B", "key", &make<HashLittle<256> > },
+	{ "hash/hashlittle-64KB", "key", &make<HashLittle<65536> > },
+	{ "hash/hashword-4KB", "key", &make<HashWord> },
+	{ "utf8/decode-ascii", "char", &make<Utf8Decode<0> > },
+	{ "utf8/decode-latin", "char", &make<Utf8Decode<1> > },
+	{ "utf8/decode-mixed", "char", &make<Utf8Decode<2> > },
+	{ "utf8/encode-ascii", "char", &make<Utf8Encode<0> > },
+	{ "utf8/encode-mixed", "char", &make<Utf8Encode<2> > },
+	{ "rng/cmwc-32", "number", &make<Cmwc32> },
+	{ "rng/xorshift-32", "number", &make<Xorshift32> },
+	{ "rng/xorshift-64", "number", &make<Xorshift64> },
+	{ "path/normalise", "path", &make<PathBench<PATH_NORMALISE> > },
+	{ "path/dirname", "path", &make<PathBench<PATH_DIRNAME> > },
+	{ "path/basename", "path", &make<PathBench<PATH_BASENAME> > },
+	{ "path/join", "path", &make<PathBench<PATH_JOIN> > },
+	{ "flags/short", "parse", &make<ParseFlags<false> > },
+	{ "flags/long", "parse", &make<ParseFlags<true> > },
+	{ "mmap/map-touch", "page", &make<MapTouch> },
+	{ "mmap/scan", "page", &make<MapScan> },
+	{ "mmap/pread", "page", &make<PreadScan> },
+};
+
+const size_t NUM_BENCHMARKS = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+// ---- measuring ----
+
+struct Stats {
+	double min, median, mean, stddev, max;
+};
+
+Stats summarise(std::vector<double> samples) {
+	std::sort(samples.begin(), samples.end());
+	const size_t n = samples.size();
+	Stats s;
+	s.min = samples[0];
+	s.max = samples[n - 1];
+	s.median = (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+	double total = 0;
+	for (size_t i = 0; i < n; ++i) { total += samples[i]; }
+	s.mean = total / n;
+	double squares = 0;
+	for (size_t i = 0; i < n; ++i) { squares += (samples[i] - s.mean) * (samples[i] - s.mean); }
+	s.stddev = (n > 1) ? std::sqrt(squares / (n - 1)) : 0.0;
+	return s;
+}
+
+struct Result {
+	const Entry *entry;
+	size_t items;
+	size_t bytes;
+	/// Batches per repetition.
+	unsigned long batches;
+	/// Nanoseconds per operation.
+	Stats ns;
+	/// Median time-stamp counter ticks per operation (0 without a TSC).
+	double ticks;
+	/// Performance counter totals over all the repetitions (empty without --perf).
+	PerfCounters::Sample perf;
+	double perf_ops;
+};
+
+struct Totals {
+	double seconds;
+	uint64_t ticks;
+};
+
+Result measure(const Entry &entry, const unsigned long warmup, const unsigned long repetitions, const double min_time,
+		PerfCounters &counters, Totals &totals) {
+	std::unique_ptr<Benchmark> bench(entry.make());
+	Result result;
+	uint64_t sink = 0;
+
+	// the fastest warmup batch decides how many batches make up a repetition
+	double fastest = 1e30;
+	for (unsigned long i = 0; i < warmup; ++i) {
+		const double t0 = now_seconds();
+		sink += bench->run();
+		fastest = std::min(fastest, now_seconds() - t0);
+	}
+	unsigned long batches = 1;
+	if (fastest < min_time) { batches = (unsigned long)std::ceil(min_time / std::max(fastest, 1e-9)); }
+
+	std::vector<double> ns(repetitions), ticks(repetitions);
+	const double ops = double(bench->items) * batches;
+	for (unsigned long r = 0; r < repetitions; ++r) {
+		// the counters are read outside the timed part (and not at all without --perf)
+		PerfCounters::Scope scope(counters, result.perf);
+		const double t0 = now_seconds();
+		const uint64_t k0 = read_ticks();
+		for (unsigned long b = 0; b < batches; ++b) { sink += bench->run(); }
+		const uint64_t k1 = read_ticks();
+		const double t1 = now_seconds();
+		ns[r] = (t1 - t0) * 1e9 / ops;
+		ticks[r] = double(k1 - k0) / ops;
+		totals.seconds += t1 - t0;
+		totals.ticks += k1 - k0;
+	}
+	g_sink = g_sink + sink;
+
+	result.entry = &entry;
+	result.items = bench->items;
+	result.bytes = bench->bytes;
+	result.batches = batches;
+	result.ns = summarise(ns);
+	result.ticks = summarise(ticks).median;
+	result.perf_ops = ops * repetitions;
+	return result;
+}
+
+// ---- output ----
+
+struct Host {
+	char machine[256];
+	char cpu_model[256];
+	long cpus;
+	int pinned_cpu;
+	char date[32];
+};
+
+void describe_host(Host &host, const int pinned_cpu) {
+	struct utsname u;
+	if (uname(&u) == 0) {
+		std::snprintf(host.machine, sizeof(host.machine), "%s %s %s", u.sysname, u.release, u.machine);
+	} else {
+		std::snprintf(host.machine, sizeof(host.machine), "unknown");
+	}
+	std::snprintf(host.cpu_model, sizeof(host.cpu_model), "unknown");
+	if (std::FILE *f = std::fopen("/proc/cpuinfo", "r")) {
+		char line[512];
+		while (std::fgets(line, sizeof(line), f)) {
+			const char *colon = std::strchr(line, ':');
+			if (colon && std::strncmp(line, "model name", 10) == 0) {
+				const char *value = colon + 1;
+				while (*value == ' ' || *value == '\t') { ++value; }
+				std::snprintf(host.cpu_model, sizeof(host.cpu_model), "%.*s", int(std::strcspn(value, "\n")), value);
+				break;
+			}
+		}
+		std::fclose(f);
+	}
+	host.cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	host.pinned_cpu = pinned_cpu;
+	const time_t t = std::time(0);
+	struct tm utc;
+	gmtime_r(&t, &utc);
+	std::strftime(host.date, sizeof(host.date), "%Y-%m-%dT%H:%M:%SZ", &utc);
+}
+
+void json_string(const char *s) {
+	std::putchar('"');
+	for (; *s; ++s) {
+		const unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			std::printf("\\%c", c);
+		} else if (c < 0x20) {
+			std::printf("\\u%04x", c);
+		} else {
+			std::putchar(c);
+		}
+	}
+	std::putchar('"');
+}
+
+void csv_field(const char *s) {
+	if (!std::strpbrk(s, ",\"\n\r")) {
+		std::fputs(s, stdout);
+		return;
+	}
+	std::putchar('"');
+	for (; *s; ++s) {
+		if (*s == '"') { std::putchar('"'); }
+		std::putchar(*s);
+	}
+	std::putchar('"');
+}
+
+double mb_per_second(const Result &r) {
+	return r.bytes ? double(r.bytes) / r.items / r.ns.median * 1e3 : 0.0;
+}
+
+double per_op(const Result &r, const PerfCounters::Event event) {
+	return double(r.perf.value[event]) / r.perf_ops;
+}
+
+bool has_ipc(const Result &r) {
+	return r.perf.has(PerfCounters::CYCLES) && r.perf.has(PerfCounters::INSTRUCTIONS) && r.perf.value[PerfCounters::CYCLES];
+}
+
+double ipc(const Result &r) {
+	return double(r.perf.value[PerfCounters::INSTRUCTIONS]) / r.perf.value[PerfCounters::CYCLES];
+}
+
+// event names as column names and keys: "branch-misses" becomes "branch_misses_per_op"
+void print_event_key(const PerfCounters::Event event) {
+	for (const char *c = PerfCounters::event_name(event); *c; ++c) {
+		std::putchar(*c == '-' ? '_' : (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c);
+	}
+	std::fputs("_per_op", stdout);
+}
+
+enum Format { TEXT, CSV, JSON };
+
+void print_header(const Format format) {
+	if (format == TEXT) {
+		std::printf("%-22s %10s %12s %12s %8s %10s %12s\n",
+				"benchmark", "ops", "ns/op", "min ns/op", "stddev", "MB/s", "ticks/op");
+	} else if (format == CSV) {
+		std::printf("label,benchmark,unit,ops,bytes,repetitions,batches,"
+				"ns_min,ns_median,ns_mean,ns_stddev,ns_max,mb_per_s,ticks_median");
+		for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+			std::putchar(',');
+			print_event_key(PerfCounters::Event(e));
+		}
+		std::printf(",ipc\n");
+	}
+}
+
+void print_result(const Format format, const Result &r, const unsigned long repetitions, const char *label, const bool first) {
+	const double mbs = mb_per_second(r);
+	if (format == TEXT) {
+		char ns_op[32];
+		std::snprintf(ns_op, sizeof(ns_op), "%.2f/%s", r.ns.median, r.entry->unit);
+		std::printf("%-22s %10zu %12s %12.2f %7.1f%% ", r.entry->name, r.items, ns_op, r.ns.min,
+				r.ns.median > 0 ? 100.0 * r.ns.stddev / r.ns.median : 0.0);
+		if (r.bytes) { std::printf("%10.1f ", mbs); } else { std::printf("%10s ", "-"); }
+		if (r.ticks > 0) { std::printf("%12.2f\n", r.ticks); } else { std::printf("%12s\n", "-"); }
+		if (r.perf.events) {
+			std::printf("%-22s", "");
+			for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+				if (!r.perf.has(PerfCounters::Event(e))) { continue; }
+				std::printf(" %s %.4g", PerfCounters::event_name(PerfCounters::Event(e)), per_op(r, PerfCounters::Event(e)));
+			}
+			if (has_ipc(r)) { std::printf(" IPC %.2f", ipc(r)); }
+			std::putchar('\n');
+		}
+	} else if (format == CSV) {
+		csv_field(label);
+		std::printf(",%s,%s,%zu,%zu,%lu,%lu,%.4f,%.4f,%.4f,%.4f,%.4f,",
+				r.entry->name, r.entry->unit, r.items, r.bytes, repetitions, r.batches,
+				r.ns.min, r.ns.median, r.ns.mean, r.ns.stddev, r.ns.max);
+		if (r.bytes) { std::printf("%.2f", mbs); }
+		std::putchar(',');
+		if (r.ticks > 0) { std::printf("%.4f", r.ticks); }
+		for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+			std::putchar(',');
+			if (r.perf.has(PerfCounters::Event(e))) { std::printf("%.4f", per_op(r, PerfCounters::Event(e))); }
+		}
+		std::putchar(',');
+		if (has_ipc(r)) { std::printf("%.4f", ipc(r)); }
+		std::putchar('\n');
+	} else {
+		std::printf("%s\n    {\"name\": ", first ? "" : ",");
+		json_string(r.entry->name);
+		std::printf(", \"unit\": \"%s\", \"ops\": %zu, \"bytes\": %zu, \"batches\": %lu,\n", r.entry->unit, r.items, r.bytes, r.batches);
+		std::printf("     \"ns_per_op\": {\"min\": %.4f, \"median\": %.4f, \"mean\": %.4f, \"stddev\": %.4f, \"max\": %.4f},\n",
+				r.ns.min, r.ns.median, r.ns.mean, r.ns.stddev, r.ns.max);
+		if (r.bytes) { std::printf("     \"mb_per_s\": %.2f, ", mbs); } else { std::printf("     \"mb_per_s\": null, "); }
+		if (r.ticks > 0) { std::printf("\"ticks_per_op\": %.4f,\n", r.ticks); } else { std::printf("\"ticks_per_op\": null,\n"); }
+		if (r.perf.events) {
+			std::printf("     \"perf\": {");
+			for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+				std::putchar('"');
+				print_event_key(PerfCounters::Event(e));
+				if (r.perf.has(PerfCounters::Event(e))) {
+					std::printf("\": %.4f, ", per_op(r, PerfCounters::Event(e)));
+				} else {
+					std::printf("\": null, ");
+				}
+			}
+			if (has_ipc(r)) { std::printf("\"ipc\": %.4f}}", ipc(r)); } else { std::printf("\"ipc\": null}}"); }
+		} else {
+			std::printf("     \"perf\": null}");
+		}
+	}
+	std::fflush(stdout);
+}
+
+void print_json_start(const Host &host, const char *label, const unsigned long warmup, const unsigned long repetitions, const double min_time) {
+	std::printf("{\n  \"label\": ");
+	json_string(label);
+	std::printf(",\n  \"date\": \"%s\",\n  \"host\": {\"system\": ", host.date);
+	json_string(host.machine);
+	std::printf(", \"cpu\": ");
+	json_string(host.cpu_model);
+	std::printf(", \"cpus\": %ld, \"pinned_cpu\": ", host.cpus);
+	if (host.pinned_cpu >= 0) { std::printf("%d", host.pinned_cpu); } else { std::printf("null"); }
+	std::printf("},\n  \"compiler\": ");
+	json_string(__VERSION__);
+	std::printf(",\n  \"settings\": {\"warmup\": %lu, \"repetitions\": %lu, \"min_time\": %g},\n  \"results\": [",
+			warmup, repetitions, min_time);
+}
+
+void print_json_end(const Totals &totals) {
+	std::printf("\n  ],\n  \"tsc_ghz\": ");
+	if (totals.ticks && totals.seconds > 0) {
+		std::printf("%.4f\n}\n", totals.ticks / totals.seconds * 1e-9);
+	} else {
+		std::printf("null\n}\n");
+	}
+}
+
+bool selected(const Entry &entry, char **patterns, const int count) {
+	if (!count) { return true; }
+	for (int i = 0; i < count; ++i) {
+		if (fnmatch(patterns[i], entry.name, 0) == 0) { return true; }
+	}
+	return false;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	unsigned long warmup = 3, repetitions = 10;
+	double min_time = 0.05;
+	int cpu = -1;
+	Format format = TEXT;
+	const char *label = "";
+	bool list = false;
+	bool perf = false;
+	int npatterns = 0;
+
+	if (const char *tmpdir = std::getenv("TMPDIR")) { g_tmpdir = tmpdir; }
+	try {
+		OptionParser opts(FLAGS, argc, argv);
+		int flag;
+		while ((flag = opts.next()) != -1) {
+			switch (flag) {
+				case 'h': opts.print_usage(STDOUT_FILENO, "Run micro-benchmarks of the hashing, UTF-8, RNG, path, flag parsing and mmap code.\n"
+								"Patterns (shell globs, e.g. 'hash/*') select benchmarks by name.\n"); return EXIT_SUCCESS;
+				case 'l': list = true; break;
+				case 'w': warmup = std::strtoul(opts.arg(), 0, 10); break;
+				case 'r': repetitions = std::strtoul(opts.arg(), 0, 10); break;
+				case 't': min_time = std::atof(opts.arg()); break;
+				case 'c': cpu = std::atoi(opts.arg()); break;
+				case 'f':
+					if (std::strcmp(opts.arg(), "text") == 0) { format = TEXT; }
+					else if (std::strcmp(opts.arg(), "csv") == 0) { format = CSV; }
+					else if (std::strcmp(opts.arg(), "json") == 0) { format = JSON; }
+					else {
+						std::fprintf(stderr, "unknown format '%s' (expected text, csv or json)\n", opts.arg());
+						return EXIT_FAILURE;
+					}
+					break;
+				case 'L': label = opts.arg(); break;
+				case 'd': g_tmpdir = opts.arg(); break;
+				case 'p': perf = true; break;
+			}
+		}
+		npatterns = opts.arg_count() - 1;
+	} catch (OptionParser::BadFlag &err) {
+		std::fprintf(stderr, "%s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	if (warmup < 1) { warmup = 1; }
+	if (repetitions < 1) { repetitions = 1; }
+	char **patterns = argv + 1;
+
+	if (list) {
+		for (size_t i = 0; i < NUM_BENCHMARKS; ++i) {
+			if (selected(BENCHMARKS[i], patterns, npatterns)) { std::printf("%s\n", BENCHMARKS[i].name); }
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			std::fprintf(stderr, "can't pin to CPU %d: %s\n", cpu, std::strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	// without --perf, no counters: reading them does nothing
+	PerfCounters counters(perf ? PerfCounters::ALL : 0u);
+	if (perf) {
+		if (!counters) {
+			std::fprintf(stderr, "no performance counters: %s\n", std::strerror(counters.error()));
+		} else if (!(counters.available() & PerfCounters::HARDWARE)) {
+			std::fprintf(stderr, "no hardware performance counters (%s), only software ones\n", std::strerror(counters.error()));
+		}
+	}
+
+	Host host;
+	describe_host(host, cpu);
+	Totals totals = { 0.0, 0u };
+	if (format == JSON) {
+		print_json_start(host, label, warmup, repetitions, min_time);
+	} else {
+		print_header(format);
+	}
+	try {
+		counters.start();
+		bool first = true;
+		for (size_t i = 0; i < NUM_BENCHMARKS; ++i) {
+			if (!selected(BENCHMARKS[i], patterns, npatterns)) { continue; }
+			const Result result = measure(BENCHMARKS[i], warmup, repetitions, min_time, counters, totals);
+			print_result(format, result, repetitions, label, first);
+			first = false;
+		}
+	} catch (PosixError &err) {
+		std::fprintf(stderr, "error: %s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	if (format == JSON) { print_json_end(totals); }
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,436 @@
+/* Tests for OptionParser: positional arguments from argv and from response files
+ * (including files whose words are split up in place by "--name=value" flags),
+ * empty arguments before and after "--", tables of long flags (up to
+ * INLINE_LONG_FLAGS of them parsed without allocating, as counted by global
+ * operator new, and bigger ones), typed flag tables (parse() asserting valid_flags()
+ * on a table that wasn't checked at compile time), and Commands: dispatch after
+ * global flags, unknown and missing commands, and a full table.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "OptionParser.hpp"
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+size_t allocations = 0;
+
+} // anonymous namespace
+
+void *operator new(const size_t size) {
+	++allocations;
+	if (void * const p = std::malloc(size ? size : 1)) { return p; }
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+const OptionParser::FlagSpec FLAGS[] = {
+	{ 'o', "o", "out", "FILE", "Write to FILE." },
+	{ 'v', "v", "verbose", 0, "Print more." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+/// A response file with the given contents, removed again when it goes out of scope.
+class TempFile {
+	public:
+		explicit TempFile(const char *contents) {
+			std::strcpy(m_path, "/tmp/optionparser-test.XXXXXX");
+			const int fd = ::mkstemp(m_path);
+			const size_t len = std::strlen(contents);
+			m_ok = fd != -1 && ::write(fd, contents, len) == ssize_t(len);
+			if (fd != -1) { ::close(fd); }
+			std::snprintf(m_arg, sizeof(m_arg), "@%s", m_path);
+		}
+		~TempFile() { ::unlink(m_path); }
+
+		bool ok() const { return m_ok; }
+		/// "@path", for argv.
+		char *arg() { return m_arg; }
+
+	private:
+		TempFile(const TempFile &);
+		TempFile &operator=(const TempFile &);
+
+		char m_path[64];
+		char m_arg[sizeof(m_path) + 1];
+		bool m_ok;
+};
+
+/// The arguments as "[a] [b] ...".
+std::string joined(const std::vector<std::string> &args) {
+	std::string out;
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (i) { out += ' '; }
+		out += "[" + args[i] + "]";
+	}
+	return out;
+}
+
+/// Parse argv (with response files), collecting the flags and positionals().
+/// @return The positional arguments as joined() puts them.
+std::string parse(std::vector<char*> argv, std::string &flags, size_t &size) {
+	OptionParser opts(FLAGS, int(argv.size()), argv.data());
+	opts.set_response_files(true);
+	flags.clear();
+	int flag;
+	while ((flag = opts.next()) != -1) {
+		flags += char(flag);
+		if (flag == 'o') { flags.append("=").append(opts.arg()); }
+		flags += ' ';
+	}
+	std::vector<std::string> positionals;
+	const OptionParser::Positionals all = opts.positionals();
+	for (OptionParser::Positionals::iterator it = all.begin(); it != all.end(); ++it) { positionals.push_back(*it); }
+	size = all.size();
+	return joined(positionals);
+}
+
+void test_response_files() {
+	char prog[] = "prog", pos3[] = "pos3", a[] = "a", b[] = "b", verbose[] = "--verbose";
+	std::string flags;
+	size_t size = 0;
+
+	// "--out=x" is split at the '=' in place, which mustn't upset the words after it
+	TempFile resp("--out=x pos1 -v pos2");
+	check(resp.ok(), "response file: write");
+	std::vector<char*> argv;
+	argv.push_back(prog);
+	argv.push_back(resp.arg());
+	argv.push_back(pos3);
+	std::string got = parse(argv, flags, size);
+	check(got == "[prog] [pos1] [pos2] [pos3]" && size == 4 && flags == "o=x v ", "response file: --name=value then positionals");
+
+	// words from files mixed in among argv's, a word at the very end of a file
+	// (with nowhere to put its NUL), and a nested file
+	TempFile inner("in1 --out 'quoted word' in2");
+	std::string outer_text = "c ";
+	outer_text += inner.arg();
+	outer_text += " d";
+	TempFile outer(outer_text.c_str());
+	argv.clear();
+	argv.push_back(prog);
+	argv.push_back(a);
+	argv.push_back(outer.arg());
+	argv.push_back(verbose);
+	argv.push_back(b);
+	got = parse(argv, flags, size);
+	check(got == "[prog] [a] [c] [in1] [in2] [d] [b]" && size == 7 && flags == "o=quoted word v ", "response file: nested, between argv words");
+
+	// a file of nothing but flags adds no positionals
+	TempFile flags_only("-v --out=y");
+	argv.clear();
+	argv.push_back(prog);
+	argv.push_back(flags_only.arg());
+	argv.push_back(a);
+	got = parse(argv, flags, size);
+	check(got == "[prog] [a]" && size == 2 && flags == "v o=y ", "response file: only flags");
+
+	// after "--", "@name" is just a positional argument
+	char dashes[] = "--";
+	argv.clear();
+	argv.push_back(prog);
+	argv.push_back(resp.arg());
+	argv.push_back(dashes);
+	argv.push_back(resp.arg());
+	got = parse(argv, flags, size);
+	check(got == "[prog] [pos1] [pos2] [" + std::string(resp.arg()) + "]" && size == 4, "response file: not expanded after --");
+}
+
+void test_empty_arguments() {
+	char prog[] = "prog", empty1[] = "", empty2[] = "", empty3[] = "", a[] = "a", b[] = "b", dashes[] = "--", v[] = "-v";
+	char *argv[] = { prog, empty1, a, v, dashes, empty2, b, empty3, nullptr };
+	const int argc = int(sizeof(argv) / sizeof(argv[0])) - 1;
+	OptionParser opts(FLAGS, argc, argv);
+	int flag, flags = 0;
+	while ((flag = opts.next()) != -1) { ++flags; }
+	check(flags == 1 && opts.arg_count() == 5 && opts.positionals().size() == 5, "empty arguments: kept only after --");
+	check(std::strcmp(argv[1], "a") == 0 && argv[2][0] == '\0' && std::strcmp(argv[3], "b") == 0 && argv[4][0] == '\0'
+			&& argv[5] == nullptr, "empty arguments: order");
+}
+
+const size_t BIG_TABLE = 300;
+
+/// A table of n long flags, "f000" and on, named in an order that sorting has to
+/// undo; the odd ones take an argument.
+void make_long_flags(const size_t n, char (*names)[8], OptionParser::FlagSpec *specs) {
+	for (size_t i = 0; i < n; ++i) {
+		std::snprintf(names[i], sizeof(names[i]), "f%03u", unsigned((i * 7u) % n));
+		const OptionParser::FlagSpec spec = { int(i), 0, names[i], (i % 2) ? "X" : 0, "A flag." };
+		specs[i] = spec;
+	}
+	const OptionParser::FlagSpec terminator = { 0, 0, 0, 0, 0 };
+	specs[n] = terminator;
+}
+
+/// Parse "--f000 --f007=seven pos --<the even flag before the last>".
+/// @return The flags seen, as "name[=value] ...".
+std::string parse_long_flags(const OptionParser::FlagSpec *specs, const char *last_name, size_t &used) {
+	char prog[] = "prog", f0[] = "--f000", f7[] = "--f007=seven", pos[] = "pos", last[64];
+	std::snprintf(last, sizeof(last), "--%s", last_name);
+	char *argv[] = { prog, f0, f7, pos, last, nullptr };
+	const int argc = int(sizeof(argv) / sizeof(argv[0])) - 1;
+	std::string got;
+	got.reserve(256);
+	const size_t before = allocations;
+	{
+		OptionParser opts(specs, argc, argv);
+		int flag;
+		while ((flag = opts.next()) != -1) {
+			got += specs[flag].long_flag;
+			if (opts.arg()) { got.append("=").append(opts.arg()); }
+			got += ' ';
+		}
+		if (opts.arg_count() != 2) { got += "(positionals)"; }
+	}
+	used = allocations - before;
+	return got;
+}
+
+/// Long flags are found in tables of any size; up to INLINE_LONG_FLAGS, neither
+/// setting up nor parsing allocates.
+void test_long_flags() {
+	static char names[BIG_TABLE][8];
+	static OptionParser::FlagSpec specs[BIG_TABLE + 1];
+	const size_t full = OptionParser::INLINE_LONG_FLAGS;
+
+	make_long_flags(full, names, specs);
+	size_t used = 0;
+	std::string got = parse_long_flags(specs, names[full - 2], used);
+	check(got == std::string("f000 f007=seven ") + names[full - 2] + " ", "long flags: all found");
+	check(used == 0, "long flags: parsing doesn't allocate");
+
+	char prog[] = "prog", missing[] = "--f999";
+	char *argv[] = { prog, missing, nullptr };
+	bool threw = false;
+	try {
+		OptionParser opts(specs, 2, argv);
+		while (opts.next() != -1) {}
+	} catch (OptionParser::UnknownFlag &) { threw = true; }
+	check(threw, "long flags: unknown");
+
+	// a bigger table is fine too; its index is allocated once
+	make_long_flags(BIG_TABLE, names, specs);
+	got = parse_long_flags(specs, names[BIG_TABLE - 2], used);
+	check(got == std::string("f000 f007=seven ") + names[BIG_TABLE - 2] + " " && used == 1, "long flags: more than fit inline");
+}
+
+struct Context {
+	std::string name;
+	std::string positionals;
+	bool verbose;
+};
+
+int specs_built = 0;
+
+const OptionParser::FlagSpec ADD_FLAGS[] = {
+	{ 'n', "n", "name", "NAME", "Name of the thing to add." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+const OptionParser::FlagSpec *add_specs() { ++specs_built; return ADD_FLAGS; }
+const OptionParser::FlagSpec *no_specs() { ++specs_built; return FLAGS + 2; }
+
+int add_handler(OptionParser &opts, void *context) {
+	Context &ctx = *static_cast<Context*>(context);
+	int flag;
+	while ((flag = opts.next()) != -1) {
+		if (flag == 'n') { ctx.name = opts.arg(); }
+	}
+	std::vector<std::string> args;
+	const OptionParser::Positionals all = opts.positionals();
+	for (OptionParser::Positionals::iterator it = all.begin(); it != all.end(); ++it) { args.push_back(*it); }
+	ctx.positionals = joined(args);
+	return 7;
+}
+
+int list_handler(OptionParser &opts, void *context) {
+	(void)context;
+	while (opts.next() != -1) {}
+	return opts.arg_count();
+}
+
+const OptionParser::Command ADD = { "add", "Add a thing.", &add_specs, &add_handler };
+const OptionParser::Command LIST = { "list", "List the things.", &no_specs, &list_handler };
+
+/// Global flags, then a command with its own flags (which the global parser leaves alone).
+void test_dispatch() {
+	OptionParser::Commands commands;
+	commands.add(LIST);
+	commands.add(ADD);
+	check(commands.size() == 2 && commands.find("add") == &ADD && commands.find("list") == &LIST
+			&& !commands.find("ad") && !commands.find(""), "commands: find");
+
+	char prog[] = "prog", v[] = "-v", add[] = "add", name[] = "--name=x", file1[] = "file1", dashes[] = "--", z[] = "-z";
+	char *argv[] = { prog, v, add, name, file1, dashes, z, nullptr };
+	const int argc = int(sizeof(argv) / sizeof(argv[0])) - 1;
+	Context ctx;
+	ctx.verbose = false;
+	OptionParser opts(FLAGS, argc, argv);
+	opts.set_stop_at_positional(true);
+	int flag;
+	while ((flag = opts.next()) != -1) {
+		if (flag == 'v') { ctx.verbose = true; }
+	}
+	check(ctx.verbose && opts.arg_count() == 6, "commands: global flags stop at the command");
+
+	specs_built = 0;
+	const int result = commands.run(opts.arg_count() - 1, argv + 1, &ctx);
+	check(result == 7 && ctx.name == "x" && ctx.positionals == "[add] [file1] [-z]", "commands: run with context");
+	check(specs_built == 1, "commands: only the selected command's flags are built");
+
+	char list[] = "list", a[] = "a";
+	char *list_argv[] = { list, a, nullptr };
+	check(commands.run(2, list_argv) == 2, "commands: handler's return value");
+}
+
+void test_unknown_commands() {
+	OptionParser::Commands commands;
+	commands.add(ADD);
+
+	char nope[] = "nope";
+	char *argv[] = { nope, nullptr };
+	bool threw = false;
+	try { commands.run(1, argv); } catch (OptionParser::UnknownCommand &e) { threw = std::strcmp(e.what(), "unknown command 'nope'") == 0; }
+	check(threw, "commands: unknown command");
+
+	threw = false;
+	try { commands.run(0, argv + 1); } catch (OptionParser::UnknownCommand &e) { threw = std::strcmp(e.what(), "expected a command") == 0; }
+	check(threw, "commands: no command");
+
+	// a bad flag for the command comes from the command's own parser
+	char add[] = "add", bad[] = "--verbose";
+	char *add_argv[] = { add, bad, nullptr };
+	Context ctx;
+	threw = false;
+	try { commands.run(2, add_argv, &ctx); } catch (OptionParser::UnknownFlag &) { threw = true; }
+	check(threw, "commands: the command's flags");
+}
+
+struct Settings {
+	bool verbose;
+	int jobs;
+	const char *output;
+};
+
+constexpr OptionParser::Flag<Settings> TYPED_FLAGS[] = {
+	{ "v", "verbose", &Settings::verbose, nullptr, "Print more." },
+	{ "j", "jobs", &Settings::jobs, "N", "Run N jobs at once." },
+	{ "o", "output", &Settings::output, "FILE", "Write to FILE." },
+};
+static_assert(OptionParser::valid_flags(TYPED_FLAGS), "bad flag table");
+
+// a bool flag with a metaname: the parser itself would take it (as a flag with an
+// argument), and it's not constexpr, so nothing checks it before parse()
+const OptionParser::Flag<Settings> MALFORMED_FLAGS[] = {
+	{ "v", "verbose", &Settings::verbose, "WHEN", "Print more." },
+	{ "j", "jobs", &Settings::jobs, "N", "Run N jobs at once." },
+};
+
+void test_typed_flags() {
+	char prog[] = "prog", v[] = "-v", j[] = "--jobs=4", o[] = "-o", out[] = "out.txt", file[] = "file";
+	char *argv[] = { prog, v, j, o, out, file, nullptr };
+	Settings settings = { false, 1, "default" };
+	const int nargs = OptionParser::parse(TYPED_FLAGS, settings, 6, argv);
+	check(nargs == 2 && settings.verbose && settings.jobs == 4 && std::strcmp(settings.output, "out.txt") == 0
+			&& std::strcmp(argv[1], "file") == 0, "typed flags: parsed into the struct");
+	check(!OptionParser::valid_flags(MALFORMED_FLAGS), "typed flags: a bool flag with a metaname is invalid");
+
+	// parse() asserts the table is valid, even though nobody static_asserted it
+	const pid_t pid = ::fork();
+	if (pid == 0) {
+		// keep the assertion message out of the test's output
+		::close(STDERR_FILENO);
+		char yes[] = "yes";
+		char *child_argv[] = { prog, v, yes, nullptr };
+		OptionParser::parse(MALFORMED_FLAGS, settings, 3, child_argv);
+		::_exit(0);
+	}
+	int status = 0;
+	check(pid != -1 && ::waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT,
+			"typed flags: parse() asserts valid_flags()");
+}
+
+/// MAX_COMMANDS commands (which fill half the hash slots, so there are collisions), then one more.
+void test_full_table() {
+	static char names[OptionParser::Commands::MAX_COMMANDS + 1][16];
+	static OptionParser::Command table[OptionParser::Commands::MAX_COMMANDS + 1];
+	OptionParser::Commands commands;
+	for (size_t i = 0; i <= OptionParser::Commands::MAX_COMMANDS; ++i) {
+		std::snprintf(names[i], sizeof(names[i]), "cmd%u", unsigned(i));
+		const OptionParser::Command command = { names[i], "A command.", &no_specs, &list_handler };
+		table[i] = command;
+	}
+	for (size_t i = 0; i < OptionParser::Commands::MAX_COMMANDS; ++i) { commands.add(table[i]); }
+
+	bool threw = false;
+	try { commands.add(table[OptionParser::Commands::MAX_COMMANDS]); } catch (std::length_error &) { threw = true; }
+	check(threw && commands.size() == OptionParser::Commands::MAX_COMMANDS, "commands: one too many");
+
+	bool found = true;
+	for (size_t i = 0; i < OptionParser::Commands::MAX_COMMANDS; ++i) { found = found && commands.find(names[i]) == &table[i]; }
+	check(found && !commands.find(names[OptionParser::Commands::MAX_COMMANDS]) && !commands.find("cmd"), "commands: find in a full table");
+
+	char last[16], x[] = "x", y[] = "y";
+	std::strcpy(last, names[OptionParser::Commands::MAX_COMMANDS - 1]);
+	char *argv[] = { last, x, y, nullptr };
+	check(commands.run(3, argv) == 3, "commands: run from a full table");
+
+	// usage lists them in the order they were added
+	std::vector<char> usage(commands.format_usage(nullptr, 0, "prog") + 1);
+	commands.format_usage(usage.data(), usage.size(), "prog");
+	const char * const first = std::strstr(usage.data(), "    cmd0\n");
+	const char * const tenth = std::strstr(usage.data(), "    cmd9\n");
+	const char * const latest = std::strstr(usage.data(), "    cmd255\n");
+	check(first && tenth && latest && first < tenth && tenth < latest, "commands: usage in order");
+}
+
+} // anonymous namespace
+
+int main() {
+	try {
+		test_response_files();
+		test_empty_arguments();
+		test_long_flags();
+		test_typed_flags();
+		test_dispatch();
+		test_unknown_commands();
+		test_full_table();
+	} catch (OptionParser::BadFlag &e) {
+		check(false, e.what());
+	}
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
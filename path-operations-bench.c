@@ -0,0 +1,183 @@
+/*
+ * Throughput benchmark for path-operations.c.
+ *
+ * Each function is run over a batch of generated paths from several
+ * distributions: short relative paths, deep absolute paths, paths full of
+ * repeated slashes, and 4 KB paths. Reports nanoseconds per path and MB/s of
+ * input, best of several runs.
+ *
+ * usage: path-operations-bench [seconds-per-case]
+ */
+
+#include "path-operations.h"
+#include "rand.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#define BENCH_INPUT_BYTES (8 * 1024 * 1024)
+#define BENCH_MAX_PATH 8192
+#define BENCH_RUNS 5
+
+struct distribution {
+   const char* name;
+   /* components: count range and length range; slashes: separator run length range */
+   unsigned min_components, max_components;
+   unsigned min_component_len, max_component_len;
+   unsigned min_slashes, max_slashes;
+   int absolute;
+   int trailing_slash;
+};
+
+static const struct distribution DISTRIBUTIONS[] = {
+   { "short", 1, 3, 3, 10, 1, 1, 0, 0 },
+   { "deep", 20, 40, 2, 8, 1, 1, 1, 0 },
+   { "slash-heavy", 3, 10, 1, 6, 1, 8, 1, 1 },
+   { "4KB", 160, 160, 20, 28, 1, 1, 1, 0 },
+};
+
+struct batch {
+   char* data;
+   size_t* offsets;
+   size_t count;
+   size_t bytes;
+};
+
+static unsigned uniform(struct xorshift_rng* rng, unsigned lo, unsigned hi)
+{
+   return lo + (hi > lo ? xorshift_next_i32(rng) % (hi - lo + 1) : 0);
+}
+
+static size_t generate_path(struct xorshift_rng* rng, const struct distribution* d, char* buf)
+{
+   static const char NAME_CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789._-";
+   size_t len = 0;
+   const unsigned n = uniform(rng, d->min_components, d->max_components);
+   for (unsigned c = 0; c < n; ++c) {
+      if (c || d->absolute) {
+         for (unsigned s = uniform(rng, d->min_slashes, d->max_slashes); s; --s) { buf[len++] = '/'; }
+      }
+      for (unsigned k = uniform(rng, d->min_component_len, d->max_component_len); k; --k) {
+         buf[len++] = NAME_CHARS[xorshift_next_i32(rng) % (sizeof(NAME_CHARS) - 1)];
+      }
+      assert(len < BENCH_MAX_PATH);
+   }
+   if (d->trailing_slash) {
+      for (unsigned s = uniform(rng, d->min_slashes, d->max_slashes); s; --s) { buf[len++] = '/'; }
+   }
+   assert(len < BENCH_MAX_PATH);
+   buf[len] = '\0';
+   return len;
+}
+
+/* NUL-terminated paths packed together, about BENCH_INPUT_BYTES in total */
+static void generate_batch(struct batch* b, const struct distribution* d, uint32_t seed)
+{
+   struct xorshift_rng rng;
+   size_t capacity = 1024;
+   xorshift_init(&rng, seed);
+   b->data = malloc(BENCH_INPUT_BYTES + BENCH_MAX_PATH);
+   b->offsets = malloc(capacity * sizeof(size_t));
+   assert(b->data && b->offsets);
+   b->count = 0;
+   b->bytes = 0;
+   while (b->bytes < BENCH_INPUT_BYTES) {
+      if (b->count + 1 == capacity) {
+         capacity *= 2;
+         b->offsets = realloc(b->offsets, capacity * sizeof(size_t));
+         assert(b->offsets);
+      }
+      b->offsets[b->count++] = b->bytes;
+      b->bytes += generate_path(&rng, d, b->data + b->bytes) + 1;
+   }
+   b->offsets[b->count] = b->bytes;
+}
+
+static double now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+enum bench_op {
+   OP_NORMALISE,
+   OP_DIRNAME,
+   OP_BASENAME,
+   OP_BASENAME_ANY,
+   OP_BATCH_DIRNAME,
+   OP_COUNT
+};
+
+static const char* const OP_NAMES[OP_COUNT] = {
+   "normalise_path", "dirname", "basename", "basename_any", "path_batch(dirname)"
+};
+
+/* prevents the compiler from discarding results */
+static volatile unsigned s_sink;
+
+static void run_once(enum bench_op op, const struct batch* b, char* out, size_t* out_offsets)
+{
+   char buf[BENCH_MAX_PATH + 2];
+   unsigned sink = 0;
+   if (op == OP_BATCH_DIRNAME) {
+      path_batch(PATH_BATCH_DIRNAME, b->data, b->offsets, b->count, out, out_offsets, 1);
+      s_sink = (unsigned char)out[out_offsets[b->count / 2]];
+      return;
+   }
+   for (size_t i = 0; i < b->count; ++i) {
+      const char* path = b->data + b->offsets[i];
+      switch (op) {
+         case OP_NORMALISE:
+            /* normalise_path works in place, so it pays for a copy too */
+            memcpy(buf, path, b->offsets[i+1] - b->offsets[i]);
+            normalise_path(buf);
+            break;
+         case OP_DIRNAME: dirname(buf, sizeof(buf), path); break;
+         case OP_BASENAME: basename(buf, sizeof(buf), path); break;
+         case OP_BASENAME_ANY: basename_any(buf, sizeof(buf), path); break;
+         default: assert(0); break;
+      }
+      sink += (unsigned char)buf[0];
+   }
+   s_sink = sink;
+}
+
+int main(int argc, char** argv)
+{
+   const double seconds = (argc > 1) ? atof(argv[1]) : 0.5;
+   const size_t ndist = sizeof(DISTRIBUTIONS) / sizeof(DISTRIBUTIONS[0]);
+
+   printf("%-12s %-20s %10s %12s %10s\n", "paths", "function", "count", "ns/path", "MB/s");
+   for (size_t d = 0; d < ndist; ++d) {
+      struct batch b;
+      generate_batch(&b, &DISTRIBUTIONS[d], 12345u + (uint32_t)d);
+      char* out = malloc(path_batch_output_size(b.offsets, b.count));
+      size_t* out_offsets = malloc((b.count + 1) * sizeof(size_t));
+      assert(out && out_offsets);
+
+      for (int op = 0; op < OP_COUNT; ++op) {
+         double best = 1e30;
+         /* repeat until 'seconds' have passed (and at least BENCH_RUNS times), keeping the best */
+         const double start = now();
+         for (int run = 0; run < BENCH_RUNS || now() - start < seconds; ++run) {
+            const double t0 = now();
+            run_once((enum bench_op)op, &b, out, out_offsets);
+            const double t = now() - t0;
+            if (t < best) { best = t; }
+         }
+         printf("%-12s %-20s %10zu %12.1f %10.1f\n", DISTRIBUTIONS[d].name, OP_NAMES[op], b.count,
+               best * 1e9 / (double)b.count, (double)b.bytes / best / 1e6);
+      }
+
+      free(out_offsets);
+      free(out);
+      free(b.offsets);
+      free(b.data);
+   }
+   return EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
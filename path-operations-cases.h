@@ -0,0 +1,122 @@
+#ifndef PATH_OPERATIONS_CASES_H
+#define PATH_OPERATIONS_CASES_H
+
+/*
+ * Path test cases with their expected results, shared by path-operations-test.c
+ * and pathtable-test.cpp. Each table ends with a NULL entry.
+ */
+
+typedef struct {
+   const char* input;
+   const char* expected;
+} TestCase;
+
+static const TestCase NORMPATH_TEST_CASES[] = {
+   { "", "" },
+   { "/", "/" },
+   { "aaa", "aaa" },
+   { "/aaa", "/aaa" },
+   { "aaa/", "aaa" },
+   { "/aaa/", "/aaa" },
+   { "/aaa/bbb", "/aaa/bbb" },
+   { "/aaa/bbb/", "/aaa/bbb" },
+   { "aaa/bbb", "aaa/bbb" },
+   { "aaa/bbb/", "aaa/bbb" },
+   { "aaa/bbb/", "aaa/bbb" },
+   { "//", "/" },
+   { "//aaa", "/aaa" },
+   { "//aaa/", "/aaa" },
+   { "//aaa/bbb", "/aaa/bbb" },
+   { "//aaa/bbb/", "/aaa/bbb" },
+   { "/", "/" },
+   { "/aaa//", "/aaa" },
+   { "/aaa//bbb", "/aaa/bbb" },
+   { "/aaa//bbb/", "/aaa/bbb" },
+   { "/aaa/bbb//", "/aaa/bbb" },
+   { NULL, NULL }
+};
+
+static const TestCase DIRNAME_TEST_CASES[] = {
+   { "", "." },
+   { "/", "/" },
+   { "aaa", "." },
+   { "/aaa", "/" },
+   { "aaa/bbb", "aaa" },
+   { "aaa/bbb/ccc/ddd", "aaa/bbb/ccc" },
+   { "/aaa/bbb", "/aaa" },
+   { "/aaa/bbb/ccc/ddd", "/aaa/bbb/ccc" },
+   { "//", "/" },
+   { "aaa//", "." },
+   { "///aaa//", "/" },
+   { "aaa///bbb//", "aaa" },
+   { "aaa//bbb///ccc///ddd//", "aaa/bbb/ccc" },
+   { "///aaa//bbb//", "/aaa" },
+   { "/aaa//bbb/ccc///ddd//", "/aaa/bbb/ccc" },
+   { NULL, NULL }
+};
+
+static const TestCase BASENAME_TEST_CASES[] = {
+   { "", "." },
+   { "/", "/" },
+   { "aaa", "aaa" },
+   { "/aaa", "aaa" },
+   { "aaa/bbb", "bbb" },
+   { "aaa/bbb/ccc/ddd", "ddd" },
+   { "/aaa/bbb", "bbb" },
+   { "/aaa/bbb/ccc/ddd", "ddd" },
+   { "//", "/" },
+   { "aaa//", "aaa" },
+   { "///aaa", "aaa" },
+   { "///aaa//", "aaa" },
+   { "aaa///bbb//", "bbb" },
+   { "aaa//bbb///ccc///ddd//", "ddd" },
+   { "///aaa//bbb//", "bbb" },
+   { "/aaa//bbb/ccc///ddd//", "ddd" },
+   { NULL, NULL }
+};
+
+static const TestCase NORMPATH_LEXICAL_TEST_CASES[] = {
+   { ".", "." },
+   { "./", "." },
+   { "..", ".." },
+   { "/.", "/" },
+   { "/..", "/" },
+   { "/../..", "/" },
+   { "aaa/..", "." },
+   { "aaa/../..", ".." },
+   { "../aaa", "../aaa" },
+   { "../../aaa/..", "../.." },
+   { "./aaa/./bbb/.", "aaa/bbb" },
+   { "aaa/bbb/../ccc", "aaa/ccc" },
+   { "/aaa/bbb/../../ccc", "/ccc" },
+   { "/aaa/../../bbb", "/bbb" },
+   { "//aaa//.//bbb//..//", "/aaa" },
+   { "aaa/.bbb/..ccc/...", "aaa/.bbb/..ccc/..." },
+   { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/../bbbbbbbbb/c", "bbbbbbbbb/c" },
+   { NULL, NULL }
+};
+
+typedef struct {
+   const char* base;
+   const char* path;
+   const char* expected;
+} JoinTestCase;
+
+static const JoinTestCase JOIN_TEST_CASES[] = {
+   { "", "", "" },
+   { "", "aaa", "aaa" },
+   { "aaa", "", "aaa" },
+   { "aaa", "bbb", "aaa/bbb" },
+   { "aaa/", "bbb/", "aaa/bbb" },
+   { "/aaa", "bbb", "/aaa/bbb" },
+   { "/aaa", "/bbb", "/bbb" },
+   { "/aaa/bbb", "../ccc", "/aaa/ccc" },
+   { "aaa", "../..", ".." },
+   { "/", "..", "/" },
+   { "aaa//bbb", "./ccc//", "aaa/bbb/ccc" },
+   { NULL, NULL, NULL }
+};
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
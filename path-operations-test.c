@@ -0,0 +1,362 @@
+#include "path-operations.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include "rand.h"
+#include "path-operations-cases.h"
+
+#define VERBOSE_SILENT  0
+#define VERBOSE_NORMAL  1
+#define VERBOSE_VERBOSE 2
+
+static int s_verbose_level = VERBOSE_VERBOSE;
+
+int test_check(const char* input, const char* expected, const char* output)
+{
+   int success = (0 == strcmp(output, expected));
+   if (success) {
+      if (s_verbose_level >= VERBOSE_VERBOSE) {
+         printf("GOOD '%s' -> '%s'\n", input, output);
+      }
+   } else {
+      if (s_verbose_level > VERBOSE_SILENT) {
+         printf(" BAD '%s' -> '%s' (expected '%s')\n", input, output, expected);
+      }
+   }
+   return success;
+}
+
+int test_inplace(void (*f)(char*), const char* input, const char* expected)
+{
+   char buf[64];
+   assert(strlen(input) < sizeof(buf));
+   assert(strlen(expected) < sizeof(buf));
+   strcpy(buf, input);
+   f(buf);
+   return test_check(input, expected, buf);
+}
+
+int test_outplace(void (*f)(char* RESTRICT, size_t, const char* RESTRICT),
+      const char* input, const char* expected)
+{
+   char buf[64];
+   assert(strlen(input) < sizeof(buf));
+   assert(strlen(expected) < sizeof(buf));
+   f(buf, sizeof(buf), input);
+   return test_check(input, expected, buf);
+}
+
+int test_view(struct path_view (*f)(struct path_view), const char* input, const char* expected)
+{
+   char buf[64];
+   struct path_view v = f(path_view_of(input));
+   assert(v.len < sizeof(buf));
+   assert(strlen(expected) < sizeof(buf));
+   memcpy(buf, v.ptr, v.len);
+   buf[v.len] = '\0';
+   /* views may keep interior runs of slashes */
+   normalise_path(buf);
+   return test_check(input, expected, buf);
+}
+
+/* rebuild the normalised path from its components, iterating in either direction */
+int test_iter(int reverse, const char* input, const char* expected)
+{
+   char buf[64];
+   char* start = buf + sizeof(buf) - 1;
+   struct path_iter it;
+   struct path_view c;
+   struct path_view path = path_view_of(input);
+   int first = 1;
+   assert(strlen(input) < sizeof(buf));
+   if (!reverse) {
+      char* to = buf;
+      if (path_view_is_absolute(path)) { *to++ = '/'; }
+      path_iter_init(&it, path);
+      while (path_iter_next(&it, &c)) {
+         if (!first) { *to++ = '/'; }
+         memcpy(to, c.ptr, c.len);
+         to += c.len;
+         first = 0;
+      }
+      *to = '\0';
+      start = buf;
+   } else {
+      *start = '\0';
+      path_riter_init(&it, path);
+      while (path_riter_next(&it, &c)) {
+         if (!first) { *--start = '/'; }
+         start -= c.len;
+         memcpy(start, c.ptr, c.len);
+         first = 0;
+      }
+      if (path_view_is_absolute(path)) { *--start = '/'; }
+   }
+   return test_check(input, expected, start);
+}
+
+void run_tests_join(int* count, int* good_count, const char* title, const JoinTestCase* cases)
+{
+   char buf[64];
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (int i = 0; cases[i].base; ++i) {
+      ++*count;
+      path_join(buf, sizeof(buf), cases[i].base, cases[i].path);
+      if (test_check(cases[i].path, cases[i].expected, buf))
+         ++*good_count;
+   }
+}
+
+void run_tests_inplace(int* count, int* good_count, const char* title, const TestCase* cases,
+      void (*f)(char*))
+{
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (int i = 0; cases[i].input; ++i) {
+      ++*count;
+      if (test_inplace(f, cases[i].input, cases[i].expected))
+         ++*good_count;
+   }
+}
+
+void run_tests_outplace(int* count, int* good_count, const char* title, const TestCase* cases,
+      void (*f)(char* RESTRICT, size_t, const char* RESTRICT))
+{
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (int i = 0; cases[i].input; ++i) {
+      ++*count;
+      if (test_outplace(f, cases[i].input, cases[i].expected))
+         ++*good_count;
+   }
+}
+
+void run_tests_view(int* count, int* good_count, const char* title, const TestCase* cases,
+      struct path_view (*f)(struct path_view))
+{
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (int i = 0; cases[i].input; ++i) {
+      ++*count;
+      if (test_view(f, cases[i].input, cases[i].expected))
+         ++*good_count;
+   }
+}
+
+void run_tests_iter(int* count, int* good_count, const char* title, const TestCase* cases, int reverse)
+{
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (int i = 0; cases[i].input; ++i) {
+      ++*count;
+      if (test_iter(reverse, cases[i].input, cases[i].expected))
+         ++*good_count;
+   }
+}
+
+/* runs all the cases as one batch, with alternate inputs NUL-terminated and not */
+void run_tests_batch(int* count, int* good_count, const char* title, const TestCase* cases,
+      enum path_batch_op op)
+{
+   char in[4096] = { 0 }, out[4096];
+   size_t in_offsets[128], out_offsets[128];
+   size_t n = 0, pos = 0;
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%s:\n", title);
+   }
+   for (; cases[n].input; ++n) {
+      const size_t len = strlen(cases[n].input);
+      assert(n + 1 < sizeof(in_offsets) / sizeof(in_offsets[0]));
+      assert(pos + len + 1 < sizeof(in));
+      in_offsets[n] = pos;
+      memcpy(in + pos, cases[n].input, len);
+      pos += len;
+      if (n & 1) { in[pos++] = '\0'; }
+   }
+   in_offsets[n] = pos;
+   assert(path_batch_output_size(in_offsets, n) <= sizeof(out));
+   path_batch(op, in, in_offsets, n, out, out_offsets, 1);
+   for (size_t i = 0; i < n; ++i) {
+      ++*count;
+      if (test_check(cases[i].input, cases[i].expected, out + out_offsets[i])
+            && strlen(out + out_offsets[i]) + 1 == out_offsets[i+1] - out_offsets[i])
+         ++*good_count;
+   }
+}
+
+/*
+ * Randomized differential test: our dirname and basename against the C library's
+ * (POSIX) versions, and the view, basename_any and batch versions against those.
+ * The C library doesn't collapse repeated slashes, so its results are normalised
+ * before comparing.
+ */
+
+#define RANDOM_MAX_PATH 1024
+
+typedef char* (*libc_path_fn)(char*);
+
+/* mostly short paths, over an alphabet that makes slash runs and dot components common */
+static size_t random_path(struct xorshift_rng* rng, char* buf)
+{
+   static const char ALPHABET[] = "///ab.";
+   const uint32_t r = xorshift_next_i32(rng);
+   const size_t len = (r & 15u) ? (r >> 8) % 32u : (r >> 8) % RANDOM_MAX_PATH;
+   for (size_t i = 0; i < len; ++i) {
+      buf[i] = ALPHABET[xorshift_next_i32(rng) % (sizeof(ALPHABET) - 1)];
+   }
+   buf[len] = '\0';
+   return len;
+}
+
+static int random_check(int* reported, const char* what, const char* input, const char* expected, const char* output)
+{
+   if (0 == strcmp(expected, output)) { return 1; }
+   if (s_verbose_level > VERBOSE_SILENT && (*reported)++ < 10) {
+      printf(" BAD %s('%s') -> '%s' (expected '%s')\n", what, input, output, expected);
+   }
+   return 0;
+}
+
+static void libc_reference(libc_path_fn f, char* RESTRICT buf, const char* RESTRICT input)
+{
+   char tmp[RANDOM_MAX_PATH + 1];
+   strcpy(tmp, input);
+   /* the result may point into tmp, or to static storage */
+   strcpy(buf, f(tmp));
+   normalise_path(buf);
+}
+
+void run_tests_random(int* count, int* good_count, uint32_t seed, int iterations)
+{
+   char input[RANDOM_MAX_PATH + 1], expected[RANDOM_MAX_PATH + 2], output[RANDOM_MAX_PATH + 2];
+   libc_path_fn libc_dirname = NULL, libc_basename = NULL;
+   struct xorshift_rng rng;
+   int reported = 0;
+
+   /* looked up at run time, since our dirname and basename take the names at link time
+    * (glibc's POSIX basename is __xpg_basename) */
+   void* libc = dlopen("libc.so.6", RTLD_LAZY);
+   if (libc) {
+      *(void**)&libc_dirname = dlsym(libc, "dirname");
+      *(void**)&libc_basename = dlsym(libc, "__xpg_basename");
+   }
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("random (seed %u, %d paths)%s:\n", (unsigned)seed, iterations,
+            (libc_dirname && libc_basename) ? "" : " [no C library reference found]");
+   }
+
+   /* the inputs are also collected into a batch, to check path_batch with several threads */
+   size_t* offsets = malloc(((size_t)iterations + 1) * sizeof(size_t));
+   char* arena = malloc((size_t)iterations * (RANDOM_MAX_PATH + 1));
+   size_t arena_used = 0;
+   assert(offsets && arena);
+
+   xorshift_init(&rng, seed);
+   for (int i = 0; i < iterations; ++i) {
+      const size_t len = random_path(&rng, input);
+      offsets[i] = arena_used;
+      memcpy(arena + arena_used, input, len + 1);
+      arena_used += len + 1;
+
+      struct path_view v;
+      if (libc_dirname) {
+         ++*count;
+         libc_reference(libc_dirname, expected, input);
+         dirname(output, sizeof(output), input);
+         if (random_check(&reported, "dirname", input, expected, output)) { ++*good_count; }
+      }
+      dirname(expected, sizeof(expected), input);
+      ++*count;
+      v = path_view_dirname(path_view_make(input, len));
+      memcpy(output, v.ptr, v.len);
+      output[v.len] = '\0';
+      normalise_path(output);
+      if (random_check(&reported, "path_view_dirname", input, expected, output)) { ++*good_count; }
+
+      if (libc_basename) {
+         ++*count;
+         libc_reference(libc_basename, expected, input);
+         basename(output, sizeof(output), input);
+         if (random_check(&reported, "basename", input, expected, output)) { ++*good_count; }
+      }
+      basename(expected, sizeof(expected), input);
+      ++*count;
+      basename_any(output, sizeof(output), input);
+      if (random_check(&reported, "basename_any", input, expected, output)) { ++*good_count; }
+      ++*count;
+      v = path_view_basename(path_view_make(input, len));
+      memcpy(output, v.ptr, v.len);
+      output[v.len] = '\0';
+      if (random_check(&reported, "path_view_basename", input, expected, output)) { ++*good_count; }
+   }
+   offsets[iterations] = arena_used;
+
+   {
+      static const enum path_batch_op OPS[] = { PATH_BATCH_NORMALISE, PATH_BATCH_DIRNAME, PATH_BATCH_BASENAME };
+      static const char* const OP_NAMES[] = { "path_batch(normalise)", "path_batch(dirname)", "path_batch(basename)" };
+      size_t* out_offsets = malloc(((size_t)iterations + 1) * sizeof(size_t));
+      char* out = malloc(path_batch_output_size(offsets, iterations));
+      assert(out_offsets && out);
+      for (int op = 0; op < 3; ++op) {
+         path_batch(OPS[op], arena, offsets, iterations, out, out_offsets, 4);
+         for (int i = 0; i < iterations; ++i) {
+            const char* in = arena + offsets[i];
+            if (OPS[op] == PATH_BATCH_NORMALISE) {
+               strcpy(expected, in);
+               normalise_path(expected);
+            } else if (OPS[op] == PATH_BATCH_DIRNAME) {
+               dirname(expected, sizeof(expected), in);
+            } else {
+               basename(expected, sizeof(expected), in);
+            }
+            ++*count;
+            if (random_check(&reported, OP_NAMES[op], in, expected, out + out_offsets[i])) { ++*good_count; }
+         }
+      }
+      free(out);
+      free(out_offsets);
+   }
+
+   free(arena);
+   free(offsets);
+   if (libc) { dlclose(libc); }
+}
+
+/* usage: path-operations-test [seed [random-iterations]] */
+int main(int argc, char** argv)
+{
+   int count = 0, good_count = 0;
+   const uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 12345u;
+   const int iterations = (argc > 2) ? atoi(argv[2]) : 100000;
+
+   run_tests_inplace(&count, &good_count, "normalise_path", NORMPATH_TEST_CASES, &normalise_path);
+   run_tests_inplace(&count, &good_count, "normalise_path_lexical", NORMPATH_TEST_CASES, &normalise_path_lexical);
+   run_tests_inplace(&count, &good_count, "normalise_path_lexical (dots)", NORMPATH_LEXICAL_TEST_CASES, &normalise_path_lexical);
+   run_tests_join(&count, &good_count, "path_join", JOIN_TEST_CASES);
+   run_tests_outplace(&count, &good_count, "dirname", DIRNAME_TEST_CASES, &dirname);
+   run_tests_outplace(&count, &good_count, "basename", BASENAME_TEST_CASES, &basename);
+   run_tests_view(&count, &good_count, "path_view_normalise", NORMPATH_TEST_CASES, &path_view_normalise);
+   run_tests_view(&count, &good_count, "path_view_dirname", DIRNAME_TEST_CASES, &path_view_dirname);
+   run_tests_view(&count, &good_count, "path_view_basename", BASENAME_TEST_CASES, &path_view_basename);
+   run_tests_iter(&count, &good_count, "path_iter", NORMPATH_TEST_CASES, 0);
+   run_tests_iter(&count, &good_count, "path_riter", NORMPATH_TEST_CASES, 1);
+   run_tests_batch(&count, &good_count, "path_batch (normalise)", NORMPATH_TEST_CASES, PATH_BATCH_NORMALISE);
+   run_tests_batch(&count, &good_count, "path_batch (dirname)", DIRNAME_TEST_CASES, PATH_BATCH_DIRNAME);
+   run_tests_batch(&count, &good_count, "path_batch (basename)", BASENAME_TEST_CASES, PATH_BATCH_BASENAME);
+   run_tests_random(&count, &good_count, seed, iterations);
+
+   if (s_verbose_level > VERBOSE_SILENT) {
+      printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+   }
+   return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim: set sts=3 sw=3 et: */
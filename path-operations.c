@@ -1,24 +1,61 @@
+#include "path-operations.h"
 #include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#define VERBOSE_SILENT  0
-#define VERBOSE_NORMAL  1
-#define VERBOSE_VERBOSE 2
-
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
-#define RESTRICT restrict
-#else
-#define RESTRICT
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
 #endif
 
-static int s_verbose_level = VERBOSE_VERBOSE;
-
 /*
- * normalised path matches language:
- *    '/'? ([^/]+ ('/' [^/]+)*)?
+ * Returns a pointer to the first '/' or NUL at or after p.
+ *
+ * The SIMD versions scan 16 (SSE2) or 32 (AVX2) bytes at a time using aligned
+ * loads. An aligned load can't cross a page boundary, so reading bytes past the
+ * terminator (or before p, which are masked off) is safe, although memory checkers
+ * that track individual bytes may complain about it.
  */
+static const char* find_separator(const char* p)
+{
+#if defined(__AVX2__)
+   const __m256i slash = _mm256_set1_epi8('/');
+   const __m256i zero = _mm256_setzero_si256();
+   const unsigned misalign = (uintptr_t)p & 31u;
+   const __m256i* block = (const __m256i*)(p - misalign);
+   __m256i v = _mm256_load_si256(block);
+   uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+         _mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(v, zero)));
+   mask &= (0xffffffffu << misalign);
+   while (!mask) {
+      v = _mm256_load_si256(++block);
+      mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(v, zero)));
+   }
+   return (const char*)block + __builtin_ctz(mask);
+#elif defined(__SSE2__)
+   const __m128i slash = _mm_set1_epi8('/');
+   const __m128i zero = _mm_setzero_si128();
+   const unsigned misalign = (uintptr_t)p & 15u;
+   const __m128i* block = (const __m128i*)(p - misalign);
+   __m128i v = _mm_load_si128(block);
+   unsigned mask = (unsigned)_mm_movemask_epi8(
+         _mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, zero)));
+   mask &= (0xffffu << misalign);
+   while (!mask) {
+      v = _mm_load_si128(++block);
+      mask = (unsigned)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, zero)));
+   }
+   return (const char*)block + __builtin_ctz(mask);
+#else
+   while (*p && *p != '/') { ++p; }
+   return p;
+#endif
+}
 
 void normalise_path(char* path)
 {
@@ -28,7 +65,10 @@ void normalise_path(char* path)
    if (*from == '/') { *to++ = *from++; }
    while (*from == '/') { ++from; }
    while (*from) {
-      while (*from && *from != '/') { *to++ = *from++; }
+      const char* sep = find_separator(from);
+      if (to != from) { memmove(to, from, sep - from); }
+      to += sep - from;
+      from = sep;
       while (*from == '/') { ++from; }
       if (*from) {
          assert(*from != '/');
@@ -40,12 +80,78 @@ void normalise_path(char* path)
    *to = '\0';
 }
 
+void normalise_path_lexical(char* path)
+{
+   assert(path);
+   const char* from = path;
+   char* to = path;
+   const int absolute = (*from == '/');
+   const int empty = !*from;
+   /* number of components written, and how many of those are leading ".." */
+   size_t count = 0, up = 0;
+   if (absolute) { *to++ = '/'; }
+   char* const base = to;
+   for (;;) {
+      while (*from == '/') { ++from; }
+      if (!*from) { break; }
+      const char* sep = find_separator(from);
+      const size_t len = sep - from;
+      if (len == 1 && from[0] == '.') {
+         /* skip */
+      } else if (len == 2 && from[0] == '.' && from[1] == '.') {
+         if (count > up) {
+            /* drop the previous component */
+            while (to > base && to[-1] != '/') { --to; }
+            if (to > base) { --to; }
+            --count;
+         } else if (!absolute) {
+            /* can't go above the start of a relative path, so keep it */
+            if (count) { *to++ = '/'; }
+            *to++ = '.';
+            *to++ = '.';
+            ++count;
+            ++up;
+         }
+         /* and "/.." is just "/" */
+      } else {
+         if (count) { *to++ = '/'; }
+         if (to != from) { memmove(to, from, len); }
+         to += len;
+         ++count;
+      }
+      from = sep;
+   }
+   if (to == path && !empty) { *to++ = '.'; }
+   *to = '\0';
+}
+
+void path_join(char* RESTRICT buf, size_t bufsize, const char* RESTRICT base, const char* RESTRICT path)
+{
+   assert(buf);
+   assert(base);
+   assert(path);
+   const size_t base_len = strlen(base);
+   const size_t path_len = strlen(path);
+   assert(bufsize >= 2);
+   assert(bufsize > base_len + 1 + path_len);
+   (void)bufsize; /* only checked by the asserts */
+   if (*path == '/' || !base_len) {
+      memcpy(buf, path, path_len + 1);
+   } else {
+      memcpy(buf, base, base_len);
+      buf[base_len] = '/';
+      memcpy(buf + base_len + 1, path, path_len + 1);
+   }
+   normalise_path_lexical(buf);
+}
+
 void dirname(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path)
 {
    assert(path);
    assert(buf);
    assert(bufsize >= 2);
    assert(bufsize > strlen(path));
+   (void)bufsize;
    strcpy(buf, path);
    normalise_path(buf);
 
@@ -69,6 +175,7 @@ void basename(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path)
    assert(buf);
    assert(bufsize >= 2);
    assert(bufsize > strlen(path));
+   (void)bufsize;
    strcpy(buf, path);
    normalise_path(buf);
 
@@ -97,6 +204,7 @@ void basename_any(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path)
    assert(buf);
    assert(bufsize >= 2);
    assert(bufsize > strlen(path));
+   (void)bufsize;
 
    const char* begin = strrchr(path, '/');
    if (!begin) { begin = path; }
@@ -124,148 +232,285 @@ void basename_any(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path)
    *buf = '\0';
 }
 
-int test_check(const char* input, const char* expected, const char* output)
+static const char PATH_DOT[] = ".";
+
+struct path_view path_view_make(const char* ptr, size_t len)
 {
-   int success = (0 == strcmp(output, expected));
-   if (success) {
-      if (s_verbose_level >= VERBOSE_VERBOSE) {
-         printf("GOOD '%s' -> '%s'\n", input, output);
-      }
-   } else {
-      if (s_verbose_level > VERBOSE_SILENT) {
-         printf(" BAD '%s' -> '%s' (expected '%s')\n", input, output, expected);
-      }
-   }
-   return success;
+   struct path_view v;
+   assert(ptr || !len);
+   v.ptr = ptr;
+   v.len = len;
+   return v;
 }
 
-int test_inplace(void (*f)(char*), const char* input, const char* expected)
+struct path_view path_view_of(const char* path)
 {
-   char buf[64];
-   assert(strlen(input) < sizeof(buf));
-   assert(strlen(expected) < sizeof(buf));
-   strcpy(buf, input);
-   f(buf);
-   return test_check(input, expected, buf);
+   assert(path);
+   return path_view_make(path, strlen(path));
 }
 
-int test_outplace(void (*f)(char* RESTRICT, size_t, const char* RESTRICT),
-      const char* input, const char* expected)
+int path_view_is_absolute(struct path_view path)
 {
-   char buf[64];
-   assert(strlen(input) < sizeof(buf));
-   assert(strlen(expected) < sizeof(buf));
-   f(buf, sizeof(buf), input);
-   return test_check(input, expected, buf);
+   return (path.len && path.ptr[0] == '/');
 }
 
-typedef struct {
-   const char* input;
-   const char* expected;
-} TestCase;
-
-static const TestCase NORMPATH_TEST_CASES[] = {
-   { "", "" },
-   { "/", "/" },
-   { "aaa", "aaa" },
-   { "/aaa", "/aaa" },
-   { "aaa/", "aaa" },
-   { "/aaa/", "/aaa" },
-   { "/aaa/bbb", "/aaa/bbb" },
-   { "/aaa/bbb/", "/aaa/bbb" },
-   { "aaa/bbb", "aaa/bbb" },
-   { "aaa/bbb/", "aaa/bbb" },
-   { "aaa/bbb/", "aaa/bbb" },
-   { "//", "/" },
-   { "//aaa", "/aaa" },
-   { "//aaa/", "/aaa" },
-   { "//aaa/bbb", "/aaa/bbb" },
-   { "//aaa/bbb/", "/aaa/bbb" },
-   { "/", "/" },
-   { "/aaa//", "/aaa" },
-   { "/aaa//bbb", "/aaa/bbb" },
-   { "/aaa//bbb/", "/aaa/bbb" },
-   { "/aaa/bbb//", "/aaa/bbb" },
-   { NULL, NULL }
-};
+/* length of path once trailing slashes are removed */
+static size_t strip_trailing_slashes(struct path_view path)
+{
+   size_t end = path.len;
+   while (end && path.ptr[end-1] == '/') { --end; }
+   return end;
+}
 
-static const TestCase DIRNAME_TEST_CASES[] = {
-   { "", "." },
-   { "/", "/" },
-   { "aaa", "." },
-   { "/aaa", "/" },
-   { "aaa/bbb", "aaa" },
-   { "aaa/bbb/ccc/ddd", "aaa/bbb/ccc" },
-   { "/aaa/bbb", "/aaa" },
-   { "/aaa/bbb/ccc/ddd", "/aaa/bbb/ccc" },
-   { "//", "/" },
-   { "aaa//", "." },
-   { "///aaa//", "/" },
-   { "aaa///bbb//", "aaa" },
-   { "aaa//bbb///ccc///ddd//", "aaa/bbb/ccc" },
-   { "///aaa//bbb//", "/aaa" },
-   { "/aaa//bbb/ccc///ddd//", "/aaa/bbb/ccc" },
-   { NULL, NULL }
-};
+struct path_view path_view_normalise(struct path_view path)
+{
+   size_t begin = 0;
+   size_t end = strip_trailing_slashes(path);
+   if (!end) {
+      /* empty, or nothing but slashes */
+      return path.len ? path_view_make(path.ptr, 1) : path_view_make(path.ptr, 0);
+   }
+   /* keep only the last of any leading slashes */
+   while (begin + 1 < end && path.ptr[begin] == '/' && path.ptr[begin+1] == '/') { ++begin; }
+   return path_view_make(path.ptr + begin, end - begin);
+}
 
-static const TestCase BASENAME_TEST_CASES[] = {
-   { "", "." },
-   { "/", "/" },
-   { "aaa", "aaa" },
-   { "/aaa", "aaa" },
-   { "aaa/bbb", "bbb" },
-   { "aaa/bbb/ccc/ddd", "ddd" },
-   { "/aaa/bbb", "bbb" },
-   { "/aaa/bbb/ccc/ddd", "ddd" },
-   { "//", "/" },
-   { "aaa//", "aaa" },
-   { "///aaa", "aaa" },
-   { "///aaa//", "aaa" },
-   { "aaa///bbb//", "bbb" },
-   { "aaa//bbb///ccc///ddd//", "ddd" },
-   { "///aaa//bbb//", "bbb" },
-   { "/aaa//bbb/ccc///ddd//", "ddd" },
-   { NULL, NULL }
-};
+struct path_view path_view_dirname(struct path_view path)
+{
+   size_t end = strip_trailing_slashes(path);
+   if (!end) {
+      return path.len ? path_view_make(path.ptr, 1) : path_view_make(PATH_DOT, 1);
+   }
+   while (end && path.ptr[end-1] != '/') { --end; }
+   if (!end) { return path_view_make(PATH_DOT, 1); }
+   while (end && path.ptr[end-1] == '/') { --end; }
+   if (!end) { return path_view_make(path.ptr, 1); }
+   {
+      /* same treatment of leading slashes as path_view_normalise */
+      size_t begin = 0;
+      while (begin + 1 < end && path.ptr[begin] == '/' && path.ptr[begin+1] == '/') { ++begin; }
+      return path_view_make(path.ptr + begin, end - begin);
+   }
+}
 
-void run_tests_inplace(int* count, int* good_count, const char* title, const TestCase* cases,
-      void (*f)(char*))
+struct path_view path_view_basename(struct path_view path)
 {
-   if (s_verbose_level > VERBOSE_SILENT) {
-      printf("%s:\n", title);
+   size_t end = strip_trailing_slashes(path);
+   size_t begin;
+   if (!end) {
+      return path.len ? path_view_make(path.ptr, 1) : path_view_make(PATH_DOT, 1);
    }
-   for (int i = 0; cases[i].input; ++i) {
-      ++*count;
-      if (test_inplace(f, cases[i].input, cases[i].expected))
-         ++*good_count;
+   begin = end;
+   while (begin && path.ptr[begin-1] != '/') { --begin; }
+   return path_view_make(path.ptr + begin, end - begin);
+}
+
+void path_iter_init(struct path_iter* it, struct path_view path)
+{
+   assert(it);
+   it->begin = path.ptr;
+   it->end = path.ptr + path.len;
+   it->pos = it->begin;
+}
+
+int path_iter_next(struct path_iter* it, struct path_view* component)
+{
+   const char* p = it->pos;
+   const char* start;
+   assert(it && component);
+   while (p != it->end && *p == '/') { ++p; }
+   if (p == it->end) { it->pos = p; return 0; }
+   start = p;
+   while (p != it->end && *p != '/') { ++p; }
+   *component = path_view_make(start, p - start);
+   it->pos = p;
+   return 1;
+}
+
+void path_riter_init(struct path_iter* it, struct path_view path)
+{
+   assert(it);
+   it->begin = path.ptr;
+   it->end = path.ptr + path.len;
+   it->pos = it->end;
+}
+
+int path_riter_next(struct path_iter* it, struct path_view* component)
+{
+   const char* p = it->pos;
+   const char* stop;
+   assert(it && component);
+   while (p != it->begin && p[-1] == '/') { --p; }
+   if (p == it->begin) { it->pos = p; return 0; }
+   stop = p;
+   while (p != it->begin && p[-1] != '/') { --p; }
+   *component = path_view_make(p, stop - p);
+   it->pos = p;
+   return 1;
+}
+
+int path_view_equal(struct path_view a, struct path_view b)
+{
+   struct path_iter ia, ib;
+   struct path_view ca, cb;
+   int more_a, more_b;
+   if (path_view_is_absolute(a) != path_view_is_absolute(b)) { return 0; }
+   path_iter_init(&ia, a);
+   path_iter_init(&ib, b);
+   for (;;) {
+      more_a = path_iter_next(&ia, &ca);
+      more_b = path_iter_next(&ib, &cb);
+      if (!more_a || !more_b) { return (more_a == more_b); }
+      if (ca.len != cb.len || memcmp(ca.ptr, cb.ptr, ca.len)) { return 0; }
    }
 }
 
-void run_tests_outplace(int* count, int* good_count, const char* title, const TestCase* cases,
-      void (*f)(char* RESTRICT, size_t, const char* RESTRICT))
+/* batches smaller than this many input bytes per thread aren't split */
+#define PATH_BATCH_MIN_BYTES_PER_THREAD (256 * 1024)
+#define PATH_BATCH_MAX_THREADS 64
+
+struct path_batch_range {
+   enum path_batch_op op;
+   const char* in;
+   const size_t* in_offsets;
+   size_t first, last;
+   char* out;
+   size_t* out_offsets;
+   /* where this range's output starts, and how many bytes it used */
+   size_t out_begin, out_used;
+};
+
+/* copies a view to out, collapsing runs of slashes; returns the length (excluding the NUL) */
+static size_t copy_collapsed(char* RESTRICT out, struct path_view v)
 {
-   if (s_verbose_level > VERBOSE_SILENT) {
-      printf("%s:\n", title);
+   size_t n = 0;
+   for (size_t i = 0; i < v.len; ++i) {
+      if (v.ptr[i] == '/' && n && out[n-1] == '/') { continue; }
+      out[n++] = v.ptr[i];
    }
-   for (int i = 0; cases[i].input; ++i) {
-      ++*count;
-      if (test_outplace(f, cases[i].input, cases[i].expected))
-         ++*good_count;
+   out[n] = '\0';
+   return n;
+}
+
+static void path_batch_run(struct path_batch_range* r)
+{
+   size_t pos = r->out_begin;
+   for (size_t i = r->first; i < r->last; ++i) {
+      struct path_view v = path_view_make(r->in + r->in_offsets[i], r->in_offsets[i+1] - r->in_offsets[i]);
+      if (v.len && v.ptr[v.len-1] == '\0') { --v.len; }
+      r->out_offsets[i] = pos;
+      switch (r->op) {
+         case PATH_BATCH_NORMALISE:
+            pos += copy_collapsed(r->out + pos, path_view_normalise(v)) + 1;
+            break;
+         case PATH_BATCH_DIRNAME:
+            pos += copy_collapsed(r->out + pos, path_view_dirname(v)) + 1;
+            break;
+         case PATH_BATCH_BASENAME:
+         case PATH_BATCH_BASENAME_ANY:
+            /* a basename never contains a slash (apart from the root itself) */
+            v = path_view_basename(v);
+            memcpy(r->out + pos, v.ptr, v.len);
+            r->out[pos + v.len] = '\0';
+            pos += v.len + 1;
+            break;
+      }
    }
+   r->out_used = pos - r->out_begin;
+}
+
+static void* path_batch_thread(void* arg)
+{
+   path_batch_run((struct path_batch_range*)arg);
+   return NULL;
 }
 
-int main(int argc, char** argv)
+size_t path_batch_output_size(const size_t* in_offsets, size_t count)
 {
-   int count = 0, good_count = 0;
+   assert(in_offsets);
+   /* a result is never longer than its input, except that "" can become "." */
+   return (in_offsets[count] - in_offsets[0]) + 2 * count;
+}
 
-   run_tests_inplace(&count, &good_count, "normalise_path", NORMPATH_TEST_CASES, &normalise_path);
-   run_tests_outplace(&count, &good_count, "dirname", DIRNAME_TEST_CASES, &dirname);
-   run_tests_outplace(&count, &good_count, "basename", BASENAME_TEST_CASES, &basename);
+size_t path_batch(enum path_batch_op op, const char* RESTRICT in, const size_t* in_offsets, size_t count,
+      char* RESTRICT out, size_t* RESTRICT out_offsets, unsigned max_threads)
+{
+   assert(in_offsets);
+   assert(out_offsets);
+   assert(in || !count);
+   assert(out || !count);
+   const size_t in_base = in_offsets[0];
+   const size_t in_bytes = in_offsets[count] - in_base;
+
+   if (!max_threads) {
+#ifdef _SC_NPROCESSORS_ONLN
+      const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      max_threads = (ncpu > 0) ? (unsigned)ncpu : 1u;
+#else
+      max_threads = 1;
+#endif
+   }
+   size_t nthreads = in_bytes / PATH_BATCH_MIN_BYTES_PER_THREAD;
+   if (nthreads > max_threads) { nthreads = max_threads; }
+   if (nthreads > PATH_BATCH_MAX_THREADS) { nthreads = PATH_BATCH_MAX_THREADS; }
+   if (nthreads > count) { nthreads = count; }
+   if (nthreads < 1) { nthreads = 1; }
 
-   if (s_verbose_level > VERBOSE_SILENT) {
-      printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+   struct path_batch_range ranges[PATH_BATCH_MAX_THREADS];
+   size_t first = 0;
+   for (size_t t = 0; t < nthreads; ++t) {
+      /* split by input bytes rather than by count, so a few long paths don't unbalance it */
+      size_t last = count;
+      if (t + 1 < nthreads) {
+         const size_t target = in_base + in_bytes / nthreads * (t + 1);
+         size_t lo = first, hi = count;
+         while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (in_offsets[mid] < target) { lo = mid + 1; } else { hi = mid; }
+         }
+         last = lo;
+      }
+      ranges[t].op = op;
+      ranges[t].in = in;
+      ranges[t].in_offsets = in_offsets;
+      ranges[t].first = first;
+      ranges[t].last = last;
+      ranges[t].out = out;
+      ranges[t].out_offsets = out_offsets;
+      /* each range gets as much output space as it could possibly need */
+      ranges[t].out_begin = (in_offsets[first] - in_base) + 2 * first;
+      ranges[t].out_used = 0;
+      first = last;
+   }
+
+   if (nthreads == 1) {
+      path_batch_run(&ranges[0]);
+   } else {
+      pthread_t threads[PATH_BATCH_MAX_THREADS];
+      int started[PATH_BATCH_MAX_THREADS];
+      for (size_t t = 1; t < nthreads; ++t) {
+         started[t] = (pthread_create(&threads[t], NULL, &path_batch_thread, &ranges[t]) == 0);
+         /* if a thread can't be started, do its share here */
+         if (!started[t]) { path_batch_run(&ranges[t]); }
+      }
+      path_batch_run(&ranges[0]);
+      for (size_t t = 1; t < nthreads; ++t) {
+         if (started[t]) { pthread_join(threads[t], NULL); }
+      }
+   }
+
+   /* close the gaps between the ranges' outputs */
+   size_t pos = ranges[0].out_used;
+   for (size_t t = 1; t < nthreads; ++t) {
+      const size_t shift = ranges[t].out_begin - pos;
+      if (shift) {
+         memmove(out + pos, out + ranges[t].out_begin, ranges[t].out_used);
+         for (size_t i = ranges[t].first; i < ranges[t].last; ++i) { out_offsets[i] -= shift; }
+      }
+      pos += ranges[t].out_used;
    }
-   return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+   out_offsets[count] = pos;
+   return pos;
 }
 
 /* vim: set sts=3 sw=3 et: */
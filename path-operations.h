@@ -0,0 +1,131 @@
+#ifndef PATH_OPERATIONS_H
+#define PATH_OPERATIONS_H
+
+#include <stddef.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
+#define RESTRICT restrict
+#else
+#define RESTRICT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * normalised path matches language:
+ *    '/'? ([^/]+ ('/' [^/]+)*)?
+ */
+void normalise_path(char* path);
+void dirname(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path);
+void basename(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path);
+void basename_any(char* RESTRICT buf, size_t bufsize, const char* RESTRICT path);
+
+/*
+ * Like normalise_path, but also removes "." components and resolves ".."
+ * components lexically ("a/b/../c" -> "a/c", "/.." -> "/"; leading ".." in
+ * a relative path are kept). A non-empty path that reduces to nothing becomes
+ * ".". This does not look at the filesystem, so it gives the wrong answer
+ * when a component before a ".." is a symlink.
+ */
+void normalise_path_lexical(char* path);
+
+/*
+ * Joins path onto base (or just uses path, if it's absolute) and normalises
+ * the result with normalise_path_lexical.
+ * bufsize must be greater than strlen(base) + strlen(path) + 1.
+ */
+void path_join(char* RESTRICT buf, size_t bufsize, const char* RESTRICT base, const char* RESTRICT path);
+
+/*
+ * Non-owning views of paths. A view is a pointer and a length; it is not
+ * NUL-terminated in general. The path_view_* operations return sub-views of
+ * their input (or of a static ".") and never copy or allocate.
+ *
+ * Views returned by path_view_normalise and path_view_dirname only drop
+ * leading and trailing repeated slashes; interior runs of slashes (e.g.
+ * "aaa//bbb") are left in place, since removing them would need a copy.
+ * The component iterators skip such runs, and path_view_equal compares
+ * paths component by component, so this is only visible if you print the
+ * view. Use normalise_path on a copy if you need the canonical spelling.
+ */
+struct path_view {
+   const char* ptr;
+   size_t len;
+};
+
+struct path_view path_view_of(const char* path);
+struct path_view path_view_make(const char* ptr, size_t len);
+
+int path_view_is_absolute(struct path_view path);
+
+/* same results as normalise_path, dirname and basename, as sub-views
+ * (except for interior slash runs, see above) */
+struct path_view path_view_normalise(struct path_view path);
+struct path_view path_view_dirname(struct path_view path);
+struct path_view path_view_basename(struct path_view path);
+
+/* non-zero if the paths have the same components (and both or neither are absolute) */
+int path_view_equal(struct path_view a, struct path_view b);
+
+/*
+ * Component iterators. Usage:
+ *    struct path_iter it;
+ *    struct path_view c;
+ *    path_iter_init(&it, path);
+ *    while (path_iter_next(&it, &c)) { ... }
+ * Components never include slashes; the root of an absolute path is not
+ * returned as a component (use path_view_is_absolute).
+ */
+struct path_iter {
+   const char* pos;
+   const char* begin;
+   const char* end;
+};
+
+void path_iter_init(struct path_iter* it, struct path_view path);
+int path_iter_next(struct path_iter* it, struct path_view* component);
+
+/* reverse iteration: returns the last component first */
+void path_riter_init(struct path_iter* it, struct path_view path);
+int path_riter_next(struct path_iter* it, struct path_view* component);
+
+/*
+ * Batch operations over packed string arenas.
+ *
+ * A batch is a buffer of paths plus count+1 offsets: path i is the bytes
+ * in[in_offsets[i]] up to in[in_offsets[i+1]], without the last byte if that
+ * is a NUL. So both NUL-terminated and plain concatenated paths work.
+ *
+ * Results are written to out in the same layout: result i starts at
+ * out[out_offsets[i]], is NUL-terminated, and has length
+ * out_offsets[i+1] - out_offsets[i] - 1. The output of one batch can be the
+ * input of another. out must hold at least path_batch_output_size() bytes
+ * (out and in must not overlap).
+ *
+ * Results are the same as normalise_path, dirname, basename and basename_any.
+ * Nothing is allocated and no strlen is needed. Large batches are split into
+ * ranges of roughly equal size and processed by up to max_threads threads
+ * (0 means one per online CPU); the results are then packed together.
+ *
+ * Returns the number of bytes of out used (out_offsets[count]).
+ */
+enum path_batch_op {
+   PATH_BATCH_NORMALISE,
+   PATH_BATCH_DIRNAME,
+   PATH_BATCH_BASENAME,
+   PATH_BATCH_BASENAME_ANY
+};
+
+size_t path_batch_output_size(const size_t* in_offsets, size_t count);
+size_t path_batch(enum path_batch_op op, const char* RESTRICT in, const size_t* in_offsets, size_t count,
+      char* RESTRICT out, size_t* RESTRICT out_offsets, unsigned max_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
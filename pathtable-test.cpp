@@ -0,0 +1,195 @@
+/* Tests for PathTable: intern/find/path() round trips over the path-operations
+ * test cases (repeated and trailing slashes, "." and ".." before and after
+ * normalise_path_lexical), parents and names against dirname and basename,
+ * truncated path() output, random paths, and tables big enough to need several
+ * name blocks and many hash table resizes.
+ *
+ * usage: pathtable-test [seed]
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "PathTable.hpp"
+#include "path-operations-cases.h"
+#include "rand.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef PathTable::PathId PathId;
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what, const std::string &input) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s '%s'\n", what, input.c_str());
+	}
+	return ok;
+}
+
+std::string normalised(const char *path, void (*normalise)(char*)) {
+	std::string s(path);
+	normalise(&s[0]);
+	return s.c_str();
+}
+
+/// Every spelling of a path interns to the same id, and path() gives the normal spelling.
+void test_normalise(PathTable &table) {
+	for (int i = 0; NORMPATH_TEST_CASES[i].input; ++i) {
+		const char * const input = NORMPATH_TEST_CASES[i].input;
+		const char * const expected = NORMPATH_TEST_CASES[i].expected;
+		const PathId id = table.intern(input);
+		check(id != PathTable::INVALID && table.path(id) == expected, "intern/path", input);
+		check(table.find(input) == id && table.find(expected) == id && table.intern(expected) == id, "find", input);
+	}
+	check(table.intern("") == PathTable::RELATIVE_ROOT && table.intern("//") == PathTable::ABSOLUTE_ROOT, "roots", "");
+}
+
+/// "." and ".." are kept as components unless the path is normalised lexically first.
+void test_dots(PathTable &table) {
+	for (int i = 0; NORMPATH_LEXICAL_TEST_CASES[i].input; ++i) {
+		const char * const input = NORMPATH_LEXICAL_TEST_CASES[i].input;
+		const PathId raw = table.intern(input);
+		check(table.path(raw) == normalised(input, &normalise_path), "dots kept", input);
+
+		const std::string resolved = normalised(input, &normalise_path_lexical);
+		const PathId id = table.intern(resolved.c_str());
+		check(resolved == NORMPATH_LEXICAL_TEST_CASES[i].expected && table.path(id) == resolved
+				&& table.find(NORMPATH_LEXICAL_TEST_CASES[i].expected) == id, "dots resolved", input);
+	}
+	check(table.intern("aaa/..") != table.intern("."), "'aaa/..' and '.' are different entries", "aaa/..");
+}
+
+/// parent() and name() agree with dirname and basename (the roots are their own dirname and basename).
+void test_parent_and_name(PathTable &table) {
+	for (int i = 0; DIRNAME_TEST_CASES[i].input; ++i) {
+		const PathId id = table.intern(DIRNAME_TEST_CASES[i].input);
+		const PathId parent = (table.parent(id) == PathTable::INVALID) ? id : table.parent(id);
+		std::string dir = table.path(parent);
+		if (dir.empty()) { dir = "."; }
+		check(dir == DIRNAME_TEST_CASES[i].expected, "parent", DIRNAME_TEST_CASES[i].input);
+	}
+	for (int i = 0; BASENAME_TEST_CASES[i].input; ++i) {
+		const PathId id = table.intern(BASENAME_TEST_CASES[i].input);
+		const struct path_view name = table.name(id);
+		std::string base(name.ptr, name.len);
+		if (id == PathTable::RELATIVE_ROOT) { base = "."; }
+		if (id == PathTable::ABSOLUTE_ROOT) { base = "/"; }
+		check(base == BASENAME_TEST_CASES[i].expected, "name", BASENAME_TEST_CASES[i].input);
+	}
+	check(table.depth(table.intern("/aaa//bbb/ccc/")) == 3 && table.depth(table.intern("aaa")) == 1
+			&& table.depth(PathTable::ABSOLUTE_ROOT) == 0, "depth", "/aaa//bbb/ccc/");
+
+	const PathId aaa = table.intern("/aaa");
+	const PathId child = table.intern_child(aaa, path_view_of("new"));
+	check(table.find_child(aaa, path_view_of("new")) == child && table.find("/aaa/new") == child
+			&& table.find_child(aaa, path_view_of("absent")) == PathTable::INVALID
+			&& table.find("/aaa/absent/x") == PathTable::INVALID, "intern_child/find_child", "/aaa/new");
+}
+
+/// path() into buffers of every size up to the full length (and one past it).
+void test_truncation(PathTable &table) {
+	static const char * const PATHS[] = { "/", "aaa", "/aaa", "/aaa/bbb/ccc", "aaa/bbb/ccc", "" };
+	for (size_t i = 0; i < sizeof(PATHS) / sizeof(PATHS[0]); ++i) {
+		const PathId id = table.intern(PATHS[i]);
+		const size_t len = std::strlen(PATHS[i]);
+		bool ok = true;
+		for (size_t size = 0; size <= len + 1; ++size) {
+			char buf[32];
+			std::memset(buf, '#', sizeof(buf));
+			ok = ok && table.path(id, buf, size) == len;
+			if (size) {
+				const size_t kept = (len < size) ? len : size - 1;
+				ok = ok && std::memcmp(buf, PATHS[i], kept) == 0 && buf[kept] == '\0';
+			}
+			ok = ok && buf[size] == '#';
+		}
+		check(ok, "path() truncation", PATHS[i]);
+	}
+}
+
+/// Random paths over "/ab.": the id depends only on the normalised path.
+void test_random(PathTable &table, const uint32_t seed) {
+	static const char ALPHABET[] = "///ab.";
+	struct xorshift_rng rng;
+	xorshift_init(&rng, seed);
+	int bad = 0;
+	for (int i = 0; i < 20000; ++i) {
+		char input[64];
+		const size_t len = xorshift_next_i32(&rng) % (sizeof(input) - 1);
+		for (size_t j = 0; j < len; ++j) { input[j] = ALPHABET[xorshift_next_i32(&rng) % (sizeof(ALPHABET) - 1)]; }
+		input[len] = '\0';
+		const std::string expected = normalised(input, &normalise_path);
+		const PathId id = table.intern(input);
+		if (table.path(id) != expected || table.find(expected.c_str()) != id) {
+			if (bad++ < 10) { check(false, "random", input); }
+		}
+	}
+	check(!bad, "random paths", "");
+}
+
+/// Enough long names to fill several 1 MB name blocks, and enough nodes for many
+/// hash table resizes; every id must still give back its path afterwards.
+void test_growth(const uint32_t seed) {
+	PathTable table;
+	const size_t start_memory = table.memory_usage();
+	std::vector<std::string> paths;
+	std::vector<PathId> ids;
+	struct xorshift_rng rng;
+	xorshift_init(&rng, seed);
+	for (unsigned i = 0; i < 4000; ++i) {
+		// names of about 1000 bytes don't divide a block evenly, so some end up at the end of one
+		std::string name(900 + xorshift_next_i32(&rng) % 200, char('a' + i % 26));
+		char number[16];
+		std::snprintf(number, sizeof(number), "%u", i);
+		name += number;
+		paths.push_back("/dir" + std::string(number, 1) + "/" + name);
+		ids.push_back(table.intern(paths.back().c_str()));
+	}
+	for (unsigned i = 0; i < 100000; ++i) {
+		char path[64];
+		std::snprintf(path, sizeof(path), "d%u/f%u", i % 97, i);
+		paths.push_back(path);
+		ids.push_back(table.intern(path));
+	}
+	check(table.memory_usage() > start_memory + 3 * (size_t(1) << 20), "names spill into more blocks", "");
+
+	bool ok = true;
+	for (size_t i = 0; i < paths.size() && ok; ++i) {
+		ok = table.path(ids[i]) == paths[i] && table.find(paths[i].c_str()) == ids[i];
+		if (!ok) { check(false, "round trip after growth", paths[i]); }
+	}
+	check(ok, "round trips after growth", "");
+	// the roots, the 10 /dirN directories and their long names, d0..d96 and the f's
+	check(table.size() == 2 + 10 + 4000 + 97 + 100000, "size after growth", "");
+
+	bool threw = false;
+	try { table.intern(std::string(65536, 'x').c_str()); } catch (std::length_error &) { threw = true; }
+	check(threw && table.intern(std::string(65535, 'x').c_str()) != PathTable::INVALID, "component length limit", "");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	const uint32_t seed = (argc > 1) ? uint32_t(std::strtoul(argv[1], nullptr, 0)) : 12345u;
+
+	PathTable table;
+	test_normalise(table);
+	test_dots(table);
+	test_parent_and_name(table);
+	test_truncation(table);
+	test_random(table, seed);
+	test_growth(seed);
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,254 @@
+/* Tests for PerfCounters that don't need a PMU: only the kernel's software events
+ * (task-clock, page-faults) are counted live, and if even those can't be opened the
+ * counters must still read as empty without failing. Checks that scopes add up to the
+ * counts over the whole span and that Site totals add up, from several threads too;
+ * difference() with multiplexed (scaled) counts and with events missing from one of
+ * the samples; the report; and that PERF_SCOPE and PERF_REPORT compile to nothing
+ * without PERF_COUNTERS.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+// the macros are tested as they are in a normal build
+#undef PERF_COUNTERS
+#include "PerfCounters.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+typedef PerfCounters::Sample Sample;
+
+const size_t PAGE = ::sysconf(_SC_PAGESIZE);
+
+/// Fault in 'pages' new pages of anonymous memory.
+void touch_pages(const size_t pages) {
+	FileMapping m = FileMapping::MapAnonymous(pages * PAGE);
+	volatile char * const p = static_cast<char*>(m.get());
+	for (size_t i = 0; i < pages; ++i) { p[i * PAGE] = 1; }
+}
+
+/// Use about 'ms' milliseconds of CPU.
+void spin(const int ms) {
+	struct timespec start, now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	do {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < ms);
+}
+
+Sample make_sample(const unsigned events, const uint64_t enabled, const uint64_t running) {
+	Sample s;
+	s.events = events;
+	s.time_enabled = enabled;
+	s.time_running = running;
+	return s;
+}
+
+const unsigned PF = 1u << PerfCounters::PAGE_FAULTS;
+const unsigned TC = 1u << PerfCounters::TASK_CLOCK;
+const unsigned CY = 1u << PerfCounters::CYCLES;
+
+void test_difference() {
+	Sample before = make_sample(PF | TC, 1000, 1000);
+	before.value[PerfCounters::PAGE_FAULTS] = 10;
+	before.value[PerfCounters::TASK_CLOCK] = 500;
+	Sample after = make_sample(PF | TC, 2000, 2000);
+	after.value[PerfCounters::PAGE_FAULTS] = 25;
+	after.value[PerfCounters::TASK_CLOCK] = 1500;
+	Sample d = PerfCounters::difference(before, after);
+	check(d.events == (PF | TC) && d.time_enabled == 1000 && d.time_running == 1000
+			&& d.value[PerfCounters::PAGE_FAULTS] == 15 && d.value[PerfCounters::TASK_CLOCK] == 1000, "difference: counting all the time");
+
+	// multiplexed: counting for a quarter of the 1000ns, so the counts are scaled by 4 (rounded)
+	after.time_enabled = 2000;
+	after.time_running = 1250;
+	before.time_running = 1000;
+	after.value[PerfCounters::PAGE_FAULTS] = 13;
+	d = PerfCounters::difference(before, after);
+	check(d.time_enabled == 1000 && d.time_running == 250 && d.value[PerfCounters::PAGE_FAULTS] == 12
+			&& d.value[PerfCounters::TASK_CLOCK] == 4000, "difference: multiplexed counts scaled up");
+	after.time_running = 1003; // 1000/3 times 1 rounds to 333
+	after.value[PerfCounters::PAGE_FAULTS] = 11;
+	d = PerfCounters::difference(before, after);
+	check(d.value[PerfCounters::PAGE_FAULTS] == 333, "difference: scaled counts rounded");
+
+	// an event in only one of the samples is left out, whichever one has it
+	after = make_sample(PF | CY, 2000, 2000);
+	after.value[PerfCounters::PAGE_FAULTS] = 30;
+	after.value[PerfCounters::CYCLES] = 12345;
+	d = PerfCounters::difference(before, after);
+	check(d.events == PF && d.value[PerfCounters::PAGE_FAULTS] == 20 && d.value[PerfCounters::TASK_CLOCK] == 0
+			&& d.value[PerfCounters::CYCLES] == 0 && !d.has(PerfCounters::CYCLES), "difference: events missing from one sample left out");
+
+	// no common events, no running time, or an empty sample: nothing
+	const Sample empty;
+	check(PerfCounters::difference(make_sample(TC, 0, 0), after).events == 0
+			&& PerfCounters::difference(before, make_sample(PF, 2000, 1000)).events == 0
+			&& PerfCounters::difference(empty, after).events == 0 && PerfCounters::difference(before, empty).events == 0,
+			"difference: nothing in common gives an empty sample");
+}
+
+void test_site_totals() {
+	static PerfCounters::Site site("synthetic");
+	Sample a = make_sample(PF, 100, 100);
+	a.value[PerfCounters::PAGE_FAULTS] = 10;
+	Sample b = make_sample(PF | TC, 100, 100);
+	b.value[PerfCounters::PAGE_FAULTS] = 5;
+	b.value[PerfCounters::TASK_CLOCK] = 7;
+	site.add(a);
+	site.add(b);
+	site.add(Sample());
+	Sample total = site.total();
+	check(site.calls() == 3 && total.events == (PF | TC) && total.value[PerfCounters::PAGE_FAULTS] == 15
+			&& total.value[PerfCounters::TASK_CLOCK] == 7 && total.value[PerfCounters::CYCLES] == 0, "Site: totals add up");
+
+	// from several threads at once
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.push_back(std::thread([&a]() {
+			for (int i = 0; i < 10000; ++i) { site.add(a); }
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); ++t) { threads[t].join(); }
+	total = site.total();
+	check(site.calls() == 40003 && total.value[PerfCounters::PAGE_FAULTS] == 400015, "Site: totals add up across threads");
+
+	Sample sum = a;
+	sum += b;
+	check(sum.events == (PF | TC) && sum.value[PerfCounters::PAGE_FAULTS] == 15 && sum.time_enabled == 200
+			&& sum.time_running == 200, "Sample: += adds counts and times");
+
+	// the report has a line per site; page-faults per call is 400015 / 40003 = 10.0
+	int fds[2];
+	if (::pipe(fds) == -1) { throw PosixError(errno); }
+	FileDes in(fds[0]);
+	{
+		FileDes out(fds[1]);
+		PerfCounters::Site::report(out);
+	}
+	std::string report;
+	char buf[4096];
+	ssize_t n;
+	while ((n = ::read(in, buf, sizeof(buf))) > 0) { report.append(buf, size_t(n)); }
+	const size_t line = report.find("\nsynthetic ");
+	const std::string row = (line == std::string::npos) ? "" : report.substr(line + 1, report.find('\n', line + 1) - line - 1);
+	check(report.compare(0, 4, "site") == 0 && row.find(" 40003 ") != std::string::npos && row.find(" 10.0 ") != std::string::npos
+			&& row.find(" - ") != std::string::npos, "Site: report");
+}
+
+void test_live() {
+	PerfCounters counters(PerfCounters::SOFTWARE);
+	if (!counters) {
+		// no perf_event_open at all (seccomp, perf_event_paranoid 3): everything reads empty
+		Sample s;
+		counters.start();
+		Sample total;
+		{
+			PerfCounters::Scope scope(counters, total);
+			touch_pages(4);
+		}
+		check(counters.error() != 0 && !counters.read(s) && s.events == 0 && total.events == 0, "no counters: empty samples");
+		return;
+	}
+	check(counters.available() == PerfCounters::SOFTWARE && counters.error() == 0, "software events open");
+
+	counters.start();
+	Sample first, last, total;
+	counters.read(first);
+	for (int i = 0; i < 3; ++i) {
+		PerfCounters::Scope scope(counters, total);
+		touch_pages(32);
+		spin(5);
+	}
+	counters.read(last);
+	const Sample whole = PerfCounters::difference(first, last);
+	check(total.events == PerfCounters::SOFTWARE && total.value[PerfCounters::PAGE_FAULTS] >= 96
+			&& total.value[PerfCounters::TASK_CLOCK] >= 10000000u, "scopes count page faults and CPU time");
+	check(whole.value[PerfCounters::PAGE_FAULTS] >= total.value[PerfCounters::PAGE_FAULTS]
+			&& whole.value[PerfCounters::TASK_CLOCK] >= total.value[PerfCounters::TASK_CLOCK]
+			&& whole.time_enabled >= total.time_enabled, "scopes add up to no more than the whole span");
+
+	// stopped counters keep their counts
+	counters.stop();
+	Sample a, b;
+	counters.read(a);
+	touch_pages(16);
+	spin(2);
+	counters.read(b);
+	check(b.value[PerfCounters::PAGE_FAULTS] == a.value[PerfCounters::PAGE_FAULTS]
+			&& b.value[PerfCounters::TASK_CLOCK] == a.value[PerfCounters::TASK_CLOCK]
+			&& a.value[PerfCounters::PAGE_FAULTS] >= 96, "stop keeps the counts");
+
+	// a Site, through each thread's own counters (which may or may not have hardware events)
+	static PerfCounters::Site site("live");
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.push_back(std::thread([]() {
+			for (int i = 0; i < 5; ++i) {
+				PerfCounters::Scope scope(site);
+				touch_pages(8);
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); ++t) { threads[t].join(); }
+	const Sample live = site.total();
+	check(site.calls() == 20 && live.has(PerfCounters::PAGE_FAULTS) && live.value[PerfCounters::PAGE_FAULTS] >= 160
+			&& (live.events & ~PerfCounters::this_thread().available()) == 0, "Site: scopes on several threads add up");
+}
+
+void compiled_away() {
+	PERF_SCOPE("compiled-away");
+}
+
+void test_macros() {
+	compiled_away();
+	bool found = false;
+	for (const PerfCounters::Site *site = PerfCounters::Site::first(); site; site = site->next()) {
+		found = found || std::strcmp(site->name(), "compiled-away") == 0;
+	}
+	// compiled in, reporting to a closed descriptor would throw
+	bool threw = false;
+	try {
+		PERF_REPORT(-1);
+	} catch (PosixError &) {
+		threw = true;
+	}
+	check(!found && !threw, "without PERF_COUNTERS, PERF_SCOPE and PERF_REPORT do nothing");
+}
+
+} // anonymous namespace
+
+int main() {
+	try {
+		test_difference();
+		test_site_totals();
+		test_live();
+		test_macros();
+	} catch (PosixError &e) {
+		check(false, e.what());
+	}
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
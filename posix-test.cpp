@@ -0,0 +1,546 @@
+/* Tests for Posix.hpp: the bulk transfer helpers (copy_file_data, send_file_data and
+ * SplicePipe) between files, pipes and sockets, with nonblocking outputs that fill
+ * up and take partial writes, and inputs that can't be spliced or seeked. Every byte
+ * must arrive once, in order, however many calls it takes.
+ * CloseQueue: threads queueing descriptors at once (with and without a worker
+ * draining), a full queue closing directly, closes held back until the drain, and
+ * draining on destruction; and the rate limit on warnings (stderr is captured).
+ * AppendMapping: growth by remapping (a page at a time), flushes every so many
+ * bytes, the file cut back to its logical size on close(), destruction and move
+ * assignment, and reopening a file to append more.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "Posix.hpp"
+#include "rand.h"
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int count = 0, good_count = 0;
+
+bool check(const bool ok, const char *what) {
+	++count;
+	if (ok) {
+		++good_count;
+	} else {
+		std::printf(" BAD %s\n", what);
+	}
+	return ok;
+}
+
+void set_nonblocking(const int fd) {
+	if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) { throw PosixError(errno); }
+}
+
+struct Pipe {
+	FileDes read;
+	FileDes write;
+
+	/// A pipe, with its capacity cut to the minimum (a page) if small is true.
+	explicit Pipe(const bool small = false) {
+		int fds[2];
+		if (::pipe2(fds, O_CLOEXEC) == -1) { throw PosixError(errno); }
+		read = FileDes(fds[0]);
+		write = FileDes(fds[1]);
+		if (small) { ::fcntl(write, F_SETPIPE_SZ, 4096); }
+	}
+};
+
+/// Random bytes.
+std::string make_data(const size_t len, const uint32_t seed) {
+	struct xorshift_rng rng;
+	xorshift_init(&rng, seed);
+	std::string data(len, '\0');
+	for (size_t i = 0; i < len; ++i) { data[i] = char(xorshift_next_i32(&rng)); }
+	return data;
+}
+
+/// An unlinked temporary file holding data, positioned at its start.
+FileDes temp_file(const std::string &data) {
+	char path[] = "/tmp/posix-test.XXXXXX";
+	FileDes fd(::mkstemp(path));
+	if (!fd) { throw PosixError(errno); }
+	::unlink(path);
+	if (::write(fd, data.data(), data.size()) != ssize_t(data.size())) { throw PosixError(EIO); }
+	::lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+/// Everything that can be read from fd (which must be nonblocking) right now.
+std::string drain(const int fd) {
+	std::string out;
+	char buf[16384];
+	ssize_t n;
+	while ((n = ::read(fd, buf, sizeof(buf))) > 0) { out.append(buf, size_t(n)); }
+	return out;
+}
+
+std::string read_file(const int fd) {
+	std::string out;
+	char buf[16384];
+	ssize_t n;
+	off_t offset = 0;
+	while ((n = ::pread(fd, buf, sizeof(buf), offset)) > 0) { out.append(buf, size_t(n)); offset += n; }
+	return out;
+}
+
+/// Call transfer(up to len) until 'expected' bytes have come out of reader (nonblocking),
+/// emptying the reader whenever the output would block.
+/// @return What came out; 'blocked' counts the calls that returned would_block.
+template <typename Transfer>
+std::string pump(Transfer transfer, const int reader, const size_t expected, const size_t len, size_t &blocked) {
+	std::string got;
+	size_t sent = 0;
+	blocked = 0;
+	for (int calls = 0; got.size() < expected && calls < 1000000; ++calls) {
+		const TransferResult r = transfer(std::min(len, expected - sent));
+		sent += r.bytes;
+		if (r.would_block) { ++blocked; }
+		got += drain(reader);
+		if (r.eof && !r.bytes) { break; }
+	}
+	got += drain(reader);
+	return (sent == got.size()) ? got : std::string("(sent and received differ)");
+}
+
+void test_copy_file_data() {
+	const std::string data = make_data(300000, 1);
+	FileDes in = temp_file(data);
+	FileDes out = temp_file("");
+
+	TransferResult r = copy_file_data(in, nullptr, out, nullptr, data.size() + 100);
+	check(r.bytes == data.size() && r.eof && !r.would_block && read_file(out) == data, "copy_file_data: file to file");
+	check(::lseek(in, 0, SEEK_CUR) == off_t(data.size()), "copy_file_data: file position advanced");
+
+	// explicit offsets leave the file positions alone
+	off_t in_offset = 1000, out_offset = 5;
+	FileDes out2 = temp_file("hello");
+	r = copy_file_data(in, &in_offset, out2, &out_offset, 5000);
+	check(r.bytes == 5000 && in_offset == 6000 && out_offset == 5005 && ::lseek(out2, 0, SEEK_CUR) == 0
+			&& read_file(out2) == "hello" + data.substr(1000, 5000), "copy_file_data: at offsets");
+
+	// from a pipe (no copy_file_range or sendfile) to a file at an offset: read/write
+	Pipe pipe;
+	const std::string small = data.substr(0, 20000);
+	if (::write(pipe.write, small.data(), small.size()) != ssize_t(small.size())) { throw PosixError(EIO); }
+	pipe.write = FileDes();
+	FileDes out3 = temp_file("");
+	out_offset = 0;
+	r = copy_file_data(pipe.read, nullptr, out3, &out_offset, 100000);
+	check(r.bytes == small.size() && r.eof && out_offset == off_t(small.size()) && read_file(out3) == small,
+			"copy_file_data: from a pipe");
+}
+
+void test_send_file_data() {
+	const std::string data = make_data(500000, 2);
+
+	// a nonblocking pipe that fills up after a page: sendfile stops with would_block,
+	// and the file position says where to carry on
+	{
+		FileDes in = temp_file(data);
+		Pipe out(true);
+		set_nonblocking(out.write);
+		set_nonblocking(out.read);
+		size_t blocked = 0;
+		const std::string got = pump([&](const size_t len) { return send_file_data(out.write, in, nullptr, len); },
+				out.read, data.size(), data.size(), blocked);
+		check(got == data && blocked > 0, "send_file_data: file to a nonblocking pipe");
+	}
+
+	// the same with an explicit offset, asking for less than there is
+	{
+		FileDes in = temp_file(data);
+		Pipe out(true);
+		set_nonblocking(out.write);
+		set_nonblocking(out.read);
+		off_t offset = 100;
+		size_t blocked = 0;
+		const std::string got = pump([&](const size_t len) { return send_file_data(out.write, in, &offset, len); },
+				out.read, 50000, 7000, blocked);
+		check(got == data.substr(100, 50000) && offset == 50100 && ::lseek(in, 0, SEEK_CUR) == 0 && blocked > 0,
+				"send_file_data: at an offset");
+	}
+
+	// from a pipe (which sendfile refuses) to a nonblocking socket with a small buffer,
+	// which takes partial writes: nothing read from the pipe may be lost
+	{
+		const std::string some = data.substr(0, 60000);
+		Pipe in;
+		if (::write(in.write, some.data(), some.size()) != ssize_t(some.size())) { throw PosixError(EIO); }
+		in.write = FileDes();
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) { throw PosixError(errno); }
+		FileDes writer(fds[0]), reader(fds[1]);
+		const int size = 4096;
+		::setsockopt(writer, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		set_nonblocking(writer);
+		set_nonblocking(reader);
+		size_t blocked = 0;
+		const std::string got = pump([&](const size_t len) { return send_file_data(writer, in.read, nullptr, len); },
+				reader, some.size(), 1u << 20, blocked);
+		check(got == some && blocked > 0, "send_file_data: pipe to a nonblocking socket");
+	}
+}
+
+void test_splice_pipe() {
+	const std::string data = make_data(400000, 3);
+
+	// pipe to a small nonblocking pipe: what the output won't take stays in the
+	// SplicePipe and goes first next time
+	{
+		Pipe in;
+		set_nonblocking(in.write);
+		Pipe out(true);
+		set_nonblocking(out.write);
+		set_nonblocking(out.read);
+		SplicePipe splicer;
+		size_t written = 0, max_buffered = 0;
+		bool capped = true;
+		std::string got;
+		for (int calls = 0; got.size() < data.size() && calls < 1000000; ++calls) {
+			const ssize_t n = ::write(in.write, data.data() + written, std::min<size_t>(data.size() - written, 30000));
+			if (n > 0) { written += size_t(n); }
+			if (written == data.size() && in.write) { in.write = FileDes(); }
+			const TransferResult r = splicer.transfer(in.read, out.write, 9000);
+			max_buffered = std::max(max_buffered, splicer.buffered());
+			capped = capped && r.bytes <= 9000;
+			got += drain(out.read);
+		}
+		check(got == data && max_buffered > 0 && splicer.buffered() == 0 && capped, "SplicePipe: buffered across calls");
+		const TransferResult r = splicer.transfer(in.read, out.write, 100);
+		check(r.eof && !r.bytes, "SplicePipe: eof");
+	}
+
+	// buffered bytes are delivered before anything new, even when len is smaller
+	{
+		Pipe in;
+		Pipe out(true);
+		set_nonblocking(out.write);
+		set_nonblocking(out.read);
+		if (::write(in.write, data.data(), 60000) != 60000) { throw PosixError(EIO); }
+		SplicePipe splicer;
+		const TransferResult first = splicer.transfer(in.read, out.write, 60000);
+		const size_t buffered = splicer.buffered();
+		std::string got = drain(out.read);
+		const TransferResult second = splicer.transfer(in.read, out.write, 10);
+		got += drain(out.read);
+		check(first.would_block && buffered > 0 && second.bytes == 10 && splicer.buffered() == buffered - 10
+				&& got == data.substr(0, first.bytes + 10), "SplicePipe: drains at most len");
+	}
+
+	// an input that can't splice or seek (a semaphore eventfd, read 8 bytes at a time)
+	// into a small nonblocking pipe: the fallback leaves what it couldn't write in the
+	// SplicePipe, and the next call must deliver that and then fall back again
+	{
+		const unsigned reads = 20000;
+		FileDes in(::eventfd(reads, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC));
+		if (!in) { throw PosixError(errno); }
+		Pipe out(true);
+		set_nonblocking(out.write);
+		set_nonblocking(out.read);
+		SplicePipe splicer;
+		size_t blocked = 0, stashed = 0;
+		std::string got;
+		try {
+			for (int calls = 0; got.size() < reads * 8u && calls < 100000; ++calls) {
+				const TransferResult r = splicer.transfer(in, out.write, 1u << 20);
+				if (r.would_block) { ++blocked; }
+				if (splicer.buffered()) { ++stashed; }
+				got += drain(out.read);
+			}
+		} catch (PosixError &e) {
+			check(false, e.what());
+		}
+		bool ones = got.size() == reads * 8u;
+		for (size_t i = 0; ones && i < got.size(); i += 8) {
+			uint64_t v;
+			std::memcpy(&v, got.data() + i, 8);
+			ones = v == 1;
+		}
+		check(ones && blocked > 0 && stashed > 0 && splicer.buffered() == 0, "SplicePipe: input that can't splice");
+	}
+
+	// and the same input with a blocking output
+	{
+		FileDes in(::eventfd(100, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC));
+		Pipe out;
+		SplicePipe splicer;
+		const TransferResult r = splicer.transfer(in, out.write, 8000);
+		set_nonblocking(out.read);
+		check(r.bytes == 800 && r.would_block && drain(out.read).size() == 800, "SplicePipe: blocking output, input that can't splice");
+	}
+}
+
+bool is_open(const int fd) {
+	return ::fcntl(fd, F_GETFD) != -1;
+}
+
+/// Threads each queue 'each' descriptors by destroying FileDes objects in a Scope.
+/// @return The descriptors queued (closed already if a worker is draining).
+std::vector<int> queue_from_threads(CloseQueue &queue, const unsigned threads, const unsigned each) {
+	std::vector<std::vector<int> > fds(threads);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.push_back(std::thread([&queue, &fds, t, each]() {
+			CloseQueue::Scope scope(queue);
+			for (unsigned i = 0; i < each; ++i) {
+				FileDes fd(::open("/dev/null", O_RDONLY | O_CLOEXEC));
+				fds[t].push_back(fd.fd());
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); ++t) { workers[t].join(); }
+	std::vector<int> all;
+	for (size_t t = 0; t < fds.size(); ++t) { all.insert(all.end(), fds[t].begin(), fds[t].end()); }
+	return all;
+}
+
+void test_close_queue() {
+	// eight threads at once: every descriptor is queued, none closed, until drain()
+	{
+		CloseQueue queue(8 * 60);
+		const std::vector<int> fds = queue_from_threads(queue, 8, 60);
+		bool open = fds.size() == 8 * 60;
+		for (size_t i = 0; i < fds.size(); ++i) { open = open && fds[i] != -1 && is_open(fds[i]); }
+		std::vector<int> sorted(fds);
+		std::sort(sorted.begin(), sorted.end());
+		open = open && std::unique(sorted.begin(), sorted.end()) == sorted.end();
+		check(open, "CloseQueue: concurrent pushes all queued");
+		bool closed = queue.drain() == fds.size() && queue.drain() == 0;
+		for (size_t i = 0; i < fds.size(); ++i) { closed = closed && !is_open(fds[i]); }
+		check(closed, "CloseQueue: drain closes them all");
+	}
+
+	// the same with a worker draining a small queue while the threads push (some
+	// pushes find it full and close directly)
+	{
+		std::vector<int> fds;
+		{
+			CloseQueue queue(64);
+			queue.start_worker(1);
+			fds = queue_from_threads(queue, 8, 2000);
+		}
+		bool closed = fds.size() == 8 * 2000;
+		for (size_t i = 0; i < fds.size(); ++i) { closed = closed && !is_open(fds[i]); }
+		check(closed, "CloseQueue: concurrent pushes with a worker");
+	}
+
+	// a full queue: try_push refuses, and a FileDes destroyed in a Scope closes directly
+	{
+		CloseQueue queue(3);
+		std::vector<int> fds;
+		{
+			CloseQueue::Scope scope(queue);
+			for (int i = 0; i < 6; ++i) {
+				FileDes fd(::open("/dev/null", O_RDONLY | O_CLOEXEC));
+				fds.push_back(fd.fd());
+			}
+		}
+		check(is_open(fds[0]) && is_open(fds[3]) && !is_open(fds[4]) && !is_open(fds[5]), "CloseQueue: capacity rounded up to 4");
+		check(!queue.try_push(fds[0]) && CloseQueue::current() == nullptr, "CloseQueue: full");
+		FileDes extra(::open("/dev/null", O_RDONLY | O_CLOEXEC));
+		const int extra_fd = extra.fd();
+		queue.push(std::move(extra));
+		check(!extra && !is_open(extra_fd), "CloseQueue: push to a full queue closes");
+		check(queue.drain() == 4 && !is_open(fds[0]) && !is_open(fds[3]), "CloseQueue: drain a full queue");
+	}
+
+	// a queued pipe end stays open: the reader doesn't see EOF until the drain
+	{
+		CloseQueue queue(16);
+		Pipe pipe;
+		set_nonblocking(pipe.read);
+		{
+			CloseQueue::Scope scope(queue);
+			pipe.write = FileDes();
+		}
+		char c;
+		const ssize_t before = ::read(pipe.read, &c, 1);
+		const int error = errno;
+		queue.drain();
+		check(before == -1 && error == EAGAIN && ::read(pipe.read, &c, 1) == 0, "CloseQueue: EOF waits for the drain");
+	}
+
+	// destroying the queue closes whatever is left in it
+	{
+		std::vector<int> fds;
+		{
+			CloseQueue queue(16);
+			CloseQueue::Scope scope(queue);
+			for (int i = 0; i < 10; ++i) {
+				FileDes fd(::open("/dev/null", O_RDONLY | O_CLOEXEC));
+				fds.push_back(fd.fd());
+			}
+			check(is_open(fds[0]) && is_open(fds[9]), "CloseQueue: still open while queued");
+		}
+		bool closed = true;
+		for (size_t i = 0; i < fds.size(); ++i) { closed = closed && !is_open(fds[i]); }
+		check(closed, "CloseQueue: drained on destruction");
+	}
+}
+
+double now_seconds() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Sleep until just after the monotonic clock's next whole second (where the warning
+/// rate limit starts a new window).
+void sleep_to_next_second() {
+	const double now = now_seconds();
+	const double wait = (double(long(now)) + 1.02) - now;
+	::usleep(useconds_t(wait * 1e6));
+}
+
+size_t count_lines(const std::string &text, const char *what) {
+	size_t n = 0;
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) { ++n; }
+	return n;
+}
+
+/// Closing invalid descriptors warns, at most 10 times a second; the rest are counted
+/// and reported when the next second's first warning comes along.
+void test_warnings() {
+	FileDes capture = temp_file("");
+	FileDes saved(::dup(STDERR_FILENO));
+	::dup2(capture, STDERR_FILENO);
+
+	// descriptors far past anything open, and not consecutive (which would be one close_range)
+	int bad[30];
+	for (int i = 0; i < 30; ++i) { bad[i] = 900000 + 2 * i; }
+	sleep_to_next_second();
+	close_descriptors(bad, 30);
+	const std::string first = read_file(capture);
+	sleep_to_next_second();
+	int one = 999999;
+	close_descriptors(&one, 1);
+	const std::string second = read_file(capture).substr(first.size());
+
+	::dup2(saved, STDERR_FILENO);
+	check(count_lines(first, "was invalid on close") == 10 && count_lines(first, "suppressed") == 0, "warnings: 10 a second");
+	check(second.find("warning: 20 warnings suppressed\n") == 0 && count_lines(second, "fd 999999 was invalid on close") == 1,
+			"warnings: suppressed ones reported next second");
+}
+
+off_t file_size(const int fd) {
+	struct stat st;
+	return (::fstat(fd, &st) == 0) ? st.st_size : -1;
+}
+
+off_t file_size(const char *path) {
+	struct stat st;
+	return (::stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+std::string read_path(const char *path) {
+	const FileDes fd(::open(path, O_RDONLY | O_CLOEXEC));
+	return fd ? read_file(fd) : std::string("(can't open)");
+}
+
+void test_append_mapping() {
+	const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+	char path[] = "/tmp/posix-test-append.XXXXXX";
+	FileDes created(::mkstemp(path));
+	if (!check(bool(created), "AppendMapping: mkstemp")) { return; }
+	created = FileDes();
+	const std::string data = make_data(10 * page + 123, 4);
+
+	// records of awkward sizes, with a grow step of one page, so they keep running over
+	// the end of the mapping and it keeps being remapped (and maybe moved)
+	{
+		AppendMapping out = AppendMapping::OpenFile(path, 1);
+		out.set_flush_interval(3 * page);
+		size_t done = 0, grows = 0, flushes = 0, last_capacity = out.capacity();
+		size_t most_unflushed = 0;
+		bool aligned = true;
+		for (size_t len = 1; done < data.size(); len = len * 3 % 1000 + 1) {
+			if (len > data.size() - done) { len = data.size() - done; }
+			const size_t unflushed = out.unflushed();
+			out.append(data.data() + done, len);
+			done += len;
+			// a flush happens before handing out space once the interval has been reached
+			if (out.unflushed() < unflushed) { ++flushes; }
+			most_unflushed = std::max(most_unflushed, unflushed);
+			if (out.capacity() != last_capacity) { ++grows; }
+			last_capacity = out.capacity();
+			aligned = aligned && out.capacity() % page == 0 && file_size(out.fd()) == off_t(out.capacity());
+		}
+		check(out.size() == data.size() && grows >= 10 && aligned, "AppendMapping: grows a page at a time");
+		check(std::memcmp(out.get(), data.data(), data.size()) == 0 && read_file(out.fd()).substr(0, data.size()) == data,
+				"AppendMapping: contents after remapping");
+		check(flushes >= 2 && most_unflushed < 3 * page + 1000, "AppendMapping: flushes every interval");
+		out.flush(false);
+		check(out.unflushed() == 0, "AppendMapping: flush");
+		out.append("x", 1);
+		out.flush(true);
+		check(out.unflushed() == 0 && file_size(path) > off_t(out.size()), "AppendMapping: flush from mid-page");
+		out.close();
+		check(!out && out.size() == 0 && file_size(path) == off_t(data.size() + 1) && read_path(path) == data + "x",
+				"AppendMapping: close truncates to the logical size");
+	}
+
+	// reopening keeps what's there; destruction (without close) truncates too
+	{
+		AppendMapping out = AppendMapping::OpenFile(path, 64 * 1024);
+		check(out.size() == data.size() + 1 && std::memcmp(out.get(), data.data(), data.size()) == 0, "AppendMapping: reopen");
+		std::memcpy(out.append(5), "hello", 5);
+		check(file_size(path) == off_t(out.capacity()) && out.capacity() >= data.size() + 6, "AppendMapping: file allocated to capacity");
+	}
+	check(read_path(path) == data + "xhello", "AppendMapping: destruction truncates");
+
+	// move assignment hands the old mapping back properly: its file is truncated and closed
+	{
+		char other_path[] = "/tmp/posix-test-append.XXXXXX";
+		FileDes other_fd(::mkstemp(other_path));
+		AppendMapping target(std::move(other_fd), 1);
+		target.append("old", 3);
+		const int old_fd = target.fd();
+		AppendMapping source = AppendMapping::OpenFile(path, 1);
+		const size_t size = source.size();
+		const int new_fd = source.fd();
+		target = std::move(source);
+		check(!source && source.get() == nullptr && source.size() == 0, "AppendMapping: moved from");
+		check(target.fd() == new_fd && target.size() == size && !is_open(old_fd) && read_path(other_path) == "old",
+				"AppendMapping: move assignment releases the old mapping");
+		target.append("!", 1);
+		target = AppendMapping();
+		check(!target && read_path(path) == data + "xhello!", "AppendMapping: assigning an empty one");
+		::unlink(other_path);
+	}
+	::unlink(path);
+}
+
+} // anonymous namespace
+
+int main() {
+	try {
+		test_copy_file_data();
+		test_send_file_data();
+		test_splice_pipe();
+		test_close_queue();
+		test_warnings();
+		test_append_mapping();
+	} catch (PosixError &e) {
+		check(false, e.what());
+	}
+
+	std::printf("%d / %d passed%s\n", good_count, count, (good_count == count) ? " (ALL OK)" : "");
+	return (good_count < count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
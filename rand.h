@@ -4,6 +4,10 @@
 #include <assert.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* these two values should be matched;
  * these choices come from G. Marsaglia (2003)
  *   Seeds for Random Number Generators */
@@ -75,4 +79,8 @@ inline uint64_t xorshift_next_i64(struct xorshift_rng *rng) {
 	return (a << 32) | b;
 }
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
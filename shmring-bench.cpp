@@ -0,0 +1,162 @@
+/* Throughput benchmark for ShmRing between processes.
+ *
+ * Forks a number of producer processes that attach to the ring and push small
+ * messages, in batches, as fast as the ring takes them, while the parent consumes
+ * them. Reports messages and bytes per second through the ring.
+ *
+ * This code is released into the public domain,
+ * WITHOUT WARRANTY OF ANY KIND.
+ */
+
+#include "ShmRing.hpp"
+#include "OptionParser.hpp"
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const OptionParser::FlagSpec FLAGS[] = {
+	{ 'h', "h?", "help", 0, "Show this help." },
+	{ 'p', "p", "producers", "N", "Number of producer processes (default 1; 1 uses single-producer mode)." },
+	{ 'm', "m", "multi-producer", 0, "Use multi-producer mode even with one producer." },
+	{ 's', "s", "slots", "N", "Ring slots (default 4096)." },
+	{ 'z', "z", "size", "BYTES", "Message size (default 16)." },
+	{ 'b', "b", "batch", "N", "Messages per try_push_batch (default 32)." },
+	{ 't', "t", "seconds", "S", "Run time in seconds (default 5)." },
+	{ 0, 0, 0, 0, 0 }
+};
+
+const size_t MAX_BATCH = 1024;
+
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Push batches until the deadline, then an empty message to say we're done.
+int produce(const int fd, const size_t size, const size_t batch_size, const double deadline) {
+	try {
+		ShmRing ring = ShmRing::Attach(FileDes(::dup(fd)));
+		std::vector<char> payload(size, 'x');
+		ShmRing::Message batch[MAX_BATCH];
+		for (size_t i = 0; i < batch_size; ++i) {
+			batch[i].data = payload.data();
+			batch[i].size = size;
+		}
+		// checking the clock every few thousand messages keeps it out of the measurement
+		for (unsigned rounds = 0; (rounds & 63) || now_seconds() < deadline; ++rounds) {
+			size_t done = 0;
+			while (done < batch_size) {
+				const size_t n = ring.try_push_batch(batch + done, batch_size - done);
+				if (!n) { sched_yield(); }
+				done += n;
+			}
+		}
+		while (!ring.try_push(payload.data(), 0)) { sched_yield(); }
+	} catch (PosixError &err) {
+		std::fprintf(stderr, "producer: %s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+class Counter {
+	public:
+		Counter(): messages(0u), bytes(0u), finished(0u) {}
+
+		uint64_t messages;
+		uint64_t bytes;
+		unsigned finished;
+
+		void operator()(const void *data, const size_t size) {
+			(void)data;
+			if (!size) { ++finished; return; }
+			++messages;
+			bytes += size;
+		}
+};
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	long producers = 1, slots = 4096, size = 16, batch = 32;
+	bool multi = false;
+	double seconds = 5.0;
+
+	try {
+		OptionParser opts(FLAGS, argc, argv);
+		int flag;
+		while ((flag = opts.next()) != -1) {
+			switch (flag) {
+				case 'h': opts.print_usage(STDOUT_FILENO, "Measure ShmRing throughput from producer processes to one consumer.\n"); return EXIT_SUCCESS;
+				case 'p': producers = std::atol(opts.arg()); break;
+				case 'm': multi = true; break;
+				case 's': slots = std::atol(opts.arg()); break;
+				case 'z': size = std::atol(opts.arg()); break;
+				case 'b': batch = std::atol(opts.arg()); break;
+				case 't': seconds = std::atof(opts.arg()); break;
+			}
+		}
+	} catch (OptionParser::BadFlag &err) {
+		std::fprintf(stderr, "%s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	if (producers < 1) { producers = 1; }
+	if (slots < 2) { slots = 2; }
+	if (size < 1) { size = 1; }
+	if (batch < 1) { batch = 1; }
+	if (batch > long(MAX_BATCH)) { batch = MAX_BATCH; }
+	const ShmRing::Mode mode = (producers > 1 || multi) ? ShmRing::MULTI_PRODUCER : ShmRing::SINGLE_PRODUCER;
+
+	try {
+		ShmRing ring = ShmRing::Create(size_t(slots), size_t(size), mode, "shmring-bench");
+		const double start = now_seconds();
+		std::vector<pid_t> children;
+		for (long i = 0; i < producers; ++i) {
+			const pid_t child = ::fork();
+			if (child == -1) { throw PosixError(errno); }
+			if (child == 0) { _exit(produce(ring.fd(), size_t(size), size_t(batch), start + seconds)); }
+			children.push_back(child);
+		}
+
+		Counter counter;
+		while (counter.finished < children.size()) {
+			if (ring.consume(counter) || ring.wait(1000)) { continue; }
+			// a producer that fails never sends its final message
+			int status = 0;
+			if (::waitpid(-1, &status, WNOHANG) > 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+				std::fprintf(stderr, "error: a producer failed\n");
+				return EXIT_FAILURE;
+			}
+		}
+		const double elapsed = now_seconds() - start;
+
+		int failed = 0;
+		for (size_t i = 0; i < children.size(); ++i) {
+			int status = 0;
+			::waitpid(children[i], &status, 0);
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { ++failed; }
+		}
+		if (failed) {
+			std::fprintf(stderr, "error: %d producers failed\n", failed);
+			return EXIT_FAILURE;
+		}
+
+		std::printf("producers %ld, %s, slots %zu, message %ld bytes, batch %ld\n", producers,
+				(mode == ShmRing::MULTI_PRODUCER) ? "multi-producer" : "single-producer", ring.capacity(), size, batch);
+		std::printf("%.3f s, %llu messages (%.0f messages/s, %.1f MB/s)\n", elapsed,
+				(unsigned long long)counter.messages, counter.messages / elapsed, counter.bytes / elapsed / 1e6);
+	} catch (PosixError &err) {
+		std::fprintf(stderr, "error: %s\n", err.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
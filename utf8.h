@@ -35,6 +35,10 @@
 #include <stdint.h>
 #include <assert.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define UTF8_ACCEPT 0
 #define UTF8_REJECT 12
 
@@ -73,4 +77,8 @@ inline int utf8_encode(uint8_t *out, uint32_t codep) {
    }
 }
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif